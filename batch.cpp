@@ -0,0 +1,334 @@
+#include "batch.hpp"
+#include "SIPL/Exceptions.hpp"
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <exception>
+#include <set>
+#include <algorithm>
+#include <sstream>
+#ifdef CPP11
+#include <chrono>
+#else
+#include <ctime>
+#endif
+
+typedef struct WriteJob {
+	TSFOutput * output;
+	std::string directory;
+	std::string name;
+	const paramList * parameters;
+	// Size of the raw file, counted in the throughput once the results are written
+	double bytesRead;
+	bool failed;
+	std::string error;
+} WriteJob;
+
+static double getWallTime() {
+#ifdef CPP11
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+	).count() / 1000.0;
+#else
+	return (double)time(NULL);
+#endif
+}
+
+static std::string getRawFilename(std::string mhdFilename) {
+	MhdHeader header;
+	if(!readMhdHeader(mhdFilename, header))
+		return "";
+	return header.rawFilename;
+}
+
+static double getFileSize(std::string filename) {
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if(!file.is_open())
+		return 0;
+	file.seekg(0, std::ios::end);
+	return (double)file.tellg();
+}
+
+// Read a file sequentially so that it is in the page cache when the volume is loaded
+static void prefetchFile(std::string filename) {
+	FILE * file = fopen(filename.c_str(), "rb");
+	if(file == NULL)
+		return;
+	const int chunkSize = 4*1024*1024;
+	char * buffer = new char[chunkSize];
+	while(fread(buffer, 1, chunkSize, file) == chunkSize) {}
+	fclose(file);
+	delete[] buffer;
+}
+
+static void writeVolume(WriteJob * job) {
+	try {
+		writeDataToDisk(job->output, job->directory, job->name, *job->parameters);
+	} catch(SIPL::SIPLException &e) {
+		job->failed = true;
+		job->error = e.what();
+	} catch(std::exception &e) {
+		job->failed = true;
+		job->error = e.what();
+	}
+	delete job->output;
+}
+
+// Counts the volume of a finished write job as processed, or as failed if
+// its results could not be written
+static void finishWriteJob(WriteJob * &job, int &succeeded, double &bytesRead, std::vector<std::string> &failures) {
+	if(job == NULL)
+		return;
+	if(job->failed) {
+		std::cout << "ERROR: Writing of " << job->name << " failed: " << job->error << std::endl;
+		failures.push_back(job->name + ": " + job->error);
+	} else {
+		succeeded++;
+		bytesRead += job->bytesRead;
+	}
+	delete job;
+	job = NULL;
+}
+
+static void joinThread(Thread * &thread) {
+	if(thread != NULL) {
+		thread->join();
+		delete thread;
+		thread = NULL;
+	}
+}
+
+// Runs the pipeline on a volume. Results that are stored are transferred to the
+// host here, so that the writer only does file I/O. Returns an error message,
+// which is empty if the volume was processed.
+static std::string processVolume(std::string filename, const paramList &parameters, std::string kernel_dir, std::string storageDir, TSFOutput * &output) {
+	std::string error = "";
+	try {
+		output = run(filename, parameters, kernel_dir);
+		if(storageDir != "off") {
+			if(output->hasCenterlineVoxels())
+				output->getCenterlineVoxels();
+			if(output->hasSegmentation())
+				output->getSegmentation();
+		}
+	} catch(SIPL::SIPLException &e) {
+		error = e.what();
+	} catch(cl::Error &e) {
+		std::ostringstream message;
+		message << "OpenCL error in " << e.what() << " (" << e.err() << ")";
+		error = message.str();
+	} catch(std::exception &e) {
+		error = e.what();
+	}
+	return error;
+}
+
+typedef struct BatchQueue {
+	std::vector<std::pair<std::string, std::string> > volumes;
+	paramList parameters;
+	std::string kernel_dir;
+	std::string storageDir;
+	// Index of the next volume to process
+	int next;
+	int succeeded;
+	double bytesRead;
+	std::vector<std::string> failures;
+	Mutex mutex;
+} BatchQueue;
+
+// Processes and writes volumes of the batch until none are left. Several of
+// these run at the same time, each with its own command queues on the shared
+// context.
+static void processVolumes(BatchQueue * queue) {
+	while(true) {
+		int i;
+		{
+			MutexLock lock(queue->mutex);
+			if(queue->next == (int)queue->volumes.size())
+				return;
+			i = queue->next;
+			queue->next++;
+			std::cout << "Processing volume " << i+1 << " of " << queue->volumes.size() << ": " << queue->volumes[i].first << std::endl;
+		}
+		const std::string filename = queue->volumes[i].first;
+
+		TSFOutput * output = NULL;
+		std::string error = processVolume(filename, queue->parameters, queue->kernel_dir, queue->storageDir, output);
+		if(error.size() == 0 && queue->storageDir != "off") {
+			WriteJob writeJob;
+			writeJob.output = output;
+			writeJob.directory = queue->storageDir;
+			writeJob.name = queue->volumes[i].second;
+			writeJob.parameters = &queue->parameters;
+			writeJob.bytesRead = 0;
+			writeJob.failed = false;
+			writeVolume(&writeJob);
+			if(writeJob.failed)
+				error = "Writing failed: " + writeJob.error;
+		} else if(output != NULL) {
+			delete output;
+		}
+
+		MutexLock lock(queue->mutex);
+		if(error.size() > 0) {
+			std::cout << "ERROR: Processing of " << filename << " failed: " << error << std::endl;
+			queue->failures.push_back(filename + ": " + error);
+		} else {
+			queue->succeeded++;
+			queue->bytesRead += getFileSize(getRawFilename(filename));
+		}
+	}
+}
+
+std::vector<std::pair<std::string, std::string> > readManifest(std::string manifestFilename) {
+	std::ifstream file(manifestFilename.c_str());
+	if(!file.is_open())
+		throw SIPL::IOException(manifestFilename.c_str(), __LINE__, __FILE__);
+
+	std::string directory = "";
+	int pos = manifestFilename.rfind('/');
+	if(pos >= 0)
+		directory = manifestFilename.substr(0, pos+1);
+
+	std::vector<std::pair<std::string, std::string> > volumes;
+	std::set<std::string> usedNames;
+	std::string line;
+	while(std::getline(file, line)) {
+		line = trim(line);
+		if(line.size() == 0 || line[0] == '#')
+			continue;
+
+		std::string filename = line;
+		std::string name = "";
+		int separator = line.find_first_of(" \t");
+		if(separator != std::string::npos) {
+			filename = line.substr(0, separator);
+			name = trim(line.substr(separator));
+		}
+		if(filename[0] != '/')
+			filename = directory + filename;
+
+		if(name.size() == 0) {
+			// Use the filename without path and extension as storage name
+			name = filename.substr(filename.rfind('/')+1);
+			if(name.rfind('.') != std::string::npos)
+				name = name.substr(0, name.rfind('.'));
+		}
+		// Make sure results of different volumes are not written to the same files
+		std::string uniqueName = name;
+		int counter = 1;
+		while(usedNames.count(uniqueName) > 0) {
+			char str[16];
+			sprintf(str, "_%d", counter);
+			uniqueName = name + str;
+			counter++;
+		}
+		usedNames.insert(uniqueName);
+
+		volumes.push_back(std::make_pair(filename, uniqueName));
+	}
+	file.close();
+
+	return volumes;
+}
+
+int runBatch(std::string manifestFilename, paramList &parameters, std::string kernel_dir) {
+	std::vector<std::pair<std::string, std::string> > volumes = readManifest(manifestFilename);
+	const std::string storageDir = getParamStr(parameters, "storage-dir");
+	const int nrOfVolumes = volumes.size();
+
+	std::vector<std::string> failures;
+	int succeeded = 0;
+	double bytesRead = 0;
+	const double startTime = getWallTime();
+
+	const int jobs = std::min((int)getParam(parameters, "batch-jobs"), nrOfVolumes);
+	if(jobs > 1) {
+		// Volumes are processed at the same time, and each job writes its own results
+		BatchQueue queue;
+		queue.volumes = volumes;
+		queue.parameters = parameters;
+		setParameter(queue.parameters, "storage-dir", "off");
+		queue.kernel_dir = kernel_dir;
+		queue.storageDir = storageDir;
+		queue.next = 0;
+		queue.succeeded = 0;
+		queue.bytesRead = 0;
+		std::vector<Thread *> threads;
+		for(int i = 0; i < jobs; i++)
+			threads.push_back(new Thread(processVolumes, &queue));
+		for(int i = 0; i < jobs; i++)
+			joinThread(threads[i]);
+		succeeded = queue.succeeded;
+		bytesRead = queue.bytesRead;
+		failures = queue.failures;
+	} else {
+		Thread * prefetcher = NULL;
+		Thread * writer = NULL;
+		WriteJob * writeJob = NULL;
+		if(nrOfVolumes > 0)
+			prefetcher = new Thread(prefetchFile, getRawFilename(volumes[0].first));
+
+		for(int i = 0; i < nrOfVolumes; i++) {
+			const std::string filename = volumes[i].first;
+			const std::string rawFilename = getRawFilename(filename);
+
+			// Wait for this volume to be read and start reading the next one
+			joinThread(prefetcher);
+			if(i+1 < nrOfVolumes)
+				prefetcher = new Thread(prefetchFile, getRawFilename(volumes[i+1].first));
+
+			std::cout << "Processing volume " << i+1 << " of " << nrOfVolumes << ": " << filename << std::endl;
+
+			// Results are written by the writer thread instead of by run()
+			paramList volumeParameters = parameters;
+			setParameter(volumeParameters, "storage-dir", "off");
+			TSFOutput * output = NULL;
+			std::string error = processVolume(filename, volumeParameters, kernel_dir, storageDir, output);
+			if(error.size() > 0) {
+				std::cout << "ERROR: Processing of " << filename << " failed: " << error << std::endl;
+				failures.push_back(filename + ": " + error);
+				if(output != NULL)
+					delete output;
+				continue;
+			}
+
+			// Write this volume while the next one is processed
+			joinThread(writer);
+			finishWriteJob(writeJob, succeeded, bytesRead, failures);
+			if(storageDir != "off") {
+				writeJob = new WriteJob;
+				writeJob->output = output;
+				writeJob->directory = storageDir;
+				writeJob->name = volumes[i].second;
+				writeJob->parameters = &parameters;
+				writeJob->bytesRead = getFileSize(rawFilename);
+				writeJob->failed = false;
+				writer = new Thread(writeVolume, writeJob);
+			} else {
+				succeeded++;
+				bytesRead += getFileSize(rawFilename);
+				delete output;
+			}
+		}
+		joinThread(prefetcher);
+		joinThread(writer);
+		finishWriteJob(writeJob, succeeded, bytesRead, failures);
+	}
+
+	// Throughput summary
+	const double seconds = std::max(getWallTime() - startTime, 1e-3);
+	std::cout << std::endl;
+	std::cout << "Batch summary" << std::endl;
+	std::cout << "=============" << std::endl;
+	std::cout << "Volumes processed: " << succeeded << " of " << nrOfVolumes << std::endl;
+	std::cout << "Total time: " << seconds << " s" << std::endl;
+	std::cout << "Throughput: " << succeeded*3600.0/seconds << " volumes/hour, " << bytesRead/(1024*1024)/seconds << " MB/s" << std::endl;
+	if(failures.size() > 0) {
+		std::cout << "Failed volumes:" << std::endl;
+		for(unsigned int i = 0; i < failures.size(); i++)
+			std::cout << "* " << failures[i] << std::endl;
+	}
+
+	return failures.size();
+}
@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "tube-segmentation.hpp"
+#include <string>
+#include <vector>
+
+/*
+ * Reads a manifest file with one .mhd filename per line. Empty lines and lines
+ * starting with # are ignored, and relative paths are relative to the manifest.
+ * An optional second column sets the storage name of the volume.
+ */
+std::vector<std::pair<std::string, std::string> > readManifest(std::string manifestFilename);
+
+/*
+ * Process all volumes in the manifest in one process. Reading the next volume
+ * from disk and writing the previous result to disk is overlapped with the
+ * processing of the current volume. With batch-jobs above 1, that number of
+ * volumes is instead processed at the same time, which fills the device with
+ * small volumes. A volume that fails is reported and skipped.
+ * Returns the number of volumes that failed.
+ */
+int runBatch(std::string manifestFilename, paramList &parameters, std::string kernel_dir);
+
+#endif
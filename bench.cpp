@@ -0,0 +1,186 @@
+#include "tube-segmentation.hpp"
+#include "profiler.hpp"
+#include "SIPL/Exceptions.hpp"
+#include "tsf-config.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+/*
+ * Benchmark of the synthetic Vascusynth datasets. Each dataset is processed
+ * several times with timing enabled, and the runtime of each stage is written
+ * as JSON or CSV so that runs from different builds can be compared.
+ */
+
+typedef struct BenchmarkRun {
+    std::string dataset;
+    int run;
+    std::vector<StageTiming> stages;
+} BenchmarkRun;
+
+static double median(std::vector<double> values) {
+    if(values.size() == 0)
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    const int middle = values.size() / 2;
+    return values.size() % 2 == 1 ? values[middle] : (values[middle-1]+values[middle])*0.5;
+}
+
+// Median of a stage over all runs of a dataset. The first run includes
+// compilation of the kernels and is left out if there are more runs.
+static StageTiming getMedian(std::vector<BenchmarkRun> &runs, std::string dataset, std::string stage, bool skipFirstRun) {
+    std::vector<double> hostTimes, deviceTimes;
+    StageTiming timing;
+    timing.name = stage;
+    timing.bytesTransferred = 0;
+    timing.count = 0;
+    timing.iterations = 0;
+    for(unsigned int i = 0; i < runs.size(); i++) {
+        if(runs[i].dataset != dataset || (runs[i].run == 0 && skipFirstRun))
+            continue;
+        for(unsigned int j = 0; j < runs[i].stages.size(); j++) {
+            if(runs[i].stages[j].name == stage) {
+                hostTimes.push_back(runs[i].stages[j].hostTime);
+                deviceTimes.push_back(runs[i].stages[j].deviceTime);
+                timing.bytesTransferred = runs[i].stages[j].bytesTransferred;
+                timing.count++;
+            }
+        }
+    }
+    timing.hostTime = median(hostTimes);
+    timing.deviceTime = median(deviceTimes);
+    return timing;
+}
+
+static void writeJSON(std::ostream &out, std::vector<BenchmarkRun> &runs, std::vector<std::string> &datasets, paramList &parameters, int repetitions) {
+    out << "{\n  \"device\": \"" << getParamStr(parameters, "device") << "\",\n";
+    out << "  \"centerline-method\": \"" << getParamStr(parameters, "centerline-method") << "\",\n";
+    out << "  \"repetitions\": " << repetitions << ",\n";
+    out << "  \"runs\": [\n";
+    for(unsigned int i = 0; i < runs.size(); i++) {
+        out << "    {\"dataset\": \"" << runs[i].dataset << "\", \"run\": " << runs[i].run << ", \"stages\": [";
+        for(unsigned int j = 0; j < runs[i].stages.size(); j++) {
+            StageTiming &s = runs[i].stages[j];
+            out << (j > 0 ? ", " : "") << "{\"name\": \"" << s.name << "\", \"host_ms\": " << s.hostTime <<
+                ", \"device_ms\": " << s.deviceTime << ", \"bytes\": " << s.bytesTransferred << "}";
+        }
+        out << "]}" << (i < runs.size()-1 ? ",\n" : "\n");
+    }
+    out << "  ],\n  \"median\": [\n";
+    bool first = true;
+    for(unsigned int d = 0; d < datasets.size(); d++) {
+        // Stages of the last run of the dataset, in the order they were run
+        std::vector<StageTiming> stages;
+        for(unsigned int i = 0; i < runs.size(); i++) {
+            if(runs[i].dataset == datasets[d])
+                stages = runs[i].stages;
+        }
+        for(unsigned int j = 0; j < stages.size(); j++) {
+            StageTiming s = getMedian(runs, datasets[d], stages[j].name, repetitions > 1);
+            out << (first ? "" : ",\n") << "    {\"dataset\": \"" << datasets[d] << "\", \"name\": \"" << s.name <<
+                "\", \"host_ms\": " << s.hostTime << ", \"device_ms\": " << s.deviceTime <<
+                ", \"bytes\": " << s.bytesTransferred << ", \"runs\": " << s.count << "}";
+            first = false;
+        }
+    }
+    out << "\n  ]\n}\n";
+}
+
+static void writeCSV(std::ostream &out, std::vector<BenchmarkRun> &runs) {
+    out << "dataset,run,stage,host_ms,device_ms,bytes\n";
+    for(unsigned int i = 0; i < runs.size(); i++) {
+        for(unsigned int j = 0; j < runs[i].stages.size(); j++) {
+            StageTiming &s = runs[i].stages[j];
+            out << runs[i].dataset << "," << runs[i].run << "," << s.name << "," <<
+                s.hostTime << "," << s.deviceTime << "," << s.bytesTransferred << "\n";
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    if(argc > 1 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)) {
+        std::cout << "Usage: " << argv[0] << " [--repetitions N] [--output benchmark.json|benchmark.csv] [--datasets 1,2,3,4] <parameters>" << std::endl;
+        std::cout << "Runs the synthetic Vascusynth datasets N times (default 5) and reports the runtime of each stage." << std::endl;
+        std::cout << "Other parameters, e.g. --device cpu, are passed on as parameters of the framework." << std::endl;
+        return 0;
+    }
+
+    paramList parameters = initParameters(PARAMETERS_DIR);
+    setParameter(parameters, "parameters", "Synthetic-Vascusynth");
+    loadParameterPreset(parameters, PARAMETERS_DIR);
+    int repetitions = 5;
+    std::string outputFilename = "benchmark.json";
+    std::string datasetList = "1,2,3,4";
+    try {
+        for(int i = 1; i < argc; i++) {
+            if(strncmp(argv[i], "--", 2) != 0 || i+1 >= argc)
+                throw SIPL::SIPLException("Arguments have to be given as --name value", __LINE__, __FILE__);
+            std::string name = std::string(argv[i]).substr(2);
+            std::string value = argv[i+1];
+            i++;
+            if(name == "repetitions") {
+                repetitions = std::max(1, atoi(value.c_str()));
+            } else if(name == "output") {
+                outputFilename = value;
+            } else if(name == "datasets") {
+                datasetList = value;
+            } else {
+                setParameter(parameters, name, value);
+            }
+        }
+    } catch(SIPL::SIPLException &e) {
+        std::cout << e.what() << std::endl;
+        return -1;
+    }
+    setParameter(parameters, "timing", "true");
+    setParameter(parameters, "timing-file", "off");
+
+    std::vector<std::string> datasets;
+    std::stringstream datasetStream(datasetList);
+    std::string number;
+    while(std::getline(datasetStream, number, ','))
+        datasets.push_back("dataset_" + number);
+
+    std::vector<BenchmarkRun> runs;
+    for(unsigned int d = 0; d < datasets.size(); d++) {
+        std::string filename = std::string(TESTDATA_DIR) + "/synthetic/" + datasets[d] + "/noisy.mhd";
+        for(int r = 0; r < repetitions; r++) {
+            std::cout << "Benchmarking " << datasets[d] << ", run " << r+1 << " of " << repetitions << std::endl;
+            // Every run uses a fresh copy, as run() modifies some of the parameters
+            paramList runParameters = parameters;
+            TSFOutput * output;
+            try {
+                output = run(filename, runParameters, std::string(KERNELS_DIR));
+            } catch(SIPL::SIPLException &e) {
+                std::cout << e.what() << std::endl;
+                return -1;
+            } catch(cl::Error &e) {
+                std::cout << "OpenCL error in " << e.what() << " (" << e.err() << ")" << std::endl;
+                return -1;
+            }
+            BenchmarkRun benchmarkRun;
+            benchmarkRun.dataset = datasets[d];
+            benchmarkRun.run = r;
+            benchmarkRun.stages = output->getProfiler()->getStages();
+            runs.push_back(benchmarkRun);
+            delete output;
+        }
+    }
+
+    std::ofstream file(outputFilename.c_str());
+    if(!file.is_open()) {
+        std::cout << "Could not open " << outputFilename << std::endl;
+        return -1;
+    }
+    if(outputFilename.size() >= 4 && outputFilename.substr(outputFilename.size()-4) == ".csv") {
+        writeCSV(file, runs);
+    } else {
+        writeJSON(file, runs, datasets, parameters, repetitions);
+    }
+    file.close();
+    std::cout << "Benchmark results written to " << outputFilename << std::endl;
+
+    return 0;
+}
@@ -4,14 +4,57 @@
 
 #include "OpenCLUtilityLibrary/OpenCLManager.hpp"
 #include "SIPL/Types.hpp"
+#include "profiler.hpp"
+#include <vector>
+// Threads and locks of the batch mode, the sub-devices and the shared session
+#ifdef CPP11
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+typedef std::thread Thread;
+typedef std::mutex Mutex;
+typedef std::lock_guard<std::mutex> MutexLock;
+typedef std::unique_lock<std::mutex> UniqueLock;
+typedef std::condition_variable Condition;
+#else
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+typedef boost::thread Thread;
+typedef boost::mutex Mutex;
+typedef boost::lock_guard<boost::mutex> MutexLock;
+typedef boost::unique_lock<boost::mutex> UniqueLock;
+typedef boost::condition_variable Condition;
+#endif
+
+class DeviceMemoryPool;
+class GVFHaloExchange;
+
+// A sub-device that z-slabs of the volume are processed on. The sub-devices
+// share a context, so memory objects can not be shared with the main device,
+// but can be copied between the sub-devices.
+
+typedef struct SlabDevice {
+    cl::Context context;
+    cl::CommandQueue queue;
+    cl::Program program;
+    cl::Device device;
+} SlabDevice;
 
 typedef struct OpenCL {
     cl::Context context;
     cl::CommandQueue queue;
+    cl::CommandQueue transferQueue; // For reads to the host that overlap with kernels, may be unset
     cl::Program program;
     cl::Device device;
     cl::Platform platform;
     oul::GarbageCollector * GC;
+    TSFProfiler * profiler;
+    DeviceMemoryPool * pool; // Reuses images and buffers between stages and runs, may be NULL
+    std::vector<SlabDevice> slabDevices; // Set when the sub-devices parameter is used, may be empty
+    GVFHaloExchange * haloExchange; // Set when processing a z-slab on a sub-device, may be NULL
+    int slab; // Index of the z-slab when haloExchange is set
 } OpenCL;
 
 #ifdef WIN32
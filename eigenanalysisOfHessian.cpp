@@ -261,76 +261,34 @@ void eigen_decomposition(float A[SIZE][SIZE], float V[SIZE][SIZE], float d[SIZE]
 
 
 #define POS(pos) pos.x+pos.y*size.x+pos.z*size.x*size.y
+// Component of the normalized vector at linear position i
+static inline float normalizedComponent(const VectorFieldView &F, int i, int component) {
+    const float3 v = F.get(i);
+    return F.get(i, component)/sqrt(v.x*v.x+v.y*v.y+v.z*v.z);
+}
+
 SIPL::float3 gradient(TubeSegmentation &TS, SIPL::int3 pos, int volumeComponent, int dimensions, int3 size) {
-    float * Fx = TS.Fx;
-    float * Fy = TS.Fy;
-    float * Fz = TS.Fz;
+    const VectorFieldView &F = TS.vectorField;
     float f100, f_100, f010, f0_10, f001, f00_1;
     SIPL::int3 npos = pos;
-    switch(volumeComponent) {
-        case 0:
-
-        npos.x +=1;
-        f100 = Fx[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        npos.x -=2;
-        f_100 = Fx[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        if(dimensions > 1) {
-            npos = pos;
-            npos.y += 1;
-            f010 = Fx[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-            npos.y -= 2;
-            f0_10 = Fx[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        }
-        if(dimensions > 2) {
-            npos = pos;
-            npos.z += 1;
-            f001 = Fx[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-            npos.z -= 2;
-            f00_1 =Fx[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        }
-    break;
-        case 1:
-
-        npos.x +=1;
-        f100 = Fy[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        npos.x -=2;
-        f_100 = Fy[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        if(dimensions > 1) {
-            npos = pos;
-            npos.y += 1;
-            f010 = Fy[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-            npos.y -= 2;
-            f0_10 = Fy[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        }
-        if(dimensions > 2) {
-            npos = pos;
-            npos.z += 1;
-            f001 = Fy[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-            npos.z -= 2;
-            f00_1 =Fy[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        }
-    break;
-        case 2:
-
-        npos.x +=1;
-        f100 = Fz[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        npos.x -=2;
-        f_100 = Fz[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        if(dimensions > 1) {
-            npos = pos;
-            npos.y += 1;
-            f010 = Fz[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-            npos.y -= 2;
-            f0_10 = Fz[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        }
-        if(dimensions > 2) {
-            npos = pos;
-            npos.z += 1;
-            f001 = Fz[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-            npos.z -= 2;
-            f00_1 =Fz[POS(npos)]/sqrt(Fx[POS(npos)]*Fx[POS(npos)]+Fy[POS(npos)]*Fy[POS(npos)]+Fz[POS(npos)]*Fz[POS(npos)]);
-        }
-    break;
+
+    npos.x +=1;
+    f100 = normalizedComponent(F, POS(npos), volumeComponent);
+    npos.x -=2;
+    f_100 = normalizedComponent(F, POS(npos), volumeComponent);
+    if(dimensions > 1) {
+        npos = pos;
+        npos.y += 1;
+        f010 = normalizedComponent(F, POS(npos), volumeComponent);
+        npos.y -= 2;
+        f0_10 = normalizedComponent(F, POS(npos), volumeComponent);
+    }
+    if(dimensions > 2) {
+        npos = pos;
+        npos.z += 1;
+        f001 = normalizedComponent(F, POS(npos), volumeComponent);
+        npos.z -= 2;
+        f00_1 = normalizedComponent(F, POS(npos), volumeComponent);
     }
 
     float3 grad(0.5f*(f100-f_100), 0.5f*(f010-f0_10), 0.5f*(f001-f00_1));
@@ -1,373 +1,228 @@
 #include "gradientVectorFlow.hpp"
+#include "memoryPool.hpp"
+#include "HelperFunctions.hpp"
+#include "SIPL/Exceptions.hpp"
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 using namespace cl;
 
-Image3D initSolutionToZero(OpenCL &ocl, SIPL::int3 size, int imageType, int bufferSize, bool no3Dwrite) {
-    Image3D v = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-
-    if(no3Dwrite) {
-        Kernel initToZeroKernel(ocl.program, "initFloatBuffer");
-        Buffer vBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, bufferSize*size.x*size.y*size.z);
-        initToZeroKernel.setArg(0,vBuffer);
-        ocl.queue.enqueueNDRangeKernel(
-                initToZeroKernel,
-                NullRange,
-                NDRange(size.x*size.y*size.z),
-                NullRange
-        );
-		cl::size_t<3> offset;
-		offset[0] = 0;
-		offset[1] = 0;
-		offset[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size.x;
-		region[1] = size.y;
-		region[2] = size.z;
-        ocl.queue.enqueueCopyBufferToImage(vBuffer,v,0,offset,region);
-    } else {
-        Kernel initToZeroKernel(ocl.program, "init3DFloat");
-        initToZeroKernel.setArg(0,v);
-        ocl.queue.enqueueNDRangeKernel(
-                initToZeroKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
-        );
-
+/*
+ * Convergence control of the GVF iterations. If gvf-tolerance is above 0, the
+ * largest change of a vector component in an iteration is computed on the
+ * device every gvf-check-interval iterations, and the iterations are stopped
+ * when it is below the tolerance. gvf-iterations is then the maximum number of
+ * iterations. The iterations and residuals are reported with the GVF stage.
+ */
+class GVFConvergence {
+public:
+    GVFConvergence(OpenCL &ocl, paramList &parameters) : ocl(ocl) {
+        tolerance = getParam(parameters, "gvf-tolerance");
+        // The iterations alternate between two vector fields, and the result
+        // is expected in the one that is written by odd iterations
+        interval = std::max(2, (int)getParam(parameters, "gvf-check-interval"));
+        interval += interval % 2;
+        if(tolerance > 0.0f)
+            result = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(int));
+    }
+    bool isEnabled() const {
+        return tolerance > 0.0f;
+    }
+    // Whether the residual should be computed when the given number of
+    // iterations are done, and the last step ran step iterations
+    bool isCheckedAfter(int iterations, int step = 1) const {
+        return tolerance > 0.0f && iterations / interval != (iterations - step) / interval;
+    }
+    bool hasConverged(int iterations, Image3D &a, Image3D &b, SIPL::int3 size) {
+        Kernel kernel(ocl.program, "GVFMaxDifference");
+        kernel.setArg(0, a);
+        kernel.setArg(1, b);
+        kernel.setArg(2, result);
+        // Padded to whole work-groups, the reads outside the images are clamped to the edge
+        return hasConverged(iterations, kernel, NDRange(((size.x + 3) / 4) * 4, ((size.y + 3) / 4) * 4, ((size.z + 3) / 4) * 4), NDRange(4,4,4));
+    }
+    bool hasConverged(int iterations, Buffer &a, Buffer &b, int elements) {
+        Kernel kernel(ocl.program, "GVFMaxDifferenceBuffer");
+        kernel.setArg(0, a);
+        kernel.setArg(1, b);
+        kernel.setArg(2, result);
+        kernel.setArg(3, elements);
+        return hasConverged(iterations, kernel, NDRange(((elements + 63) / 64) * 64), NDRange(64));
     }
+    void report(int iterations) {
+        if(tolerance > 0.0f)
+            std::cout << "NOTE: GVF ran " << iterations << " iterations" << std::endl;
+        ocl.profiler->addIterations("GVF", iterations);
+    }
+private:
+    bool hasConverged(int iterations, Kernel &kernel, NDRange globalSize, NDRange localSize) {
+        int zero = 0;
+        ocl.queue.enqueueWriteBuffer(result, CL_FALSE, 0, sizeof(int), &zero);
+        ocl.queue.enqueueNDRangeKernel(kernel, NullRange, globalSize, localSize);
+        // The bits of the largest difference are stored as an int
+        union { int bits; float value; } residual;
+        ocl.queue.enqueueReadBuffer(result, CL_TRUE, 0, sizeof(int), &residual.bits);
+        ocl.profiler->addResidual("GVF", iterations, residual.value);
+        return residual.value < tolerance;
+    }
+    OpenCL &ocl;
+    Buffer result;
+    float tolerance;
+    int interval;
+};
+
+GVFHaloExchange::GVFHaloExchange(int slabs, int interval) :
+        starts(slabs), ends(slabs), brickStarts(slabs), brickSizes(slabs), images(slabs), buffers(slabs) {
+    this->interval = interval;
+    waiting = 0;
+    generation = 0;
+    aborted = false;
+}
 
-    return v;
+void GVFHaloExchange::setSlab(int slab, int start, int end, int brickStart, int brickSize) {
+    starts[slab] = start;
+    ends[slab] = end;
+    brickStarts[slab] = brickStart;
+    brickSizes[slab] = brickSize;
 }
-void gaussSeidelSmoothing(
-        OpenCL &ocl,
-        Image3D &v,
-        Image3D &r,
-        Image3D &sqrMag,
-        int iterations,
-        SIPL::int3 size,
-        float mu,
-        float spacing,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-
-    if(iterations <= 0)
-        return;
-
-    Kernel gaussSeidelKernel = Kernel(ocl.program, "GVFgaussSeidel");
-    Kernel gaussSeidelKernel2 = Kernel(ocl.program, "GVFgaussSeidel2");
-
-    Image3D v_2 = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-     );
 
-    gaussSeidelKernel.setArg(0, r);
-    gaussSeidelKernel.setArg(1, sqrMag);
-    gaussSeidelKernel.setArg(2, mu);
-    gaussSeidelKernel.setArg(3, spacing);
-    gaussSeidelKernel2.setArg(0, r);
-    gaussSeidelKernel2.setArg(1, sqrMag);
-    gaussSeidelKernel2.setArg(2, mu);
-    gaussSeidelKernel2.setArg(3, spacing);
+int GVFHaloExchange::getInterval() const {
+    return interval;
+}
 
-    if(no3Dwrite) {
-        cl::size_t<3> offset;
-		offset[0] = 0;
-		offset[1] = 0;
-		offset[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size.x;
-		region[1] = size.y;
-		region[2] = size.z;
-        Buffer v_2_buffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, bufferSize*size.x*size.y*size.z);
-
-        for(int i = 0; i < iterations*2; i++) {
-             if(i % 2 == 0) {
-                 gaussSeidelKernel.setArg(4, v);
-                 gaussSeidelKernel.setArg(5, v_2_buffer);
-                 ocl.queue.enqueueNDRangeKernel(
-                    gaussSeidelKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-                );
-                ocl.queue.enqueueCopyBufferToImage(v_2_buffer, v_2,0,offset,region);
-             } else {
-                 gaussSeidelKernel2.setArg(4, v_2);
-                 gaussSeidelKernel2.setArg(5, v_2_buffer);
-                 ocl.queue.enqueueNDRangeKernel(
-                    gaussSeidelKernel2,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-                );
-                ocl.queue.enqueueCopyBufferToImage(v_2_buffer, v,0,offset,region);
-             }
-        }
-    } else {
-         for(int i = 0; i < iterations*2; i++) {
-             if(i % 2 == 0) {
-                 gaussSeidelKernel.setArg(4, v);
-                 gaussSeidelKernel.setArg(5, v_2);
-                 ocl.queue.enqueueNDRangeKernel(
-                    gaussSeidelKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-                );
-             } else {
-                 gaussSeidelKernel2.setArg(4, v_2);
-                 gaussSeidelKernel2.setArg(5, v);
-                 ocl.queue.enqueueNDRangeKernel(
-                    gaussSeidelKernel2,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-                );
-             }
+// Runs of layers of the brick of a slab outside the slab, and the slabs they belong to
+std::vector<GVFHaloExchange::HaloCopy> GVFHaloExchange::getHaloCopies(int slab) const {
+    std::vector<HaloCopy> copies;
+    const int brickEnd = brickStarts[slab] + brickSizes[slab];
+    int layer = brickStarts[slab];
+    while(layer < brickEnd) {
+        if(layer >= starts[slab] && layer < ends[slab]) {
+            layer = ends[slab];
+            continue;
         }
+        unsigned int owner = 0;
+        while(owner < starts.size() && !(layer >= starts[owner] && layer < ends[owner]))
+            owner++;
+        if(owner == starts.size())
+            throw SIPL::SIPLException("A layer of a brick does not belong to any slab", __LINE__, __FILE__);
+        HaloCopy copy;
+        copy.slab = owner;
+        copy.sourceLayer = layer - brickStarts[owner];
+        copy.destinationLayer = layer - brickStarts[slab];
+        copy.layers = std::min(ends[owner], brickEnd) - layer;
+        copies.push_back(copy);
+        layer += copy.layers;
     }
+    return copies;
 }
 
-Image3D restrictVolume(
-        OpenCL &ocl,
-        Image3D &v,
-        SIPL::int3 newSize,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-
-    // Check to see if size is a power of 2 and equal in all dimensions
-
-    Image3D v_2 = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            newSize.x,
-            newSize.y,
-            newSize.z
-    );
-
-    Kernel restrictKernel = Kernel(ocl.program, "restrictVolume");
-    if(no3Dwrite) {
-        cl::size_t<3> offset;
-		offset[0] = 0;
-		offset[1] = 0;
-		offset[2] = 0;
-		cl::size_t<3> region;
-		region[0] = newSize.x;
-		region[1] = newSize.y;
-		region[2] = newSize.z;
-        Buffer v_2_buffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, bufferSize*newSize.x*newSize.y*newSize.z);
-        restrictKernel.setArg(0, v);
-        restrictKernel.setArg(1, v_2_buffer);
-        ocl.queue.enqueueNDRangeKernel(
-                restrictKernel,
-                NullRange,
-                NDRange(newSize.x,newSize.y,newSize.z),
-                NDRange(4,4,4)
-        );
-        ocl.queue.enqueueCopyBufferToImage(v_2_buffer, v_2,0,offset,region);
-    } else {
-        restrictKernel.setArg(0, v);
-        restrictKernel.setArg(1, v_2);
-        ocl.queue.enqueueNDRangeKernel(
-                restrictKernel,
-                NullRange,
-                NDRange(newSize.x,newSize.y,newSize.z),
-                NDRange(4,4,4)
-        );
+// Waits until all slabs have called wait the same number of times
+void GVFHaloExchange::wait() {
+    UniqueLock lock(mutex);
+    const int generation = this->generation;
+    waiting++;
+    if(waiting == (int)starts.size()) {
+        waiting = 0;
+        this->generation++;
+        condition.notify_all();
     }
-
-    return v_2;
+    while(generation == this->generation && !aborted)
+        condition.wait(lock);
+    if(aborted)
+        throw SIPL::SIPLException("GVF was stopped because the processing of another slab failed", __LINE__, __FILE__);
 }
 
-Image3D prolongateVolume(
-        OpenCL &ocl,
-        Image3D &v_l,
-        Image3D &v_l_p1,
-        SIPL::int3 size,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-    Image3D v_2 = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-
-    Kernel prolongateKernel = Kernel(ocl.program, "prolongate");
-    if(no3Dwrite) {
-        cl::size_t<3> offset;
-		offset[0] = 0;
-		offset[1] = 0;
-		offset[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size.x;
-		region[1] = size.y;
-		region[2] = size.z;
-        Buffer v_2_buffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, bufferSize*size.x*size.y*size.z);
-        prolongateKernel.setArg(0, v_l);
-        prolongateKernel.setArg(1, v_l_p1);
-        prolongateKernel.setArg(2, v_2_buffer);
-        ocl.queue.enqueueNDRangeKernel(
-                prolongateKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
-        );
+bool GVFHaloExchange::abort() {
+    MutexLock lock(mutex);
+    const bool wasAborted = aborted;
+    aborted = true;
+    condition.notify_all();
+    return !wasAborted;
+}
 
-        ocl.queue.enqueueCopyBufferToImage(v_2_buffer, v_2,0,offset,region);
-    } else {
-        prolongateKernel.setArg(0, v_l);
-        prolongateKernel.setArg(1, v_l_p1);
-        prolongateKernel.setArg(2, v_2);
-        ocl.queue.enqueueNDRangeKernel(
-                prolongateKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
+void GVFHaloExchange::exchange(OpenCL &ocl, int slab, Image3D &vectorField) {
+    // The vector fields of the other slabs are read when all slabs have
+    // finished their iterations, and are not written again until all slabs
+    // have finished copying
+    ocl.queue.finish();
+    images[slab] = vectorField;
+    wait();
+    const int width = vectorField.getImageInfo<CL_IMAGE_WIDTH>();
+    const int height = vectorField.getImageInfo<CL_IMAGE_HEIGHT>();
+    std::vector<HaloCopy> copies = getHaloCopies(slab);
+    for(unsigned int i = 0; i < copies.size(); i++) {
+        ocl.queue.enqueueCopyImage(
+                images[copies[i].slab],
+                vectorField,
+                oul::createRegion(0, 0, copies[i].sourceLayer),
+                oul::createRegion(0, 0, copies[i].destinationLayer),
+                oul::createRegion(width, height, copies[i].layers)
         );
     }
-
-    return v_2;
+    ocl.queue.finish();
+    wait();
+    images[slab] = Image3D();
 }
 
-Image3D prolongateVolume2(
-        OpenCL &ocl,
-        Image3D &v_l_p1,
-        SIPL::int3 size,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-    Image3D v_2 = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-
-    Kernel prolongateKernel = Kernel(ocl.program, "prolongate2");
-    if(no3Dwrite) {
-        cl::size_t<3> offset;
-		offset[0] = 0;
-		offset[1] = 0;
-		offset[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size.x;
-		region[1] = size.y;
-		region[2] = size.z;
-        Buffer v_2_buffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, bufferSize*size.x*size.y*size.z);
-        prolongateKernel.setArg(0, v_l_p1);
-        prolongateKernel.setArg(1, v_2_buffer);
-        ocl.queue.enqueueNDRangeKernel(
-                prolongateKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
-        );
-
-        ocl.queue.enqueueCopyBufferToImage(v_2_buffer, v_2,0,offset,region);
-    } else {
-        prolongateKernel.setArg(0, v_l_p1);
-        prolongateKernel.setArg(1, v_2);
-        ocl.queue.enqueueNDRangeKernel(
-                prolongateKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
+void GVFHaloExchange::exchange(OpenCL &ocl, int slab, Buffer &vectorField, ::size_t layerBytes) {
+    ocl.queue.finish();
+    buffers[slab] = vectorField;
+    wait();
+    std::vector<HaloCopy> copies = getHaloCopies(slab);
+    for(unsigned int i = 0; i < copies.size(); i++) {
+        ocl.queue.enqueueCopyBuffer(
+                buffers[copies[i].slab],
+                vectorField,
+                copies[i].sourceLayer*layerBytes,
+                copies[i].destinationLayer*layerBytes,
+                copies[i].layers*layerBytes
         );
     }
+    ocl.queue.finish();
+    wait();
+    buffers[slab] = Buffer();
+}
 
-    return v_2;
+// Size of the bricks of the tiled GVF kernel, which are loaded into local memory
+#define GVF_TILE 8
+
+std::string getGVFBuildOptions(cl::Device &device, paramList &parameters) {
+    // The brick and a halo of one voxel per iteration has to fit in local memory
+    const cl_ulong localMemorySize = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    int sweeps = getParam(parameters, "gvf-sweeps");
+    while(sweeps > 1 && (cl_ulong)pow(GVF_TILE+2*sweeps, 3)*4*sizeof(float) > localMemorySize)
+        sweeps--;
+    if(sweeps != (int)getParam(parameters, "gvf-sweeps")) {
+        std::cout << "NOTE: Reducing gvf-sweeps to " << sweeps << " to fit the local memory of the device." << std::endl;
+        std::ostringstream value;
+        value << sweeps;
+        setParameter(parameters, "gvf-sweeps", value.str());
+    }
+    std::ostringstream options;
+    // With one sweep the tiled kernel is not used, and is compiled with a small brick
+    options << "-D GVF_TILE=" << (sweeps > 1 ? GVF_TILE : 4) << " -D GVF_SWEEPS=" << sweeps;
+    return options.str();
 }
 
+static void setTiledIterationArgs(Kernel &kernel, Image3D &initVectorField, float MU, SIPL::int3 size) {
+    kernel.setArg(0, initVectorField);
+    kernel.setArg(3, MU);
+    kernel.setArg(4, size.x);
+    kernel.setArg(5, size.y);
+    kernel.setArg(6, size.z);
+}
 
-Image3D residual(
-        OpenCL &ocl,
-        Image3D &r,
-        Image3D &v,
-        Image3D &sqrMag,
-        float mu,
-        float spacing,
-        SIPL::int3 size,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-    Image3D newResidual = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
+// Each work group of the tiled GVF kernel has 4x4x4 work items and updates one brick
+static NDRange getTiledIterationGlobalSize(SIPL::int3 size) {
+    return NDRange(
+            ((size.x+GVF_TILE-1)/GVF_TILE)*4,
+            ((size.y+GVF_TILE-1)/GVF_TILE)*4,
+            ((size.z+GVF_TILE-1)/GVF_TILE)*4
     );
-
-    Kernel residualKernel(ocl.program, "residual");
-    if(no3Dwrite) {
-        cl::size_t<3> offset;
-		offset[0] = 0;
-		offset[1] = 0;
-		offset[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size.x;
-		region[1] = size.y;
-		region[2] = size.z;
-        Buffer newResidualBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, bufferSize*size.x*size.y*size.z);
-        residualKernel.setArg(0, r);
-        residualKernel.setArg(1, v);
-        residualKernel.setArg(2, sqrMag);
-        residualKernel.setArg(3, mu);
-        residualKernel.setArg(4, spacing);
-        residualKernel.setArg(5, newResidualBuffer);
-        ocl.queue.enqueueNDRangeKernel(
-                residualKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
-        );
-
-        ocl.queue.enqueueCopyBufferToImage(newResidualBuffer, newResidual,0,offset,region);
-    } else {
-        residualKernel.setArg(0, r);
-        residualKernel.setArg(1, v);
-        residualKernel.setArg(2, sqrMag);
-        residualKernel.setArg(3, mu);
-        residualKernel.setArg(4, spacing);
-        residualKernel.setArg(5, newResidual);
-        ocl.queue.enqueueNDRangeKernel(
-                residualKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
-        );
-    }
-    return newResidual;
 }
 
-
 SIPL::int3 calculateNewSize(SIPL::int3 size) {
     bool sizeIsOkay = false;
     if(size.x == size.y && size.x == size.z) {
@@ -394,343 +249,236 @@ SIPL::int3 calculateNewSize(SIPL::int3 size) {
 
 }
 
-void multigridVcycle(
-        OpenCL &ocl,
-        Image3D &r_l,
-        Image3D &v_l,
-        Image3D &sqrMag,
-        int l,
-        int v1,
-        int v2,
-        int l_max,
-        float mu,
-        float spacing,
-        SIPL::int3 size,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-
-    // Pre-smoothing
-    gaussSeidelSmoothing(ocl,v_l,r_l,sqrMag,v1,size,mu,spacing,imageType,bufferSize,no3Dwrite);
-
-    if(l < l_max) {
-        SIPL::int3 newSize = calculateNewSize(size);
-
-        // Compute new residual
-        Image3D p_l = residual(ocl, r_l, v_l, sqrMag, mu, spacing, size,imageType,bufferSize,no3Dwrite);
-
-        // Restrict residual
-        Image3D r_l_p1 = restrictVolume(ocl, p_l, newSize,imageType,bufferSize,no3Dwrite);
-
-        // Restrict sqrMag
-        Image3D sqrMag_l_p1 = restrictVolume(ocl, sqrMag, newSize,imageType,bufferSize,no3Dwrite);
-
-        // Initialize v_l_p1
-        Image3D v_l_p1 = initSolutionToZero(ocl,newSize,imageType,bufferSize,no3Dwrite);
-
-        // Solve recursively
-        multigridVcycle(ocl, r_l_p1, v_l_p1, sqrMag_l_p1, l+1,v1,v2,l_max,mu,spacing*2,newSize,imageType,bufferSize,no3Dwrite);
-
-        // Prolongate
-        v_l = prolongateVolume(ocl, v_l, v_l_p1, size,imageType,bufferSize,no3Dwrite);
+// Number of coarser grids below a volume. The grids are restricted until they
+// are 8 voxels wide.
+int calculateMaxLevel(SIPL::int3 size) {
+    int l_max = 0;
+    SIPL::int3 newSize = calculateNewSize(size);
+    while(newSize.x >= 8) {
+        l_max++;
+        newSize = calculateNewSize(newSize);
     }
-
-    // Post-smoothing
-    gaussSeidelSmoothing(ocl,v_l,r_l,sqrMag,v2,size,mu,spacing,imageType,bufferSize,no3Dwrite);
+    return l_max;
 }
 
 /*
-Image3D runMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL::int3 &size) {
+ * Images of one grid of the multigrid GVF. They are allocated once and reused
+ * by all cycles and components. If 3D image writes are not supported, the
+ * kernels write to the buffer, which is then copied to the image.
+ */
+typedef struct MultigridLevel {
+    SIPL::int3 size;
+    float spacing;
+    Image3D sqrMag;
+    Image3D r; // Right hand side
+    Image3D v; // Solution
+    Image3D tmp; // Used for smoothing, residuals and prolongation
+    Buffer buffer;
+} MultigridLevel;
 
-    const int GVFIterations = getParam(parameters, "gvf-iterations");
-    const bool no3Dwrite = !getParamBool(parameters, "3d_write");
-    const float MU = getParam(parameters, "gvf-mu");
-    const int totalSize = size.x*size.y*size.z;
-    const bool use16bit = getParamBool(parameters, "16bit-vectors");
-    int imageType;
-    if(use16bit) {
-        imageType = CL_SNORM_INT16;
-    } else {
-        imageType = CL_FLOAT;
+/*
+ * Full multigrid solver of one component of the GVF. All kernels are enqueued
+ * without waiting for the queue, as the queue runs them in order.
+ */
+class MultigridGVF {
+public:
+    MultigridGVF(OpenCL &ocl, Image3D &sqrMag, SIPL::int3 size, int l_max, float mu, int imageType, int bufferSize, bool no3Dwrite);
+    // Computes the correction of the solution f of a component (1 == x, 2 == y, 3 == z)
+    Image3D & solve(Image3D &f, Image3D &vectorField, int component, int v0, int v1, int v2);
+    void initSolutionToZero(MultigridLevel &level, Image3D &v);
+    // Runs a kernel over a grid and stores the result, which is argument outputArg of the kernel, in output
+    void enqueueLevelKernel(Kernel &kernel, int outputArg, MultigridLevel &level, Image3D &output);
+    MultigridLevel & getLevel(int l);
+private:
+    void fullMultigrid(int l, int v0, int v1, int v2);
+    void multigridVcycle(int l, int v1, int v2);
+    void gaussSeidelSmoothing(int l, int iterations);
+    void restrictVolume(Image3D &v, int l);
+    void copyBufferToImage(MultigridLevel &level, Image3D &image);
+    OpenCL &ocl;
+    std::vector<MultigridLevel> levels;
+    float mu;
+    Kernel gaussSeidelKernel, gaussSeidelKernel2, restrictKernel, prolongateKernel,
+           prolongateKernel2, residualKernel, fmgResidualKernel, initToZeroKernel;
+};
+
+MultigridGVF::MultigridGVF(OpenCL &ocl, Image3D &sqrMag, SIPL::int3 size, int l_max, float mu, int imageType, int bufferSize, bool no3Dwrite) : ocl(ocl), mu(mu) {
+    gaussSeidelKernel = Kernel(ocl.program, "GVFgaussSeidel");
+    gaussSeidelKernel2 = Kernel(ocl.program, "GVFgaussSeidel2");
+    restrictKernel = Kernel(ocl.program, "restrictVolume");
+    prolongateKernel = Kernel(ocl.program, "prolongate");
+    prolongateKernel2 = Kernel(ocl.program, "prolongate2");
+    residualKernel = Kernel(ocl.program, "residual");
+    fmgResidualKernel = Kernel(ocl.program, "fmgResidual");
+    initToZeroKernel = Kernel(ocl.program, no3Dwrite ? "initFloatBuffer" : "init3DFloat");
+
+    for(int l = 0; l <= l_max; l++) {
+        MultigridLevel level;
+        level.size = l == 0 ? size : calculateNewSize(levels[l-1].size);
+        level.spacing = l == 0 ? 1.0f : levels[l-1].spacing*2;
+        level.r = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, imageType), level.size.x, level.size.y, level.size.z);
+        level.v = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, imageType), level.size.x, level.size.y, level.size.z);
+        level.tmp = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, imageType), level.size.x, level.size.y, level.size.z);
+        if(no3Dwrite)
+            level.buffer = createBuffer(ocl, CL_MEM_READ_WRITE, bufferSize*level.size.x*level.size.y*level.size.z);
+        if(l == 0) {
+            level.sqrMag = sqrMag;
+        } else {
+            // sqrMag is the same for all cycles, and is restricted only once
+            level.sqrMag = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, imageType), level.size.x, level.size.y, level.size.z);
+        }
+        levels.push_back(level);
+        if(l > 0) {
+            restrictKernel.setArg(0, levels[l-1].sqrMag);
+            enqueueLevelKernel(restrictKernel, 1, levels[l], levels[l].sqrMag);
+        }
     }
+}
 
-    Kernel initKernel = Kernel(ocl.program, "MGGVFInit");
-
-    int v1 = 2;
-    int v2 = 2;
-    int l_max = 6; // TODO this should be calculated
-    float spacing = 1.0f;
-
-    // create sqrMag
-    Kernel createSqrMagKernel(ocl.program, "createSqrMag");
-    Image3D sqrMag = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
+MultigridLevel & MultigridGVF::getLevel(int l) {
+    return levels[l];
+}
 
-    createSqrMagKernel.setArg(0, *vectorField);
-    createSqrMagKernel.setArg(1, sqrMag);
-    ocl.queue.enqueueNDRangeKernel(
-            createSqrMagKernel,
-            NullRange,
-            NDRange(size.x,size.y,size.z),
-            NullRange
-    );
-    std::cout << "sqrMag created" << std::endl;
+void MultigridGVF::copyBufferToImage(MultigridLevel &level, Image3D &image) {
+    cl::size_t<3> offset;
+    offset[0] = 0;
+    offset[1] = 0;
+    offset[2] = 0;
+    cl::size_t<3> region;
+    region[0] = level.size.x;
+    region[1] = level.size.y;
+    region[2] = level.size.z;
+    ocl.queue.enqueueCopyBufferToImage(level.buffer, image, 0, offset, region);
+}
 
-    // create fx and rx
-    Image3D fx = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-    Image3D *rx = new Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-    ocl.GC->addMemoryObject(rx);
-    initKernel.setArg(0, *vectorField);
-    initKernel.setArg(1, fx);
-    initKernel.setArg(2, *rx);
-    initKernel.setArg(3, 1);
+void MultigridGVF::enqueueLevelKernel(Kernel &kernel, int outputArg, MultigridLevel &level, Image3D &output) {
+    const bool no3Dwrite = level.buffer() != NULL;
+    if(no3Dwrite) {
+        kernel.setArg(outputArg, level.buffer);
+    } else {
+        kernel.setArg(outputArg, output);
+    }
     ocl.queue.enqueueNDRangeKernel(
-            initKernel,
+            kernel,
             NullRange,
-            NDRange(size.x,size.y,size.z),
-            NullRange
+            NDRange(level.size.x,level.size.y,level.size.z),
+            NDRange(4,4,4)
     );
-    std::cout << "fx initialized" << std::endl;
+    if(no3Dwrite)
+        copyBufferToImage(level, output);
+}
 
-    // X component
-    for(int i = 0; i < GVFIterations; i++) {
-        multigridVcycle(ocl,*rx,fx,sqrMag,0,v1,v2,l_max,MU,spacing,size,imageType);
-        ocl.queue.finish();
+void MultigridGVF::initSolutionToZero(MultigridLevel &level, Image3D &v) {
+    if(level.buffer() != NULL) {
+        initToZeroKernel.setArg(0, level.buffer);
+        ocl.queue.enqueueNDRangeKernel(
+                initToZeroKernel,
+                NullRange,
+                NDRange(level.size.x*level.size.y*level.size.z),
+                NullRange
+        );
+        copyBufferToImage(level, v);
+    } else {
+        enqueueLevelKernel(initToZeroKernel, 0, level, v);
     }
-    std::cout << "fx finished" << std::endl;
-
-    // delete rx
-    ocl.GC->deleteMemoryObject(rx);
+}
 
-    // create fy and ry
-    Image3D fy = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-    Image3D *ry = new Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-    ocl.GC->addMemoryObject(ry);
-    initKernel.setArg(0, *vectorField);
-    initKernel.setArg(1, fy);
-    initKernel.setArg(2, *ry);
-    initKernel.setArg(3, 2);
-    ocl.queue.enqueueNDRangeKernel(
-            initKernel,
-            NullRange,
-            NDRange(size.x,size.y,size.z),
-            NullRange
-    );
-    std::cout << "fy initialized" << std::endl;
-    // Y component
-    for(int i = 0; i < GVFIterations; i++) {
-        multigridVcycle(ocl,*ry,fy,sqrMag,0,v1,v2,l_max,MU,spacing,size,imageType);
-        ocl.queue.finish();
+void MultigridGVF::gaussSeidelSmoothing(int l, int iterations) {
+    MultigridLevel &level = levels[l];
+    gaussSeidelKernel.setArg(0, level.r);
+    gaussSeidelKernel.setArg(1, level.sqrMag);
+    gaussSeidelKernel.setArg(2, mu);
+    gaussSeidelKernel.setArg(3, level.spacing);
+    gaussSeidelKernel2.setArg(0, level.r);
+    gaussSeidelKernel2.setArg(1, level.sqrMag);
+    gaussSeidelKernel2.setArg(2, mu);
+    gaussSeidelKernel2.setArg(3, level.spacing);
+    for(int i = 0; i < iterations; i++) {
+        gaussSeidelKernel.setArg(4, level.v);
+        enqueueLevelKernel(gaussSeidelKernel, 5, level, level.tmp);
+        gaussSeidelKernel2.setArg(4, level.tmp);
+        enqueueLevelKernel(gaussSeidelKernel2, 5, level, level.v);
     }
-    std::cout << "fy finished" << std::endl;
+}
 
-    // delete ry
-    ocl.GC->deleteMemoryObject(ry);
-    // create fz and rz
-    Image3D fz = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-    Image3D *rz = new Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-    ocl.GC->addMemoryObject(rz);
-    initKernel.setArg(0, *vectorField);
-    initKernel.setArg(1, fz);
-    initKernel.setArg(2, *rz);
-    initKernel.setArg(3, 3);
-    ocl.queue.enqueueNDRangeKernel(
-            initKernel,
-            NullRange,
-            NDRange(size.x,size.y,size.z),
-            NullRange
-    );
-    std::cout << "fz initialized" << std::endl;
-    ocl.GC->deleteMemoryObject(vectorField);
-    // Z component
-    for(int i = 0; i < GVFIterations; i++) {
-        multigridVcycle(ocl,*rz,fz,sqrMag,0,v1,v2,l_max,MU,spacing,size,imageType);
-        ocl.queue.finish();
-    }
-    std::cout << "fz finished" << std::endl;
+// Restricts v to the right hand side of grid l+1
+void MultigridGVF::restrictVolume(Image3D &v, int l) {
+    restrictKernel.setArg(0, v);
+    enqueueLevelKernel(restrictKernel, 1, levels[l+1], levels[l+1].r);
+}
 
-    // delete rz
-    ocl.GC->deleteMemoryObject(rz);
+void MultigridGVF::multigridVcycle(int l, int v1, int v2) {
+    MultigridLevel &level = levels[l];
 
+    // Pre-smoothing
+    gaussSeidelSmoothing(l, v1);
 
-    Image3D finalVectorField = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_RGBA, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
-    Kernel finalizeKernel = Kernel(ocl.program, "MGGVFFinish");
-    finalizeKernel.setArg(0, fx);
-    finalizeKernel.setArg(1, fy);
-    finalizeKernel.setArg(2, fz);
-    finalizeKernel.setArg(3, finalVectorField);
-    ocl.queue.enqueueNDRangeKernel(
-            finalizeKernel,
-            NullRange,
-            NDRange(size.x,size.y,size.z),
-            NullRange
-    );
-    std::cout << "MG GVF finished" << std::endl;
+    if(l < (int)levels.size()-1) {
+        // Compute new residual
+        residualKernel.setArg(0, level.r);
+        residualKernel.setArg(1, level.v);
+        residualKernel.setArg(2, level.sqrMag);
+        residualKernel.setArg(3, mu);
+        residualKernel.setArg(4, level.spacing);
+        enqueueLevelKernel(residualKernel, 5, level, level.tmp);
 
+        // Restrict residual
+        restrictVolume(level.tmp, l);
 
-    return finalVectorField;
-}
-*/
-
-Image3D computeNewResidual(
-        OpenCL &ocl,
-        Image3D &f,
-        Image3D &vectorField,
-        float mu,
-        float spacing,
-        int component,
-        SIPL::int3 size,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-    Image3D newResidual = Image3D(
-            ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, imageType),
-            size.x,
-            size.y,
-            size.z
-    );
+        // Initialize v_l_p1
+        initSolutionToZero(levels[l+1], levels[l+1].v);
 
-    Kernel residualKernel(ocl.program, "fmgResidual");
-    if(no3Dwrite) {
-        cl::size_t<3> offset;
-		offset[0] = 0;
-		offset[1] = 0;
-		offset[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size.x;
-		region[1] = size.y;
-		region[2] = size.z;
-        Buffer newResidualBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, bufferSize*size.x*size.y*size.z);
-        residualKernel.setArg(0,vectorField);
-        residualKernel.setArg(1, f);
-        residualKernel.setArg(2, mu);
-        residualKernel.setArg(3, spacing);
-        residualKernel.setArg(4, component);
-        residualKernel.setArg(5, newResidualBuffer);
-        ocl.queue.enqueueNDRangeKernel(
-                residualKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
-        );
-        ocl.queue.enqueueCopyBufferToImage(newResidualBuffer, newResidual,0,offset,region);
-    } else {
-        residualKernel.setArg(0,vectorField);
-        residualKernel.setArg(1, f);
-        residualKernel.setArg(2, mu);
-        residualKernel.setArg(3, spacing);
-        residualKernel.setArg(4, component);
-        residualKernel.setArg(5, newResidual);
-        ocl.queue.enqueueNDRangeKernel(
-                residualKernel,
-                NullRange,
-                NDRange(size.x,size.y,size.z),
-                NDRange(4,4,4)
-        );
+        // Solve recursively
+        multigridVcycle(l+1, v1, v2);
+
+        // Prolongate
+        prolongateKernel.setArg(0, level.v);
+        prolongateKernel.setArg(1, levels[l+1].v);
+        enqueueLevelKernel(prolongateKernel, 2, level, level.tmp);
+        std::swap(level.v, level.tmp);
     }
 
-    return newResidual;
+    // Post-smoothing
+    gaussSeidelSmoothing(l, v2);
 }
 
-Image3D fullMultigrid(
-        OpenCL &ocl,
-        Image3D &r_l,
-        Image3D &sqrMag,
-        int l,
-        int v0,
-        int v1,
-        int v2,
-        int l_max,
-        float mu,
-        float spacing,
-        SIPL::int3 size,
-        int imageType,
-        int bufferSize,
-        bool no3Dwrite
-        ) {
-    Image3D v_l;
-    if(l < l_max) {
-        SIPL::int3 newSize = calculateNewSize(size);
-        Image3D r_l_p1 = restrictVolume(ocl, r_l, newSize, imageType,bufferSize,no3Dwrite);
-        Image3D sqrMag_l = restrictVolume(ocl,sqrMag,newSize,imageType,bufferSize,no3Dwrite);
-        Image3D v_l_p1 = fullMultigrid(ocl,r_l_p1,sqrMag_l,l+1,v0,v1,v2,l_max,mu,spacing*2,newSize, imageType,bufferSize,no3Dwrite);
-        v_l = prolongateVolume2(ocl,v_l_p1, size,imageType,bufferSize,no3Dwrite);
+void MultigridGVF::fullMultigrid(int l, int v0, int v1, int v2) {
+    MultigridLevel &level = levels[l];
+    if(l < (int)levels.size()-1) {
+        restrictVolume(level.r, l);
+        fullMultigrid(l+1, v0, v1, v2);
+        prolongateKernel2.setArg(0, levels[l+1].v);
+        enqueueLevelKernel(prolongateKernel2, 1, level, level.v);
     } else {
-        v_l = initSolutionToZero(ocl,size,imageType,bufferSize,no3Dwrite);
+        initSolutionToZero(level, level.v);
     }
 
     for(int i = 0; i < v0; i++) {
-        multigridVcycle(ocl,r_l,v_l,sqrMag,l,v1,v2,l_max,mu,spacing,size,imageType,bufferSize,no3Dwrite);
+        multigridVcycle(l, v1, v2);
     }
+}
 
-    return v_l;
-
+Image3D & MultigridGVF::solve(Image3D &f, Image3D &vectorField, int component, int v0, int v1, int v2) {
+    MultigridLevel &level = levels[0];
+    fmgResidualKernel.setArg(0, vectorField);
+    fmgResidualKernel.setArg(1, f);
+    fmgResidualKernel.setArg(2, mu);
+    fmgResidualKernel.setArg(3, level.spacing);
+    fmgResidualKernel.setArg(4, component);
+    enqueueLevelKernel(fmgResidualKernel, 5, level, level.r);
+
+    fullMultigrid(0, v0, v1, v2);
+    return level.v;
 }
 
 Image3D runFMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL::int3 &size) {
+    if(ocl.haloExchange != NULL)
+        throw SIPL::SIPLException("The FMG GVF can not be run on z-slabs", __LINE__, __FILE__);
 
     const int GVFIterations = getParam(parameters, "gvf-iterations");
     const bool no3Dwrite = !getParamBool(parameters, "3d_write");
     const float MU = getParam(parameters, "gvf-mu");
+    GVFConvergence convergence(ocl, parameters);
     const int totalSize = size.x*size.y*size.z;
     const bool use16bit = getParamBool(parameters, "16bit-vectors");
     int imageType, bufferTypeSize;
@@ -742,18 +490,18 @@ Image3D runFMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL
         bufferTypeSize = sizeof(float);
     }
 
-    Kernel initKernel = Kernel(ocl.program, "MGGVFInit");
-
     int v0 = 1;
     int v1 = 2;
     int v2 = 2;
-    int l_max = 2; // TODO this should be calculated
-    float spacing = 1.0f;
+    int l_max = getParam(parameters, "multigrid-levels");
+    if(l_max == 0)
+        l_max = calculateMaxLevel(size);
+    std::cout << "Running multigrid GVF with " << l_max+1 << " grids" << std::endl;
 
     // create sqrMag
     Kernel createSqrMagKernel(ocl.program, "createSqrMag");
-    Image3D sqrMag = Image3D(
-            ocl.context,
+    Image3D sqrMag = createImage3D(
+            ocl,
             CL_MEM_READ_WRITE,
             ImageFormat(CL_R, imageType),
             size.x,
@@ -770,8 +518,8 @@ Image3D runFMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL
     region[2] = size.z;
 
     if(no3Dwrite) {
-        Buffer sqrMagBuffer = Buffer(
-                ocl.context,
+        Buffer sqrMagBuffer = createBuffer(
+                ocl,
                 CL_MEM_WRITE_ONLY,
                 totalSize*bufferTypeSize
         );
@@ -796,170 +544,43 @@ Image3D runFMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL
     }
     std::cout << "sqrMag created" << std::endl;
 
+    MultigridGVF multigrid(ocl, sqrMag, size, l_max, MU, imageType, bufferTypeSize, no3Dwrite);
+    MultigridLevel &finest = multigrid.getLevel(0);
     Kernel addKernel(ocl.program, "addTwoImages");
-    Image3D fx = initSolutionToZero(ocl,size,imageType,bufferTypeSize,no3Dwrite);
-
-    // X component
-    for(int i = 0; i < GVFIterations; i++) {
-        Image3D rx = computeNewResidual(ocl,fx,*vectorField,MU,spacing,1,size,imageType,bufferTypeSize,no3Dwrite);
-        Image3D fx2 = fullMultigrid(ocl,rx,sqrMag,0,v0,v1,v2,l_max,MU,spacing,size,imageType,bufferTypeSize,no3Dwrite);
-        ocl.queue.finish();
-        if(no3Dwrite) {
-            Buffer fx3 = Buffer(
-                    ocl.context,
-                    CL_MEM_WRITE_ONLY,
-                    totalSize*bufferTypeSize
-            );
-
-            addKernel.setArg(0,fx);
-            addKernel.setArg(1,fx2);
-            addKernel.setArg(2,fx3);
-            ocl.queue.enqueueNDRangeKernel(
-                    addKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-            );
-            ocl.queue.enqueueCopyBufferToImage(fx3,fx,0,offset,region);
-            ocl.queue.finish();
-        } else {
-            Image3D fx3 = Image3D(
-                ocl.context,
-                CL_MEM_READ_WRITE,
-                ImageFormat(CL_R, imageType),
-                size.x,
-                size.y,
-                size.z
-            );
-
-            addKernel.setArg(0,fx);
-            addKernel.setArg(1,fx2);
-            addKernel.setArg(2,fx3);
-            ocl.queue.enqueueNDRangeKernel(
-                    addKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-            );
-            ocl.queue.finish();
-
-            fx = fx3;
-        }
-
+    Image3D sum = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, imageType), size.x, size.y, size.z);
+    Image3D zero;
+    if(convergence.isEnabled()) {
+        zero = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, imageType), size.x, size.y, size.z);
+        multigrid.initSolutionToZero(finest, zero);
     }
-    std::cout << "fx finished" << std::endl;
-
-    // create fy and ry
-    // Y component
-    Image3D fy = initSolutionToZero(ocl,size,imageType,bufferTypeSize,no3Dwrite);
-    for(int i = 0; i < GVFIterations; i++) {
-        Image3D ry = computeNewResidual(ocl,fy,*vectorField,MU,spacing,2,size,imageType,bufferTypeSize,no3Dwrite);
-        Image3D fy2 = fullMultigrid(ocl,ry,sqrMag,0,v0,v1,v2,l_max,MU,spacing,size,imageType,bufferTypeSize,no3Dwrite);
-        ocl.queue.finish();
-        if(no3Dwrite) {
-            Buffer fy3 = Buffer(
-                    ocl.context,
-                    CL_MEM_WRITE_ONLY,
-                    totalSize*bufferTypeSize
-            );
-
-            addKernel.setArg(0,fy);
-            addKernel.setArg(1,fy2);
-            addKernel.setArg(2,fy3);
-            ocl.queue.enqueueNDRangeKernel(
-                    addKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-            );
-            ocl.queue.enqueueCopyBufferToImage(fy3,fy,0,offset,region);
-            ocl.queue.finish();
-        } else {
-            Image3D fy3 = Image3D(
-                ocl.context,
-                CL_MEM_READ_WRITE,
-                ImageFormat(CL_R, imageType),
-                size.x,
-                size.y,
-                size.z
-            );
-
-            addKernel.setArg(0,fy);
-            addKernel.setArg(1,fy2);
-            addKernel.setArg(2,fy3);
-            ocl.queue.enqueueNDRangeKernel(
-                    addKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-            );
-            ocl.queue.finish();
-
-            fy = fy3;
-        }
 
-    }
-
-    std::cout << "fy finished" << std::endl;
-
-    // create fz and rz
-    // Z component
-    Image3D fz = initSolutionToZero(ocl,size,imageType,bufferTypeSize,no3Dwrite);
-    for(int i = 0; i < GVFIterations; i++) {
-        Image3D rz = computeNewResidual(ocl,fz,*vectorField,MU,spacing,3,size,imageType,bufferTypeSize,no3Dwrite);
-        Image3D fz2 = fullMultigrid(ocl,rz,sqrMag,0,v0,v1,v2,l_max,MU,spacing,size,imageType,bufferTypeSize,no3Dwrite);
-        ocl.queue.finish();
-        if(no3Dwrite) {
-            Buffer fz3 = Buffer(
-                    ocl.context,
-                    CL_MEM_WRITE_ONLY,
-                    totalSize*bufferTypeSize
-            );
-
-            addKernel.setArg(0,fz);
-            addKernel.setArg(1,fz2);
-            addKernel.setArg(2,fz3);
-            ocl.queue.enqueueNDRangeKernel(
-                    addKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-            );
-            ocl.queue.enqueueCopyBufferToImage(fz3,fz,0,offset,region);
-            ocl.queue.finish();
-        } else {
-            Image3D fz3 = Image3D(
-                ocl.context,
-                CL_MEM_READ_WRITE,
-                ImageFormat(CL_R, imageType),
-                size.x,
-                size.y,
-                size.z
-            );
-
-            addKernel.setArg(0,fz);
-            addKernel.setArg(1,fz2);
-            addKernel.setArg(2,fz3);
-            ocl.queue.enqueueNDRangeKernel(
-                    addKernel,
-                    NullRange,
-                    NDRange(size.x,size.y,size.z),
-                    NDRange(4,4,4)
-            );
-            ocl.queue.finish();
-
-            fz = fz3;
+    // Solve for each component. A correction is added to the solution in each iteration.
+    Image3D f[3];
+    const char * names[3] = {"fx", "fy", "fz"};
+    for(int component = 1; component <= 3; component++) {
+        Image3D &fc = f[component-1];
+        fc = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, imageType), size.x, size.y, size.z);
+        multigrid.initSolutionToZero(finest, fc);
+        int iterations = GVFIterations;
+        for(int i = 0; i < GVFIterations; i++) {
+            Image3D &correction = multigrid.solve(fc, *vectorField, component, v0, v1, v2);
+            addKernel.setArg(0, fc);
+            addKernel.setArg(1, correction);
+            multigrid.enqueueLevelKernel(addKernel, 2, finest, sum);
+            std::swap(fc, sum);
+            if(convergence.isCheckedAfter(i+1) && convergence.hasConverged(i+1, correction, zero, size)) {
+                iterations = i+1;
+                break;
+            }
         }
-
+        convergence.report(iterations);
+        std::cout << names[component-1] << " finished" << std::endl;
     }
 
-    ocl.GC->deleteMemoryObject(vectorField);
-
-    std::cout << "fz finished" << std::endl;
-
+    deleteMemoryObject(ocl, vectorField);
 
-    Image3D finalVectorField = Image3D(
-            ocl.context,
+    Image3D finalVectorField = createImage3D(
+            ocl,
             CL_MEM_READ_WRITE,
             ImageFormat(CL_RGBA, imageType),
             size.x,
@@ -968,15 +589,15 @@ Image3D runFMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL
     );
     Kernel finalizeKernel = Kernel(ocl.program, "MGGVFFinish");
     if(no3Dwrite) {
-        Buffer finalVectorFieldBuffer = Buffer(
-                ocl.context,
+        Buffer finalVectorFieldBuffer = createBuffer(
+                ocl,
                 CL_MEM_WRITE_ONLY,
                 4*totalSize*bufferTypeSize
         );
 
-        finalizeKernel.setArg(0, fx);
-        finalizeKernel.setArg(1, fy);
-        finalizeKernel.setArg(2, fz);
+        finalizeKernel.setArg(0, f[0]);
+        finalizeKernel.setArg(1, f[1]);
+        finalizeKernel.setArg(2, f[2]);
         finalizeKernel.setArg(3, finalVectorFieldBuffer);
         ocl.queue.enqueueNDRangeKernel(
                 finalizeKernel,
@@ -986,9 +607,9 @@ Image3D runFMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL
         );
         ocl.queue.enqueueCopyBufferToImage(finalVectorFieldBuffer,finalVectorField,0,offset,region);
     } else {
-        finalizeKernel.setArg(0, fx);
-        finalizeKernel.setArg(1, fy);
-        finalizeKernel.setArg(2, fz);
+        finalizeKernel.setArg(0, f[0]);
+        finalizeKernel.setArg(1, f[1]);
+        finalizeKernel.setArg(2, f[2]);
         finalizeKernel.setArg(3, finalVectorField);
         ocl.queue.enqueueNDRangeKernel(
                 finalizeKernel,
@@ -1009,11 +630,14 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
     const int GVFIterations = getParam(parameters, "gvf-iterations");
     const bool no3Dwrite = !getParamBool(parameters, "3d_write");
     const float MU = getParam(parameters, "gvf-mu");
+    GVFConvergence convergence(ocl, parameters);
     const int totalSize = size.x*size.y*size.z;
 
     Kernel GVFInitKernel = Kernel(ocl.program, "GVF3DInit");
     Kernel GVFIterationKernel = Kernel(ocl.program, "GVF3DIteration");
+    Kernel GVFTiledIterationKernel = Kernel(ocl.program, "GVF3DTiledIteration");
     Kernel GVFFinishKernel = Kernel(ocl.program, "GVF3DFinish");
+    const int sweeps = getParam(parameters, "gvf-sweeps");
     Image3D resultVectorField;
 
     std::cout << "Running GVF with " << GVFIterations << " iterations " << std::endl;
@@ -1022,17 +646,17 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
     	if(getParamBool(parameters, "16bit-vectors"))
     		vectorFieldSize = sizeof(short);
         // Create auxillary buffers
-        Buffer * vectorFieldBuffer = new Buffer(
-                ocl.context,
+        Buffer * vectorFieldBuffer = new Buffer(createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 3*vectorFieldSize*totalSize
-        );
+        ));
         ocl.GC->addMemoryObject(vectorFieldBuffer);
-        Buffer * vectorFieldBuffer1 = new Buffer(
-                ocl.context,
+        Buffer * vectorFieldBuffer1 = new Buffer(createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 3*vectorFieldSize*totalSize
-        );
+        ));
         ocl.GC->addMemoryObject(vectorFieldBuffer1);
 
         GVFInitKernel.setArg(0, *vectorField);
@@ -1047,28 +671,34 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
         // Run iterations
         GVFIterationKernel.setArg(0, *vectorField);
         GVFIterationKernel.setArg(3, MU);
-
-        for(int i = 0; i < GVFIterations; i++) {
-            if(i % 2 == 0) {
-                GVFIterationKernel.setArg(1, *vectorFieldBuffer);
-                GVFIterationKernel.setArg(2, *vectorFieldBuffer1);
+        setTiledIterationArgs(GVFTiledIterationKernel, *vectorField, MU, size);
+
+        int iterations = 0;
+        while(iterations < GVFIterations) {
+            // Several iterations are run by the tiled kernel, and the rest one at a time
+            const int step = GVFIterations - iterations >= sweeps ? sweeps : 1;
+            Kernel &kernel = step > 1 ? GVFTiledIterationKernel : GVFIterationKernel;
+            kernel.setArg(1, *vectorFieldBuffer);
+            kernel.setArg(2, *vectorFieldBuffer1);
+            if(step > 1) {
+                ocl.queue.enqueueNDRangeKernel(kernel, NullRange, getTiledIterationGlobalSize(size), NDRange(4,4,4));
             } else {
-                GVFIterationKernel.setArg(1, *vectorFieldBuffer1);
-                GVFIterationKernel.setArg(2, *vectorFieldBuffer);
+                ocl.queue.enqueueNDRangeKernel(kernel, NullRange, NDRange(size.x,size.y,size.z), NDRange(4,4,4));
             }
-                ocl.queue.enqueueNDRangeKernel(
-                        GVFIterationKernel,
-                        NullRange,
-                        NDRange(size.x,size.y,size.z),
-                        NDRange(4,4,4)
-                );
+            std::swap(vectorFieldBuffer, vectorFieldBuffer1);
+            iterations += step;
+            if(convergence.isCheckedAfter(iterations, step) && convergence.hasConverged(iterations, *vectorFieldBuffer, *vectorFieldBuffer1, 3*totalSize))
+                break;
+            if(ocl.haloExchange != NULL && iterations < GVFIterations && iterations % ocl.haloExchange->getInterval() == 0)
+                ocl.haloExchange->exchange(ocl, ocl.slab, *vectorFieldBuffer, (::size_t)3*vectorFieldSize*size.x*size.y);
         }
+        convergence.report(iterations);
         ocl.queue.finish(); //This finish is necessary
-        ocl.GC->deleteMemoryObject(vectorFieldBuffer1);
-        ocl.GC->deleteMemoryObject(vectorField);
+        deleteMemoryObject(ocl, vectorFieldBuffer1);
+        deleteMemoryObject(ocl, vectorField);
 
-        Buffer finalVectorFieldBuffer = Buffer(
-                ocl.context,
+        Buffer finalVectorFieldBuffer = createBuffer(
+                ocl,
                 CL_MEM_WRITE_ONLY,
                 4*vectorFieldSize*totalSize
         );
@@ -1084,7 +714,7 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
                 NDRange(4,4,4)
         );
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(vectorFieldBuffer);
+        deleteMemoryObject(ocl, vectorFieldBuffer);
 
 		cl::size_t<3> offset;
 		offset[0] = 0;
@@ -1097,9 +727,9 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
 
         // Copy buffer contents to image
 		if(getParamBool(parameters, "16bit-vectors")) {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
         } else {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
         }
         ocl.queue.enqueueCopyBufferToImage(
                 finalVectorFieldBuffer,
@@ -1108,16 +738,17 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
                 offset,
                 region
         );
+        releaseToPool(ocl, finalVectorFieldBuffer);
 
     } else {
         Image3D vectorField1;
         Image3D initVectorField;
         if(getParamBool(parameters, "16bit-vectors")) {
-            vectorField1 = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
-            initVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_SNORM_INT16), size.x, size.y, size.z);
+            vectorField1 = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+            initVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_SNORM_INT16), size.x, size.y, size.z);
         } else {
-            vectorField1 = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
-            initVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_FLOAT), size.x, size.y, size.z);
+            vectorField1 = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+            initVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_FLOAT), size.x, size.y, size.z);
         }
 
         // init vectorField from image
@@ -1133,30 +764,38 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
         // Run iterations
         GVFIterationKernel.setArg(0, initVectorField);
         GVFIterationKernel.setArg(3, MU);
-
-        for(int i = 0; i < GVFIterations; i++) {
-            if(i % 2 == 0) {
-                GVFIterationKernel.setArg(1, vectorField1);
-                GVFIterationKernel.setArg(2, *vectorField);
+        setTiledIterationArgs(GVFTiledIterationKernel, initVectorField, MU, size);
+
+        int iterations = 0;
+        while(iterations < GVFIterations) {
+            // Several iterations are run by the tiled kernel, and the rest one at a time
+            const int step = GVFIterations - iterations >= sweeps ? sweeps : 1;
+            Kernel &kernel = step > 1 ? GVFTiledIterationKernel : GVFIterationKernel;
+            kernel.setArg(1, vectorField1);
+            kernel.setArg(2, *vectorField);
+            if(step > 1) {
+                ocl.queue.enqueueNDRangeKernel(kernel, NullRange, getTiledIterationGlobalSize(size), NDRange(4,4,4));
             } else {
-                GVFIterationKernel.setArg(1, *vectorField);
-                GVFIterationKernel.setArg(2, vectorField1);
+                ocl.queue.enqueueNDRangeKernel(kernel, NullRange, NDRange(size.x,size.y,size.z), NDRange(4,4,4));
             }
-                ocl.queue.enqueueNDRangeKernel(
-                        GVFIterationKernel,
-                        NullRange,
-                        NDRange(size.x,size.y,size.z),
-                        NDRange(4,4,4)
-                );
+            // The result is kept in vectorField1
+            std::swap(vectorField1, *vectorField);
+            iterations += step;
+            if(convergence.isCheckedAfter(iterations, step) && convergence.hasConverged(iterations, vectorField1, *vectorField, size))
+                break;
+            if(ocl.haloExchange != NULL && iterations < GVFIterations && iterations % ocl.haloExchange->getInterval() == 0)
+                ocl.haloExchange->exchange(ocl, ocl.slab, vectorField1);
         }
+        convergence.report(iterations);
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(vectorField);
+        releaseToPool(ocl, initVectorField);
+        deleteMemoryObject(ocl, vectorField);
 
         // Copy vector field to image
 		if(getParamBool(parameters, "16bit-vectors")) {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
         } else {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
         }
         GVFFinishKernel.setArg(0, vectorField1);
         GVFFinishKernel.setArg(1, resultVectorField);
@@ -1167,6 +806,7 @@ Image3D runFastGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIP
                 NDRange(size.x,size.y,size.z),
                 NDRange(4,4,4)
         );
+        releaseToPool(ocl, vectorField1);
     }
     return resultVectorField;
 }
@@ -1175,6 +815,7 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
     const int GVFIterations = getParam(parameters, "gvf-iterations");
     const bool no3Dwrite = !getParamBool(parameters, "3d_write");
     const float MU = getParam(parameters, "gvf-mu");
+    GVFConvergence convergence(ocl, parameters);
     const int totalSize = size.x*size.y*size.z;
 
     Kernel GVFInitKernel = Kernel(ocl.program, "GVF3DInit_one_component");
@@ -1193,14 +834,14 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
     	Buffer *vectorFieldZ;
         for(int component = 1; component < 4; component++) {
 
-        	Buffer * vectorField1 = new Buffer(
-                ocl.context,
+        	Buffer * vectorField1 = new Buffer(createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 vectorFieldSize*totalSize
-			);
+			));
             ocl.GC->addMemoryObject(vectorField1);
-			Buffer initVectorField = Buffer(
-                ocl.context,
+			Buffer initVectorField = createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 2*vectorFieldSize*totalSize
 			);
@@ -1217,8 +858,8 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 			);
 			ocl.queue.finish();
 
-			Buffer vectorField2 = Buffer(
-                ocl.context,
+			Buffer vectorField2 = createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 vectorFieldSize*totalSize
 			);
@@ -1227,6 +868,7 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 			GVFIterationKernel.setArg(0, initVectorField);
 			GVFIterationKernel.setArg(3, MU);
 
+			int iterations = GVFIterations;
 			for(int i = 0; i < GVFIterations; i++) {
 				if(i % 2 == 0) {
 					GVFIterationKernel.setArg(1, *vectorField1);
@@ -1241,7 +883,12 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 							NDRange(size.x,size.y,size.z),
 							NullRange
 					);
+				if(convergence.isCheckedAfter(i+1) && convergence.hasConverged(i+1, *vectorField1, vectorField2, totalSize)) {
+					iterations = i+1;
+					break;
+				}
 			}
+			convergence.report(iterations);
 			if(component == 1) {
 				vectorFieldX = vectorField1;
 			} else if(component == 2) {
@@ -1252,7 +899,7 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 			ocl.queue.finish();
 			std::cout << "finished component " << component << std::endl;
         }
-        ocl.GC->deleteMemoryObject(vectorField);
+        deleteMemoryObject(ocl, vectorField);
 
 
 		bool usingTwoBuffers = false;
@@ -1262,28 +909,28 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
         unsigned int maxBufferSize = ocl.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
         if(getParamBool(parameters, "16bit-vectors")) {
 			if(4*sizeof(short)*totalSize < maxBufferSize) {
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize);
 			} else {
 				std::cout << "NOTE: Could not fit entire vector field into one buffer. Splitting buffer in two." << std::endl;
 				// create two buffers
 				unsigned int limit = (float)maxBufferSize / (4*sizeof(short));
 				maxZ = floor((float)limit/(size.x*size.y));
 				unsigned int splitSize = maxZ*size.x*size.y*4*sizeof(short);
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, splitSize);
-				vectorFieldBuffer2 = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize-splitSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, splitSize);
+				vectorFieldBuffer2 = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize-splitSize);
 				usingTwoBuffers = true;
 			}
         } else {
 			if(4*sizeof(float)*totalSize < maxBufferSize) {
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize);
 			} else {
 				std::cout << "NOTE: Could not fit entire vector field into one buffer. Splitting buffer in two." << std::endl;
 				// create two buffers
 				unsigned int limit = (float)maxBufferSize / (4*sizeof(float));
 				maxZ = floor((float)limit/(size.x*size.y));
 				unsigned int splitSize = maxZ*size.x*size.y*4*sizeof(float);
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, splitSize);
-				vectorFieldBuffer2 = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize-splitSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, splitSize);
+				vectorFieldBuffer2 = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize-splitSize);
 				usingTwoBuffers = true;
     		}
         }
@@ -1304,9 +951,9 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
         );
 
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(vectorFieldX);
-        ocl.GC->deleteMemoryObject(vectorFieldY);
-        ocl.GC->deleteMemoryObject(vectorFieldZ);
+        deleteMemoryObject(ocl, vectorFieldX);
+        deleteMemoryObject(ocl, vectorFieldY);
+        deleteMemoryObject(ocl, vectorFieldZ);
 
 		cl::size_t<3> offset;
 		offset[0] = 0;
@@ -1318,9 +965,9 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 		region[2] = size.z;
 
 		if(getParamBool(parameters, "16bit-vectors")) {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
         } else {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
         }
 		if(usingTwoBuffers) {
 			cl::size_t<3> region2;
@@ -1371,13 +1018,13 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
         for(int component = 1; component < 4; component++) {
         	Image3D initVectorField, vectorField1, vectorField2;
         	if(getParamBool(parameters, "32bit-vectors")) {
-				vectorField1 = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z);
-				vectorField2 = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z);
-				initVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_FLOAT), size.x, size.y, size.z);
+				vectorField1 = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z);
+				vectorField2 = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z);
+				initVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_FLOAT), size.x, size.y, size.z);
 			} else {
-				vectorField1 = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SNORM_INT16), size.x, size.y, size.z);
-				vectorField2 = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SNORM_INT16), size.x, size.y, size.z);
-				initVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_SNORM_INT16), size.x, size.y, size.z);
+				vectorField1 = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SNORM_INT16), size.x, size.y, size.z);
+				vectorField2 = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SNORM_INT16), size.x, size.y, size.z);
+				initVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RG, CL_SNORM_INT16), size.x, size.y, size.z);
 			}
 
 			// init vectorField from image
@@ -1396,6 +1043,7 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 			GVFIterationKernel.setArg(0, initVectorField);
 			GVFIterationKernel.setArg(3, MU);
 
+			int iterations = GVFIterations;
 			for(int i = 0; i < GVFIterations; i++) {
 				if(i % 2 == 0) {
 					GVFIterationKernel.setArg(1, vectorField1);
@@ -1410,7 +1058,12 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 					NDRange(size.x,size.y,size.z),
 					NDRange(4,4,4)
 				);
+				if(convergence.isCheckedAfter(i+1) && convergence.hasConverged(i+1, vectorField1, vectorField2, size)) {
+					iterations = i+1;
+					break;
+				}
 			}
+			convergence.report(iterations);
 			if(component == 1) {
 				vectorFieldX = vectorField1;
 			} else if(component == 2) {
@@ -1423,9 +1076,9 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
         }
 
 		if(getParamBool(parameters, "16bit-vectors")) {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
         } else {
-            resultVectorField = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+            resultVectorField = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
         }
         // Copy vector fields to image
         GVFFinishKernel.setArg(0, vectorFieldX);
@@ -1448,6 +1101,8 @@ Image3D runLowMemoryGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameter
 Image3D runGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameters, SIPL::int3 &size, bool useLessMemory) {
 
 	if(useLessMemory) {
+        if(ocl.haloExchange != NULL)
+            throw SIPL::SIPLException("The slow GVF that uses less memory can not be run on z-slabs", __LINE__, __FILE__);
 		std::cout << "NOTE: Running slow GVF that uses less memory." << std::endl;
 		return runLowMemoryGVF(ocl,vectorField,parameters,size);
 	} else {
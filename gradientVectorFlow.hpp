@@ -3,8 +3,57 @@
 #include "commons.hpp"
 #include "SIPL/Types.hpp"
 #include "parameters.hpp"
+#include <string>
+#include <vector>
 using namespace cl;
 
+// Build options of the GVF kernels. gvf-sweeps is reduced if the bricks of
+// the tiled GVF kernel do not fit in the local memory of the device.
+std::string getGVFBuildOptions(cl::Device &device, paramList &parameters);
+
+/*
+ * Exchange of the GVF between z-slabs of a volume that are processed
+ * concurrently on sub-devices, each in a brick that overlaps the neighbouring
+ * slabs. An iteration updates a voxel from its neighbours, so the layers of a
+ * brick that are the same as in a run on the whole volume shrink by one voxel
+ * per iteration from the cut faces of the brick. Every interval iterations
+ * the slabs wait for each other, and the layers of each brick outside its
+ * slab are copied from the bricks of the slabs they belong to. The bricks have
+ * to extend at least interval layers beyond their slab, plus the layers of
+ * the brick where the initial vector field is not exact.
+ */
+class GVFHaloExchange {
+public:
+    GVFHaloExchange(int slabs, int interval);
+    // Slab i is the layers [start, end) of the volume, and is processed in a brick that starts at layer brickStart
+    void setSlab(int slab, int start, int end, int brickStart, int brickSize);
+    int getInterval() const;
+    // Called by every slab after each multiple of interval iterations with its current vector field
+    void exchange(OpenCL &ocl, int slab, Image3D &vectorField);
+    void exchange(OpenCL &ocl, int slab, Buffer &vectorField, ::size_t layerBytes);
+    // Called by a slab that fails, so that the other slabs stop waiting for
+    // it. Returns false if the exchange was already aborted.
+    bool abort();
+private:
+    typedef struct HaloCopy {
+        int slab; // That the layers are copied from
+        int sourceLayer;
+        int destinationLayer;
+        int layers;
+    } HaloCopy;
+    std::vector<HaloCopy> getHaloCopies(int slab) const;
+    void wait();
+    std::vector<int> starts, ends, brickStarts, brickSizes;
+    std::vector<Image3D> images;
+    std::vector<Buffer> buffers;
+    int interval;
+    int waiting;
+    int generation;
+    bool aborted;
+    Mutex mutex;
+    Condition condition;
+};
+
 Image3D runGVF(OpenCL &ocl, Image3D * vectorField, paramList &parameters, SIPL::int3 &size, bool useLessMemory);
 
 Image3D runFMGGVF(OpenCL &ocl, Image3D *vectorField, paramList &parameters, SIPL::int3 &size);
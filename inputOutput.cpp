@@ -1,48 +1,278 @@
 #include "inputOutput.hpp"
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include "SIPL/Exceptions.hpp"
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
 using namespace SIPL;
 using namespace cl;
 
-template <typename T>
-void writeToRaw(T * voxels, std::string filename, int SIZE_X, int SIZE_Y, int SIZE_Z) {
+std::string trim(std::string str) {
+    const std::string::size_type start = str.find_first_not_of(" \t\r\n");
+    if(start == std::string::npos)
+        return "";
+    const std::string::size_type end = str.find_last_not_of(" \t\r\n");
+    return str.substr(start, end-start+1);
+}
+
+bool readMhdHeader(std::string filename, MhdHeader &header) {
+    header.elementType = "";
+    header.rawFilename = "";
+    header.size = SIPL::int3(0,0,0);
+    header.spacing = SIPL::float3(1,1,1);
+    header.typeFound = false;
+    header.sizeFound = false;
+    header.rawFilenameFound = false;
+    std::ifstream mhdFile(filename.c_str());
+    if(!mhdFile.is_open())
+        return false;
+
+    std::string line;
+    while(std::getline(mhdFile, line)) {
+        const std::string::size_type separator = line.find("=");
+        if(separator == std::string::npos)
+            continue;
+        const std::string key = trim(line.substr(0, separator));
+        const std::string value = trim(line.substr(separator+1));
+        if(key == "ElementType") {
+            header.elementType = value.substr(0, value.find(" "));
+            header.typeFound = true;
+        } else if(key == "ElementDataFile") {
+            header.rawFilename = value.substr(0, value.find(" "));
+            const std::string::size_type pos = filename.rfind('/');
+            if(pos != std::string::npos)
+                header.rawFilename = filename.substr(0, pos+1) + header.rawFilename;
+            header.rawFilenameFound = true;
+        } else if(key == "DimSize") {
+            std::istringstream values(value);
+            values >> header.size.x >> header.size.y >> header.size.z;
+            header.sizeFound = !values.fail();
+        } else if(key == "ElementSpacing") {
+            std::istringstream values(value);
+            values >> header.spacing.x >> header.spacing.y >> header.spacing.z;
+        }
+    }
+    return true;
+}
+
+// Returns the number of bytes written
+static unsigned long long writeToFile(std::string filename, const std::string &header, const char * data, unsigned long long bytes) {
     FILE * file = fopen(filename.c_str(), "wb");
-    fwrite(voxels, sizeof(T), SIZE_X*SIZE_Y*SIZE_Z, file);
-    fclose(file);
-}
-
-void writeDataToDisk(TSFOutput * output, std::string storageDirectory, std::string name) {
-	SIPL::int3 * size = output->getSize();
-	if(output->hasCenterlineVoxels()) {
-		// Create MHD file
-		std::ofstream file;
-		std::string filename = storageDirectory + name + ".centerline.mhd";
-		file.open(filename.c_str());
-		file << "ObjectType = Image\n";
-		file << "NDims = 3\n";
-		file << "DimSize = " << output->getSize()->x << " " << output->getSize()->y << " " << output->getSize()->z << "\n";
-		file << "ElementSpacing = " << output->getSpacing().x << " " << output->getSpacing().y << " " << output->getSpacing().z << "\n";
-		file << "ElementType = MET_CHAR\n";
-		file << "ElementDataFile = " << name << ".centerline.raw\n";
-		file.close();
-		writeToRaw<char>(output->getCenterlineVoxels(), storageDirectory + name + ".centerline.raw", size->x, size->y, size->z);
-	}
+    if(file == NULL)
+        throw SIPL::IOException(filename.c_str(), __LINE__, __FILE__);
+    // A full disk is only reported by a short write, or when the file is closed
+    const bool written = fwrite(header.data(), 1, header.size(), file) == header.size() &&
+        fwrite(data, 1, bytes, file) == bytes;
+    if(fclose(file) != 0 || !written)
+        throw SIPL::IOException(filename.c_str(), __LINE__, __FILE__);
+    return header.size() + bytes;
+}
+
+std::vector<unsigned char> packBits(const char * mask, unsigned int voxels) {
+    std::vector<unsigned char> bits((voxels + 7) / 8, 0);
+#pragma omp parallel for
+    for(int i = 0; i < (int)bits.size(); i++) {
+        unsigned char byte = 0;
+        for(unsigned int j = 0; j < 8 && i*8+j < voxels; j++) {
+            if(mask[i*8+j] != 0)
+                byte |= 1 << j;
+        }
+        bits[i] = byte;
+    }
+    return bits;
+}
+
+void unpackBits(const std::vector<unsigned char> &bits, char * mask, unsigned int voxels) {
+#pragma omp parallel for
+    for(int i = 0; i < (int)voxels; i++) {
+        mask[i] = (bits[i/8] >> (i%8)) & 1;
+    }
+}
+
+std::vector<unsigned int> encodeRunLengths(const char * mask, unsigned int voxels) {
+    std::vector<unsigned int> runs;
+    bool value = false;
+    unsigned int length = 0;
+    for(unsigned int i = 0; i < voxels; i++) {
+        if((mask[i] != 0) != value) {
+            runs.push_back(length);
+            value = !value;
+            length = 0;
+        }
+        length++;
+    }
+    runs.push_back(length);
+    return runs;
+}
+
+void decodeRunLengths(const std::vector<unsigned int> &runs, char * mask, unsigned int voxels) {
+    unsigned int position = 0;
+    for(unsigned int i = 0; i < runs.size() && position < voxels; i++) {
+        const unsigned int length = std::min(runs[i], voxels - position);
+        memset(mask + position, i % 2, length);
+        position += length;
+    }
+}
+
+#ifdef USE_ZLIB
+std::string compressZlib(const char * data, unsigned long long bytes) {
+    // Each chunk is compressed to raw deflate data that ends on a byte
+    // boundary (a sync flush), so that the chunks can be concatenated. Only
+    // the last chunk ends the stream.
+    const unsigned long long chunkSize = 4*1024*1024;
+    const int chunks = std::max(1ULL, (bytes + chunkSize - 1) / chunkSize);
+    std::vector<std::string> compressed(chunks);
+    std::vector<uLong> checksums(chunks);
+    int failures = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:failures)
+    for(int i = 0; i < chunks; i++) {
+        const unsigned long long start = i*chunkSize;
+        const uInt length = std::min(chunkSize, bytes - start);
+        checksums[i] = adler32(adler32(0L, Z_NULL, 0), (const Bytef *)(data + start), length);
+        z_stream stream;
+        memset(&stream, 0, sizeof(z_stream));
+        if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            failures++;
+            continue;
+        }
+        // The bound is for a finished stream, a sync flush adds a few bytes more
+        std::vector<Bytef> buffer(deflateBound(&stream, length) + 16);
+        stream.next_in = (Bytef *)(data + start);
+        stream.avail_in = length;
+        stream.next_out = &buffer[0];
+        stream.avail_out = buffer.size();
+        if(i == chunks-1) {
+            if(deflate(&stream, Z_FINISH) != Z_STREAM_END)
+                failures++;
+        } else if(deflate(&stream, Z_SYNC_FLUSH) != Z_OK || stream.avail_in > 0 || stream.avail_out == 0) {
+            failures++;
+        }
+        compressed[i].assign((const char *)&buffer[0], buffer.size() - stream.avail_out);
+        deflateEnd(&stream);
+    }
+    if(failures > 0)
+        throw SIPL::SIPLException("Compression with zlib failed", __LINE__, __FILE__);
+
+    // zlib header for a 32K window and the default compression level
+    std::string result;
+    result += (char)0x78;
+    result += (char)0x9C;
+    uLong checksum = checksums[0];
+    for(int i = 0; i < chunks; i++) {
+        result += compressed[i];
+        if(i > 0)
+            checksum = adler32_combine(checksum, checksums[i], std::min(chunkSize, bytes - i*chunkSize));
+    }
+    for(int i = 3; i >= 0; i--)
+        result += (char)((checksum >> (8*i)) & 0xFF);
+    return result;
+}
+#endif
+
+// Writes name.mhd and the data, compressed to name.zraw or uncompressed to name.raw
+static unsigned long long writeMetaImage(TSFOutput * output, std::string storageDirectory, std::string name, std::string elementType, const char * data, unsigned long long bytes, bool compress) {
+    std::string dataFilename = name + ".raw";
+    unsigned long long written;
+    long long compressedSize = -1;
+#ifdef USE_ZLIB
+    if(compress) {
+        std::string compressed = compressZlib(data, bytes);
+        dataFilename = name + ".zraw";
+        written = writeToFile(storageDirectory + dataFilename, "", compressed.data(), compressed.size());
+        compressedSize = compressed.size();
+    } else {
+        written = writeToFile(storageDirectory + dataFilename, "", data, bytes);
+    }
+#else
+    written = writeToFile(storageDirectory + dataFilename, "", data, bytes);
+#endif
+
+    std::ofstream file;
+    std::string filename = storageDirectory + name + ".mhd";
+    file.open(filename.c_str());
+    file << "ObjectType = Image\n";
+    file << "NDims = 3\n";
+    file << "DimSize = " << output->getSize()->x << " " << output->getSize()->y << " " << output->getSize()->z << "\n";
+    file << "ElementSpacing = " << output->getSpacing().x << " " << output->getSpacing().y << " " << output->getSpacing().z << "\n";
+    file << "ElementType = " << elementType << "\n";
+    if(compressedSize >= 0) {
+        file << "CompressedData = True\n";
+        file << "CompressedDataSize = " << compressedSize << "\n";
+    }
+    // Has to be the last field
+    file << "ElementDataFile = " << dataFilename << "\n";
+    file.close();
+    return written;
+}
 
-	if(output->hasSegmentation()) {
-		// Create MHD file
-		std::ofstream file;
-		std::string filename = storageDirectory + name + ".segmentation.mhd";
-		file.open(filename.c_str());
-		file << "ObjectType = Image\n";
-		file << "NDims = 3\n";
-		file << "DimSize = " << output->getSize()->x << " " << output->getSize()->y << " " << output->getSize()->z << "\n";
-		file << "ElementSpacing = " << output->getSpacing().x << " " << output->getSpacing().y << " " << output->getSpacing().z << "\n";
-		file << "ElementType = MET_CHAR\n";
-		file << "ElementDataFile = " << name << ".segmentation.raw\n";
-		file.close();
-
-		writeToRaw<char>(output->getSegmentation(), storageDirectory + name + ".segmentation.raw", size->x, size->y, size->z);
+static unsigned long long writeMask(TSFOutput * output, std::string storageDirectory, std::string name, const char * mask, std::string format, bool compress) {
+    SIPL::int3 * size = output->getSize();
+    const unsigned int voxels = size->x*size->y*size->z;
+    if(format == "raw")
+        return writeMetaImage(output, storageDirectory, name, "MET_CHAR", mask, voxels, compress);
+
+    std::ostringstream header;
+    header << (format == "bitpacked" ? "TSF-BIT-MASK " : "TSF-RLE-MASK ") << size->x << " " << size->y << " " << size->z << " " <<
+        output->getSpacing().x << " " << output->getSpacing().y << " " << output->getSpacing().z << "\n";
+    if(format == "bitpacked") {
+        std::vector<unsigned char> bits = packBits(mask, voxels);
+        return writeToFile(storageDirectory + name + ".bits", header.str(), (const char *)&bits[0], bits.size());
+    } else {
+        std::vector<unsigned int> runs = encodeRunLengths(mask, voxels);
+        std::vector<unsigned char> data(runs.size()*4);
+        for(unsigned int i = 0; i < runs.size(); i++) {
+            for(int j = 0; j < 4; j++)
+                data[i*4+j] = (runs[i] >> (8*j)) & 0xFF;
+        }
+        return writeToFile(storageDirectory + name + ".rle", header.str(), (const char *)&data[0], data.size());
+    }
+}
+
+// Writes a float volume as float, or scaled to 16 bit unsigned integers
+static unsigned long long writeFloatVolume(TSFOutput * output, std::string storageDirectory, std::string name, const float * volume, float scale, bool is16bit, bool compress) {
+    SIPL::int3 * size = output->getSize();
+    const int voxels = size->x*size->y*size->z;
+    if(!is16bit)
+        return writeMetaImage(output, storageDirectory, name, "MET_FLOAT", (const char *)volume, (unsigned long long)voxels*sizeof(float), compress);
+
+    unsigned short * data = new unsigned short[voxels];
+#pragma omp parallel for
+    for(int i = 0; i < voxels; i++) {
+        data[i] = (unsigned short)std::min(65535.0f, std::max(0.0f, volume[i]*scale + 0.5f));
+    }
+    unsigned long long written = writeMetaImage(output, storageDirectory, name, "MET_USHORT", (const char *)data, (unsigned long long)voxels*sizeof(unsigned short), compress);
+    delete[] data;
+    return written;
+}
+
+void writeDataToDisk(TSFOutput * output, std::string storageDirectory, std::string name, const paramList &parameters) {
+	TSFProfiler * profiler = output->getProfiler();
+	profiler->start("write");
+	const std::string maskFormat = getParamStr(parameters, "storage-mask-format");
+	const std::string TDFFormat = getParamStr(parameters, "storage-tdf-radius");
+	const bool compress = getParamStr(parameters, "storage-compression") == "zlib";
+#ifndef USE_ZLIB
+	if(compress)
+		std::cout << "WARNING: Compression is not available, as the framework was built without zlib. Writing uncompressed data." << std::endl;
+#endif
+	unsigned long long bytes = 0;
+	if(output->hasCenterlineVoxels())
+		bytes += writeMask(output, storageDirectory, name + ".centerline", output->getCenterlineVoxels(), maskFormat, compress);
+	if(output->hasSegmentation())
+		bytes += writeMask(output, storageDirectory, name + ".segmentation", output->getSegmentation(), maskFormat, compress);
+	if(TDFFormat != "off") {
+		// The TDF is in [0,1], the radius is stored in hundredths of a voxel
+		if(output->hasTDF())
+			bytes += writeFloatVolume(output, storageDirectory, name + ".TDF", output->getTDF(), 65535.0f, TDFFormat == "16bit", compress);
+		if(output->hasRadius())
+			bytes += writeFloatVolume(output, storageDirectory, name + ".radius", output->getRadius(), 100.0f, TDFFormat == "16bit", compress);
 	}
+	profiler->addBytesTransferred("write", bytes);
+	profiler->stop("write");
 }
 
 void writeToVtkFile(paramList &parameters, std::vector<int3> vertices, std::vector<SIPL::int2> edges) {
@@ -70,47 +300,115 @@ TSFOutput::TSFOutput(oul::DeviceCriteria criteria, SIPL::int3 * size, bool TDFis
     std::vector<cl::Device> validDevices = manager->getDevicesForBestPlatform(
                             criteria, platformDevices);
 
-    this->context = new oul::Context(validDevices,false,false);//TODO:, false, getParamBool(parameters, "timing"));
+    init(new oul::Context(validDevices,false,false), size, TDFis16bit);//TODO:, false, getParamBool(parameters, "timing"));
+}
+
+TSFOutput::TSFOutput(oul::Context * context, SIPL::int3 * size, bool TDFis16bit) {
+	init(context, size, TDFis16bit);
+}
+
+TSFOutput::TSFOutput(SIPL::int3 * size) {
+	this->context = NULL;
+	this->ocl = NULL;
+	this->profiler = new TSFProfiler();
+	this->TDFis16bit = false;
+	this->size = size;
+	hostHasCenterlineVoxels = false;
+	hostHasSegmentation = false;
+	hostHasTDF = false;
+	hostHasRadius = false;
+	deviceHasCenterlineVoxels = false;
+	deviceHasSegmentation = false;
+	deviceHasTDF = false;
+	deviceHasRadius = false;
+	backgroundTransfers = false;
+	TDFTransfer = NULL;
+	radiusTransfer = NULL;
+	segmentationTransfer = NULL;
+	centerlineVoxelsTransfer = NULL;
+}
+
+void TSFOutput::init(oul::Context * context, SIPL::int3 * size, bool TDFis16bit) {
+	this->context = context;
 	this->TDFis16bit = TDFis16bit;
     OpenCL * ocl = new OpenCL;
     ocl->context = context->getContext();
 	ocl->platform = context->getPlatform();
 	ocl->queue = context->getQueue(0);
 	ocl->device = context->getDevice(0);
+	this->profiler = new TSFProfiler();
+	ocl->profiler = profiler;
+	ocl->pool = NULL;
+	ocl->haloExchange = NULL;
 	this->ocl = ocl;
 	this->size = size;
 	hostHasCenterlineVoxels = false;
 	hostHasSegmentation = false;
 	hostHasTDF = false;
+	hostHasRadius = false;
 	deviceHasCenterlineVoxels = false;
 	deviceHasSegmentation = false;
 	deviceHasTDF = false;
+	deviceHasRadius = false;
+	backgroundTransfers = false;
+	TDFTransfer = NULL;
+	radiusTransfer = NULL;
+	segmentationTransfer = NULL;
+	centerlineVoxelsTransfer = NULL;
 }
 
 oul::Context * TSFOutput::getContext() {
     return this->context;
 }
 
+TSFProfiler * TSFOutput::getProfiler() {
+    return this->profiler;
+}
+
+void TSFOutput::enableBackgroundTransfers(cl::CommandQueue transferQueue) {
+	if(ocl == NULL)
+		return;
+	ocl->transferQueue = transferQueue;
+	backgroundTransfers = true;
+}
+
+void TSFOutput::setQueue(cl::CommandQueue queue) {
+	if(ocl == NULL)
+		return;
+	ocl->queue = queue;
+}
+
 TSFOutput::~TSFOutput() {
 	if(hostHasTDF)
 		delete[] TDF;
+	if(hostHasRadius)
+		delete[] radius;
 	if(hostHasSegmentation)
 		delete[] segmentation;
 	if(hostHasCenterlineVoxels)
 		delete[] centerlineVoxels;
 	if(deviceHasTDF)
 		delete oclTDF;
+	if(deviceHasRadius)
+		delete oclRadius;
 	if(deviceHasSegmentation)
 		delete oclSegmentation;
 	if(deviceHasCenterlineVoxels)
 		delete oclCenterlineVoxels;
+	delete TDFTransfer;
+	delete radiusTransfer;
+	delete segmentationTransfer;
+	delete centerlineVoxelsTransfer;
 	delete ocl;
+	delete profiler;
 	delete size;
 }
 
 void TSFOutput::setTDF(Image3D * image) {
 	deviceHasTDF = true;
 	oclTDF = image;
+	if(backgroundTransfers && TDFTransfer == NULL)
+		TDFTransfer = new AsyncImageRead(*ocl, *image, *size);
 }
 
 void TSFOutput::setTDF(float * data) {
@@ -118,9 +416,23 @@ void TSFOutput::setTDF(float * data) {
 	TDF = data;
 }
 
+void TSFOutput::setRadius(Image3D * image) {
+	deviceHasRadius = true;
+	oclRadius = image;
+	if(backgroundTransfers && radiusTransfer == NULL)
+		radiusTransfer = new AsyncImageRead(*ocl, *image, *size);
+}
+
+void TSFOutput::setRadius(float * data) {
+	hostHasRadius = true;
+	radius = data;
+}
+
 void TSFOutput::setSegmentation(Image3D * image) {
 	deviceHasSegmentation = true;
 	oclSegmentation = image;
+	if(backgroundTransfers && segmentationTransfer == NULL)
+		segmentationTransfer = new AsyncImageRead(*ocl, *image, *size);
 }
 
 void TSFOutput::setSegmentation(char * data) {
@@ -131,6 +443,8 @@ void TSFOutput::setSegmentation(char * data) {
 void TSFOutput::setCenterlineVoxels(Image3D * image) {
 	deviceHasCenterlineVoxels = true;
 	oclCenterlineVoxels = image;
+	if(backgroundTransfers && centerlineVoxelsTransfer == NULL)
+		centerlineVoxelsTransfer = new AsyncImageRead(*ocl, *image, *size);
 }
 
 void TSFOutput::setCenterlineVoxels(char * data) {
@@ -146,27 +460,22 @@ float * TSFOutput::getTDF() {
 	if(hostHasTDF) {
 		return TDF;
 	} else if(deviceHasTDF) {
-		// Transfer data from device to host
-		cl::size_t<3> origin;
-		origin[0] = 0;
-		origin[1] = 0;
-		origin[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size->x;
-		region[1] = size->y;
-		region[2] = size->z;
+		// Transfer data from device to host, unless it was started when the TDF was set
+		if(TDFTransfer == NULL)
+			TDFTransfer = new AsyncImageRead(*ocl, *oclTDF, *size);
 		int totalSize = size->x*size->y*size->z;
 		TDF = new float[totalSize];
 		if(TDFis16bit) {
-			unsigned short * tempTDF = new unsigned short[totalSize];
-			ocl->queue.enqueueReadImage(*oclTDF,CL_TRUE, origin, region, 0, 0, tempTDF);
+			unsigned short * tempTDF = (unsigned short *)TDFTransfer->getData();
+#pragma omp parallel for
 			for(int i = 0; i < totalSize;i++) {
 				TDF[i] = (float)tempTDF[i] / 65535.0f;
 			}
-			delete[] tempTDF;
 		} else {
-			ocl->queue.enqueueReadImage(*oclTDF,CL_TRUE, origin, region, 0, 0, TDF);
+			TDFTransfer->copyTo(TDF);
 		}
+		delete TDFTransfer;
+		TDFTransfer = NULL;
 		hostHasTDF = true;
 		return TDF;
 	} else {
@@ -174,21 +483,35 @@ float * TSFOutput::getTDF() {
 	}
 }
 
+float * TSFOutput::getRadius() {
+	if(hostHasRadius) {
+		return radius;
+	} else if(deviceHasRadius) {
+		// Transfer data from device to host, unless it was started when the radius was set
+		if(radiusTransfer == NULL)
+			radiusTransfer = new AsyncImageRead(*ocl, *oclRadius, *size);
+		radius = new float[size->x*size->y*size->z];
+		radiusTransfer->copyTo(radius);
+		delete radiusTransfer;
+		radiusTransfer = NULL;
+		hostHasRadius = true;
+		return radius;
+	} else {
+		throw SIPL::SIPLException("Trying to fetch non existing data from TSFOutput", __LINE__, __FILE__);
+	}
+}
+
 char * TSFOutput::getSegmentation() {
 	if(hostHasSegmentation) {
 		return segmentation;
 	} else if(deviceHasSegmentation) {
-		// Transfer data from device to host
-		cl::size_t<3> origin;
-		origin[0] = 0;
-		origin[1] = 0;
-		origin[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size->x;
-		region[1] = size->y;
-		region[2] = size->z;
+		// Transfer data from device to host, unless it was started when the segmentation was set
+		if(segmentationTransfer == NULL)
+			segmentationTransfer = new AsyncImageRead(*ocl, *oclSegmentation, *size);
 		segmentation = new char[size->x*size->y*size->z];
-		ocl->queue.enqueueReadImage(*oclSegmentation,CL_TRUE, origin, region, 0, 0, segmentation);
+		segmentationTransfer->copyTo(segmentation);
+		delete segmentationTransfer;
+		segmentationTransfer = NULL;
 		hostHasSegmentation = true;
 		return segmentation;
 	} else {
@@ -200,17 +523,13 @@ char * TSFOutput::getCenterlineVoxels() {
 	if(hostHasCenterlineVoxels) {
 		return centerlineVoxels;
 	} else if(deviceHasCenterlineVoxels) {
-		// Transfer data from device to host
-		cl::size_t<3> origin;
-		origin[0] = 0;
-		origin[1] = 0;
-		origin[2] = 0;
-		cl::size_t<3> region;
-		region[0] = size->x;
-		region[1] = size->y;
-		region[2] = size->z;
+		// Transfer data from device to host, unless it was started when the centerline was set
+		if(centerlineVoxelsTransfer == NULL)
+			centerlineVoxelsTransfer = new AsyncImageRead(*ocl, *oclCenterlineVoxels, *size);
 		centerlineVoxels = new char[size->x*size->y*size->z];
-		ocl->queue.enqueueReadImage(*oclCenterlineVoxels,CL_TRUE, origin, region, 0, 0, centerlineVoxels);
+		centerlineVoxelsTransfer->copyTo(centerlineVoxels);
+		delete centerlineVoxelsTransfer;
+		centerlineVoxelsTransfer = NULL;
 		hostHasCenterlineVoxels = true;
 		return centerlineVoxels;
 	} else {
@@ -5,24 +5,33 @@
 #include <vector>
 #include "parameters.hpp"
 #include "commons.hpp"
+#include "transfer.hpp"
 using namespace SIPL;
 
 class TSFOutput {
 public:
 	TSFOutput(oul::DeviceCriteria criteria, SIPL::int3 * size, bool TDFis16bit = false);
+	TSFOutput(oul::Context * context, SIPL::int3 * size, bool TDFis16bit = false);
+	// Output with host data only, used by the native backend
+	TSFOutput(SIPL::int3 * size);
 	bool hasSegmentation() { return deviceHasSegmentation || hostHasSegmentation; };
 	bool hasCenterlineVoxels() { return deviceHasCenterlineVoxels || hostHasCenterlineVoxels; };
 	bool hasTDF() { return deviceHasTDF || hostHasTDF; };
+	// The radius is only kept if storage-tdf-radius is set
+	bool hasRadius() { return deviceHasRadius || hostHasRadius; };
 	void setTDF(cl::Image3D *);
 	void setSegmentation(cl::Image3D *);
 	void setCenterlineVoxels(cl::Image3D *);
 	void setTDF(float *);
+	void setRadius(cl::Image3D *);
+	void setRadius(float *);
 	void setSegmentation(char *);
 	void setCenterlineVoxels(char *);
 	void setSize(SIPL::int3 *);
 	char * getSegmentation();
 	char * getCenterlineVoxels();
 	float * getTDF();
+	float * getRadius();
 	SIPL::int3 * getSize();
 	~TSFOutput();
 	SIPL::int3 getShiftVector() const;
@@ -30,11 +39,20 @@ public:
 	SIPL::float3 getSpacing() const;
 	void setSpacing(SIPL::float3 spacing);
 	oul::Context *getContext();
+	// Runtime of each stage, recorded when the timing parameter is set
+	TSFProfiler *getProfiler();
+	// Start reading results on the device to the host as soon as they are
+	// set, on the given queue, so that the reads overlap with later stages
+	void enableBackgroundTransfers(cl::CommandQueue transferQueue);
+	// Queue that the results are written by, and read to the host with
+	void setQueue(cl::CommandQueue queue);
 private:
+	void init(oul::Context * context, SIPL::int3 * size, bool TDFis16bit);
 	oul::Context *context;
 	cl::Image3D* oclCenterlineVoxels;
 	cl::Image3D* oclSegmentation;
 	cl::Image3D* oclTDF;
+	cl::Image3D* oclRadius;
 	SIPL::int3* size;
 	SIPL::float3 spacing;
 	SIPL::int3 shiftVector;
@@ -43,16 +61,64 @@ private:
 	bool hostHasCenterlineVoxels;
 	bool hostHasTDF;
 	bool deviceHasTDF;
+	bool hostHasRadius;
+	bool deviceHasRadius;
 	bool deviceHasCenterlineVoxels;
 	bool deviceHasSegmentation;
 	char* segmentation;
 	char* centerlineVoxels;
 	float* TDF;
+	float* radius;
 	OpenCL* ocl;
+	TSFProfiler* profiler;
+	bool backgroundTransfers;
+	AsyncImageRead* TDFTransfer;
+	AsyncImageRead* radiusTransfer;
+	AsyncImageRead* segmentationTransfer;
+	AsyncImageRead* centerlineVoxelsTransfer;
 };
 
 void writeToVtkFile(paramList &parameters, std::vector<int3> vertices, std::vector<SIPL::int2> edges);
 
-void writeDataToDisk(TSFOutput * output, std::string storageDirectory, std::string name);
+// Removes spaces, tabs and line endings at both ends
+std::string trim(std::string str);
+
+typedef struct MhdHeader {
+    std::string elementType; // e.g. MET_SHORT
+    std::string rawFilename; // Relative to the working directory
+    SIPL::int3 size;
+    SIPL::float3 spacing; // 1 if not given
+    bool typeFound;
+    bool sizeFound;
+    bool rawFilenameFound;
+} MhdHeader;
+
+/*
+ * Reads the keys of a MetaImage (.mhd) header that the pipeline uses. The raw
+ * filename is given the directory of the header. Returns false if the header
+ * can not be opened.
+ */
+bool readMhdHeader(std::string filename, MhdHeader &header);
+
+/*
+ * Writes the centerline and the segmentation, and the TDF and the radius if
+ * storage-tdf-radius is set. MetaImage data is compressed with zlib if
+ * storage-compression is set. The masks can instead be written bit-packed
+ * (.bits) or run-length encoded (.rle), see storage-mask-format. Both start
+ * with a text line with the format, the size and the spacing, e.g.
+ * "TSF-BIT-MASK 512 512 800 0.5 0.5 0.8". The bits are stored with the first voxel in the lowest bit, and the
+ * run lengths as 32 bit little endian integers, alternating between runs of
+ * zeros and ones, starting with zeros.
+ */
+void writeDataToDisk(TSFOutput * output, std::string storageDirectory, std::string name, const paramList &parameters);
+
+std::vector<unsigned char> packBits(const char * mask, unsigned int voxels);
+void unpackBits(const std::vector<unsigned char> &bits, char * mask, unsigned int voxels);
+std::vector<unsigned int> encodeRunLengths(const char * mask, unsigned int voxels);
+void decodeRunLengths(const std::vector<unsigned int> &runs, char * mask, unsigned int voxels);
+#ifdef USE_ZLIB
+// A zlib stream of chunks that are compressed in parallel
+std::string compressZlib(const char * data, unsigned long long bytes);
+#endif
 
 #endif
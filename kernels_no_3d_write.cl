@@ -724,191 +724,151 @@ __kernel void createPositions2D(
     vstore2(pos, target, positions);
 }
 
-__kernel void linkLengths(
-        __global int const * restrict positions,
-        __write_only image2d_t lengths
-        ) {
-    const float3 xa = convert_float3(vload3(get_global_id(0), positions));
-    const float3 xb = convert_float3(vload3(get_global_id(1), positions));
-
-    write_imagef(lengths, (int2)(get_global_id(0), get_global_id(1)), (float4)(distance(xa,xb),0.0f,0.0f,0.0f));
-}
-
-__kernel void compact(
-        __read_only image2d_t lengths,
-        volatile __global int * incs,
-        __write_only image2d_t compacted_lengths,
-        __private float maxDistance
-        ) {
-    const int i = get_global_id(0);
-    const int j = get_global_id(1);
-
-    float length = read_imagef(lengths, sampler, (int2)(i,j)).x;
-    if(length < maxDistance && length > 0.0f) {
-        volatile int nr = atomic_inc(&(incs[i]));
-        write_imagef(compacted_lengths, (int2)(i,nr), (float4)(length, j, 0, 0));
-    }
-}
-
 __kernel void linkCenterpoints(
         __read_only image3d_t TDF,
         __global int const * restrict positions,
-        __write_only image2d_t edges,
-        __read_only image2d_t compacted_lengths,
+        __global int const * restrict neighbourOffsets,
+        __global int const * restrict neighbours,
+        __global float const * restrict neighbourDistances,
+        __global int * bestPairs,
         __private int sum,
         __private float minAvgTDF,
         __private float maxDistance
     ) {
-    int id = get_global_id(0);
+    const int id = get_global_id(0);
     if(id >= sum)
-        id = 0;
+        return;
     float3 xa = convert_float3(vload3(id, positions));
-    //printf("%f %f %f\n",xa.x,xa.y,xa.z);
 
-    int2 bestPair;
+    // The neighbours are the vertices closer than maxDistance
+    const int start = neighbourOffsets[id];
+    const int end = neighbourOffsets[id+1];
+    int2 bestPair = {-1, -1};
     float shortestDistance = maxDistance*2;
-    bool validPairFound = false;
-    for(int i = 0; i < sum; i++) {
-        float2 cl = read_imagef(compacted_lengths, sampler, (int2)(id,i)).xy;
-
-        // reached the end?
-        if(cl.x == 0.0f)
-            break;
-
-    float3 xb = convert_float3(vload3(cl.y, positions));
-    int db = round(cl.x);
-    if(db >= shortestDistance)
-        continue;
-    for(int j = 0; j < i; j++) {
-        float2 cl2  = read_imagef(compacted_lengths, sampler, (int2)(id,j)).xy;
-        if(cl2.y == cl.y) 
+    for(int i = start; i < end; i++) {
+        const int b = neighbours[i];
+        float3 xb = convert_float3(vload3(b, positions));
+        int db = round(neighbourDistances[i]);
+        if(db >= shortestDistance)
             continue;
+        for(int j = start; j < i; j++) {
+            const int c = neighbours[j];
+            float3 xc = convert_float3(vload3(c, positions));
+            int dc = round(neighbourDistances[j]);
+
+            if(db+dc < shortestDistance) {
+                // Check angle
+                float3 ab = (xb-xa);
+                float3 ac = (xc-xa);
+                float angle = acos(dot(normalize(ab), normalize(ac)));
+                if(angle < 2.0f) // 120 degrees
+                    continue;
+
+                // Check avg TDF for a-b
+                float avgTDF = 0.0f;
+                for(int k = 0; k <= db; k++) {
+                    float alpha = (float)k/db;
+                    float3 p = xa+ab*alpha;
+                    float t = read_imagef(TDF, interpolationSampler, p.xyzz).x;
+                    avgTDF += t;
+                }
+                avgTDF /= db+1;
+                if(avgTDF < minAvgTDF)
+                    continue;
+
+                avgTDF = 0.0f;
+
+                // Check avg TDF for a-c
+                for(int k = 0; k <= dc; k++) {
+                    float alpha = (float)k/dc;
+                    float3 p = xa+ac*alpha;
+                    float t = read_imagef(TDF, interpolationSampler, p.xyzz).x;
+                    avgTDF += t;
+                }
+                avgTDF /= dc+1;
 
-        // reached the end?
-        if(cl2.x == 0.0f)
-            break;
-    float3 xc = convert_float3(vload3(cl2.y, positions));
-
-    // Check distance between xa and xb
-    int dc = round(cl2.x);
-
-    float minTDF = 0.0f;
-    float maxVarTDF = 1.005f;
-    float maxIntensity = 1.3f;
-    float maxAvgIntensity = 1.2f;
-    float maxVarIntensity = 1.005f;
-
-    if(db+dc < shortestDistance) {
-        // Check angle
-        float3 ab = (xb-xa);
-        float3 ac = (xc-xa);
-        float angle = acos(dot(normalize(ab), normalize(ac)));
-        if(angle < 2.0f) // 120 degrees
-            continue;
-        // Check TDF
-        float avgTDF = 0.0f;
-        float avgIntensity = 0.0f;
-        for(int k = 0; k <= db; k++) {
-            float alpha = (float)k/db;
-float3 p = xa+ab*alpha;
-            float t = read_imagef(TDF, interpolationSampler, p.xyzz).x; 
-            avgTDF += t;
-        }
-        avgTDF /= db+1;
-        if(avgTDF < minAvgTDF)
-            continue;
+                if(avgTDF < minAvgTDF)
+                    continue;
 
-/*
-        float varTDF = 0.0f;
-        for(int k = 0; k <= db; k++) {
-            float alpha = (float)k/db;
-float3 p = xa+ab*alpha;
-            float t = read_imagef(TDF, interpolationSampler, p.xyzz).x; 
-            float i = read_imagef(intensity, interpolationSampler, p.xyzz).x; 
-            varIntensity += (i-avgIntensity)*(i-avgIntensity);
-            varTDF += (t-avgTDF)*(t-avgTDF);
-            if(i > maxIntensity || t < minTDF) {
-                invalid = true;
-                break;
+                bestPair.x = b;
+                bestPair.y = c;
+                shortestDistance = db+dc;
             }
         }
-        if(invalid)
-            continue;
-
-        if(db > 4 && varTDF / (db+1) > maxVarTDF)
-            continue;
-            */
-
-        avgTDF = 0.0f;
-        for(int k = 0; k <= dc; k++) {
-            float alpha = (float)k/dc;
-            float3 p = xa+ac*alpha;
-            float t = read_imagef(TDF, interpolationSampler, p.xyzz).x; 
-            avgTDF += t;
-        }
-        avgTDF /= dc+1;
-
-        if(avgTDF < minAvgTDF)
-            continue;
+    }
 
-    /*
-        for(int k = 0; k <= dc; k++) {
-            float alpha = (float)k/dc;
-float3 p = xa+ac*alpha;
-            float t = read_imagef(TDF, interpolationSampler, p.xyzz).x; 
-            varTDF += (t-avgTDF)*(t-avgTDF);
-        }
+    vstore2(bestPair, id, bestPairs);
+}
 
-        if(dc > 4 && varIntensity / (dc+1) > maxVarIntensity)
-            continue;
-        if(dc > 4 && varTDF / (dc+1) > maxVarTDF)
-            continue;
-            */
+__kernel void compactEdges(
+        __global int const * restrict bestPairs,
+        __global int * edges,
+        volatile __global int * counter,
+        __private int sum
+    ) {
+    const int id = get_global_id(0);
+    if(id >= sum)
+        return;
+    const int2 pair = vload2(id, bestPairs);
+    if(pair.x < 0)
+        return;
 
-        validPairFound = true;
-        bestPair.x = cl.y;
-        bestPair.y = cl2.y;
-        shortestDistance = db+dc;
+    // If both vertices selected the edge, it is stored by the one with the smallest index
+    const int2 pairB = vload2(pair.x, bestPairs);
+    if(!(pair.x < id && (pairB.x == id || pairB.y == id))) {
+        const int nr = atomic_inc(counter);
+        vstore2((int2)(id, pair.x), nr, edges);
+    }
+    const int2 pairC = vload2(pair.y, bestPairs);
+    if(!(pair.y < id && (pairC.x == id || pairC.y == id))) {
+        const int nr = atomic_inc(counter);
+        vstore2((int2)(id, pair.y), nr, edges);
     }
-    }}
-
-    if(validPairFound) {
-        // Store edges
-        int2 edge = {id, bestPair.x};
-        int2 edge2 = {id, bestPair.y};
-        write_imageui(edges, edge, (uint4)(1,0,0,0));
-        write_imageui(edges, edge2, (uint4)(1,0,0,0));
+}
+
+// Follows the parent pointers in C to the root of the tree of vertex i
+int findComponentRoot(volatile __global int * C, int i) {
+    int parent = C[i];
+    while(parent != i) {
+        i = parent;
+        parent = C[i];
     }
+    return i;
 }
 
-__kernel void graphComponentLabeling(
+// Union-find hooking. The root with the largest index of the two trees of an
+// edge is hooked to the other root. As a parent always has a smaller index
+// than its child, C stays a forest when several edges hook the same root.
+__kernel void graphComponentHooking(
         __global int const * restrict edges,
         volatile __global int * C,
         __global int * m,
         __private int sum
         ) {
-    int id = get_global_id(0);
+    const int id = get_global_id(0);
     if(id >= sum)
-        id = 0;
+        return;
     int2 edge = vload2(id, edges);
-    const int ca = C[edge.x];
-    const int cb = C[edge.y];
+    const int ra = findComponentRoot(C, edge.x);
+    const int rb = findComponentRoot(C, edge.y);
 
-    // Find the smallest C value and store in C in the others
-    if(ca == cb) {
-        return;
-    } else {
-        if(ca < cb) {
-            // ca is smallest
-            atomic_min(&C[edge.y], ca);
-        } else {
-            // cb is smallest
-            atomic_min(&C[edge.x], cb);
-        }
+    if(ra != rb) {
+        atomic_min(&C[max(ra, rb)], min(ra, rb));
         m[0] = 1; // register change
     }
 }
 
+// Pointer jumping: let each vertex point to the root of its tree
+__kernel void graphComponentPointerJumping(
+        volatile __global int * C,
+        __private int sum
+        ) {
+    const int id = get_global_id(0);
+    if(id >= sum)
+        return;
+    C[id] = findComponentRoot(C, id);
+}
+
 __kernel void calculateTreeLength(
         __global int const * restrict C,
         volatile __global int * S
@@ -944,44 +904,18 @@ __kernel void removeSmallTrees(
     }
 }
 
-__kernel void removeDuplicateEdges(
-		__read_only image2d_t edgeTuples,
-		__write_only image2d_t edgeTuples2
-	) {
-	const int2 pos = {get_global_id(0), get_global_id(1)};
-	if(read_imageui(edgeTuples, sampler, pos).x == 0) {
-		write_imageui(edgeTuples2,pos, (uint4)(0,0,0,0));
-	} else if(pos.x > pos.y) {
-		// Check if opposite is an edge
-		if(read_imageui(edgeTuples, sampler, (int2)(pos.y,pos.x)).x == 1) {
-			// opposite exists => remove this one
-			write_imageui(edgeTuples2,pos, (uint4)(0,0,0,0));
-		} else {
-			// opposite doesn't exist => save this one
-			write_imageui(edgeTuples2,pos, (uint4)(1,0,0,0));
-		}
-	} else {
-		write_imageui(edgeTuples2,pos, (uint4)(1,0,0,0));
-	}
-}
-
 #define SQR_MAG(pos) read_imagef(vectorField, sampler, pos).w
 
-__kernel void dd(
+// Finds the centerpoint candidate with the largest TDF in a cube. Returns
+// false if the cube has no candidates.
+bool findBestCenterpoint(
     __read_only image3d_t TDF,
     __read_only image3d_t centerpointCandidates,
-    __global uchar * centerpoints,
-    __private int cubeSize
+    const int4 readPos,
+    const int cubeSize,
+    int4 * bestPos
     ) {
-
-    int4 bestPos;
     float bestTDF = 0.0f;
-    int4 readPos = {
-        get_global_id(0)*cubeSize,
-        get_global_id(1)*cubeSize,
-        get_global_id(2)*cubeSize,
-        0
-    };
     bool found = false;
     for(int a = 0; a < cubeSize; a++) {
     for(int b = 0; b < cubeSize; b++) {
@@ -992,10 +926,34 @@ __kernel void dd(
             if(tdf > bestTDF) {
                 found = true;
                 bestTDF = tdf;
-                bestPos = pos;
+                *bestPos = pos;
             }
         }
     }}}
+    return found;
+}
+
+__kernel void dd(
+    __read_only image3d_t TDF,
+    __read_only image3d_t centerpointCandidates,
+    __global uchar * centerpoints,
+    __private int cubeSize
+    ) {
+
+    int4 bestPos;
+    int4 readPos = {
+        get_global_id(0)*cubeSize,
+        get_global_id(1)*cubeSize,
+        get_global_id(2)*cubeSize,
+        0
+    };
+    bool found;
+#ifdef CUBE_SIZE
+    if(cubeSize == CUBE_SIZE)
+        found = findBestCenterpoint(TDF, centerpointCandidates, readPos, CUBE_SIZE, &bestPos);
+    else
+#endif
+        found = findBestCenterpoint(TDF, centerpointCandidates, readPos, cubeSize, &bestPos);
     if(found) {
         centerpoints[bestPos.x+bestPos.y*get_image_width(TDF)+bestPos.z*get_image_width(TDF)*get_image_height(TDF)] = 1;
     }
@@ -1097,47 +1055,110 @@ __kernel void combine(
     }
 }
 
-__kernel void initGrowing(
-	__read_only image3d_t centerline,
-	__global char * initSegmentation,
-	__read_only image3d_t avgRadius
-	) {
-    int4 pos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
-    if(read_imagei(centerline, sampler, pos).x == 1) {
-	
-    	float radius = read_imagef(avgRadius, sampler, pos).x;
-    	int N = min(max(1, (int)round(radius/2.0f)), 4);
-
-        for(int a = -N; a < N+1; a++) {
-        for(int b = -N; b < N+1; b++) {
-        for(int c = -N; c < N+1; c++) {
-            int4 n;
-            n.x = pos.x + a;
-            n.y = pos.y + b;
-            n.z = pos.z + c;
-	    if(read_imagei(centerline, sampler, n).x == 0 &&
-            n.x >= 0 && n.y >= 0 && n.z >= 0 &&
-            n.x < get_global_size(0) && n.y < get_global_size(1) && n.z < get_global_size(2))
-            initSegmentation[LPOS(n)] = 2; 
-        }}}
-	}
+// The segmentation used for growing is a char buffer, which is accessed
+// through 32 bit words so that a voxel can be changed atomically. A voxel is 0
+// (not segmented), 1 (accepted), or 2 or 3 if it is in the frontier of an
+// even or odd round. The bytes of a word are assumed to be little endian.
+#define GROWING_VALUE(segmentation, i) ((segmentation[(i) >> 2] >> (((i) & 3)*8)) & 0xFF)
+
+// Sets voxel i to value if it is 0 or current. Returns true if this call changed it.
+bool claimVoxel(volatile __global uint * segmentation, const int i, const uint current, const uint value) {
+    volatile __global uint * word = &segmentation[i >> 2];
+    const uint shift = (i & 3)*8;
+    uint old = *word;
+    while(true) {
+        const uint v = (old >> shift) & 0xFF;
+        if(v != 0 && v != current)
+            return false;
+        const uint updated = (old & ~(0xFFu << shift)) | (value << shift);
+        const uint previous = atomic_cmpxchg(word, old, updated);
+        if(previous == old)
+            return true;
+        old = previous;
+    }
 }
 
+// Collects all voxels with the given value into a frontier
+__kernel void createGrowingFrontier(
+        __global char const * restrict segmentation,
+        __private int value,
+        __global int * frontier,
+        volatile __global int * frontierSize,
+        __private int capacity
+    ) {
+    const int i = get_global_id(0);
+    if(segmentation[i] == value) {
+        const int nr = atomic_inc(frontierSize);
+        if(nr < capacity)
+            frontier[nr] = i;
+    }
+}
 
+__kernel void initGrowing(
+	__read_only image3d_t avgRadius,
+	volatile __global uint * segmentation,
+	__global int const * restrict centerpoints,
+	__private int nofCenterpoints,
+	__global int * frontier,
+	volatile __global int * frontierSize,
+	__private int capacity,
+	__private int sizeX,
+	__private int sizeY,
+	__private int sizeZ
+	) {
+    const int k = get_global_id(0);
+    if(k >= nofCenterpoints)
+        return;
+    const int i = centerpoints[k];
+    int4 pos = {i % sizeX, (i / sizeX) % sizeY, i / (sizeX*sizeY), 0};
+    float radius = read_imagef(avgRadius, sampler, pos).x;
+    int N = min(max(1, (int)round(radius/2.0f)), 4);
+
+    for(int a = -N; a < N+1; a++) {
+    for(int b = -N; b < N+1; b++) {
+    for(int c = -N; c < N+1; c++) {
+        int4 n;
+        n.x = pos.x + a;
+        n.y = pos.y + b;
+        n.z = pos.z + c;
+        if(n.x < 0 || n.y < 0 || n.z < 0 || n.x >= sizeX || n.y >= sizeY || n.z >= sizeZ)
+            continue;
+        // Add voxels that are not on the centerline to the first frontier
+        const int j = n.x + n.y*sizeX + n.z*sizeX*sizeY;
+        if(claimVoxel(segmentation, j, 0, 2)) {
+            const int nr = atomic_inc(frontierSize);
+            if(nr < capacity)
+                frontier[nr] = j;
+        }
+    }}}
+}
 
+// Processes the voxels in the frontier. The voxels that are added to the
+// next frontier are marked at once, while the voxels in the frontier are
+// only accepted or rejected by updateGrowing, so that all voxels in this
+// round read the same segmentation.
 __kernel void grow(
-	__read_only image3d_t currentSegmentation,
 	__read_only image3d_t gvf,
-	__global char * nextSegmentation,
-	__global int * stop
+	volatile __global uint * segmentation,
+	__global int * frontier,
+	__private int frontierSize,
+	__global int * nextFrontier,
+	volatile __global int * nextFrontierSize,
+	__private int capacity,
+	__private int current,
+	__private int sizeX,
+	__private int sizeY,
+	__private int sizeZ
 	) {
-
-    int4 X = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
-    char value = read_imagei(currentSegmentation, sampler, X).x;
-    // value of 2, means to check it, 1 means it is already accepted
-    if(value == 1) {
-        nextSegmentation[LPOS(X)] = 1;
-    }else if(value == 2){
+    const int k = get_global_id(0);
+    if(k >= frontierSize)
+        return;
+    const int i = frontier[k];
+    // The voxel may have been accepted while it was added to this frontier
+    if(GROWING_VALUE(segmentation, i) == 1)
+        return;
+    const int next = current == 2 ? 3 : 2;
+    int4 X = {i % sizeX, (i / sizeX) % sizeY, i / (sizeX*sizeY), 0};
 	float FNXw = read_imagef(gvf, sampler, X).w;
 
 	bool continueGrowing = false;
@@ -1151,14 +1172,16 @@ __kernel void grow(
 	    Y.x = X.x + a;
 	    Y.y = X.y + b;
 	    Y.z = X.z + c;
-	    
-	    char valueY = read_imagei(currentSegmentation, sampler, Y).x;
-	    if(valueY != 1) {
+	    if(Y.x < 0 || Y.y < 0 || Y.z < 0 || Y.x >= sizeX || Y.y >= sizeY || Y.z >= sizeZ)
+		continue;
+	    const int j = Y.x + Y.y*sizeX + Y.z*sizeX*sizeY;
+
+	    if(GROWING_VALUE(segmentation, j) != 1) {
 		float4 FNY = read_imagef(gvf, sampler, Y);
 		FNY.x /= FNY.w;
 		FNY.y /= FNY.w;
 		FNY.z /= FNY.w;
-	    if(FNY.w > FNXw /*|| FNXw < 0.1f*/) {
+	    if(FNY.w > FNXw) {
 
 		int4 Z;
 		float maxDotProduct = -2.0f;
@@ -1176,7 +1199,7 @@ __kernel void grow(
 		    YZ.y = Zc.y-Y.y;
 		    YZ.z = Zc.z-Y.z;
 		    YZ = normalize(YZ);
-const float v = FNY.x*YZ.x+FNY.y*YZ.y+FNY.z*YZ.z;
+		    const float v = FNY.x*YZ.x+FNY.y*YZ.y+FNY.z*YZ.z;
 		    if(v > maxDotProduct) {
 			maxDotProduct = v;
 			Z = Zc;
@@ -1184,26 +1207,39 @@ const float v = FNY.x*YZ.x+FNY.y*YZ.y+FNY.z*YZ.z;
 		}}}
 
 		if(Z.x == X.x && Z.y == X.y && Z.z == X.z) {
-            nextSegmentation[LPOS(X)] = 1;
-            // Check if in bounds
-            if(Y.x >= 0 && Y.y >= 0 && Y.z >= 0 && 
-                Y.x < get_global_size(0) && Y.y < get_global_size(1) && Y.z < get_global_size(2)) {
-                nextSegmentation[LPOS(Y)] = 2; 
-                continueGrowing = true;
-            }
+		    continueGrowing = true;
+		    if(claimVoxel(segmentation, j, current, next)) {
+			const int nr = atomic_inc(nextFrontierSize);
+			if(nr < capacity)
+			    nextFrontier[nr] = j;
+		    }
 		}
 	    }}
-
 	}}}
 
-	if(continueGrowing) {
-		// Added new items to list (values of 2)
-		stop[0] = 0;
-	} else {
+	if(!continueGrowing) {
 		// X was not accepted
-        nextSegmentation[LPOS(X)] = 0;
+		frontier[k] = -1-i;
 	}
 }
+
+// Accepts or rejects the voxels of a frontier processed by grow
+__kernel void updateGrowing(
+	__global char * segmentation,
+	__global int const * restrict frontier,
+	__private int frontierSize,
+	__private int next
+	) {
+    const int k = get_global_id(0);
+    if(k >= frontierSize)
+        return;
+    const int entry = frontier[k];
+    if(entry >= 0) {
+        segmentation[entry] = 1;
+    } else if(segmentation[-1-entry] != next) {
+        // Rejected voxels stay in the segmentation if they are in the next frontier
+        segmentation[-1-entry] = 0;
+    }
 }
 
 __kernel void sphereSegmentation(
@@ -1439,29 +1475,68 @@ __kernel void toFloat(
     processedVolume[LPOS(pos)] = value;
 }
 
-__kernel void blurVolumeWithGaussian(
-        __read_only image3d_t volume,
+// Mask of a separable Gaussian blur applied at position i of a line, which
+// starts maskSize voxels before the first voxel of the work-group
+float applyBlurMask(__local float * tileLine, __constant float * mask, const int i, const int maskSize) {
+    float sum = 0.0f;
+    for(int a = -maskSize; a < maskSize+1; a++)
+        sum += mask[a+maskSize]*tileLine[i+a+maskSize];
+    return sum;
+}
+
+/*
+ * One pass of the separable Gaussian blur along direction (0: x, 1: y, 2: z).
+ * Each line of the work-group is read once into local memory, including the
+ * borders needed by the mask, and the mask is applied from there.
+ */
+__kernel void blurVolumeWithGaussianPass(
+        __global const float * volume,
         __global float * blurredVolume,
         __private int maskSize,
-        __constant float * mask
+        __constant float * mask,
+        __private int direction,
+        __local float * tile,
+        __private int sizeX,
+        __private int sizeY,
+        __private int sizeZ
     ) {
 
     const int4 pos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
-    // TODO: need to take into account spacing here?
-    
-    // Collect neighbor values and multiply with gaussian
-    float sum = 0.0f;
-    // Calculate the mask size based on sigma (larger sigma, larger mask)
-    for(int a = -maskSize; a < maskSize+1; a++) {
-        for(int b = -maskSize; b < maskSize+1; b++) {
-            for(int c = -maskSize; c < maskSize+1; c++) {
-                sum += mask[a+maskSize+(b+maskSize)*(maskSize*2+1)+(c+maskSize)*(maskSize*2+1)*(maskSize*2+1)]
-                        *read_imagef(volume, sampler, pos + (int4)(a,b,c,0)).x; 
-            }
-        }
+    const int4 localPos = {get_local_id(0), get_local_id(1), get_local_id(2), 0};
+    const int4 localSize = {get_local_size(0), get_local_size(1), get_local_size(2), 0};
+    // The global size is padded to whole work-groups
+    const int4 volumeSize = {sizeX, sizeY, sizeZ, 1};
+    const int4 dir = {direction == 0, direction == 1, direction == 2, 0};
+
+    // Position along the line and index of the line in the work-group
+    const int length = direction == 0 ? localSize.x : (direction == 1 ? localSize.y : localSize.z);
+    const int i = direction == 0 ? localPos.x : (direction == 1 ? localPos.y : localPos.z);
+    const int line = direction == 0 ? localPos.y+localPos.z*localSize.y :
+        (direction == 1 ? localPos.x+localPos.z*localSize.x : localPos.x+localPos.y*localSize.x);
+    const int tileLength = length+2*maskSize;
+    __local float * tileLine = tile + line*tileLength;
+
+    for(int j = i; j < tileLength; j += length) {
+        // Clamp to edge, as the image sampler does
+        const int4 n = clamp(pos + dir*(j-i-maskSize), (int4)(0,0,0,0), volumeSize-1);
+        tileLine[j] = volume[n.x+n.y*sizeX+n.z*sizeX*sizeY];
     }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // With specialize-kernels the mask sizes of the blurs are compile time
+    // constants, so the loop can be unrolled
+    float sum;
+#if defined(BLUR_MASK_SIZE_SMALL) && defined(BLUR_MASK_SIZE_LARGE)
+    if(maskSize == BLUR_MASK_SIZE_SMALL)
+        sum = applyBlurMask(tileLine, mask, i, BLUR_MASK_SIZE_SMALL);
+    else if(maskSize == BLUR_MASK_SIZE_LARGE)
+        sum = applyBlurMask(tileLine, mask, i, BLUR_MASK_SIZE_LARGE);
+    else
+#endif
+        sum = applyBlurMask(tileLine, mask, i, maskSize);
 
-    blurredVolume[LPOS(pos)] = sum;
+    if(pos.x < sizeX && pos.y < sizeY && pos.z < sizeZ)
+        blurredVolume[pos.x+pos.y*sizeX+pos.z*sizeX*sizeY] = sum;
 }
 
 #define SELECT_BUFFER(vec1,vec2,z,maxZ) z < maxZ ? vec1:vec2
@@ -1500,16 +1575,17 @@ F.z = vectorSign*F.z;
 __constant float cosValues[32] = {1.0f, 0.540302f, -0.416147f, -0.989992f, -0.653644f, 0.283662f, 0.96017f, 0.753902f, -0.1455f, -0.91113f, -0.839072f, 0.0044257f, 0.843854f, 0.907447f, 0.136737f, -0.759688f, -0.957659f, -0.275163f, 0.660317f, 0.988705f, 0.408082f, -0.547729f, -0.999961f, -0.532833f, 0.424179f, 0.991203f, 0.646919f, -0.292139f, -0.962606f, -0.748058f, 0.154251f, 0.914742f};
 __constant float sinValues[32] = {0.0f, 0.841471f, 0.909297f, 0.14112f, -0.756802f, -0.958924f, -0.279415f, 0.656987f, 0.989358f, 0.412118f, -0.544021f, -0.99999f, -0.536573f, 0.420167f, 0.990607f, 0.650288f, -0.287903f, -0.961397f, -0.750987f, 0.149877f, 0.912945f, 0.836656f, -0.00885131f, -0.84622f, -0.905578f, -0.132352f, 0.762558f, 0.956376f, 0.270906f, -0.663634f, -0.988032f, -0.404038f};
 
-__kernel void circleFittingTDF(
+// Directions across a tube at pos, which are the eigenvectors of the Hessian
+// of the vector field with the two eigenvalues of largest magnitude. The
+// eigenvalues of e2 and e3 are stored in eigenValues.
+void getTubeCrossSection(
         __read_only image3d_t vectorField,
-        __global TDF_TYPE * T,
-        __global float * Radius,
-        __private float rMin,
-        __private float rMax,
-        __private float rStep
+        const int4 pos,
+        const float rMax,
+        float3 * e2,
+        float3 * e3,
+        float2 * eigenValues
     ) {
-    const int4 pos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
-
     // Find Hessian Matrix
     float3 Fx, Fy, Fz;
     if(rMax < 4) {
@@ -1528,49 +1604,246 @@ __kernel void circleFittingTDF(
         {Fy.x, Fy.y, Fz.y},
         {Fz.x, Fz.y, Fz.z}
     };
-    
+
     // Eigen decomposition
-    float eigenValues[3];
+    float values[3];
     float eigenVectors[3][3];
-    eigen_decomposition(Hessian, eigenVectors, eigenValues);
-    //const float3 lambda = {eigenValues[0], eigenValues[1], eigenValues[2]};
-    //const float3 e1 = {eigenVectors[0][0], eigenVectors[1][0], eigenVectors[2][0]};
-    const float3 e2 = {eigenVectors[0][1], eigenVectors[1][1], eigenVectors[2][1]};
-    const float3 e3 = {eigenVectors[0][2], eigenVectors[1][2], eigenVectors[2][2]};
+    eigen_decomposition(Hessian, eigenVectors, values);
+    *e2 = (float3)(eigenVectors[0][1], eigenVectors[1][1], eigenVectors[2][1]);
+    *e3 = (float3)(eigenVectors[0][2], eigenVectors[1][2], eigenVectors[2][2]);
+    *eigenValues = (float2)(values[1], values[2]);
+}
+
+// Average component of the vector field towards the center of a circle across the tube
+float circleFittingResponse(
+        __read_only image3d_t vectorField,
+        const float4 floatPos,
+        const float radius,
+        const float3 e2,
+        const float3 e3
+    ) {
+    const int samples = 32;
+    float radiusSum = 0.0f;
+    for(int j = 0; j < samples; j++) {
+        float3 V_alpha = cosValues[j]*e3 + sinValues[j]*e2;
+        float4 position = floatPos + radius*V_alpha.xyzz;
+        float3 V = -read_imagef(vectorField, interpolationSampler, position).xyz;
+        radiusSum += dot(V, V_alpha);
+    }
+    return radiusSum / samples;
+}
+
+// Number of radii rMin, rMin+rStep, ... that are not above rMax. The
+// tolerance keeps rMax when it is a whole number of steps from rMin.
+int getRadiusCount(const float rMin, const float rMax, const float rStep) {
+    if(rMin > rMax)
+        return 0;
+    if(rStep <= 0.0f)
+        return 1;
+    return (int)floor((rMax - rMin)/rStep + 0.001f) + 1;
+}
 
-    // Circle Fitting
+// Increases the radius rMin+k*rStep until the response drops to or below the
+// largest response so far. Returns the largest response, which is 0 if the
+// response at rMin is not positive, and stores its radius in maxRadius.
+float circleFittingRadii(
+        __read_only image3d_t vectorField,
+        const float4 floatPos,
+        const float3 e2,
+        const float3 e3,
+        const float rMin,
+        const float rStep,
+        const int count,
+        float * maxRadius
+    ) {
     float maxSum = 0.0f;
-    float maxRadius = 0.0f;
-    const float4 floatPos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
-        int samples = 32;
-        int stride = 1;
-    for(float radius = rMin; radius <= rMax; radius += rStep) {
-        bool negatives = false;
-        float radiusSum = 0.0f;
-            for(int j = 0; j < samples && !negatives; j++) {
-            float3 V_alpha = cosValues[j*stride]*e3 + sinValues[j*stride]*e2;
-            float4 position = floatPos + radius*V_alpha.xyzz;
-            float3 V = -read_imagef(vectorField, interpolationSampler, position).xyz;
-            radiusSum += dot(V, V_alpha);
-            //if(dot(normalize(V), normalize(V_alpha)) < 0.2f)
-            //    negatives = true;
-        }
-        //if(negatives) // these instructions may lead to wierd results
-        //	continue;
-        radiusSum /= samples;
+    for(int k = 0; k < count; k++) {
+        const float radius = rMin + k*rStep;
+        const float radiusSum = circleFittingResponse(vectorField, floatPos, radius, e2, e3);
         if(radiusSum > maxSum) {
             maxSum = radiusSum;
-            maxRadius = radius;
+            *maxRadius = radius;
         } else {
             break;
         }
     }
+    return maxSum;
+}
+
+// With specialize-kernels the number of radii of the TDF of large tubes is
+// compiled in, so that the loop has a constant trip count and can be unrolled.
+float circleFitting(
+        __read_only image3d_t vectorField,
+        const float4 floatPos,
+        const float3 e2,
+        const float3 e3,
+        const float rMin,
+        const float rMax,
+        const float rStep,
+        float * maxRadius
+    ) {
+#ifdef TDF_RADIUS_COUNT
+    if(rMin == TDF_RADIUS_MIN && rMax == TDF_RADIUS_MAX && rStep == TDF_RADIUS_STEP)
+        return circleFittingRadii(vectorField, floatPos, e2, e3, TDF_RADIUS_MIN, TDF_RADIUS_STEP, TDF_RADIUS_COUNT, maxRadius);
+#endif
+    return circleFittingRadii(vectorField, floatPos, e2, e3, rMin, rStep, getRadiusCount(rMin, rMax, rStep), maxRadius);
+}
+
+__kernel void circleFittingTDF(
+        __read_only image3d_t vectorField,
+        __global TDF_TYPE * T,
+        __global float * Radius,
+        __private float rMin,
+        __private float rMax,
+        __private float rStep
+    ) {
+    const int4 pos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
+    float3 e2, e3;
+    float2 eigenValues;
+    getTubeCrossSection(vectorField, pos, rMax, &e2, &e3, &eigenValues);
+    float maxRadius = 0.0f;
+    const float maxSum = circleFitting(vectorField, convert_float4(pos), e2, e3, rMin, rMax, rStep, &maxRadius);
 
     // Store result
     T[LPOS(pos)] = FLOAT_TO_UNORM16(maxSum);
     Radius[LPOS(pos)] = maxRadius;
 }
 
+// Divergence of the vector field at pos, which is the sum of the eigenvalues
+// of the Hessian of getTubeCrossSection. The vectors converge across a tube,
+// so it is negative inside tubes.
+float getDivergence(
+        __read_only image3d_t vectorField,
+        const int4 pos,
+        const float rMax
+    ) {
+    const float4 x1 = read_imagef(vectorField, sampler, pos + (int4)(1,0,0,0));
+    const float4 x_1 = read_imagef(vectorField, sampler, pos - (int4)(1,0,0,0));
+    const float4 y1 = read_imagef(vectorField, sampler, pos + (int4)(0,1,0,0));
+    const float4 y_1 = read_imagef(vectorField, sampler, pos - (int4)(0,1,0,0));
+    const float4 z1 = read_imagef(vectorField, sampler, pos + (int4)(0,0,1,0));
+    const float4 z_1 = read_imagef(vectorField, sampler, pos - (int4)(0,0,1,0));
+    if(rMax < 4)
+        return 0.5f*(x1.x - x_1.x + y1.y - y_1.y + z1.z - z_1.z);
+    return 0.5f*(x1.x/x1.w - x_1.x/x_1.w + y1.y/y1.w - y_1.y/y_1.w + z1.z/z1.w - z_1.z/z_1.w);
+}
+
+// Marks the voxels that may be inside a tube, which are those where the
+// vector field converges and, if maxMagnitude is above 0, is not longer than
+// maxMagnitude. This is the only work done for every voxel: the TDF and the
+// radius of all voxels are set to 0, and circleFittingTDFSparse computes
+// those of the candidates.
+__kernel void circleFittingTDFCandidates(
+        __read_only image3d_t vectorField,
+        __global TDF_TYPE * T,
+        __global float * Radius,
+        __global char * candidates,
+        __private float rMin,
+        __private float rMax,
+        __private float maxMagnitude
+    ) {
+    const int4 pos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
+    bool candidate = rMin <= rMax;
+    if(candidate && maxMagnitude > 0.0f)
+        candidate = length(read_imagef(vectorField, sampler, pos).xyz) <= maxMagnitude;
+    if(candidate)
+        candidate = getDivergence(vectorField, pos, rMax) < 0.0f;
+    candidates[LPOS(pos)] = candidate ? 1 : 0;
+    T[LPOS(pos)] = FLOAT_TO_UNORM16(0.0f);
+    Radius[LPOS(pos)] = 0.0f;
+}
+
+// circleFittingTDF of the voxels in a list of positions. Voxels without
+// negative eigenvalues across the tube are skipped, and keep the TDF and
+// radius 0 of circleFittingTDFCandidates.
+__kernel void circleFittingTDFSparse(
+        __read_only image3d_t vectorField,
+        __global TDF_TYPE * T,
+        __global float * Radius,
+        __global int const * positions,
+        __private int count,
+        __private int sizeX,
+        __private int sizeY,
+        __private float rMin,
+        __private float rMax,
+        __private float rStep
+    ) {
+    const int i = get_global_id(0);
+    if(i >= count)
+        return;
+    const int3 position = vload3(i, positions);
+    const int4 pos = {position.x, position.y, position.z, 0};
+    float3 e2, e3;
+    float2 eigenValues;
+    getTubeCrossSection(vectorField, pos, rMax, &e2, &e3, &eigenValues);
+    if(eigenValues.x >= 0.0f || eigenValues.y >= 0.0f)
+        return;
+    float maxRadius = 0.0f;
+    const float maxSum = circleFitting(vectorField, convert_float4(pos), e2, e3, rMin, rMax, rStep, &maxRadius);
+
+    // Store result
+    const int offset = pos.x+pos.y*sizeX+pos.z*sizeX*sizeY;
+    T[offset] = FLOAT_TO_UNORM16(maxSum);
+    Radius[offset] = maxRadius;
+}
+
+// Combines the TDF of a downsampled vector field with TDFlarge, as combine
+// does. The downsampled TDF and radius are interpolated at the center of each
+// voxel, and the radius is scaled to the full resolution.
+__kernel void combineUpsampled(
+    __read_only image3d_t TDFcoarse,
+    __read_only image3d_t radiusCoarse,
+    __global TDF_TYPE * TDFlarge,
+    __global float * radiusLarge,
+    __private int scale,
+    __private int sizeX,
+    __private int sizeY
+    ) {
+    const int i = get_global_id(0);
+    const int4 pos = {i % sizeX, (i / sizeX) % sizeY, i / (sizeX*sizeY), 0};
+    const float4 coarsePos = (convert_float4(pos) + 0.5f) / scale;
+    const float TDF = read_imagef(TDFcoarse, interpolationSampler, coarsePos).x;
+    if(UNORM16_TO_FLOAT(TDFlarge[i]) < TDF) {
+        TDFlarge[i] = FLOAT_TO_UNORM16(TDF);
+        radiusLarge[i] = read_imagef(radiusCoarse, interpolationSampler, coarsePos).x*scale;
+    }
+}
+
+// Average of the 2x2x2 vectors of a vector field that are inside fineSize.
+// The downsampled field is padded to a multiple of 4, and the padding gets
+// zero vectors instead of copies of the edge. The magnitude is stored in w, as
+// in GVF3DFinish.
+float4 downsampleVector(__read_only image3d_t vectorField, const int4 pos, const int4 fineSize) {
+    float3 sum = {0.0f, 0.0f, 0.0f};
+    int count = 0;
+    for(int z = 0; z < 2; z++) {
+    for(int y = 0; y < 2; y++) {
+    for(int x = 0; x < 2; x++) {
+        const int4 finePos = pos*2 + (int4)(x,y,z,0);
+        if(finePos.x < fineSize.x && finePos.y < fineSize.y && finePos.z < fineSize.z) {
+            sum += read_imagef(vectorField, sampler, finePos).xyz;
+            count++;
+        }
+    }}}
+    float4 v;
+    v.xyz = count > 0 ? sum / (float)count : (float3)(0.0f, 0.0f, 0.0f);
+    v.w = 0;
+    v.w = length(v) > 0.0f ? length(v) : 1.0f;
+    return v;
+}
+
+__kernel void downsampleVectorField(
+        __read_only image3d_t vectorField,
+        __global VECTOR_FIELD_TYPE * downsampledVectorField,
+        __private int fineSizeX,
+        __private int fineSizeY,
+        __private int fineSizeZ
+    ) {
+    const int4 pos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
+    const int4 fineSize = {fineSizeX, fineSizeY, fineSizeZ, 0};
+    vstore4(FLOAT_TO_SNORM16_4(downsampleVector(vectorField, pos, fineSize)), LPOS(pos), downsampledVectorField);
+}
+
 __kernel void splineTDF(
         __read_only image3d_t vectorField,
         __global TDF_TYPE * T,
@@ -1786,6 +2059,112 @@ v2.z = -6*v.z;
 
 }
 
+// Tiled GVF iterations. Each work group of 4x4x4 loads a brick of
+// GVF_TILE^3 voxels and a halo of GVF_SWEEPS voxels into local memory, and
+// runs GVF_SWEEPS Jacobi iterations on it before the brick is written back.
+// The valid part of the brick shrinks by one voxel per iteration, so the
+// result is the same as that of GVF_SWEEPS launches of GVF3DIteration,
+// except that 16 bit vectors are only rounded when the brick is written.
+#ifndef GVF_TILE
+#define GVF_TILE 8
+#endif
+#ifndef GVF_SWEEPS
+#define GVF_SWEEPS 2
+#endif
+#define GVF_REGION (GVF_TILE+2*GVF_SWEEPS)
+#define GVF_REGION_SIZE (GVF_REGION*GVF_REGION*GVF_REGION)
+#define GVF_CELLS_PER_ITEM ((GVF_REGION_SIZE+63)/64)
+
+// Position in the region of a work group of cell i
+int4 getGVFRegionCell(const int i) {
+    int4 cell = {i % GVF_REGION, (i / GVF_REGION) % GVF_REGION, i / (GVF_REGION*GVF_REGION), 0};
+    return cell;
+}
+
+// Whether a cell of the region is still valid after the given number of sweeps
+bool isInGVFWindow(const int4 cell, const int sweep) {
+    return all(cell.xyz >= (int3)(sweep,sweep,sweep)) && all(cell.xyz < (int3)(GVF_REGION-sweep,GVF_REGION-sweep,GVF_REGION-sweep));
+}
+
+#define GVF_LOCAL_POS(cell) ((cell).x+((cell).y+(cell).z*GVF_REGION)*GVF_REGION)
+
+__kernel void GVF3DTiledIteration(
+        __read_only image3d_t init_vector_field,
+        __global VECTOR_FIELD_TYPE const * restrict read_vector_field,
+        __global VECTOR_FIELD_TYPE * write_vector_field,
+        __private float mu,
+        __private int sizeX,
+        __private int sizeY,
+        __private int sizeZ
+        ) {
+    const int4 size = {sizeX, sizeY, sizeZ, 0};
+    __local float3 region[GVF_REGION_SIZE];
+    float3 updated[GVF_CELLS_PER_ITEM];
+    const int id = get_local_id(0) + get_local_id(1)*4 + get_local_id(2)*16;
+    const int4 origin = (int4)(get_group_id(0), get_group_id(1), get_group_id(2), 0)*GVF_TILE - (int4)(GVF_SWEEPS,GVF_SWEEPS,GVF_SWEEPS,0);
+
+    for(int i = id; i < GVF_REGION_SIZE; i += 64) {
+        int4 pos = origin + getGVFRegionCell(i);
+        pos.xyz = clamp(pos.xyz, (int3)(0,0,0), size.xyz-1);
+        region[i] = SNORM16_TO_FLOAT_3(vload3(NLPOS(pos), read_vector_field));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(int sweep = 1; sweep <= GVF_SWEEPS; sweep++) {
+        // Update the voxels that are not on the border of the volume
+        for(int j = 0; j < GVF_CELLS_PER_ITEM; j++) {
+            const int i = id + j*64;
+            const int4 cell = getGVFRegionCell(i);
+            const int4 pos = origin + cell;
+            if(i >= GVF_REGION_SIZE || !isInGVFWindow(cell, sweep) ||
+                    any(pos.xyz < (int3)(1,1,1)) || any(pos.xyz > size.xyz-2))
+                continue;
+            float4 init_vector = read_imagef(init_vector_field, sampler, pos);
+            float3 v = region[i];
+            float3 laplacian = -6*v +
+                region[i+1] + region[i-1] +
+                region[i+GVF_REGION] + region[i-GVF_REGION] +
+                region[i+GVF_REGION*GVF_REGION] + region[i-GVF_REGION*GVF_REGION];
+            v += mu*laplacian - (v - init_vector.xyz)*(init_vector.x*init_vector.x+init_vector.y*init_vector.y+init_vector.z*init_vector.z);
+            updated[j] = v;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for(int j = 0; j < GVF_CELLS_PER_ITEM; j++) {
+            const int i = id + j*64;
+            const int4 cell = getGVFRegionCell(i);
+            const int4 pos = origin + cell;
+            if(i < GVF_REGION_SIZE && isInGVFWindow(cell, sweep) &&
+                    all(pos.xyz >= (int3)(1,1,1)) && all(pos.xyz <= size.xyz-2))
+                region[i] = updated[j];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Enforce mirror boundary conditions on the border of the volume
+        for(int j = 0; j < GVF_CELLS_PER_ITEM; j++) {
+            const int i = id + j*64;
+            const int4 cell = getGVFRegionCell(i);
+            int4 pos = origin + cell;
+            if(i >= GVF_REGION_SIZE || !isInGVFWindow(cell, sweep) ||
+                    any(pos.xyz < (int3)(0,0,0)) || any(pos.xyz >= size.xyz) ||
+                    (all(pos.xyz >= (int3)(1,1,1)) && all(pos.xyz <= size.xyz-2)))
+                continue;
+            pos = select(pos, (int4)(2,2,2,0), pos == (int4)(0,0,0,0));
+            pos = select(pos, size-3, pos >= size-1);
+            const int4 mirrorCell = pos - origin;
+            if(all(mirrorCell.xyz >= (int3)(0,0,0)) && all(mirrorCell.xyz < (int3)(GVF_REGION,GVF_REGION,GVF_REGION)))
+                region[i] = region[GVF_LOCAL_POS(mirrorCell)];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    for(int i = id; i < GVF_REGION_SIZE; i += 64) {
+        const int4 cell = getGVFRegionCell(i);
+        const int4 pos = origin + cell;
+        if(isInGVFWindow(cell, GVF_SWEEPS) && all(pos.xyz < size.xyz))
+            vstore3(FLOAT_TO_SNORM16_3(region[i]), NLPOS(pos), write_vector_field);
+    }
+}
+
 __kernel void GVF3DInit(
 		__read_only image3d_t vectorFieldImage,
 		__global VECTOR_FIELD_TYPE * vectorField
@@ -2149,6 +2528,56 @@ __kernel void GVFgaussSeidel2(
 }
 
 
+// Reduces the values of a work group of 64 items to the largest one, which is
+// stored in result with an atomic max on its bits, as they are not negative
+void storeMaxInGroup(__local float * values, const int id, volatile __global int * result) {
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(int i = 32; i > 0; i /= 2) {
+        if(id < i)
+            values[id] = max(values[id], values[id+i]);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if(id == 0)
+        atomic_max(result, as_int(values[0]));
+}
+
+// Largest change of a vector component between two GVF iterations. Has to be run with work groups of 4x4x4.
+__kernel void GVFMaxDifference(
+        __read_only image3d_t a,
+        __read_only image3d_t b,
+        volatile __global int * result
+        ) {
+    __local float values[64];
+    const int4 pos = {get_global_id(0), get_global_id(1), get_global_id(2), 0};
+    const int id = get_local_id(0) + get_local_id(1)*4 + get_local_id(2)*16;
+    const float3 difference = fabs(read_imagef(a, sampler, pos).xyz - read_imagef(b, sampler, pos).xyz);
+    values[id] = max(difference.x, max(difference.y, difference.z));
+    storeMaxInGroup(values, id, result);
+}
+
+// Largest change of a vector component between two GVF iterations stored in
+// buffers. Has to be run with work groups of 64, the global size is padded to
+// whole work-groups.
+__kernel void GVFMaxDifferenceBuffer(
+        __global VECTOR_FIELD_TYPE const * restrict a,
+        __global VECTOR_FIELD_TYPE const * restrict b,
+        volatile __global int * result,
+        __private int elements
+        ) {
+    __local float values[64];
+    const int i = get_global_id(0);
+    const int id = get_local_id(0);
+    values[id] = 0.0f;
+    if(i < elements) {
+#ifdef VECTORS_16BIT
+        values[id] = fabs((float)a[i] - (float)b[i]) / 32767.0f;
+#else
+        values[id] = fabs(a[i] - b[i]);
+#endif
+    }
+    storeMaxInGroup(values, id, result);
+}
+
 __kernel void addTwoImages(
         __read_only image3d_t i1,
         __read_only image3d_t i2,
@@ -1,4 +1,5 @@
 #include "tube-segmentation.hpp"
+#include "batch.hpp"
 #include "SIPL/Core.hpp"
 #include "tsf-config.h"
 
@@ -15,6 +16,9 @@ int main(int argc, char ** argv) {
         std::cout << std::endl;
         std::cout << "Example: " << argv[0] << " tests/data/synthetic/dataset_1/noisy.mhd --parameters Synthetic-Vascusynth --display" << std::endl;
         std::cout << std::endl;
+        std::cout << "Batch usage: " << argv[0] << " manifest.txt --batch --storage-dir results/ <parameters>" << std::endl;
+        std::cout << "The manifest lists one .mhd file per line." << std::endl;
+        std::cout << std::endl;
         std::cout << "Available parameter presets: " << std::endl;
         std::cout << "* Lung-Airways-CT" << std::endl;
         std::cout << "* Neuro-Vessels-USA" << std::endl;
@@ -34,6 +38,17 @@ int main(int argc, char ** argv) {
     paramList parameters = getParameters(argc, argv);
     std::string filename = argv[1];
 
+    if(getParamBool(parameters, "batch")) {
+    	try {
+    		return runBatch(filename, parameters, std::string(KERNELS_DIR)) == 0 ? 0 : -1;
+    	} catch(SIPL::SIPLException &e) {
+    		std::cout << e.what() << std::endl;
+    		return -1;
+    	} catch(cl::Error &e) {
+    		std::cout << "OpenCL error in " << e.what() << " (" << e.err() << ")" << std::endl;
+    		return -1;
+    	}
+    }
 
     TSFOutput * output;
     try {
@@ -41,6 +56,10 @@ int main(int argc, char ** argv) {
     } catch(SIPL::SIPLException &e) {
     	std::cout << e.what() << std::endl;
 
+    	return -1;
+    } catch(cl::Error &e) {
+    	std::cout << "OpenCL error in " << e.what() << " (" << e.err() << ")" << std::endl;
+
     	return -1;
     }
 
@@ -0,0 +1,299 @@
+#include "memoryPlanner.hpp"
+#include "tube-segmentation.hpp"
+#include <iostream>
+#include <algorithm>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// The smallest tile that is worth processing, as the halo is often larger
+static const int minimumTileSize = 16;
+// The estimate leaves out objects that are proportional to the number of
+// candidates or centerpoints, objects that the pool keeps allocated after an
+// earlier stage released them, and the overhead of the driver
+static const double deviceMargin = 1.2;
+// Initial size of the two frontiers of the segmentation, see segmentation.cpp
+static const unsigned long long frontierBytes = 2*65536*sizeof(int);
+
+MemoryLimits getMemoryLimits(cl::Device device, const paramList &parameters) {
+    MemoryLimits limits;
+    limits.deviceBytes = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    limits.maxAllocBytes = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+#ifdef WIN32
+    limits.hostBytes = 0;
+#else
+    limits.hostBytes = (unsigned long long)sysconf(_SC_PHYS_PAGES)*sysconf(_SC_PAGE_SIZE);
+#endif
+    limits.budget = false;
+    limits.canChangeVectorType = false;
+
+    const unsigned long long budget = (unsigned long long)getParam(parameters, "memory-budget")*1024*1024;
+    if(budget > 0) {
+        limits.budget = true;
+        limits.deviceBytes = std::min(limits.deviceBytes, budget);
+        if(limits.hostBytes == 0 || budget < limits.hostBytes)
+            limits.hostBytes = budget;
+    }
+
+    if(getParamBool(parameters, "batch")) {
+        const unsigned long long jobs = std::max(1, (int)getParam(parameters, "batch-jobs"));
+        limits.deviceBytes /= jobs;
+        limits.hostBytes /= jobs;
+    }
+    return limits;
+}
+
+static bool uses3DWrite(const paramList &parameters) {
+    // Set by run() from the device, before that only buffers-only is known
+    unordered_map<std::string, BoolParameter>::const_iterator it = parameters.bools.find("3d_write");
+    if(it != parameters.bools.end())
+        return it->second.get();
+    return !getParamBool(parameters, "buffers-only");
+}
+
+std::vector<StageMemory> estimateStageMemory(SIPL::int3 size, const paramList &parameters) {
+    const double voxels = (double)size.x*size.y*size.z;
+    const bool no3Dwrite = !uses3DWrite(parameters);
+    // One component of a vector, the TDF has the same type
+    const double v = getParamBool(parameters, "16bit-vectors") ? sizeof(short) : sizeof(float);
+    const double f = sizeof(float);
+    const bool smallRadius = getParam(parameters, "radius-min") < 2.5f;
+    // The dataset is converted to float on the device, and freed by the large blur
+    const double dataset = f;
+    const double datasetAfterBlur = getParam(parameters, "large-blur") > 0 ? 0 : f;
+    // Levels of a histogram pyramid above the base, at most an int per 8 voxels
+    const double HPLevels = 4.0/7.0;
+    // The sparse TDF compacts the char candidates with a histogram pyramid
+    const double sparseTDF = getParamBool(parameters, "sparse-tdf") ? 1 + HPLevels : 0;
+
+    // The GVF input is the vector field, the result replaces it
+    double GVF;
+    if(getParamBool(parameters, "use-fmg-gvf")) {
+        // Residual, solution, temporary and squared magnitude on all levels,
+        // which add up to 8/7 of the finest, the three components, the sum and zero
+        GVF = 4*v + 4*v*8.0/7.0 + 3*v + 2*v + 4*v + (no3Dwrite ? 4*v : 0);
+    } else if(getParamBool(parameters, "gvf-low-memory")) {
+        // One component at a time
+        GVF = 4*v + (no3Dwrite ? v + 2*v + v + 4*v : v + v + 2*v) + 4*v;
+    } else {
+        GVF = 4*v + (no3Dwrite ? 3*v + 3*v + 4*v : 4*v + 2*v) + 4*v;
+    }
+
+    std::vector<StageMemory> stages;
+    StageMemory stage;
+    stage.wholeVolume = false;
+    stage.name = "blur";
+    stage.deviceBytes = voxels*(dataset + f);
+    stages.push_back(stage);
+    stage.name = "vector field";
+    stage.deviceBytes = voxels*(dataset + f + 4*v + (no3Dwrite ? 4*v : 0));
+    stages.push_back(stage);
+    if(smallRadius) {
+        // TDF of the small radii on the vector field without GVF
+        stage.name = "TDF small";
+        stage.deviceBytes = voxels*(dataset + 4*v + v + f + sparseTDF);
+        stages.push_back(stage);
+    }
+    stage.name = "GVF";
+    stage.deviceBytes = voxels*(datasetAfterBlur + GVF);
+    stages.push_back(stage);
+    // Results of the large radii, of the small radii and the combined images
+    stage.name = "TDF";
+    stage.deviceBytes = voxels*(4*v + (v + f)*(smallRadius ? 3 : 2) + sparseTDF);
+    stages.push_back(stage);
+    // The centerline, three char images of centerpoints and the histogram
+    // pyramid that compacts them. The buffers of the linking are proportional
+    // to the number of centerpoints.
+    stage.name = "centerline";
+    stage.wholeVolume = true;
+    stage.deviceBytes = voxels*(4*v + v + f + 1 + 3 + HPLevels);
+    stages.push_back(stage);
+    // The vector field and the retained TDF, radius and centerline, the
+    // segmentation as bytes and as words, and the frontiers of the growing
+    stage.name = "segmentation";
+    stage.deviceBytes = voxels*(4*v + v + f + 1 + 1 + 1 + f) + frontierBytes;
+    stages.push_back(stage);
+    return stages;
+}
+
+unsigned long long estimateHostMemory(SIPL::int3 size, const paramList &parameters) {
+    const double voxels = (double)size.x*size.y*size.z;
+    const double v = getParamBool(parameters, "16bit-vectors") ? sizeof(short) : sizeof(float);
+    const double f = sizeof(float);
+    // The volume as read from disk, at most float
+    double bytes = f;
+    if(getParam(parameters, "radius-min") < 2.5f)
+        bytes += v + f;
+    // TDF, radius, centerline and segmentation
+    bytes += v + f + 1 + 1;
+    // The ridge traversal copies the vector field and the TDF to float arrays
+    if(getParamStr(parameters, "centerline-method") == "ridge")
+        bytes += 4*f + 4*f;
+    return voxels*bytes;
+}
+
+static unsigned long long getPeak(const std::vector<StageMemory> &stages) {
+    unsigned long long peak = 0;
+    for(unsigned int i = 0; i < stages.size(); i++)
+        peak = std::max(peak, stages[i].deviceBytes);
+    return peak*deviceMargin;
+}
+
+// Largest single buffer without 3D image writes. The buffers of the vector
+// field are split in two if needed, but the GVF needs whole vector fields,
+// unless it processes one component at a time.
+static unsigned long long getLargestObject(SIPL::int3 size, const paramList &parameters) {
+    if(uses3DWrite(parameters))
+        return 0;
+    const double v = getParamBool(parameters, "16bit-vectors") ? sizeof(short) : sizeof(float);
+    const double components = getParamBool(parameters, "gvf-low-memory") ? 2 : 4;
+    return (double)size.x*size.y*size.z*components*v;
+}
+
+// The dataset and the stitched vector field, TDF and radius stay on the device
+static unsigned long long getTiledResidentBytes(SIPL::int3 size, const paramList &parameters) {
+    const double v = getParamBool(parameters, "16bit-vectors") ? sizeof(short) : sizeof(float);
+    return (double)size.x*size.y*size.z*(sizeof(float) + 4*v + v + sizeof(float));
+}
+
+static SIPL::int3 getBrickSize(SIPL::int3 size, int tileSize, int halo) {
+    return SIPL::int3(
+            std::min(size.x, tileSize) + 2*halo,
+            std::min(size.y, tileSize) + 2*halo,
+            std::min(size.z, tileSize) + 2*halo
+    );
+}
+
+// The stages of one brick, followed by the stages after the TDF, which run on
+// the whole volume when the tiles have been stitched
+static std::vector<StageMemory> estimateTiledStageMemory(SIPL::int3 size, SIPL::int3 brickSize, const paramList &parameters) {
+    paramList brickParameters = parameters;
+    setParameter(brickParameters, "tiled-execution", "false");
+    std::vector<StageMemory> brickStages = estimateStageMemory(brickSize, brickParameters);
+    std::vector<StageMemory> wholeStages = estimateStageMemory(size, parameters);
+    std::vector<StageMemory> stages;
+    for(unsigned int i = 0; i < brickStages.size(); i++) {
+        if(!brickStages[i].wholeVolume)
+            stages.push_back(brickStages[i]);
+    }
+    for(unsigned int i = 0; i < wholeStages.size(); i++) {
+        if(wholeStages[i].wholeVolume)
+            stages.push_back(wholeStages[i]);
+    }
+    return stages;
+}
+
+// The whole volume stages already count the stitched results they use
+static unsigned long long getTiledPeak(SIPL::int3 size, const std::vector<StageMemory> &stages, const paramList &parameters) {
+    std::vector<StageMemory> brickStages, wholeStages;
+    for(unsigned int i = 0; i < stages.size(); i++) {
+        if(stages[i].wholeVolume) {
+            wholeStages.push_back(stages[i]);
+        } else {
+            brickStages.push_back(stages[i]);
+        }
+    }
+    return std::max(getTiledResidentBytes(size, parameters) + getPeak(brickStages), getPeak(wholeStages));
+}
+
+int getTileSizeForLimits(SIPL::int3 size, const paramList &parameters, MemoryLimits limits) {
+    paramList brickParameters = parameters;
+    setParameter(brickParameters, "tiled-execution", "false");
+    const int halo = getBrickHalo(parameters);
+    // The largest tile that is accepted by the tile-size parameter. Tiles
+    // smaller than the halo are not used, see runTiledCircleFittingMethod.
+    int tileSize = std::min(1024, std::max(size.x, std::max(size.y, size.z)));
+    tileSize -= tileSize % 4;
+    for(; tileSize >= std::max(minimumTileSize, halo); tileSize -= 4) {
+        SIPL::int3 brickSize = getBrickSize(size, tileSize, halo);
+        if(getTiledPeak(size, estimateTiledStageMemory(size, brickSize, parameters), parameters) <= limits.deviceBytes &&
+                getLargestObject(brickSize, brickParameters) <= limits.maxAllocBytes)
+            return tileSize;
+    }
+    return 0;
+}
+
+static MemoryPlan createPlan(SIPL::int3 size, const paramList &parameters, MemoryLimits limits) {
+    MemoryPlan plan;
+    plan.use16bitVectors = getParamBool(parameters, "16bit-vectors");
+    plan.lowMemoryGVF = getParamBool(parameters, "gvf-low-memory");
+    plan.tiled = getParamBool(parameters, "tiled-execution");
+    plan.hostBytes = estimateHostMemory(size, parameters);
+    bool fitsAllocation;
+    if(plan.tiled) {
+        plan.tileSize = getParam(parameters, "tile-size");
+        if(plan.tileSize <= 0)
+            plan.tileSize = std::max(std::max(minimumTileSize, getBrickHalo(parameters)), getTileSizeForLimits(size, parameters, limits));
+        paramList brickParameters = parameters;
+        setParameter(brickParameters, "tiled-execution", "false");
+        SIPL::int3 brickSize = getBrickSize(size, plan.tileSize, getBrickHalo(parameters));
+        plan.stages = estimateTiledStageMemory(size, brickSize, parameters);
+        plan.deviceBytes = getTiledPeak(size, plan.stages, parameters);
+        fitsAllocation = getLargestObject(brickSize, brickParameters) <= limits.maxAllocBytes;
+    } else {
+        plan.tileSize = 0;
+        plan.stages = estimateStageMemory(size, parameters);
+        plan.deviceBytes = getPeak(plan.stages);
+        fitsAllocation = getLargestObject(size, parameters) <= limits.maxAllocBytes;
+    }
+    plan.fits = plan.deviceBytes <= limits.deviceBytes && fitsAllocation &&
+        (limits.hostBytes == 0 || plan.hostBytes <= limits.hostBytes);
+    return plan;
+}
+
+MemoryPlan planMemory(SIPL::int3 size, const paramList &parameters, MemoryLimits limits) {
+    paramList candidate = parameters;
+    if(!getParamBool(candidate, "tiled-execution")) {
+        MemoryPlan plan = createPlan(size, candidate, limits);
+        if(plan.fits)
+            return plan;
+
+        if(limits.canChangeVectorType && !getParamBool(candidate, "16bit-vectors") &&
+                !getParamBool(candidate, "32bit-vectors")) {
+            setParameter(candidate, "16bit-vectors", "true");
+            plan = createPlan(size, candidate, limits);
+            if(plan.fits)
+                return plan;
+        }
+
+        paramList lowMemory = candidate;
+        setParameter(lowMemory, "use-fmg-gvf", "false");
+        setParameter(lowMemory, "gvf-low-memory", "true");
+        plan = createPlan(size, lowMemory, limits);
+        if(plan.fits)
+            return plan;
+
+        setParameter(candidate, "tiled-execution", "true");
+    }
+    return createPlan(size, candidate, limits);
+}
+
+void applyMemoryPlan(paramList &parameters, const MemoryPlan &plan, MemoryLimits limits) {
+    setParameter(parameters, "16bit-vectors", plan.use16bitVectors ? "true" : "false");
+    if(plan.lowMemoryGVF) {
+        if(getParamBool(parameters, "use-fmg-gvf"))
+            std::cout << "WARNING: Not using the multigrid GVF (use-fmg-gvf), because the volume only fits with the low memory GVF." << std::endl;
+        setParameter(parameters, "use-fmg-gvf", "false");
+        setParameter(parameters, "gvf-low-memory", "true");
+    }
+    setParameter(parameters, "tiled-execution", plan.tiled ? "true" : "false");
+
+    std::string peakStage = "";
+    unsigned long long peak = 0;
+    for(unsigned int i = 0; i < plan.stages.size(); i++) {
+        if(plan.stages[i].deviceBytes >= peak) {
+            peak = plan.stages[i].deviceBytes;
+            peakStage = plan.stages[i].name;
+        }
+    }
+    std::cout << "NOTE: Memory plan: " << (plan.use16bitVectors ? "16" : "32") << " bit vectors, " <<
+        (plan.lowMemoryGVF ? "low memory GVF, " : "") <<
+        (plan.tiled ? "tiles of size " : "whole volume");
+    if(plan.tiled)
+        std::cout << plan.tileSize;
+    std::cout << ". Estimated peak device memory " << (double)plan.deviceBytes/(1024*1024) << " MB in " << peakStage <<
+        " of " << (double)limits.deviceBytes/(1024*1024) << " MB" << (limits.budget ? " (memory budget)" : "") <<
+        ", host memory " << (double)plan.hostBytes/(1024*1024) << " MB" << std::endl;
+    if(!plan.fits)
+        std::cout << "WARNING: There may not be enough memory available to process this volume, even in tiles." << std::endl;
+}
@@ -0,0 +1,57 @@
+#ifndef MEMORY_PLANNER_H
+#define MEMORY_PLANNER_H
+
+#include "commons.hpp"
+#include "parameters.hpp"
+#include <string>
+#include <vector>
+
+/*
+ * Estimates the memory used by each stage of the circle fitting pipeline from
+ * the size of the volume and the parameters, and chooses the fastest
+ * configuration that fits on the device and the host. The configurations are
+ * tried in this order:
+ *  1. As given by the parameters
+ *  2. 16 bit vector fields, if the vector type can still be changed
+ *  3. The GVF that processes one vector component at a time
+ *  4. Tiled execution, with the largest tiles that fit
+ */
+
+typedef struct MemoryLimits {
+    unsigned long long deviceBytes;
+    unsigned long long maxAllocBytes;
+    unsigned long long hostBytes; // 0 if unknown
+    bool budget; // The limits are set by the memory-budget parameter
+    bool canChangeVectorType;
+} MemoryLimits;
+
+typedef struct StageMemory {
+    std::string name;
+    unsigned long long deviceBytes;
+    bool wholeVolume; // Runs on the whole volume, also with tiled execution
+} StageMemory;
+
+typedef struct MemoryPlan {
+    bool use16bitVectors;
+    bool lowMemoryGVF;
+    bool tiled;
+    int tileSize;
+    std::vector<StageMemory> stages; // Of the whole volume, or of one tile and the stages after the TDF
+    unsigned long long deviceBytes; // Estimated peak with a margin, including the results of the tiles
+    unsigned long long hostBytes;
+    bool fits;
+} MemoryPlan;
+
+// Global memory of the device and physical memory of the host, limited by
+// memory-budget and shared by the volumes that are processed at the same time
+// in batch mode
+MemoryLimits getMemoryLimits(cl::Device device, const paramList &parameters);
+std::vector<StageMemory> estimateStageMemory(SIPL::int3 size, const paramList &parameters);
+unsigned long long estimateHostMemory(SIPL::int3 size, const paramList &parameters);
+// Largest tile size that fits, or 0 if not even the smallest tile fits
+int getTileSizeForLimits(SIPL::int3 size, const paramList &parameters, MemoryLimits limits);
+MemoryPlan planMemory(SIPL::int3 size, const paramList &parameters, MemoryLimits limits);
+// Sets the parameters of the plan and prints it
+void applyMemoryPlan(paramList &parameters, const MemoryPlan &plan, MemoryLimits limits);
+
+#endif
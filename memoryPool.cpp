@@ -0,0 +1,275 @@
+#include "memoryPool.hpp"
+#include <sstream>
+#include <algorithm>
+
+static int getChannelCount(cl_channel_order order) {
+    switch(order) {
+        case CL_RG:
+        case CL_RA:
+            return 2;
+        case CL_RGB:
+            return 3;
+        case CL_RGBA:
+        case CL_BGRA:
+        case CL_ARGB:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+static int getChannelSize(cl_channel_type type) {
+    switch(type) {
+        case CL_SNORM_INT8:
+        case CL_UNORM_INT8:
+        case CL_SIGNED_INT8:
+        case CL_UNSIGNED_INT8:
+            return 1;
+        case CL_SNORM_INT16:
+        case CL_UNORM_INT16:
+        case CL_SIGNED_INT16:
+        case CL_UNSIGNED_INT16:
+        case CL_HALF_FLOAT:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+static bool isAllocationError(cl::Error &e) {
+    return e.err() == CL_MEM_OBJECT_ALLOCATION_FAILURE ||
+        e.err() == CL_OUT_OF_RESOURCES ||
+        e.err() == CL_OUT_OF_HOST_MEMORY;
+}
+
+DeviceMemoryPool::DeviceMemoryPool(cl::Context context) {
+    this->context = context;
+    allocatedBytes = 0;
+    peakBytesInUse = 0;
+    nextMark = 0;
+}
+
+cl_mem DeviceMemoryPool::getHandle(PoolEntry &entry) {
+    return entry.image() != NULL ? entry.image() : entry.buffer();
+}
+
+void DeviceMemoryPool::acquire(PoolEntry &entry) {
+    entry.requested = true;
+    entry.inUse = true;
+    entry.mark = nextMark++;
+}
+
+DeviceMemoryPool::PoolEntry * DeviceMemoryPool::findFreeEntry(std::string key, cl::CommandQueue &queue) {
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        PoolEntry &entry = entries[i];
+        if(entry.key != key || entry.inUse)
+            continue;
+
+        if(entry.lastQueue() != queue()) {
+            // Commands on the previous queue may still use the object
+            cl::Event marker;
+            entry.lastQueue.enqueueMarker(&marker);
+            entry.lastQueue.flush();
+            std::vector<cl::Event> waitFor;
+            waitFor.push_back(marker);
+            queue.enqueueWaitForEvents(waitFor);
+            entry.lastQueue = queue;
+        }
+        acquire(entry);
+        return &entry;
+    }
+    return NULL;
+}
+
+void DeviceMemoryPool::addEntry(PoolEntry &entry) {
+    acquire(entry);
+    entries.push_back(entry);
+    allocatedBytes += entry.bytes;
+}
+
+void DeviceMemoryPool::updatePeak() {
+    unsigned long long bytesInUse = 0;
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        if(entries[i].inUse)
+            bytesInUse += entries[i].bytes;
+    }
+    if(peakBytesInUse < bytesInUse)
+        peakBytesInUse = bytesInUse;
+}
+
+cl::Image3D DeviceMemoryPool::getImage3D(cl::CommandQueue &queue, cl::ImageFormat format, int width, int height, int depth) {
+    MutexLock lock(mutex);
+    std::ostringstream key;
+    key << "image " << format.image_channel_order << " " << format.image_channel_data_type << " " << width << " " << height << " " << depth;
+
+    cl::Image3D image;
+    PoolEntry * free = findFreeEntry(key.str(), queue);
+    if(free != NULL) {
+        image = free->image;
+    } else {
+        PoolEntry entry;
+        entry.key = key.str();
+        try {
+            entry.image = cl::Image3D(context, CL_MEM_READ_WRITE, format, width, height, depth);
+        } catch(cl::Error &e) {
+            if(!isAllocationError(e))
+                throw;
+            // Release the unused objects and try again
+            clearUnlocked(false);
+            entry.image = cl::Image3D(context, CL_MEM_READ_WRITE, format, width, height, depth);
+        }
+        entry.bytes = (unsigned long long)width*height*depth*
+            getChannelCount(format.image_channel_order)*getChannelSize(format.image_channel_data_type);
+        entry.lastQueue = queue;
+        addEntry(entry);
+        image = entry.image;
+    }
+    updatePeak();
+    return image;
+}
+
+cl::Buffer DeviceMemoryPool::getBuffer(cl::CommandQueue &queue, ::size_t bytes) {
+    MutexLock lock(mutex);
+    std::ostringstream key;
+    key << "buffer " << bytes;
+
+    cl::Buffer buffer;
+    PoolEntry * free = findFreeEntry(key.str(), queue);
+    if(free != NULL) {
+        buffer = free->buffer;
+    } else {
+        PoolEntry entry;
+        entry.key = key.str();
+        try {
+            entry.buffer = cl::Buffer(context, CL_MEM_READ_WRITE, bytes);
+        } catch(cl::Error &e) {
+            if(!isAllocationError(e))
+                throw;
+            clearUnlocked(false);
+            entry.buffer = cl::Buffer(context, CL_MEM_READ_WRITE, bytes);
+        }
+        entry.bytes = bytes;
+        entry.lastQueue = queue;
+        addEntry(entry);
+        buffer = entry.buffer;
+    }
+    updatePeak();
+    return buffer;
+}
+
+void DeviceMemoryPool::clearUnlocked(bool onlyUnrequested) {
+    std::vector<PoolEntry> kept;
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        PoolEntry &entry = entries[i];
+        if(entry.inUse || (onlyUnrequested && entry.requested)) {
+            entry.requested = false;
+            kept.push_back(entry);
+        } else {
+            allocatedBytes -= entry.bytes;
+        }
+    }
+    entries = kept;
+}
+
+void DeviceMemoryPool::release(const cl::Memory &object) {
+    MutexLock lock(mutex);
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        if(getHandle(entries[i]) == object()) {
+            entries[i].inUse = false;
+            return;
+        }
+    }
+}
+
+void DeviceMemoryPool::detach(const cl::Memory &object) {
+    MutexLock lock(mutex);
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        if(getHandle(entries[i]) == object()) {
+            allocatedBytes -= entries[i].bytes;
+            entries.erase(entries.begin() + i);
+            return;
+        }
+    }
+}
+
+unsigned long long DeviceMemoryPool::getMark() {
+    MutexLock lock(mutex);
+    return nextMark;
+}
+
+void DeviceMemoryPool::releaseSince(cl::CommandQueue &queue, unsigned long long mark, const std::vector<cl_mem> &kept) {
+    MutexLock lock(mutex);
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        PoolEntry &entry = entries[i];
+        if(entry.inUse && entry.mark >= mark && entry.lastQueue() == queue() &&
+                std::find(kept.begin(), kept.end(), getHandle(entry)) == kept.end())
+            entry.inUse = false;
+    }
+}
+
+void DeviceMemoryPool::clear() {
+    MutexLock lock(mutex);
+    clearUnlocked(false);
+}
+
+void DeviceMemoryPool::trim() {
+    MutexLock lock(mutex);
+    clearUnlocked(true);
+}
+
+unsigned long long DeviceMemoryPool::getAllocatedBytes() {
+    MutexLock lock(mutex);
+    return allocatedBytes;
+}
+
+unsigned long long DeviceMemoryPool::getPeakBytesInUse() {
+    MutexLock lock(mutex);
+    return peakBytesInUse;
+}
+
+void DeviceMemoryPool::resetPeak() {
+    MutexLock lock(mutex);
+    peakBytesInUse = 0;
+}
+
+cl::Image3D createImage3D(OpenCL &ocl, cl_mem_flags flags, cl::ImageFormat format, int width, int height, int depth) {
+    if(ocl.pool == NULL)
+        return cl::Image3D(ocl.context, flags, format, width, height, depth);
+    return ocl.pool->getImage3D(ocl.queue, format, width, height, depth);
+}
+
+cl::Buffer createBuffer(OpenCL &ocl, cl_mem_flags flags, ::size_t bytes) {
+    if(ocl.pool == NULL)
+        return cl::Buffer(ocl.context, flags, bytes);
+    return ocl.pool->getBuffer(ocl.queue, bytes);
+}
+
+void releaseToPool(OpenCL &ocl, const cl::Memory &object) {
+    if(ocl.pool != NULL && object() != NULL)
+        ocl.pool->release(object);
+}
+
+void detachFromPool(OpenCL &ocl, const cl::Memory &object) {
+    if(ocl.pool != NULL && object() != NULL)
+        ocl.pool->detach(object);
+}
+
+void deleteMemoryObject(OpenCL &ocl, cl::Memory * object) {
+    releaseToPool(ocl, *object);
+    ocl.GC->deleteMemoryObject(object);
+}
+
+DeviceMemoryScope::DeviceMemoryScope(OpenCL &ocl) {
+    pool = ocl.pool;
+    queue = ocl.queue;
+    mark = pool != NULL ? pool->getMark() : 0;
+}
+
+DeviceMemoryScope::~DeviceMemoryScope() {
+    if(pool != NULL)
+        pool->releaseSince(queue, mark, kept);
+}
+
+void DeviceMemoryScope::keep(const cl::Memory &object) {
+    kept.push_back(object());
+}
@@ -0,0 +1,107 @@
+#ifndef MEMORY_POOL_H
+#define MEMORY_POOL_H
+
+#include "commons.hpp"
+#include <string>
+#include <vector>
+
+/*
+ * Keeps the images and buffers it allocates, so that a later request for an
+ * object of the same format and size reuses the memory instead of allocating
+ * new. An object is in use from the request until it is returned with
+ * release, or by the end of a DeviceMemoryScope that it was requested in.
+ * An object that is kept after that, e.g. a result of a run, has to be
+ * detached from the pool. All objects are allocated with CL_MEM_READ_WRITE,
+ * so that they can be reused by any stage.
+ *
+ * The pool can be shared by runs on different queues of the same context. An
+ * object that was last handed to another queue is only used after the
+ * commands enqueued on that queue before the request have finished.
+ */
+class DeviceMemoryPool {
+public:
+    DeviceMemoryPool(cl::Context context);
+    cl::Image3D getImage3D(cl::CommandQueue &queue, cl::ImageFormat format, int width, int height, int depth);
+    cl::Buffer getBuffer(cl::CommandQueue &queue, ::size_t bytes);
+    // Returns an object to the pool. Commands that are already enqueued on the
+    // queue it was requested for may still use it. Objects that are not from
+    // the pool are ignored.
+    void release(const cl::Memory &object);
+    // Removes an object from the pool, so that it is freed when the caller
+    // holds no more references to it
+    void detach(const cl::Memory &object);
+    unsigned long long getMark();
+    // Returns the objects that were requested on queue after getMark returned
+    // mark, except those in kept
+    void releaseSince(cl::CommandQueue &queue, unsigned long long mark, const std::vector<cl_mem> &kept);
+    // Frees all objects that are not in use
+    void clear();
+    // Frees the objects that are not in use and were not requested since the previous call
+    void trim();
+    unsigned long long getAllocatedBytes();
+    // Largest number of bytes in use at the same time since the last reset
+    unsigned long long getPeakBytesInUse();
+    void resetPeak();
+private:
+    typedef struct PoolEntry {
+        std::string key;
+        cl::Image3D image;
+        cl::Buffer buffer;
+        unsigned long long bytes;
+        cl::CommandQueue lastQueue;
+        bool requested;
+        bool inUse;
+        unsigned long long mark; // Of the last request
+    } PoolEntry;
+    DeviceMemoryPool(const DeviceMemoryPool &other);
+    DeviceMemoryPool & operator=(const DeviceMemoryPool &other);
+    cl_mem getHandle(PoolEntry &entry);
+    void acquire(PoolEntry &entry);
+    PoolEntry * findFreeEntry(std::string key, cl::CommandQueue &queue);
+    void addEntry(PoolEntry &entry);
+    void updatePeak();
+    void clearUnlocked(bool onlyUnrequested);
+    cl::Context context;
+    std::vector<PoolEntry> entries;
+    unsigned long long allocatedBytes;
+    unsigned long long peakBytesInUse;
+    unsigned long long nextMark;
+    Mutex mutex;
+};
+
+/*
+ * Returns the objects that are requested from the pool of ocl on its queue
+ * while the scope exists, when it ends. Used around work whose objects are
+ * known to be unused afterwards, such as a tile or a run. Objects that live
+ * on, e.g. the stitched result of the tiles, are excluded with keep.
+ */
+class DeviceMemoryScope {
+public:
+    DeviceMemoryScope(OpenCL &ocl);
+    ~DeviceMemoryScope();
+    void keep(const cl::Memory &object);
+private:
+    DeviceMemoryScope(const DeviceMemoryScope &other);
+    DeviceMemoryScope & operator=(const DeviceMemoryScope &other);
+    DeviceMemoryPool * pool;
+    cl::CommandQueue queue;
+    unsigned long long mark;
+    std::vector<cl_mem> kept;
+};
+
+/*
+ * Allocates an image or a buffer from the pool of ocl, or directly from the
+ * context if it has no pool. Objects that are created from host memory are
+ * not pooled and should be created directly.
+ */
+cl::Image3D createImage3D(OpenCL &ocl, cl_mem_flags flags, cl::ImageFormat format, int width, int height, int depth);
+cl::Buffer createBuffer(OpenCL &ocl, cl_mem_flags flags, ::size_t bytes);
+
+// Returns an object to the pool of ocl, if it has one, when the caller is done with it
+void releaseToPool(OpenCL &ocl, const cl::Memory &object);
+// Removes an object from the pool of ocl, if it has one, e.g. a result that is kept after the run
+void detachFromPool(OpenCL &ocl, const cl::Memory &object);
+// Deletes an object that was added to the garbage collector of ocl, and returns it to the pool
+void deleteMemoryObject(OpenCL &ocl, cl::Memory * object);
+
+#endif
@@ -0,0 +1,476 @@
+#include "nativeBackend.hpp"
+#include "eigenanalysisOfHessian.hpp"
+#include "ridgeTraversalCenterlineExtraction.hpp"
+#include "SIPL/Exceptions.hpp"
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <stack>
+#include <algorithm>
+
+#define LPOS(a,b,c) ((a)+(b)*size.x+(c)*size.x*size.y)
+
+// cos(j) and sin(j) for j = 0..31, the same sample directions as the circleFittingTDF kernel
+static const float cosValues[32] = {1.0f, 0.540302f, -0.416147f, -0.989992f, -0.653644f, 0.283662f, 0.96017f, 0.753902f, -0.1455f, -0.91113f, -0.839072f, 0.0044257f, 0.843854f, 0.907447f, 0.136737f, -0.759688f, -0.957659f, -0.275163f, 0.660317f, 0.988705f, 0.408082f, -0.547729f, -0.999961f, -0.532833f, 0.424179f, 0.991203f, 0.646919f, -0.292139f, -0.962606f, -0.748058f, 0.154251f, 0.914742f};
+static const float sinValues[32] = {0.0f, 0.841471f, 0.909297f, 0.14112f, -0.756802f, -0.958924f, -0.279415f, 0.656987f, 0.989358f, 0.412118f, -0.544021f, -0.99999f, -0.536573f, 0.420167f, 0.990607f, 0.650288f, -0.287903f, -0.961397f, -0.750987f, 0.149877f, 0.912945f, 0.836656f, -0.00885131f, -0.84622f, -0.905578f, -0.132352f, 0.762558f, 0.956376f, 0.270906f, -0.663634f, -0.988032f, -0.404038f};
+
+static inline int clampToEdge(int i, int n) {
+    return i < 0 ? 0 : (i >= n ? n-1 : i);
+}
+
+template <class T>
+static float * convertToFloat(std::ifstream &rawFile, SIPL::int3 rawSize, SIPL::int3 size, paramList &parameters) {
+    const int rawTotalSize = rawSize.x*rawSize.y*rawSize.z;
+    T * data = new T[rawTotalSize];
+    rawFile.read((char *)data, sizeof(T)*rawTotalSize);
+    if(rawFile.gcount() != sizeof(T)*rawTotalSize) {
+        delete[] data;
+        throw SIPL::SIPLException("Raw file is smaller than the size given in the mhd file", __LINE__, __FILE__);
+    }
+
+    float minimum, maximum;
+    if(getParamStr(parameters, "minimum") != "off") {
+        minimum = atof(getParamStr(parameters, "minimum").c_str());
+    } else {
+        std::cout << "NOTE: minimum parameter not set, finding minimum automatically." << std::endl;
+        minimum = *std::min_element(data, data+rawTotalSize);
+        std::cout << "NOTE: minimum found to be " << minimum << std::endl;
+    }
+    if(getParamStr(parameters, "maximum") != "off") {
+        maximum = atof(getParamStr(parameters, "maximum").c_str());
+    } else {
+        std::cout << "NOTE: maximum parameter not set, finding maximum automatically." << std::endl;
+        maximum = *std::max_element(data, data+rawTotalSize);
+        std::cout << "NOTE: maximum found to be " << maximum << std::endl;
+    }
+
+    // Same conversion as the toFloat kernel
+    float * result = new float[size.x*size.y*size.z];
+#pragma omp parallel for
+    for(int z = 0; z < size.z; z++) {
+    for(int y = 0; y < size.y; y++) {
+    for(int x = 0; x < size.x; x++) {
+        float v = data[x+y*rawSize.x+z*rawSize.x*rawSize.y];
+        v = v > maximum ? maximum : v;
+        v = v < minimum ? minimum : v;
+        result[LPOS(x,y,z)] = (v - minimum) / (maximum - minimum);
+    }}}
+    delete[] data;
+
+    return result;
+}
+
+float * readDatasetToHost(std::string filename, paramList &parameters, SIPL::int3 * size, TSFOutput * output) {
+    MhdHeader header;
+    if(!readMhdHeader(filename, header))
+        throw SIPL::IOException(filename.c_str(), __LINE__, __FILE__);
+    if(!header.typeFound || !header.sizeFound || !header.rawFilenameFound) {
+        throw SIPL::SIPLException("Error reading mhd file. Type, filename or size not found", __LINE__, __FILE__);
+    }
+    const std::string typeName = header.elementType;
+    const std::string rawFilename = header.rawFilename;
+    const SIPL::float3 spacing = header.spacing;
+    *size = header.size;
+
+    std::ifstream rawFile(rawFilename.c_str(), std::ios::in | std::ios::binary);
+    if(!rawFile.is_open())
+        throw SIPL::IOException(rawFilename.c_str(), __LINE__, __FILE__);
+
+    if(getParamStr(parameters, "cropping") != "no")
+        std::cout << "NOTE: Cropping is not supported by the native backend and is skipped." << std::endl;
+
+    // Shrink volume so that each dimension is dividable by 4, as done for OpenCL devices
+    SIPL::int3 rawSize = *size;
+    size->x -= size->x % 4;
+    size->y -= size->y % 4;
+    size->z -= size->z % 4;
+    if(size->x != rawSize.x || size->y != rawSize.y || size->z != rawSize.z)
+        std::cout << "NOTE: reduced size to " << size->x << ", " << size->y << ", " << size->z << std::endl;
+
+    float * dataset;
+    if(typeName == "MET_SHORT") {
+        dataset = convertToFloat<short>(rawFile, rawSize, *size, parameters);
+    } else if(typeName == "MET_USHORT") {
+        if(getParamStr(parameters, "parameters") == "Lung-Airways-CT" || getParamStr(parameters, "parameters") == "AAA-Vessels-CT") {
+            // The presets assume signed values, shift the limits as done in readDatasetAndTransfer
+            char str[255];
+            sprintf(str, "%f", atof(getParamStr(parameters, "minimum").c_str())+1024.0f);
+            setParameter(parameters, "minimum", str);
+            sprintf(str, "%f", atof(getParamStr(parameters, "maximum").c_str())+1024.0f);
+            setParameter(parameters, "maximum", str);
+        }
+        dataset = convertToFloat<unsigned short>(rawFile, rawSize, *size, parameters);
+    } else if(typeName == "MET_CHAR") {
+        dataset = convertToFloat<char>(rawFile, rawSize, *size, parameters);
+    } else if(typeName == "MET_UCHAR") {
+        dataset = convertToFloat<unsigned char>(rawFile, rawSize, *size, parameters);
+    } else if(typeName == "MET_FLOAT") {
+        dataset = convertToFloat<float>(rawFile, rawSize, *size, parameters);
+    } else {
+        std::string str = "unsupported data type " + typeName;
+        throw SIPL::SIPLException(str.c_str(), __LINE__, __FILE__);
+    }
+    rawFile.close();
+
+    std::cout << "Dataset of size " << size->x << " " << size->y << " " << size->z << " loaded" << std::endl;
+    output->setShiftVector(SIPL::int3(0,0,0));
+    output->setSpacing(spacing);
+
+    return dataset;
+}
+
+// One pass of a separable filter along the given direction (0, 1 or 2)
+static void blurPass(const float * input, float * output, SIPL::int3 size, const std::vector<float> &mask, int direction) {
+    const int maskSize = mask.size() / 2;
+    const int length = direction == 0 ? size.x : (direction == 1 ? size.y : size.z);
+    const int stride = direction == 0 ? 1 : (direction == 1 ? size.x : size.x*size.y);
+#pragma omp parallel for
+    for(int z = 0; z < size.z; z++) {
+    for(int y = 0; y < size.y; y++) {
+    for(int x = 0; x < size.x; x++) {
+        const int pos = direction == 0 ? x : (direction == 1 ? y : z);
+        const int start = LPOS(x,y,z) - pos*stride;
+        float sum = 0.0f;
+        for(int a = -maskSize; a <= maskSize; a++)
+            sum += mask[a+maskSize]*input[start + clampToEdge(pos+a, length)*stride];
+        output[LPOS(x,y,z)] = sum;
+    }}}
+}
+
+float * blurVolumeWithGaussianNative(float * volume, SIPL::int3 size, float sigma) {
+    int maskSize = 1;
+    float * maskData = createBlurMask(sigma, &maskSize);
+    std::vector<float> mask(maskData, maskData+maskSize*2+1);
+    delete[] maskData;
+
+    const int totalSize = size.x*size.y*size.z;
+    float * result = new float[totalSize];
+    float * temp = new float[totalSize];
+    blurPass(volume, result, size, mask, 0);
+    blurPass(result, temp, size, mask, 1);
+    blurPass(temp, result, size, mask, 2);
+    delete[] temp;
+
+    return result;
+}
+
+void createVectorFieldNative(float * volume, SIPL::int3 size, float Fmax, int vsign, float * Fx, float * Fy, float * Fz) {
+#pragma omp parallel for
+    for(int z = 0; z < size.z; z++) {
+    for(int y = 0; y < size.y; y++) {
+    for(int x = 0; x < size.x; x++) {
+        float fx = vsign*0.5f*(volume[LPOS(clampToEdge(x+1,size.x),y,z)] - volume[LPOS(clampToEdge(x-1,size.x),y,z)]);
+        float fy = vsign*0.5f*(volume[LPOS(x,clampToEdge(y+1,size.y),z)] - volume[LPOS(x,clampToEdge(y-1,size.y),z)]);
+        float fz = vsign*0.5f*(volume[LPOS(x,y,clampToEdge(z+1,size.z))] - volume[LPOS(x,y,clampToEdge(z-1,size.z))]);
+
+        // Fmax normalization
+        const float l = sqrt(fx*fx+fy*fy+fz*fz);
+        const float scale = l < Fmax ? 1.0f/Fmax : 1.0f/l;
+        Fx[LPOS(x,y,z)] = fx*scale;
+        Fy[LPOS(x,y,z)] = fy*scale;
+        Fz[LPOS(x,y,z)] = fz*scale;
+    }}}
+}
+
+void runGVFNative(SIPL::int3 size, float mu, int iterations, float * Fx, float * Fy, float * Fz) {
+    const int totalSize = size.x*size.y*size.z;
+    const int strideZ = size.x*size.y;
+    std::cout << "Running GVF with " << iterations << " iterations " << std::endl;
+
+    // The initial vector field and its squared magnitude, as in GVF3DInit
+    float * f[3] = {new float[totalSize], new float[totalSize], new float[totalSize]};
+    float * sqrMag = new float[totalSize];
+    memcpy(f[0], Fx, sizeof(float)*totalSize);
+    memcpy(f[1], Fy, sizeof(float)*totalSize);
+    memcpy(f[2], Fz, sizeof(float)*totalSize);
+#pragma omp parallel for
+    for(int i = 0; i < totalSize; i++)
+        sqrMag[i] = Fx[i]*Fx[i] + Fy[i]*Fy[i] + Fz[i]*Fz[i];
+
+    // Mirror boundary conditions, as in GVF3DIteration
+    std::vector<int> mirrorX(size.x), mirrorY(size.y), mirrorZ(size.z);
+    for(int i = 0; i < size.x; i++)
+        mirrorX[i] = i == 0 ? 2 : (i >= size.x-1 ? size.x-3 : i);
+    for(int i = 0; i < size.y; i++)
+        mirrorY[i] = i == 0 ? 2 : (i >= size.y-1 ? size.y-3 : i);
+    for(int i = 0; i < size.z; i++)
+        mirrorZ[i] = i == 0 ? 2 : (i >= size.z-1 ? size.z-3 : i);
+
+    float * v[3] = {Fx, Fy, Fz};
+    float * v2[3] = {new float[totalSize], new float[totalSize], new float[totalSize]};
+    for(int iteration = 0; iteration < iterations; iteration++) {
+        float ** read = iteration % 2 == 0 ? v : v2;
+        float ** write = iteration % 2 == 0 ? v2 : v;
+#pragma omp parallel for
+        for(int z = 0; z < size.z; z++) {
+        for(int y = 0; y < size.y; y++) {
+            const int rowStart = LPOS(0,mirrorY[y],mirrorZ[z]);
+            for(int component = 0; component < 3; component++) {
+                const float * r = read[component];
+                const float * init = f[component];
+                float * w = write[component] + LPOS(0,y,z);
+                for(int x = 0; x < size.x; x++) {
+                    const int p = rowStart + mirrorX[x];
+                    const float laplacian = -6.0f*r[p] + r[p+1] + r[p-1] + r[p+size.x] + r[p-size.x] + r[p+strideZ] + r[p-strideZ];
+                    w[x] = r[p] + mu*laplacian - (r[p] - init[p])*sqrMag[p];
+                }
+            }
+        }}
+    }
+    if(iterations % 2 == 1) {
+        memcpy(Fx, v2[0], sizeof(float)*totalSize);
+        memcpy(Fy, v2[1], sizeof(float)*totalSize);
+        memcpy(Fz, v2[2], sizeof(float)*totalSize);
+    }
+
+    for(int i = 0; i < 3; i++) {
+        delete[] f[i];
+        delete[] v2[i];
+    }
+    delete[] sqrMag;
+}
+
+// Trilinear interpolation with the conventions of an OpenCL linear sampler with
+// unnormalized coordinates and clamp to edge, where voxel centers are at i+0.5
+static inline float interpolate(const float * F, SIPL::int3 size, float x, float y, float z) {
+    x -= 0.5f;
+    y -= 0.5f;
+    z -= 0.5f;
+    const int x0 = (int)floor(x), y0 = (int)floor(y), z0 = (int)floor(z);
+    const float a = x-x0, b = y-y0, c = z-z0;
+    const int x1 = clampToEdge(x0+1,size.x), y1 = clampToEdge(y0+1,size.y), z1 = clampToEdge(z0+1,size.z);
+    const int cx0 = clampToEdge(x0,size.x), cy0 = clampToEdge(y0,size.y), cz0 = clampToEdge(z0,size.z);
+    return (1-a)*(1-b)*(1-c)*F[LPOS(cx0,cy0,cz0)] +
+            a*(1-b)*(1-c)*F[LPOS(x1,cy0,cz0)] +
+            (1-a)*b*(1-c)*F[LPOS(cx0,y1,cz0)] +
+            a*b*(1-c)*F[LPOS(x1,y1,cz0)] +
+            (1-a)*(1-b)*c*F[LPOS(cx0,cy0,z1)] +
+            a*(1-b)*c*F[LPOS(x1,cy0,z1)] +
+            (1-a)*b*c*F[LPOS(cx0,y1,z1)] +
+            a*b*c*F[LPOS(x1,y1,z1)];
+}
+
+void runCircleFittingTDFNative(SIPL::int3 size, float * Fx, float * Fy, float * Fz, float * TDF, float * radius, float radiusMin, float radiusMax, float radiusStep) {
+    const int totalSize = size.x*size.y*size.z;
+
+    // The kernel uses the gradient of the normalized vector field for large radii
+    const bool normalize = radiusMax >= 4;
+    float * magnitude = NULL;
+    if(normalize) {
+        magnitude = new float[totalSize];
+#pragma omp parallel for
+        for(int i = 0; i < totalSize; i++) {
+            const float l = sqrt(Fx[i]*Fx[i] + Fy[i]*Fy[i] + Fz[i]*Fz[i]);
+            magnitude[i] = l > 0.0f ? l : 1.0f;
+        }
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for(int z = 0; z < size.z; z++) {
+    for(int y = 0; y < size.y; y++) {
+    for(int x = 0; x < size.x; x++) {
+        // Hessian matrix from the gradient of the vector field
+        const int x1 = LPOS(clampToEdge(x+1,size.x),y,z), x_1 = LPOS(clampToEdge(x-1,size.x),y,z);
+        const int y1 = LPOS(x,clampToEdge(y+1,size.y),z), y_1 = LPOS(x,clampToEdge(y-1,size.y),z);
+        const int z1 = LPOS(x,y,clampToEdge(z+1,size.z)), z_1 = LPOS(x,y,clampToEdge(z-1,size.z));
+        float Fxx, Fyx, Fyy, Fzx, Fzy, Fzz;
+        if(normalize) {
+            Fxx = 0.5f*(Fx[x1]/magnitude[x1] - Fx[x_1]/magnitude[x_1]);
+            Fyx = 0.5f*(Fy[x1]/magnitude[x1] - Fy[x_1]/magnitude[x_1]);
+            Fyy = 0.5f*(Fy[y1]/magnitude[y1] - Fy[y_1]/magnitude[y_1]);
+            Fzx = 0.5f*(Fz[x1]/magnitude[x1] - Fz[x_1]/magnitude[x_1]);
+            Fzy = 0.5f*(Fz[y1]/magnitude[y1] - Fz[y_1]/magnitude[y_1]);
+            Fzz = 0.5f*(Fz[z1]/magnitude[z1] - Fz[z_1]/magnitude[z_1]);
+        } else {
+            Fxx = 0.5f*(Fx[x1] - Fx[x_1]);
+            Fyx = 0.5f*(Fy[x1] - Fy[x_1]);
+            Fyy = 0.5f*(Fy[y1] - Fy[y_1]);
+            Fzx = 0.5f*(Fz[x1] - Fz[x_1]);
+            Fzy = 0.5f*(Fz[y1] - Fz[y_1]);
+            Fzz = 0.5f*(Fz[z1] - Fz[z_1]);
+        }
+        float Hessian[3][3] = {
+            {Fxx, Fyx, Fzx},
+            {Fyx, Fyy, Fzy},
+            {Fzx, Fzy, Fzz}
+        };
+        float eigenValues[3];
+        float eigenVectors[3][3];
+        eigen_decomposition(Hessian, eigenVectors, eigenValues);
+        const float e2[3] = {eigenVectors[0][1], eigenVectors[1][1], eigenVectors[2][1]};
+        const float e3[3] = {eigenVectors[0][2], eigenVectors[1][2], eigenVectors[2][2]};
+
+        // Circle fitting
+        float maxSum = 0.0f;
+        float maxRadius = 0.0f;
+        for(float r = radiusMin; r <= radiusMax; r += radiusStep) {
+            float radiusSum = 0.0f;
+            for(int j = 0; j < 32; j++) {
+                const float ax = cosValues[j]*e3[0] + sinValues[j]*e2[0];
+                const float ay = cosValues[j]*e3[1] + sinValues[j]*e2[1];
+                const float az = cosValues[j]*e3[2] + sinValues[j]*e2[2];
+                const float px = x + r*ax, py = y + r*ay, pz = z + r*az;
+                radiusSum -= interpolate(Fx, size, px, py, pz)*ax +
+                        interpolate(Fy, size, px, py, pz)*ay +
+                        interpolate(Fz, size, px, py, pz)*az;
+            }
+            radiusSum /= 32;
+            if(radiusSum > maxSum) {
+                maxSum = radiusSum;
+                maxRadius = r;
+            } else {
+                break;
+            }
+        }
+        TDF[LPOS(x,y,z)] = maxSum;
+        radius[LPOS(x,y,z)] = maxRadius;
+    }}}
+
+    if(normalize)
+        delete[] magnitude;
+}
+
+void runCircleFittingMethodNative(float * dataset, SIPL::int3 size, paramList &parameters, TubeSegmentation &T, TSFProfiler &profiler) {
+    const float radiusMin = getParam(parameters, "radius-min");
+    const float radiusMax = getParam(parameters, "radius-max");
+    const float radiusStep = getParam(parameters, "radius-step");
+    const float Fmax = getParam(parameters, "fmax");
+    const int vectorSign = getParamStr(parameters, "mode") == "black" ? -1 : 1;
+    const float smallBlurSigma = getParam(parameters, "small-blur");
+    const float largeBlurSigma = getParam(parameters, "large-blur");
+    const int totalSize = size.x*size.y*size.z;
+
+    if(getParamBool(parameters, "use-spline-tdf") || getParamBool(parameters, "use-fmg-gvf"))
+        std::cout << "NOTE: Spline TDF and FMG GVF are not available in the native backend. Using circle fitting TDF and GVF." << std::endl;
+
+    float * TDFsmall = NULL;
+    float * radiusSmall = NULL;
+    if(radiusMin < 2.5f) {
+        profiler.start("blur");
+        float * blurredVolume = dataset;
+        if(smallBlurSigma > 0)
+            blurredVolume = blurVolumeWithGaussianNative(dataset, size, smallBlurSigma);
+        profiler.stop("blur");
+        profiler.start("vector field");
+        float * FxSmall = new float[totalSize];
+        float * FySmall = new float[totalSize];
+        float * FzSmall = new float[totalSize];
+        createVectorFieldNative(blurredVolume, size, Fmax, vectorSign, FxSmall, FySmall, FzSmall);
+        if(smallBlurSigma > 0)
+            delete[] blurredVolume;
+        profiler.stop("vector field");
+
+        profiler.start("TDF");
+        TDFsmall = new float[totalSize];
+        radiusSmall = new float[totalSize];
+        runCircleFittingTDFNative(size, FxSmall, FySmall, FzSmall, TDFsmall, radiusSmall, radiusMin, 3.0f, 0.5f);
+        profiler.stop("TDF");
+
+        if(radiusMax < 2.5) {
+            // Stop here
+            T.Fx = FxSmall;
+            T.Fy = FySmall;
+            T.Fz = FzSmall;
+            T.vectorField = VectorFieldView(T.Fx, T.Fy, T.Fz);
+            T.TDF = TDFsmall;
+            T.radius = radiusSmall;
+            return;
+        }
+        delete[] FxSmall;
+        delete[] FySmall;
+        delete[] FzSmall;
+    }
+
+    /* Large Airways */
+    profiler.start("blur");
+    float * blurredVolume = dataset;
+    if(largeBlurSigma > 0)
+        blurredVolume = blurVolumeWithGaussianNative(dataset, size, largeBlurSigma);
+    profiler.stop("blur");
+    profiler.start("vector field");
+    T.Fx = new float[totalSize];
+    T.Fy = new float[totalSize];
+    T.Fz = new float[totalSize];
+    createVectorFieldNative(blurredVolume, size, Fmax, vectorSign, T.Fx, T.Fy, T.Fz);
+    T.vectorField = VectorFieldView(T.Fx, T.Fy, T.Fz);
+    if(largeBlurSigma > 0)
+        delete[] blurredVolume;
+    profiler.stop("vector field");
+
+    profiler.start("GVF");
+    runGVFNative(size, getParam(parameters, "gvf-mu"), getParam(parameters, "gvf-iterations"), T.Fx, T.Fy, T.Fz);
+    profiler.stop("GVF");
+
+    profiler.start("TDF");
+    T.TDF = new float[totalSize];
+    T.radius = new float[totalSize];
+    runCircleFittingTDFNative(size, T.Fx, T.Fy, T.Fz, T.TDF, T.radius, std::max(2.5f, radiusMin), radiusMax, radiusStep);
+
+    if(radiusMin < 2.5f) {
+        // Combine the small and large TDF, as in the combine kernel
+#pragma omp parallel for
+        for(int i = 0; i < totalSize; i++) {
+            if(T.TDF[i] < TDFsmall[i]) {
+                T.TDF[i] = TDFsmall[i];
+                T.radius[i] = radiusSmall[i];
+            }
+        }
+        delete[] TDFsmall;
+        delete[] radiusSmall;
+    }
+    profiler.stop("TDF");
+}
+
+TSFOutput * runNative(std::string filename, paramList &parameters) {
+    std::cout << "Using the native backend" << std::endl;
+
+    SIPL::int3 * size = new SIPL::int3();
+    TSFOutput * output = new TSFOutput(size);
+    TSFProfiler * profiler = output->getProfiler();
+    profiler->setEnabled(getParamBool(parameters, "timing") || getParamBool(parameters, "timer-total") || getParamStr(parameters, "timing-file") != "off");
+    profiler->start("total");
+    TubeSegmentation T;
+    // The output owns the radius if it is stored
+    const bool storeRadius = getParamStr(parameters, "storage-tdf-radius") != "off";
+    try {
+        profiler->start("read");
+        float * dataset = readDatasetToHost(filename, parameters, size, output);
+        profiler->stop("read");
+        runCircleFittingMethodNative(dataset, *size, parameters, T, *profiler);
+        delete[] dataset;
+        output->setTDF(T.TDF);
+        if(storeRadius)
+            output->setRadius(T.radius);
+
+        if(!getParamBool(parameters, "tdf-only")) {
+            if(getParamStr(parameters, "centerline-method") != "ridge")
+                std::cout << "NOTE: The native backend only supports the ridge centerline method. Using ridge." << std::endl;
+            profiler->start("centerline");
+            std::stack<CenterlinePoint> centerlineStack;
+            T.centerline = runRidgeTraversal(T, *size, parameters, centerlineStack, *profiler);
+            output->setCenterlineVoxels(T.centerline);
+            profiler->stop("centerline");
+            if(!getParamBool(parameters, "no-segmentation"))
+                std::cout << "NOTE: Segmentation is not available in the native backend." << std::endl;
+        }
+    } catch(SIPL::SIPLException &e) {
+        delete output;
+        throw;
+    }
+    delete[] T.Fx;
+    delete[] T.Fy;
+    delete[] T.Fz;
+    if(!storeRadius)
+        delete[] T.radius;
+
+    if(getParamStr(parameters, "storage-dir") != "off") {
+        writeDataToDisk(output, getParamStr(parameters, "storage-dir"), getParamStr(parameters, "storage-name"), parameters);
+    }
+    profiler->stop("total");
+    if(getParamStr(parameters, "timing-file") != "off")
+        profiler->writeToFile(getParamStr(parameters, "timing-file"));
+
+    return output;
+}
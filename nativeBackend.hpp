@@ -0,0 +1,30 @@
+#ifndef NATIVE_BACKEND_H
+#define NATIVE_BACKEND_H
+
+#include "tube-segmentation.hpp"
+
+/*
+ * C++ versions of the filters in kernels.cl, used when the device parameter is
+ * "native". This allows the TDF and the ridge traversal centerline extraction to
+ * run on machines without an OpenCL platform. The volumes are stored with x as
+ * the fastest changing index and are sampled with clamp to edge, as in the kernels.
+ */
+
+// Reads a .mhd file and converts it to floats in [0,1] using the minimum and maximum parameters
+float * readDatasetToHost(std::string filename, paramList &parameters, SIPL::int3 * size, TSFOutput * output);
+
+float * blurVolumeWithGaussianNative(float * volume, SIPL::int3 size, float sigma);
+
+void createVectorFieldNative(float * volume, SIPL::int3 size, float Fmax, int vsign, float * Fx, float * Fy, float * Fz);
+
+// Runs the GVF iterations in place on the vector field
+void runGVFNative(SIPL::int3 size, float mu, int iterations, float * Fx, float * Fy, float * Fz);
+
+void runCircleFittingTDFNative(SIPL::int3 size, float * Fx, float * Fy, float * Fz, float * TDF, float * radius, float radiusMin, float radiusMax, float radiusStep);
+
+// Fills Fx, Fy, Fz, TDF and radius of T
+void runCircleFittingMethodNative(float * dataset, SIPL::int3 size, paramList &parameters, TubeSegmentation &T, TSFProfiler &profiler);
+
+TSFOutput * runNative(std::string filename, paramList &parameters);
+
+#endif
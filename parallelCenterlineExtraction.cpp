@@ -1,7 +1,9 @@
 #include "parallelCenterlineExtraction.hpp"
+#include "memoryPool.hpp"
 #include "tube-segmentation.hpp"
 #include <vector>
 #include <queue>
+#include <algorithm>
 #include "inputOutput.hpp"
 #include "OpenCLUtilityLibrary/HistogramPyramids.hpp"
 #include "eigenanalysisOfHessian.hpp"
@@ -18,8 +20,6 @@ using namespace SIPL;
 
 #define LPOS(a,b,c) (a)+(b)*(size.x)+(c)*(size.x*size.y)
 #define POS(pos) pos.x+pos.y*size.x+pos.z*size.x*size.y
-#define M(a,b,c) 1-sqrt(pow(T.Fx[a+b*size.x+c*size.x*size.y],2.0f) + pow(T.Fy[a+b*size.x+c*size.x*size.y],2.0f) + pow(T.Fz[a+b*size.x+c*size.x*size.y],2.0f))
-#define SQR_MAG(pos) sqrt(pow(T.Fx[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.Fy[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.Fz[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f))
 #define SQR_MAG_SMALL(pos) sqrt(pow(T.FxSmall[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.FySmall[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.FzSmall[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f))
 
 
@@ -126,6 +126,34 @@ std::vector<Node *> minimumSpanningTreePCE(
 	return result;
 }
 
+static inline int findComponentRoot(int * labels, int i) {
+	while(labels[i] != i) {
+		// Path halving
+		labels[i] = labels[labels[i]];
+		i = labels[i];
+	}
+	return i;
+}
+
+void labelGraphComponents(const std::vector<SIPL::int2> &edges, const int nofVertices, int * labels) {
+	for(int i = 0; i < nofVertices; i++)
+		labels[i] = i;
+
+	for(int i = 0; i < edges.size(); i++) {
+		const int ra = findComponentRoot(labels, edges[i].x);
+		const int rb = findComponentRoot(labels, edges[i].y);
+		// The root with the smallest index becomes the root of both trees
+		if(ra < rb) {
+			labels[rb] = ra;
+		} else if(rb < ra) {
+			labels[ra] = rb;
+		}
+	}
+
+	for(int i = 0; i < nofVertices; i++)
+		labels[i] = findComponentRoot(labels, i);
+}
+
 void removeLoops(
 		std::vector<int3> &vertices,
 		std::vector<SIPL::int2> &edges,
@@ -208,25 +236,18 @@ void removeLoops(
 	if(sizeBeforeMST == 0) {
 	    throw SIPL::SIPLException("Centerline graph size is 0! Can't continue. Maybe lower min-tree-length?", __LINE__,__FILE__);
 	}
+	// Each MST visits a connected component, so a new tree is started from
+	// every node that was not visited by the previous trees
 	unordered_set<int> visited;
-	std::vector<Node *> newGraph = minimumSpanningTreePCE(0, graph, size, visited);
-	int sizeAfterMST = newGraph.size();
-
-	while(newGraph.size() < graph.size()) {
-		// Some nodes were not visited: find new root
-		int root;
-		for(int i = 0; i < graph.size(); i++) {
-			if(visited.find(POS(graph[i]->pos)) == visited.end()) {
-				// i has not been used
-				root = i;
-			}
-		}
+	std::vector<Node *> newGraph;
+	for(int root = 0; root < graph.size(); root++) {
+		if(visited.find(POS(graph[root]->pos)) != visited.end())
+			continue;
 
 		std::vector<Node *> newGraph2 = minimumSpanningTreePCE(root, graph, size, visited);
 		for(int i = 0; i < newGraph2.size(); i++) {
 			newGraph.push_back(newGraph2[i]);
 		}
-		int sizeAfterMST = newGraph.size();
 	}
 
 	// Restore graph
@@ -320,6 +341,97 @@ char * createCenterlineVoxels(
 
 	return centerlines;
 }
+/*
+ * The vertices are sorted by the cell of a uniform grid with cells of size
+ * maxDistance, so only the 27 cells around a vertex have to be searched.
+ */
+static inline long long getCellKey(int x, int y, int z, int3 &gridSize) {
+    return x + (long long)y*gridSize.x + (long long)z*gridSize.x*gridSize.y;
+}
+
+void findNeighbourVertices(const int * positions, const int nofVertices, const float maxDistance, std::vector<int> &offsets, std::vector<int> &neighbours, std::vector<float> &distances) {
+    offsets.assign(nofVertices+1, 0);
+    neighbours.clear();
+    distances.clear();
+    if(nofVertices == 0)
+        return;
+
+    int3 minimum(positions[0], positions[1], positions[2]);
+    int3 maximum = minimum;
+    for(int i = 1; i < nofVertices; i++) {
+        minimum.x = std::min(minimum.x, positions[i*3]);
+        minimum.y = std::min(minimum.y, positions[i*3+1]);
+        minimum.z = std::min(minimum.z, positions[i*3+2]);
+        maximum.x = std::max(maximum.x, positions[i*3]);
+        maximum.y = std::max(maximum.y, positions[i*3+1]);
+        maximum.z = std::max(maximum.z, positions[i*3+2]);
+    }
+    const float cellSize = std::max(maxDistance, 1.0f);
+    int3 gridSize(
+        (int)floor((maximum.x-minimum.x) / cellSize) + 1,
+        (int)floor((maximum.y-minimum.y) / cellSize) + 1,
+        (int)floor((maximum.z-minimum.z) / cellSize) + 1
+    );
+    std::vector<int3> cells(nofVertices);
+    std::vector<std::pair<long long, int> > sortedVertices(nofVertices);
+    for(int i = 0; i < nofVertices; i++) {
+        cells[i] = int3(
+            (int)floor((positions[i*3]-minimum.x) / cellSize),
+            (int)floor((positions[i*3+1]-minimum.y) / cellSize),
+            (int)floor((positions[i*3+2]-minimum.z) / cellSize)
+        );
+        sortedVertices[i] = std::make_pair(getCellKey(cells[i].x, cells[i].y, cells[i].z, gridSize), i);
+    }
+    // Sorting by the pair keeps the vertices of a cell in increasing index order
+    std::sort(sortedVertices.begin(), sortedVertices.end());
+
+    // Count neighbours of each vertex in the first pass and store them in the second
+    for(int pass = 0; pass < 2; pass++) {
+        if(pass == 1) {
+            for(int i = 0; i < nofVertices; i++)
+                offsets[i+1] += offsets[i];
+            neighbours.resize(offsets[nofVertices]);
+            distances.resize(offsets[nofVertices]);
+        }
+#pragma omp parallel for schedule(dynamic, 64)
+        for(int i = 0; i < nofVertices; i++) {
+            const int3 cell = cells[i];
+            int counter = 0;
+            std::vector<std::pair<int, float> > found;
+            for(int c = std::max(cell.z-1, 0); c <= std::min(cell.z+1, gridSize.z-1); c++) {
+            for(int b = std::max(cell.y-1, 0); b <= std::min(cell.y+1, gridSize.y-1); b++) {
+            for(int a = std::max(cell.x-1, 0); a <= std::min(cell.x+1, gridSize.x-1); a++) {
+                const long long key = getCellKey(a, b, c, gridSize);
+                std::vector<std::pair<long long, int> >::iterator it = std::lower_bound(
+                        sortedVertices.begin(), sortedVertices.end(), std::make_pair(key, 0));
+                for(; it != sortedVertices.end() && it->first == key; ++it) {
+                    const int j = it->second;
+                    const float dx = positions[i*3]-positions[j*3];
+                    const float dy = positions[i*3+1]-positions[j*3+1];
+                    const float dz = positions[i*3+2]-positions[j*3+2];
+                    const float distance = sqrt(dx*dx+dy*dy+dz*dz);
+                    if(distance < maxDistance && distance > 0.0f) {
+                        if(pass == 0) {
+                            counter++;
+                        } else {
+                            found.push_back(std::make_pair(j, distance));
+                        }
+                    }
+                }
+            }}}
+            if(pass == 0) {
+                offsets[i+1] = counter;
+            } else {
+                std::sort(found.begin(), found.end());
+                for(int k = 0; k < found.size(); k++) {
+                    neighbours[offsets[i]+k] = found[k].first;
+                    distances[offsets[i]+k] = found[k].second;
+                }
+            }
+        }
+    }
+}
+
 Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radius) {
     const int totalSize = size.x*size.y*size.z;
 	const bool no3Dwrite = !getParamBool(parameters, "3d_write");
@@ -338,48 +450,25 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
     region[1] = size.y;
     region[2] = size.z;
 
-    // Transfer TDF, vectorField and radius to host
+    // Transfer TDF and radius to host. The radius is transferred while the
+    // candidate points are found, and the vector field is mapped when they
+    // are filtered.
     TubeSegmentation T;
-    T.Fx = new float[totalSize];
-    T.Fy = new float[totalSize];
-    T.Fz = new float[totalSize];
     T.TDF = new float[totalSize];
+    AsyncImageRead * TDFRead = new AsyncImageRead(ocl, TDF, size);
+    AsyncImageRead * radiusRead = new AsyncImageRead(ocl, radius, size);
 
     if(!getParamBool(parameters, "16bit-vectors")) {
-    	// 32 bit vector fields
-        float * Fs = new float[totalSize*4];
-        ocl.queue.enqueueReadImage(vectorField, CL_TRUE, offset, region, 0, 0, Fs);
-#pragma omp parallel for
-        for(int i = 0; i < totalSize; i++) {
-            T.Fx[i] = Fs[i*4];
-            T.Fy[i] = Fs[i*4+1];
-            T.Fz[i] = Fs[i*4+2];
-        }
-        delete[] Fs;
-        ocl.queue.enqueueReadImage(TDF, CL_TRUE, offset, region, 0, 0, T.TDF);
+        TDFRead->copyTo(T.TDF);
     } else {
-    	// 16 bit vector fields
-        short * Fs = new short[totalSize*4];
-        ocl.queue.enqueueReadImage(vectorField, CL_TRUE, offset, region, 0, 0, Fs);
-#pragma omp parallel for
-        for(int i = 0; i < totalSize; i++) {
-            T.Fx[i] = MAX(-1.0f, Fs[i*4] / 32767.0f);
-            T.Fy[i] = MAX(-1.0f, Fs[i*4+1] / 32767.0f);;
-            T.Fz[i] = MAX(-1.0f, Fs[i*4+2] / 32767.0f);
-        }
-        delete[] Fs;
-
         // Convert 16 bit TDF to 32 bit
-        unsigned short * tempTDF = new unsigned short[totalSize];
-        ocl.queue.enqueueReadImage(TDF, CL_TRUE, offset, region, 0, 0, tempTDF);
+        unsigned short * tempTDF = (unsigned short *)TDFRead->getData();
 #pragma omp parallel for
         for(int i = 0; i < totalSize; i++) {
             T.TDF[i] = (float)tempTDF[i] / 65535.0f;
         }
-        delete[] tempTDF;
     }
-    T.radius = new float[totalSize];
-    ocl.queue.enqueueReadImage(radius, CL_TRUE, offset, region, 0, 0, T.radius);
+    delete TDFRead;
 
     // Get candidate points
     std::vector<int3> candidatePoints;
@@ -395,7 +484,13 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
     }}}
     std::cout << "candidate points: " << candidatePoints.size() << std::endl;
 
+    T.radius = new float[totalSize];
+    radiusRead->copyTo(T.radius);
+    delete radiusRead;
+
     unordered_set<int> filteredPoints;
+    HostVectorField * hostVectorField = new HostVectorField(ocl, vectorField, size);
+    T.vectorField = hostVectorField->getView();
 #pragma omp parallel for
     for(int i = 0; i < candidatePoints.size(); i++) {
         int3 pos = candidatePoints[i];
@@ -423,7 +518,7 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
             float3 r_projected_n = r_projected.normalize();
             float theta = acos(rn.dot(r_projected_n));
             if((theta < thetaLimit && length < maxD)) {
-                if(SQR_MAG(n) < SQR_MAG(pos)) {
+                if(T.vectorField.magnitude(POS(n)) < T.vectorField.magnitude(POS(pos))) {
                     invalid = true;
                     break;
                 }
@@ -435,6 +530,8 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
             filteredPoints.insert(POS(pos));
         }
     }
+    delete hostVectorField;
+    T.vectorField = VectorFieldView();
     candidatePoints.clear();
     std::cout << "filtered points: " << filteredPoints.size() << std::endl;
 
@@ -473,24 +570,34 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
     std::cout << "filtered points: " <<nofPoints<< std::endl;
     std::vector<SIPL::int2> edges;
 
-    // Do linking
+    // Do linking. Pairs are only accepted if the sum of their distances is
+    // below 2*maxDistance, so only vertices within that distance are searched.
+    int * centerpointPositions = new int[nofPoints*3];
+    for(int i = 0; i < nofPoints; i++) {
+        centerpointPositions[i*3] = centerpoints[i].x;
+        centerpointPositions[i*3+1] = centerpoints[i].y;
+        centerpointPositions[i*3+2] = centerpoints[i].z;
+    }
+    std::vector<int> neighbourOffsets, neighbours;
+    std::vector<float> neighbourDistances;
+    findNeighbourVertices(centerpointPositions, nofPoints, maxDistance*2+1, neighbourOffsets, neighbours, neighbourDistances);
+    delete[] centerpointPositions;
+
     for(int i = 0; i < nofPoints;i++) {
         int3 xa = centerpoints[i];
         SIPL::int2 bestPair;
         float shortestDistance = maxDistance*2;
         bool validPairFound = false;
 
-        for(int j = 0; j < nofPoints;j++) {
-            if(i == j)
-                continue;
+        for(int n = neighbourOffsets[i]; n < neighbourOffsets[i+1]; n++) {
+            const int j = neighbours[n];
             int3 xb = centerpoints[j];
 
             int db = round(xa.distance(xb));
             if(db >= shortestDistance)
                 continue;
-            for(int k = 0; k < j;k++) {
-                if(k == i)
-                    continue;
+            for(int m = neighbourOffsets[i]; m < n; m++) {
+                const int k = neighbours[m];
                 int3 xc = centerpoints[k];
 
                 int dc = round(xa.distance(xc));
@@ -550,29 +657,8 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
     std::cout << "nr of edges: " << edges.size() << std::endl;
 
     // Do graph component labeling
-    // Create initial labels
     int * labels = new int[nofPoints];
-    for(int i = 0; i < nofPoints; i++) {
-        labels[i] = i;
-    }
-
-    // Do iteratively using edges until no more changes
-    bool changeDetected = true;
-    while(changeDetected) {
-        changeDetected = false;
-        for(int i = 0; i < edges.size(); i++) {
-            SIPL::int2 edge = edges[i];
-            if(labels[edge.x] != labels[edge.y]) {
-                changeDetected = true;
-                if(labels[edge.x] < labels[edge.y]) {
-                    labels[edge.x] = labels[edge.y];
-                } else {
-                    labels[edge.y] = labels[edge.x];
-                }
-            }
-        }
-    }
-
+    labelGraphComponents(edges, nofPoints, labels);
 
     // Calculate length of each label
     int * lengths = new int[nofPoints]();
@@ -624,8 +710,8 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
 
     ocl.queue.finish();
     char * centerlinesData = createCenterlineVoxels(vertices, edges, T.radius, size);
-    Image3D centerlines= Image3D(
-        ocl.context,
+    Image3D centerlines= createImage3D(
+        ocl,
         CL_MEM_READ_WRITE,
         ImageFormat(CL_R, CL_SIGNED_INT8),
         size.x, size.y, size.z
@@ -655,9 +741,6 @@ Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList
     ocl.queue.finish();
 
     delete[] T.TDF;
-    delete[] T.Fx;
-    delete[] T.Fy;
-    delete[] T.Fz;
     delete[] T.radius;
     delete[] centerlinesData;
 
@@ -691,27 +774,23 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
     Kernel ddKernel(ocl.program, "dd");
     Kernel initCharBuffer(ocl.program, "initCharBuffer");
 
-    cl::Event startEvent, endEvent;
-    cl_ulong start, end;
-    if(getParamBool(parameters, "timing")) {
-        ocl.queue.enqueueMarker(&startEvent);
-    }
-    Image3D * centerpointsImage2 = new Image3D(
-            ocl.context,
+    ocl.profiler->start("centerline/centerpoints", ocl.queue);
+    Image3D * centerpointsImage2 = new Image3D(createImage3D(
+            ocl,
             CL_MEM_READ_WRITE,
             ImageFormat(CL_R, CL_SIGNED_INT8),
             size.x, size.y, size.z
-    );
+    ));
     ocl.GC->addMemoryObject(centerpointsImage2);
     Buffer vertices;
     int sum = 0;
 
     if(no3Dwrite) {
-        Buffer * centerpoints = new Buffer(
-                ocl.context,
+        Buffer * centerpoints = new Buffer(createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 sizeof(char)*totalSize
-        );
+        ));
         ocl.GC->addMemoryObject(centerpoints);
 
         candidatesKernel.setArg(0, TDF);
@@ -730,11 +809,11 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
         candidates2Kernel.setArg(0, TDF);
         candidates2Kernel.setArg(1, radius);
         candidates2Kernel.setArg(2, vectorField);
-        Buffer * centerpoints2 = new Buffer(
-                ocl.context,
+        Buffer * centerpoints2 = new Buffer(createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 sizeof(char)*totalSize
-        );
+        ));
         ocl.GC->addMemoryObject(centerpoints2);
         initCharBuffer.setArg(0, *centerpoints2);
         ocl.queue.enqueueNDRangeKernel(
@@ -752,7 +831,7 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
         hp3.traverse(candidates2Kernel, 4);
         ocl.queue.finish();
         hp3.deleteHPlevels();
-        ocl.GC->deleteMemoryObject(centerpoints);
+        deleteMemoryObject(ocl, centerpoints);
         ocl.queue.enqueueCopyBufferToImage(
             *centerpoints2,
             *centerpointsImage2,
@@ -761,7 +840,7 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
             region
         );
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(centerpoints2);
+        deleteMemoryObject(ocl, centerpoints2);
 
 		if(getParamBool(parameters, "centerpoints-only")) {
 			return *centerpointsImage2;
@@ -769,11 +848,11 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
         ddKernel.setArg(0, TDF);
         ddKernel.setArg(1, *centerpointsImage2);
         ddKernel.setArg(3, cubeSize);
-        Buffer * centerpoints3 = new Buffer(
-                ocl.context,
+        Buffer * centerpoints3 = new Buffer(createBuffer(
+                ocl,
                 CL_MEM_READ_WRITE,
                 sizeof(char)*totalSize
-        );
+        ));
         ocl.GC->addMemoryObject(centerpoints3);
         initCharBuffer.setArg(0, *centerpoints3);
         ocl.queue.enqueueNDRangeKernel(
@@ -790,7 +869,7 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
                 NullRange
         );
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(centerpointsImage2);
+        deleteMemoryObject(ocl, centerpointsImage2);
 
         // Construct HP of centerpointsImage
         oul::HistogramPyramid3DBuffer hp(ocl);
@@ -802,7 +881,7 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
         vertices = hp.createPositionBuffer();
         ocl.queue.finish();
         hp.deleteHPlevels();
-        ocl.GC->deleteMemoryObject(centerpoints3);
+        deleteMemoryObject(ocl, centerpoints3);
     } else {
         Kernel init3DImage(ocl.program, "init3DImage");
         init3DImage.setArg(0, *centerpointsImage2);
@@ -813,12 +892,12 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
             NullRange
         );
 
-        Image3D * centerpointsImage = new Image3D(
-                ocl.context,
+        Image3D * centerpointsImage = new Image3D(createImage3D(
+                ocl,
                 CL_MEM_READ_WRITE,
                 ImageFormat(CL_R, CL_SIGNED_INT8),
                 size.x, size.y, size.z
-        );
+        ));
         ocl.GC->addMemoryObject(centerpointsImage);
 
         candidatesKernel.setArg(0, TDF);
@@ -847,14 +926,14 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
         hp3.traverse(candidates2Kernel, 4);
         ocl.queue.finish();
         hp3.deleteHPlevels();
-        ocl.GC->deleteMemoryObject(centerpointsImage);
+        deleteMemoryObject(ocl, centerpointsImage);
 
-        Image3D * centerpointsImage3 = new Image3D(
-                ocl.context,
+        Image3D * centerpointsImage3 = new Image3D(createImage3D(
+                ocl,
                 CL_MEM_READ_WRITE,
                 ImageFormat(CL_R, CL_SIGNED_INT8),
                 size.x, size.y, size.z
-        );
+        ));
         ocl.GC->addMemoryObject(centerpointsImage3);
         init3DImage.setArg(0, *centerpointsImage3);
         ocl.queue.enqueueNDRangeKernel(
@@ -878,7 +957,7 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
                 NullRange
         );
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(centerpointsImage2);
+        deleteMemoryObject(ocl, centerpointsImage2);
 
         // Construct HP of centerpointsImage
         oul::HistogramPyramid3D hp(ocl);
@@ -890,185 +969,111 @@ Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters,
         vertices = hp.createPositionBuffer();
         ocl.queue.finish();
         hp.deleteHPlevels();
-        ocl.GC->deleteMemoryObject(centerpointsImage3);
+        deleteMemoryObject(ocl, centerpointsImage3);
     }
     if(sum < 8) {
     	throw SIPL::SIPLException("Too few centerpoints detected. Revise parameters.", __LINE__, __FILE__);
-    } else if(sum >= 16384) {
-    	throw SIPL::SIPLException("Too many centerpoints detected. More cropping of dataset is probably needed.", __LINE__, __FILE__);
     }
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME centerpoint extraction: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
-
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
-    // Run linking kernel
-    Image2D edgeTuples = Image2D(
+    ocl.profiler->stop("centerline/centerpoints", ocl.queue);
+
+    ocl.profiler->start("centerline/linking", ocl.queue);
+    // Find the vertices within max-distance of each vertex on the host
+    int * vertexPositions = new int[sum*3];
+    ocl.queue.enqueueReadBuffer(vertices, CL_TRUE, 0, sum*3*sizeof(int), vertexPositions);
+    std::vector<int> neighbourOffsets, neighbours;
+    std::vector<float> neighbourDistances;
+    findNeighbourVertices(vertexPositions, sum, maxDistance, neighbourOffsets, neighbours, neighbourDistances);
+    delete[] vertexPositions;
+    std::cout << "number of vertex pairs within max-distance " << neighbours.size() << std::endl;
+    // Buffers can't be empty
+    if(neighbours.size() == 0) {
+        neighbours.push_back(0);
+        neighbourDistances.push_back(0.0f);
+    }
+    Buffer neighbourOffsetsBuffer = Buffer(
             ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, CL_UNSIGNED_INT8),
-            sum, sum
-    );
-    Kernel init2DImage(ocl.program, "init2DImage");
-    init2DImage.setArg(0, edgeTuples);
-    ocl.queue.enqueueNDRangeKernel(
-        init2DImage,
-        NullRange,
-        NDRange(sum, sum),
-        NullRange
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            sizeof(int)*(sum+1),
+            &neighbourOffsets[0]
     );
-    int globalSize = sum;
-    while(globalSize % 64 != 0) globalSize++;
-
-    // Create lengths image
-    Image2D * lengths = new Image2D(
+    Buffer neighboursBuffer = Buffer(
             ocl.context,
-            CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, CL_FLOAT),
-            sum, sum
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            sizeof(int)*neighbours.size(),
+            &neighbours[0]
     );
-    ocl.GC->addMemoryObject(lengths);
-
-    // Run linkLengths kernel
-    Kernel linkLengths(ocl.program, "linkLengths");
-    linkLengths.setArg(0, vertices);
-    linkLengths.setArg(1, *lengths);
-    ocl.queue.enqueueNDRangeKernel(
-            linkLengths,
-            NullRange,
-            NDRange(sum, sum),
-            NullRange
-    );
-
-    // Create and init compacted_lengths image
-    float * cl = new float[sum*sum*2]();
-    Image2D * compacted_lengths = new Image2D(
+    Buffer neighbourDistancesBuffer = Buffer(
             ocl.context,
-            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-            ImageFormat(CL_RG, CL_FLOAT),
-            sum, sum,
-            0,
-            cl
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            sizeof(float)*neighbourDistances.size(),
+            &neighbourDistances[0]
     );
-    ocl.GC->addMemoryObject(compacted_lengths);
-    delete[] cl;
+    int globalSize = sum;
+    while(globalSize % 64 != 0) globalSize++;
 
-    // Create and initialize incs buffer
-    Buffer incs = Buffer(
-            ocl.context,
+    // Each vertex selects the best pair of vertices to link to
+    Buffer bestPairs = createBuffer(
+            ocl,
             CL_MEM_READ_WRITE,
-            sizeof(int)*sum
+            sizeof(int)*2*sum
     );
-
-    Kernel initIncsBuffer(ocl.program, "initIntBuffer");
-    initIncsBuffer.setArg(0, incs);
-    ocl.queue.enqueueNDRangeKernel(
-        initIncsBuffer,
-        NullRange,
-        NDRange(sum),
-        NullRange
-    );
-
-    // Run compact kernel
-    Kernel compactLengths(ocl.program, "compact");
-    compactLengths.setArg(0, *lengths);
-    compactLengths.setArg(1, incs);
-    compactLengths.setArg(2, *compacted_lengths);
-    compactLengths.setArg(3, maxDistance);
-    ocl.queue.enqueueNDRangeKernel(
-            compactLengths,
-            NullRange,
-            NDRange(sum, sum),
-            NullRange
-    );
-    ocl.queue.finish();
-    ocl.GC->deleteMemoryObject(lengths);
-
     Kernel linkingKernel(ocl.program, "linkCenterpoints");
     linkingKernel.setArg(0, TDF);
     linkingKernel.setArg(1, vertices);
-    linkingKernel.setArg(2, edgeTuples);
-    linkingKernel.setArg(3, *compacted_lengths);
-    linkingKernel.setArg(4, sum);
-    linkingKernel.setArg(5, Tmean);
-    linkingKernel.setArg(6, maxDistance);
+    linkingKernel.setArg(2, neighbourOffsetsBuffer);
+    linkingKernel.setArg(3, neighboursBuffer);
+    linkingKernel.setArg(4, neighbourDistancesBuffer);
+    linkingKernel.setArg(5, bestPairs);
+    linkingKernel.setArg(6, sum);
+    linkingKernel.setArg(7, Tmean);
+    linkingKernel.setArg(8, maxDistance);
     ocl.queue.enqueueNDRangeKernel(
             linkingKernel,
             NullRange,
             NDRange(globalSize),
             NDRange(64)
     );
-    ocl.queue.finish();
-    ocl.GC->deleteMemoryObject(compacted_lengths);
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME linking: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
+    ocl.profiler->stop("centerline/linking", ocl.queue);
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
-
-	// Remove duplicate edges
-	Image2D edgeTuples2 = Image2D(
-			ocl.context,
+    ocl.profiler->start("centerline/compaction", ocl.queue);
+    // Store the edges, without duplicates, in the edges buffer
+    Buffer edges = createBuffer(
+            ocl,
             CL_MEM_READ_WRITE,
-            ImageFormat(CL_R, CL_UNSIGNED_INT8),
-            sum, sum
+            sizeof(int)*2*2*sum
+    );
+    Buffer edgeCounter = createBuffer(
+            ocl,
+            CL_MEM_READ_WRITE,
+            sizeof(int)
     );
-	Kernel removeDuplicatesKernel(ocl.program, "removeDuplicateEdges");
-	removeDuplicatesKernel.setArg(0, edgeTuples);
-	removeDuplicatesKernel.setArg(1, edgeTuples2);
-	ocl.queue.enqueueNDRangeKernel(
-			removeDuplicatesKernel,
-			NullRange,
-			NDRange(sum,sum),
-			NullRange
-	);
-	edgeTuples = edgeTuples2;
-
-    // Run HP on edgeTuples
-    oul::HistogramPyramid2D hp2(ocl);
-    hp2.create(edgeTuples, sum, sum);
-
-	std::cout << "number of edges detected " << hp2.getSum() << std::endl;
-    if(hp2.getSum() == 0) {
+    int sum2 = 0;
+    ocl.queue.enqueueWriteBuffer(edgeCounter, CL_FALSE, 0, sizeof(int), &sum2);
+    Kernel compactEdgesKernel(ocl.program, "compactEdges");
+    compactEdgesKernel.setArg(0, bestPairs);
+    compactEdgesKernel.setArg(1, edges);
+    compactEdgesKernel.setArg(2, edgeCounter);
+    compactEdgesKernel.setArg(3, sum);
+    ocl.queue.enqueueNDRangeKernel(
+            compactEdgesKernel,
+            NullRange,
+            NDRange(globalSize),
+            NDRange(64)
+    );
+    ocl.queue.enqueueReadBuffer(edgeCounter, CL_TRUE, 0, sizeof(int), &sum2);
+
+	std::cout << "number of edges detected " << sum2 << std::endl;
+    if(sum2 == 0) {
         throw SIPL::SIPLException("No edges were found", __LINE__, __FILE__);
-    } else if(hp2.getSum() > 10000000) {
-    	throw SIPL::SIPLException("More than 10 million edges found. Must be wrong!", __LINE__, __FILE__);
-    } else if(hp2.getSum() < 0){
-    	throw SIPL::SIPLException("A negative number of edges was found!", __LINE__, __FILE__);
     }
+    ocl.profiler->stop("centerline/compaction", ocl.queue);
 
-    // Run create positions kernel on edges
-    Buffer edges = hp2.createPositionBuffer();
-    ocl.queue.finish();
-    hp2.deleteHPlevels();
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME HP creation and traversal: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
-
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
+    ocl.profiler->start("centerline/labeling", ocl.queue);
 
     // Do graph component labeling
-    Buffer C = Buffer(
-            ocl.context,
+    Buffer C = createBuffer(
+            ocl,
             CL_MEM_READ_WRITE,
             sizeof(int)*sum
     );
@@ -1083,60 +1088,54 @@ if(getParamBool(parameters, "timing")) {
     );
 
 
-    Buffer m = Buffer(
-            ocl.context,
-            CL_MEM_WRITE_ONLY,
+    Buffer m = createBuffer(
+            ocl,
+            CL_MEM_READ_WRITE,
             sizeof(int)
     );
 
-    Kernel labelingKernel(ocl.program, "graphComponentLabeling");
-    labelingKernel.setArg(0, edges);
-    labelingKernel.setArg(1, C);
-    labelingKernel.setArg(2, m);
+    // Hook the trees of the edges together and compress the trees with
+    // pointer jumping until no edge connects two different trees
+    Kernel hookingKernel(ocl.program, "graphComponentHooking");
+    hookingKernel.setArg(0, edges);
+    hookingKernel.setArg(1, C);
+    hookingKernel.setArg(2, m);
+    hookingKernel.setArg(3, sum2);
+    Kernel pointerJumpingKernel(ocl.program, "graphComponentPointerJumping");
+    pointerJumpingKernel.setArg(0, C);
+    pointerJumpingKernel.setArg(1, sum);
+    int edgesGlobalSize = sum2;
+    while(edgesGlobalSize % 64 != 0) edgesGlobalSize++;
     int M;
-    int sum2 = hp2.getSum();
-    labelingKernel.setArg(3, sum2);
-    globalSize = sum2;
-    while(globalSize % 64 != 0) globalSize++;
     int i = 0;
-    int minIterations = 100;
     do {
-        // write 0 to m
-        if(i > minIterations) {
-            M = 0;
-            ocl.queue.enqueueWriteBuffer(m, CL_FALSE, 0, sizeof(int), &M);
-        } else {
-            M = 1;
-        }
-
+        M = 0;
+        ocl.queue.enqueueWriteBuffer(m, CL_FALSE, 0, sizeof(int), &M);
+        ocl.queue.enqueueNDRangeKernel(
+                hookingKernel,
+                NullRange,
+                NDRange(edgesGlobalSize),
+                NDRange(64)
+        );
         ocl.queue.enqueueNDRangeKernel(
-                labelingKernel,
+                pointerJumpingKernel,
                 NullRange,
                 NDRange(globalSize),
                 NDRange(64)
         );
 
         // read m from device
-        if(i > minIterations)
-            ocl.queue.enqueueReadBuffer(m, CL_TRUE, 0, sizeof(int), &M);
+        ocl.queue.enqueueReadBuffer(m, CL_TRUE, 0, sizeof(int), &M);
         ++i;
     } while(M == 1);
     std::cout << "did graph component labeling in " << i << " iterations " << std::endl;
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME graph component labeling: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
+    ocl.profiler->stop("centerline/labeling", ocl.queue);
 
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
+    ocl.profiler->start("centerline/small tree removal", ocl.queue);
     // Remove small trees
-    Buffer S = Buffer(
-            ocl.context,
+    Buffer S = createBuffer(
+            ocl,
             CL_MEM_READ_WRITE,
             sizeof(int)*sum
     );
@@ -1158,8 +1157,8 @@ if(getParamBool(parameters, "timing")) {
             NDRange(sum),
             NullRange
     );
-    Image3D centerlines= Image3D(
-            ocl.context,
+    Image3D centerlines= createImage3D(
+            ocl,
             CL_MEM_READ_WRITE,
             ImageFormat(CL_R, CL_SIGNED_INT8),
             size.x, size.y, size.z
@@ -1266,8 +1265,8 @@ if(getParamBool(parameters, "timing")) {
 		RSTKernel.setArg(3, S);
 		RSTKernel.setArg(4, minTreeLength);
 		if(no3Dwrite) {
-			Buffer centerlinesBuffer = Buffer(
-					ocl.context,
+			Buffer centerlinesBuffer = createBuffer(
+					ocl,
 					CL_MEM_WRITE_ONLY,
 					sizeof(char)*totalSize
 			);
@@ -1321,12 +1320,6 @@ if(getParamBool(parameters, "timing")) {
 		}
     }
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME of removing small trees: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
+    ocl.profiler->stop("centerline/small tree removal", ocl.queue);
     return centerlines;
 }
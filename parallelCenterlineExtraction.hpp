@@ -3,8 +3,15 @@
 #include "commons.hpp"
 #include "SIPL/Types.hpp"
 #include "parameters.hpp"
+#include <vector>
 using namespace cl;
 
 Image3D runNewCenterlineAlg(OpenCL &ocl, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radius);
 Image3D runNewCenterlineAlgWithoutOpenCL(OpenCL &ocl, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radius);
+// Finds the vertices (x,y,z triplets) closer than maxDistance to each vertex.
+// The neighbours of vertex i, in increasing order, are stored in
+// neighbours[offsets[i]] to neighbours[offsets[i+1]-1], and their distances in distances.
+void findNeighbourVertices(const int * positions, const int nofVertices, const float maxDistance, std::vector<int> &offsets, std::vector<int> &neighbours, std::vector<float> &distances);
+// Labels each vertex with the smallest vertex index in its connected component
+void labelGraphComponents(const std::vector<SIPL::int2> &edges, const int nofVertices, int * labels);
 #endif
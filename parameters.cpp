@@ -6,7 +6,7 @@
 #include "tsf-config.h"
 #include <locale>
 #include <sstream>
-#include "tsf-config.h"
+#include "commons.hpp"
 using namespace std;
 
 float stringToFloat(string str) {
@@ -106,6 +106,11 @@ void loadParameterPreset(paramList &parameters, std::string parameter_dir) {
 }
 
 paramList initParameters(std::string parameter_dir) {
+	static unordered_map<std::string, paramList> parsedParameters;
+	static Mutex mutex;
+	MutexLock lock(mutex);
+	if(parsedParameters.count(parameter_dir) > 0)
+		return parsedParameters[parameter_dir];
 	paramList parameters;
 
 	std::ifstream file;
@@ -168,6 +173,7 @@ paramList initParameters(std::string parameter_dir) {
 		getline(file, line);
 	}
 
+	parsedParameters[parameter_dir] = parameters;
 	return parameters;
 }
 
@@ -197,31 +203,44 @@ void setParameter(paramList &parameters, string name, string value) {
 
 }
 
-float getParam(paramList parameters, string parameterName) {
-	if(parameters.numerics.count(parameterName) == 0) {
+float getParam(const paramList &parameters, const string &parameterName) {
+	unordered_map<std::string, NumericParameter>::const_iterator it = parameters.numerics.find(parameterName);
+	if(it == parameters.numerics.end()) {
     	std::string str = "numeric parameter not found: " + parameterName;
         throw SIPL::SIPLException(str.c_str());
 	}
-	NumericParameter v = parameters.numerics[parameterName];
-	return v.get();
+	return it->second.get();
 }
 
-bool getParamBool(paramList parameters, string parameterName) {
-	if(parameters.bools.count(parameterName) == 0) {
+bool getParamBool(const paramList &parameters, const string &parameterName) {
+	unordered_map<std::string, BoolParameter>::const_iterator it = parameters.bools.find(parameterName);
+	if(it == parameters.bools.end()) {
     	std::string str = "bool parameter not found: " + parameterName;
         throw SIPL::SIPLException(str.c_str());
 	}
-	BoolParameter v = parameters.bools[parameterName];
-	return v.get();
+	return it->second.get();
 }
 
-string getParamStr(paramList parameters, string parameterName) {
-	if(parameters.strings.count(parameterName) == 0) {
+string getParamStr(const paramList &parameters, const string &parameterName) {
+	unordered_map<std::string, StringParameter>::const_iterator it = parameters.strings.find(parameterName);
+	if(it == parameters.strings.end()) {
     	std::string str = "string parameter not found: " + parameterName;
         throw SIPL::SIPLException(str.c_str());
 	}
-	StringParameter v = parameters.strings[parameterName];
-	return v.get();
+	return it->second.get();
+}
+
+void validateParameters(const paramList &parameters) {
+	if(getParam(parameters, "radius-min") > getParam(parameters, "radius-max")) {
+		throw SIPL::SIPLException("radius-min can not be larger than radius-max", __LINE__, __FILE__);
+	}
+	if(getParamStr(parameters, "centerline-method") == "ridge" &&
+			getParam(parameters, "tdf-low") > getParam(parameters, "tdf-high")) {
+		throw SIPL::SIPLException("tdf-low can not be larger than tdf-high", __LINE__, __FILE__);
+	}
+	if(getParamBool(parameters, "16bit-vectors") && getParamBool(parameters, "32bit-vectors")) {
+		throw SIPL::SIPLException("16bit-vectors and 32bit-vectors can not both be set", __LINE__, __FILE__);
+	}
 }
 
 paramList getParameters(int argc, char ** argv) {
@@ -265,6 +284,7 @@ paramList getParameters(int argc, char ** argv) {
 			setParameter(parameters, token.substr(2), nextToken);
         }
     }
+	validateParameters(parameters);
 
 	return parameters;
 }
@@ -275,7 +295,7 @@ BoolParameter::BoolParameter(bool defaultValue, string description, string group
 	this->group = group;
 }
 
-bool BoolParameter::get() {
+bool BoolParameter::get() const {
 	return this->value;
 }
 
@@ -292,7 +312,7 @@ NumericParameter::NumericParameter(float defaultValue, float min, float max, flo
 	this->group = group;
 }
 
-float NumericParameter::get() {
+float NumericParameter::get() const {
 	return this->value;
 }
 
@@ -304,7 +324,7 @@ void NumericParameter::set(float value) {
 	}
 }
 
-bool NumericParameter::validate(float value) {
+bool NumericParameter::validate(float value) const {
 	return (value >= min) && (value <= max) ;//&& ((float)ceil((value-min)/step) - (float)(value-min)/step < 0.0001);
 }
 
@@ -315,7 +335,7 @@ StringParameter::StringParameter(string defaultValue, vector<string> possibiliti
 	this->group = group;
 }
 
-string StringParameter::get() {
+string StringParameter::get() const {
 	return this->value;
 }
 
@@ -331,9 +351,9 @@ void StringParameter::setWithoutValidation(std::string value) {
     this->value = value;
 }
 
-bool StringParameter::validate(string value) {
+bool StringParameter::validate(string value) const {
 	if(possibilities.size() > 0) {
-		vector<string>::iterator it;
+		vector<string>::const_iterator it;
 		bool found = false;
 		for(it=possibilities.begin();it!=possibilities.end();it++){
 			if(value == *it) {
@@ -21,7 +21,7 @@ class BoolParameter {
 public:
 	BoolParameter() {};
 	BoolParameter(bool defaultValue, std::string description, std::string group);
-	bool get();
+	bool get() const;
 	void set(bool value);
 	std::string getDescription() const;
 	std::string getGroup() const;
@@ -36,9 +36,9 @@ class NumericParameter {
 public:
 	NumericParameter() {};
 	NumericParameter(float defaultValue, float min, float max, float step, std::string description, std::string group);
-	float get();
+	float get() const;
 	void set(float value);
-	bool validate(float value);
+	bool validate(float value) const;
 	float getMax() const;
 	void setMax(float max);
 	float getMin() const;
@@ -61,10 +61,10 @@ class StringParameter {
 public:
 	StringParameter() {};
 	StringParameter(std::string defaultValue, std::vector<std::string> possibilities, std::string description, std::string group);
-	std::string get();
+	std::string get() const;
 	void set(std::string value);
 	void setWithoutValidation(std::string value);
-	bool validate(std::string value);
+	bool validate(std::string value) const;
 	std::vector<std::string> getPossibilities() const;
 	std::string getDescription() const;
 	std::string getGroup() const;
@@ -82,12 +82,15 @@ typedef struct paramList {
 } paramList;
 
 void loadParameterPreset(paramList &parameters, std::string parameter_dir);
+// The parameters file is parsed once per directory, later calls return a copy
 paramList initParameters(std::string parameter_dir);
 void setParameter(paramList &parameters, std::string name, std::string value);
 paramList getParameters(int argc, char ** argv);
-float getParam(paramList parameters, std::string parameterName);
-bool getParamBool(paramList parameters, std::string parameterName);
-std::string getParamStr(paramList parameters, std::string parameterName);
+float getParam(const paramList &parameters, const std::string &parameterName);
+bool getParamBool(const paramList &parameters, const std::string &parameterName);
+std::string getParamStr(const paramList &parameters, const std::string &parameterName);
+// Throws an exception if the values of different parameters contradict each other
+void validateParameters(const paramList &parameters);
 void printAllParameters();
 
 #endif /* PARAMETERS_HPP_ */
@@ -0,0 +1,184 @@
+#include "profiler.hpp"
+#include "SIPL/Exceptions.hpp"
+#include <iostream>
+#include <fstream>
+#ifdef CPP11
+#include <chrono>
+#else
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#endif
+
+// Current wall time in ms
+static double getHostTime() {
+#ifdef CPP11
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now().time_since_epoch()
+    ).count()*1.0e-3;
+#else
+    return (boost::posix_time::microsec_clock::universal_time() -
+            boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_microseconds()*1.0e-3;
+#endif
+}
+
+TSFProfiler::TSFProfiler(bool enabled) {
+    this->enabled = enabled;
+}
+
+void TSFProfiler::setEnabled(bool enabled) {
+    this->enabled = enabled;
+}
+
+bool TSFProfiler::isEnabled() const {
+    return enabled;
+}
+
+StageTiming & TSFProfiler::getStage(std::string stage) {
+    for(unsigned int i = 0; i < stages.size(); i++) {
+        if(stages[i].name == stage)
+            return stages[i];
+    }
+    StageTiming timing;
+    timing.name = stage;
+    timing.hostTime = 0.0;
+    timing.deviceTime = 0.0;
+    timing.bytesTransferred = 0;
+    timing.count = 0;
+    timing.iterations = 0;
+    stages.push_back(timing);
+    return stages.back();
+}
+
+void TSFProfiler::start(std::string stage) {
+    if(!enabled)
+        return;
+    getStage(stage);
+    hostStart[stage] = getHostTime();
+}
+
+void TSFProfiler::start(std::string stage, cl::CommandQueue &queue) {
+    if(!enabled)
+        return;
+    cl::Event startEvent;
+    queue.enqueueMarker(&startEvent);
+    deviceStart[stage] = startEvent;
+    start(stage);
+}
+
+void TSFProfiler::stop(std::string stage) {
+    if(!enabled || hostStart.count(stage) == 0)
+        return;
+    StageTiming &timing = getStage(stage);
+    const double hostTime = getHostTime() - hostStart[stage];
+    hostStart.erase(stage);
+    timing.hostTime += hostTime;
+    timing.count++;
+    std::cout << "RUNTIME of " << stage << ": " << hostTime << " ms" << std::endl;
+}
+
+void TSFProfiler::stop(std::string stage, cl::CommandQueue &queue) {
+    if(!enabled || hostStart.count(stage) == 0)
+        return;
+    cl::Event endEvent;
+    queue.enqueueMarker(&endEvent);
+    queue.finish();
+    StageTiming &timing = getStage(stage);
+    const double hostTime = getHostTime() - hostStart[stage];
+    hostStart.erase(stage);
+    double deviceTime = 0.0;
+    if(deviceStart.count(stage) > 0) {
+        cl_ulong start, end;
+        deviceStart[stage].getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
+        endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
+        deviceTime = (end-start)*1.0e-6;
+        deviceStart.erase(stage);
+    }
+    timing.hostTime += hostTime;
+    timing.deviceTime += deviceTime;
+    timing.count++;
+    std::cout << "RUNTIME of " << stage << ": " << hostTime << " ms (device " << deviceTime << " ms)" << std::endl;
+}
+
+void TSFProfiler::addBytesTransferred(std::string stage, unsigned long long bytes) {
+    if(!enabled)
+        return;
+    getStage(stage).bytesTransferred += bytes;
+}
+
+void TSFProfiler::addIterations(std::string stage, int iterations) {
+    if(!enabled)
+        return;
+    getStage(stage).iterations += iterations;
+}
+
+void TSFProfiler::addResidual(std::string stage, int iteration, double residual) {
+    if(!enabled)
+        return;
+    getStage(stage).residuals.push_back(std::make_pair(iteration, residual));
+}
+
+void TSFProfiler::addStages(const TSFProfiler &other, std::string prefix) {
+    if(!enabled)
+        return;
+    for(unsigned int i = 0; i < other.stages.size(); i++) {
+        const StageTiming &stage = other.stages[i];
+        StageTiming &timing = getStage(prefix + stage.name);
+        timing.hostTime += stage.hostTime;
+        timing.deviceTime += stage.deviceTime;
+        timing.bytesTransferred += stage.bytesTransferred;
+        timing.count += stage.count;
+        timing.iterations += stage.iterations;
+        timing.residuals.insert(timing.residuals.end(), stage.residuals.begin(), stage.residuals.end());
+    }
+}
+
+std::vector<StageTiming> TSFProfiler::getStages() const {
+    return stages;
+}
+
+void TSFProfiler::clear() {
+    stages.clear();
+    hostStart.clear();
+    deviceStart.clear();
+}
+
+void TSFProfiler::writeToFile(std::string filename) const {
+    std::ofstream file(filename.c_str());
+    if(!file.is_open())
+        throw SIPL::IOException(filename.c_str(), __LINE__, __FILE__);
+    if(filename.size() >= 4 && filename.substr(filename.size()-4) == ".csv") {
+        writeCSV(file);
+    } else {
+        writeJSON(file);
+    }
+    file.close();
+}
+
+void TSFProfiler::writeJSON(std::ostream &out) const {
+    out << "{\n  \"stages\": [\n";
+    for(unsigned int i = 0; i < stages.size(); i++) {
+        out << "    {\"name\": \"" << stages[i].name << "\", " <<
+            "\"host_ms\": " << stages[i].hostTime << ", " <<
+            "\"device_ms\": " << stages[i].deviceTime << ", " <<
+            "\"bytes\": " << stages[i].bytesTransferred << ", " <<
+            "\"count\": " << stages[i].count;
+        if(stages[i].iterations > 0) {
+            out << ", \"iterations\": " << stages[i].iterations << ", \"residuals\": [";
+            for(unsigned int j = 0; j < stages[i].residuals.size(); j++) {
+                out << (j > 0 ? ", " : "") << "[" << stages[i].residuals[j].first << ", " << stages[i].residuals[j].second << "]";
+            }
+            out << "]";
+        }
+        out << "}";
+        out << (i < stages.size()-1 ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void TSFProfiler::writeCSV(std::ostream &out) const {
+    out << "stage,host_ms,device_ms,bytes,count\n";
+    for(unsigned int i = 0; i < stages.size(); i++) {
+        out << stages[i].name << "," << stages[i].hostTime << "," <<
+            stages[i].deviceTime << "," << stages[i].bytesTransferred << "," <<
+            stages[i].count << "\n";
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+
+#include "OpenCLUtilityLibrary/OpenCLManager.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <utility>
+
+/*
+ * Runtime of one stage of the pipeline. A stage that is run several times,
+ * e.g. once per tile, is accumulated.
+ */
+typedef struct StageTiming {
+    std::string name;
+    double hostTime; // Wall time in ms
+    double deviceTime; // Time between the markers on the queue in ms, 0 for host stages
+    unsigned long long bytesTransferred; // Between host and device, or to and from disk
+    int count;
+    int iterations; // Of iterative stages, such as GVF
+    std::vector<std::pair<int, double> > residuals; // Iteration and residual of each convergence check
+} StageTiming;
+
+/*
+ * Collects the runtime of each stage of a run (read, crop, blur, vector field,
+ * GVF, TDF, centerline, segmentation and write). The device time is measured
+ * with markers on the command queue, which therefore has to be created with
+ * profiling enabled. Stopping a stage waits for the queue to finish, so the
+ * profiler does nothing unless it is enabled with the timing parameter.
+ */
+class TSFProfiler {
+public:
+    TSFProfiler(bool enabled = false);
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    void start(std::string stage);
+    void start(std::string stage, cl::CommandQueue &queue);
+    void stop(std::string stage);
+    void stop(std::string stage, cl::CommandQueue &queue);
+    void addBytesTransferred(std::string stage, unsigned long long bytes);
+    void addIterations(std::string stage, int iterations);
+    void addResidual(std::string stage, int iteration, double residual);
+    // Accumulates the stages of another profiler, e.g. of a part of the volume
+    // that was processed concurrently, with prefix added to their names
+    void addStages(const TSFProfiler &other, std::string prefix);
+    std::vector<StageTiming> getStages() const;
+    void clear();
+    // Writes all stages as JSON or as CSV, depending on the extension of the filename
+    void writeToFile(std::string filename) const;
+    void writeJSON(std::ostream &out) const;
+    void writeCSV(std::ostream &out) const;
+private:
+    StageTiming & getStage(std::string stage);
+    bool enabled;
+    std::vector<StageTiming> stages;
+    std::map<std::string, double> hostStart;
+    std::map<std::string, cl::Event> deviceStart;
+};
+
+#endif
@@ -1,40 +1,76 @@
 #include "ridgeTraversalCenterlineExtraction.hpp"
-#include <queue>
 #include <vector>
-#include <list>
+#include <algorithm>
 #include "eigenanalysisOfHessian.hpp"
-#include "timing.hpp"
-#ifdef CPP11
-#include <unordered_set>
-using std::unordered_set;
-#else
-#include <boost/unordered_set.hpp>
-using boost::unordered_set;
-#endif
 
 typedef struct point {
     float value;
     int x,y,z;
 } point;
 
-class PointComparison {
-    public:
-    bool operator() (const point &lhs, const point &rhs) const {
-        return (lhs.value < rhs.value);
-    }
-};
-
 float sign(float a) {
     return a < 0 ? -1.0f: 1.0f;
 }
 
 #define LPOS(a,b,c) (a)+(b)*(size.x)+(c)*(size.x*size.y)
 #define POS(pos) pos.x+pos.y*size.x+pos.z*size.x*size.y
-#define M(a,b,c) 1-sqrt(pow(T.Fx[a+b*size.x+c*size.x*size.y],2.0f) + pow(T.Fy[a+b*size.x+c*size.x*size.y],2.0f) + pow(T.Fz[a+b*size.x+c*size.x*size.y],2.0f))
-#define SQR_MAG(pos) sqrt(pow(T.Fx[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.Fy[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.Fz[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f))
 #define SQR_MAG_SMALL(pos) sqrt(pow(T.FxSmall[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.FySmall[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f) + pow(T.FzSmall[pos.x+pos.y*size.x+pos.z*size.x*size.y],2.0f))
 
-char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parameters, std::stack<CenterlinePoint> centerlineStack) {
+// Strongest TDF response first. Equal responses are ordered by position so
+// that the order does not depend on which thread found the point.
+class StartPointOrder {
+    public:
+    StartPointOrder(SIPL::int3 size) : size(size) {}
+    bool operator() (const point &lhs, const point &rhs) const {
+        if(lhs.value != rhs.value)
+            return lhs.value > rhs.value;
+        return LPOS(lhs.x,lhs.y,lhs.z) < LPOS(rhs.x,rhs.y,rhs.z);
+    }
+    private:
+    SIPL::int3 size;
+};
+
+// Number of buckets the TDF response of the start points is quantized into
+#define START_POINT_BUCKETS 1024
+
+/*
+ * Sorts the start points with the strongest TDF response first. The points
+ * are first distributed into buckets by their quantized TDF response, after
+ * which only the points within each bucket have to be sorted.
+ */
+static void sortStartPoints(std::vector<point> &points, float Thigh, SIPL::int3 size) {
+    if(points.size() < 2)
+        return;
+    float maxValue = Thigh;
+    for(unsigned int i = 0; i < points.size(); i++)
+        maxValue = std::max(maxValue, points[i].value);
+    const float scale = maxValue > Thigh ? (START_POINT_BUCKETS-1)/(maxValue-Thigh) : 0.0f;
+
+    // Bucket 0 holds the largest responses
+    std::vector<int> bucketOf(points.size());
+    std::vector<int> bucketStart(START_POINT_BUCKETS+1, 0);
+    for(unsigned int i = 0; i < points.size(); i++) {
+        int bucket = (START_POINT_BUCKETS-1) - (int)((points[i].value-Thigh)*scale);
+        bucket = std::min(std::max(bucket, 0), START_POINT_BUCKETS-1);
+        bucketOf[i] = bucket;
+        bucketStart[bucket+1]++;
+    }
+    for(int i = 0; i < START_POINT_BUCKETS; i++)
+        bucketStart[i+1] += bucketStart[i];
+
+    std::vector<point> sorted(points.size());
+    std::vector<int> next(bucketStart.begin(), bucketStart.end()-1);
+    for(unsigned int i = 0; i < points.size(); i++)
+        sorted[next[bucketOf[i]]++] = points[i];
+
+    StartPointOrder order(size);
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < START_POINT_BUCKETS; i++)
+        std::sort(sorted.begin()+bucketStart[i], sorted.begin()+bucketStart[i+1], order);
+    points.swap(sorted);
+}
+
+char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parameters, std::stack<CenterlinePoint> centerlineStack, TSFProfiler &profiler) {
 
     float Thigh = getParam(parameters, "tdf-high"); // 0.6
     int Dmin = getParam(parameters, "min-distance");
@@ -45,78 +81,107 @@ char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parame
     int TreeMin = getParam(parameters, "min-tree-length"); // 200
     const int totalSize = size.x*size.y*size.z;
 
+    // Label of the centerline each voxel belongs to. -1 marks the voxels of
+    // the centerline currently being traversed.
     int * centerlines = new int[totalSize]();
-    INIT_TIMER
-
-    // Create queue
-    std::priority_queue<point, std::vector<point>, PointComparison> queue;
 
-    START_TIMER
-    // Collect all valid start points
+    profiler.start("centerline start points");
+    // Magnitude of the vector field, used in all comparisons below
+    float * magnitude = new float[totalSize];
     #pragma omp parallel for
-    for(int z = 2; z < size.z-2; z++) {
-        for(int y = 2; y < size.y-2; y++) {
-            for(int x = 2; x < size.x-2; x++) {
-                if(T.TDF[LPOS(x,y,z)] < Thigh)
+    for(int i = 0; i < totalSize; i++) {
+        magnitude[i] = T.vectorField.magnitude(i);
+    }
+
+    // Linear offsets and directions to the 26 neighbors
+    int neighborOffset[26];
+    float3 neighborDirection[26];
+    int neighbors = 0;
+    for(int a = -1; a < 2; a++) {
+        for(int b = -1; b < 2; b++) {
+            for(int c = -1; c < 2; c++) {
+                if(a == 0 && b == 0 && c == 0)
                     continue;
+                neighborOffset[neighbors] = LPOS(a,b,c);
+                neighborDirection[neighbors] = float3((float)a,(float)b,(float)c).normalize();
+                neighbors++;
+            }
+        }
+    }
 
-                int3 pos(x,y,z);
-                bool valid = true;
-                for(int a = -1; a < 2; a++) {
-                    for(int b = -1; b < 2; b++) {
-                        for(int c = -1; c < 2; c++) {
-                            int3 nPos(x+a,y+b,z+c);
-                            if(SQR_MAG(nPos) < SQR_MAG(pos)) {
-                                valid = false;
-                                break;
-                            }
+    // Collect all valid start points. Each thread collects its own points,
+    // which are merged afterwards.
+    std::vector<point> startPoints;
+    #pragma omp parallel
+    {
+        std::vector<point> threadStartPoints;
+        #pragma omp for schedule(dynamic) nowait
+        for(int z = 2; z < size.z-2; z++) {
+            for(int y = 2; y < size.y-2; y++) {
+                for(int x = 2; x < size.x-2; x++) {
+                    const int n = LPOS(x,y,z);
+                    if(T.TDF[n] < Thigh)
+                        continue;
+
+                    bool valid = true;
+                    for(int i = 0; i < 26; i++) {
+                        if(magnitude[n+neighborOffset[i]] < magnitude[n]) {
+                            valid = false;
+                            break;
                         }
                     }
-                }
 
-                if(valid) {
-                    point p;
-                    p.value = T.TDF[LPOS(x,y,z)];
-                    p.x = x;
-                    p.y = y;
-                    p.z = z;
-                    #pragma omp critical
-                    queue.push(p);
+                    if(valid) {
+                        point p;
+                        p.value = T.TDF[n];
+                        p.x = x;
+                        p.y = y;
+                        p.z = z;
+                        threadStartPoints.push_back(p);
+                    }
                 }
             }
         }
+        #pragma omp critical
+        startPoints.insert(startPoints.end(), threadStartPoints.begin(), threadStartPoints.end());
     }
 
-    std::cout << "Processing " << queue.size() << " valid start points" << std::endl;
-    if(queue.size() == 0) {
+    std::cout << "Processing " << startPoints.size() << " valid start points" << std::endl;
+    if(startPoints.size() == 0) {
+        delete[] magnitude;
+        delete[] centerlines;
     	throw SIPL::SIPLException("no valid start points found", __LINE__, __FILE__);
     }
-    STOP_TIMER("finding start points")
-    START_TIMER
+    sortStartPoints(startPoints, Thigh, size);
+    profiler.stop("centerline start points");
+    profiler.start("centerline traversal");
     int counter = 1;
+    // Position 0 is used as "no point found" below
     T.TDF[0] = 0;
-    T.Fx[0] = 1;
-    T.Fy[0] = 0;
-    T.Fz[0] = 0;
-
+    magnitude[0] = 1;
 
-    // Create a map of centerline distances
-    unordered_map<int, int> centerlineDistances;
+    // Length and stack of each centerline, indexed by label. The length of
+    // a centerline that has been merged into another one is 0.
+    std::vector<int> centerlineDistances(1, 0);
+    std::vector<std::stack<CenterlinePoint> > centerlineStacks(1);
 
-    // Create a map of centerline stacks
-    unordered_map<int, std::stack<CenterlinePoint> > centerlineStacks;
+    // Voxels of the centerline currently being traversed
+    std::vector<int> newCenterlines;
 
-    while(!queue.empty()) {
+    for(unsigned int s = 0; s < startPoints.size(); s++) {
         // Traverse from new start point
-        point p = queue.top();
-        queue.pop();
+        point p = startPoints[s];
 
         // Has it been handled before?
         if(centerlines[LPOS(p.x,p.y,p.z)] == 1)
             continue;
 
-        unordered_set<int> newCenterlines;
-        newCenterlines.insert(LPOS(p.x,p.y,p.z));
+        newCenterlines.clear();
+        // Previous label of the start point, restored if the centerline is rejected
+        const int startPointLabel = centerlines[LPOS(p.x,p.y,p.z)];
+        if(startPointLabel == 0)
+            centerlines[LPOS(p.x,p.y,p.z)] = -1;
+        newCenterlines.push_back(LPOS(p.x,p.y,p.z));
         int distance = 1;
         int connections = 0;
         int prevConnection = -1;
@@ -149,60 +214,58 @@ char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parame
             // Traverse
             while(true) {
                 int3 maxPoint(0,0,0);
+                int maxPos = 0;
 
                 // Check for out of bounds
                 if(position.x < 3 || position.x > size.x-3 || position.y < 3 || position.y > size.y-3 || position.z < 3 || position.z > size.z-3)
                     break;
 
                 // Try to find next point from all neighbors
-                for(int a = -1; a < 2; a++) {
-                    for(int b = -1; b < 2; b++) {
-                        for(int c = -1; c < 2; c++) {
-                            int3 n(position.x+a,position.y+b,position.z+c);
-                            if((a == 0 && b == 0 && c == 0) || T.TDF[POS(n)] == 0.0f)
-                                continue;
-
-                            float3 dir((float)(n.x-position.x),(float)(n.y-position.y),(float)(n.z-position.z));
-                            dir = dir.normalize();
-                            if( (dir.x*t_i.x+dir.y*t_i.y+dir.z*t_i.z) <= 0.1)
-                                continue;
-
-                            if(T.radius[POS(n)] >= 1.5f) {
-                                if(M(n.x,n.y,n.z) > M(maxPoint.x,maxPoint.y,maxPoint.z))
-                                maxPoint = n;
-                            } else {
-                                if(T.TDF[LPOS(n.x,n.y,n.z)]*M(n.x,n.y,n.z) > T.TDF[POS(maxPoint)]*M(maxPoint.x,maxPoint.y,maxPoint.z))
-                                maxPoint = n;
-                            }
-
-                        }
+                const int pos = POS(position);
+                for(int i = 0; i < 26; i++) {
+                    const int n = pos+neighborOffset[i];
+                    if(T.TDF[n] == 0.0f)
+                        continue;
+
+                    const float3 dir = neighborDirection[i];
+                    if( (dir.x*t_i.x+dir.y*t_i.y+dir.z*t_i.z) <= 0.1)
+                        continue;
+
+                    if(T.radius[n] >= 1.5f) {
+                        if(1-magnitude[n] > 1-magnitude[maxPos])
+                            maxPos = n;
+                    } else {
+                        // Same as the former T.TDF*M(), which expanded to TDF - magnitude
+                        if(T.TDF[n]-magnitude[n] > T.TDF[maxPos]-magnitude[maxPos])
+                            maxPos = n;
                     }
                 }
 
-                if(maxPoint.x+maxPoint.y+maxPoint.z > 0) {
+                if(maxPos > 0) {
+                    maxPoint = int3(maxPos % size.x, (maxPos / size.x) % size.y, maxPos / (size.x*size.y));
                     // New maxpoint found, check it!
-                    if(centerlines[LPOS(maxPoint.x,maxPoint.y,maxPoint.z)] > 0) {
+                    if(centerlines[maxPos] > 0) {
                         // Hit an existing centerline
                         if(prevConnection == -1) {
-                            prevConnection = centerlines[LPOS(maxPoint.x,maxPoint.y,maxPoint.z)];
+                            prevConnection = centerlines[maxPos];
                         } else {
-                            if(prevConnection ==centerlines[LPOS(maxPoint.x,maxPoint.y,maxPoint.z)]) {
+                            if(prevConnection == centerlines[maxPos]) {
                                 // A loop has occured, reject this centerline
                                 connections = 5;
                             } else {
-                                secondConnection = centerlines[LPOS(maxPoint.x,maxPoint.y,maxPoint.z)];
+                                secondConnection = centerlines[maxPos];
                             }
                         }
                         break;
-                    } else if(M(maxPoint.x,maxPoint.y,maxPoint.z) < Mlow || (belowTlow > maxBelowTlow && T.TDF[LPOS(maxPoint.x,maxPoint.y,maxPoint.z)] < Tlow)) {
+                    } else if(1-magnitude[maxPos] < Mlow || (belowTlow > maxBelowTlow && T.TDF[maxPos] < Tlow)) {
                         // New point is below thresholds
                         break;
-                    } else if(newCenterlines.count(LPOS(maxPoint.x,maxPoint.y,maxPoint.z)) > 0) {
+                    } else if(centerlines[maxPos] == -1) {
                         // Loop detected!
                         break;
                     } else {
                         // Point is OK, proceed to add it and continue
-                        if(T.TDF[LPOS(maxPoint.x,maxPoint.y,maxPoint.z)] < Tlow) {
+                        if(T.TDF[maxPos] < Tlow) {
                             belowTlow++;
                         } else {
                             belowTlow = 0;
@@ -237,14 +300,15 @@ char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parame
                         // update position
                         position = maxPoint;
                         distance ++;
-                        newCenterlines.insert(LPOS(maxPoint.x,maxPoint.y,maxPoint.z));
-                        meanTube += T.TDF[LPOS(maxPoint.x,maxPoint.y,maxPoint.z)];
+                        centerlines[maxPos] = -1;
+                        newCenterlines.push_back(maxPos);
+                        meanTube += T.TDF[maxPos];
 
                         // Create centerline point
                         CenterlinePoint p;
                         p.pos = position;
                         p.next = &(stack.top()); // add previous
-                        if(T.radius[POS(p.pos)] > 3.0f) {
+                        if(T.radius[maxPos] > 3.0f) {
                             p.large = true;
                         } else {
                             p.large = false;
@@ -267,102 +331,94 @@ char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parame
             //std::cout << "Finished. Distance " << distance << " meanTube: " << meanTube/distance << std::endl;
             //std::cout << "------------------- New centerlines added #" << counter << " -------------------------" << std::endl;
 
-            unordered_set<int>::iterator usit;
             if(prevConnection == -1) {
                 // No connections
-                for(usit = newCenterlines.begin(); usit != newCenterlines.end(); usit++) {
-                    centerlines[*usit] = counter;
+                for(unsigned int i = 0; i < newCenterlines.size(); i++) {
+                    centerlines[newCenterlines[i]] = counter;
                 }
-                centerlineDistances[counter] = distance;
-                centerlineStacks[counter] = stack;
+                centerlineDistances.push_back(distance);
+                centerlineStacks.push_back(stack);
                 counter ++;
             } else {
                 // The first connection
 
-                std::stack<CenterlinePoint> prevConnectionStack = centerlineStacks[prevConnection];
+                std::stack<CenterlinePoint> &prevConnectionStack = centerlineStacks[prevConnection];
                 while(!stack.empty()) {
                     prevConnectionStack.push(stack.top());
                     stack.pop();
                 }
 
-                for(usit = newCenterlines.begin(); usit != newCenterlines.end(); usit++) {
-                    centerlines[*usit] = prevConnection;
+                for(unsigned int i = 0; i < newCenterlines.size(); i++) {
+                    centerlines[newCenterlines[i]] = prevConnection;
                 }
                 centerlineDistances[prevConnection] += distance;
                 if(secondConnection != -1) {
-                    // Two connections, move secondConnection to prevConnection
-                    std::stack<CenterlinePoint> secondConnectionStack = centerlineStacks[secondConnection];
-                    centerlineStacks.erase(secondConnection);
+                    // Two connections, move secondConnection to prevConnection.
+                    // The stack holds every voxel that has the label.
+                    std::stack<CenterlinePoint> &secondConnectionStack = centerlineStacks[secondConnection];
                     while(!secondConnectionStack.empty()) {
+                        const int n = POS(secondConnectionStack.top().pos);
+                        if(centerlines[n] == secondConnection)
+                            centerlines[n] = prevConnection;
                         prevConnectionStack.push(secondConnectionStack.top());
                         secondConnectionStack.pop();
                     }
 
-                    #pragma omp parallel for
-                    for(int i = 0; i < totalSize;i++) {
-                        if(centerlines[i] == secondConnection)
-                            centerlines[i] = prevConnection;
-                    }
                     centerlineDistances[prevConnection] += centerlineDistances[secondConnection];
-                    centerlineDistances.erase(secondConnection);
+                    centerlineDistances[secondConnection] = 0;
                 }
-
-                centerlineStacks[prevConnection] = prevConnectionStack;
             }
+        } else {
+            // Rejected, give the voxels back
+            for(unsigned int i = 0; i < newCenterlines.size(); i++) {
+                centerlines[newCenterlines[i]] = 0;
+            }
+            centerlines[LPOS(p.x,p.y,p.z)] = startPointLabel;
         } // end if new point can be added
-    } // End while queue is not empty
+    } // End for each start point
+    delete[] magnitude;
     std::cout << "Finished traversal" << std::endl;
-    STOP_TIMER("traversal")
-    START_TIMER
+    profiler.stop("centerline traversal");
+    profiler.start("centerline largest tree");
+
+    // Find largest connected tree and all trees above a certain size
+    int max = 0;
+    std::vector<char> trees(counter, 0);
+    for(int label = 1; label < counter; label++) {
+        if(centerlineDistances[label] == 0)
+            continue;
+        if(max == 0 || centerlineDistances[label] > centerlineDistances[max])
+            max = label;
+        if(centerlineDistances[label] > TreeMin)
+            trees[label] = 1;
+    }
 
-    if(centerlineDistances.size() == 0) {
+    if(max == 0) {
         //throw SIPL::SIPLException("no centerlines were extracted");
+        delete[] centerlines;
         char * returnCenterlines = new char[totalSize]();
         return returnCenterlines;
     }
 
-    // Find largest connected tree and all trees above a certain size
-    unordered_map<int, int>::iterator it;
-    int max = centerlineDistances.begin()->first;
-    std::list<int> trees;
-    for(it = centerlineDistances.begin(); it != centerlineDistances.end(); it++) {
-        if(it->second > centerlineDistances[max])
-            max = it->first;
-        if(it->second > TreeMin)
-            trees.push_back(it->first);
-    }
-    std::list<int>::iterator it2;
     // TODO: if use the method with TreeMin have to add them to centerlineStack also
     centerlineStack = centerlineStacks[max];
-    for(it2 = trees.begin(); it2 != trees.end(); it2++) {
-        while(!centerlineStacks[*it2].empty()) {
-            centerlineStack.push(centerlineStacks[*it2].top());
-            centerlineStacks[*it2].pop();
+    for(int label = 1; label < counter; label++) {
+        if(!trees[label])
+            continue;
+        while(!centerlineStacks[label].empty()) {
+            centerlineStack.push(centerlineStacks[label].top());
+            centerlineStacks[label].pop();
         }
     }
 
     char * returnCenterlines = new char[totalSize]();
-    // Mark largest tree with 1, and rest with 0
+    // Mark largest tree and all trees above a certain size with 1, and rest with 0
+    trees[max] = 1;
     #pragma omp parallel for
     for(int i = 0; i < totalSize;i++) {
-        if(centerlines[i] == max) {
-        //if(centerlines[i] > 0) {
-            returnCenterlines[i] = 1;
-        } else {
-            bool valid = false;
-            for(it2 = trees.begin(); it2 != trees.end(); it2++) {
-                if(centerlines[i] == *it2) {
-                    returnCenterlines[i] = 1;
-                    valid = true;
-                    break;
-                }
-            }
-            if(!valid)
-                returnCenterlines[i] = 0;
-
-        }
+        returnCenterlines[i] = centerlines[i] > 0 && trees[centerlines[i]];
     }
-    STOP_TIMER("finding largest tree")
+    profiler.stop("centerline largest tree");
 
 	delete[] centerlines;
     return returnCenterlines;
@@ -12,6 +12,7 @@ typedef struct CenterlinePoint {
     CenterlinePoint * next;
 } CenterlinePoint;
 
-char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parameters, std::stack<CenterlinePoint> centerlineStack);
+// The start points, traversal and largest tree are timed as stages of profiler
+char * runRidgeTraversal(TubeSegmentation &T, SIPL::int3 size, paramList &parameters, std::stack<CenterlinePoint> centerlineStack, TSFProfiler &profiler);
 
 #endif
@@ -1,16 +1,46 @@
 #include "segmentation.hpp"
+#include "memoryPool.hpp"
 #include <iostream>
 using namespace cl;
 
-Image3D runInverseGradientSegmentation(OpenCL &ocl, Image3D &centerline, Image3D &vectorField, Image3D &radius, SIPL::int3 size, paramList parameters) {
+// Collects the voxels of the segmentation with the given value into frontier.
+// The frontier is reallocated if it has room for fewer voxels.
+static int createGrowingFrontier(OpenCL &ocl, Buffer &segmentation, int value, Buffer &frontier, int &capacity, Buffer &counter, const int totalSize) {
+    Kernel createFrontierKernel(ocl.program, "createGrowingFrontier");
+    int frontierSize = 0;
+    do {
+        if(frontierSize > capacity) {
+            capacity = frontierSize;
+            frontier = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(int)*capacity);
+        }
+        int zero = 0;
+        ocl.queue.enqueueWriteBuffer(counter, CL_FALSE, 0, sizeof(int), &zero);
+        createFrontierKernel.setArg(0, segmentation);
+        createFrontierKernel.setArg(1, value);
+        createFrontierKernel.setArg(2, frontier);
+        createFrontierKernel.setArg(3, counter);
+        createFrontierKernel.setArg(4, capacity);
+        ocl.queue.enqueueNDRangeKernel(
+            createFrontierKernel,
+            NullRange,
+            NDRange(totalSize),
+            NullRange
+        );
+        ocl.queue.enqueueReadBuffer(counter, CL_TRUE, 0, sizeof(int), &frontierSize);
+    } while(frontierSize > capacity);
+
+    return frontierSize;
+}
+
+static int getFrontierGlobalSize(int frontierSize) {
+    int globalSize = frontierSize;
+    while(globalSize % 64 != 0) globalSize++;
+    return globalSize;
+}
+
+Image3D runInverseGradientSegmentation(OpenCL &ocl, Image3D &centerline, Image3D &vectorField, Image3D &radius, SIPL::int3 size, const paramList &parameters) {
     const int totalSize = size.x*size.y*size.z;
 	const bool no3Dwrite = !getParamBool(parameters, "3d_write");
-    cl::Event startEvent, endEvent;
-    cl_ulong start, end;
-    if(getParamBool(parameters, "timing")) {
-        ocl.queue.enqueueMarker(&startEvent);
-    }
-
     Kernel dilateKernel = Kernel(ocl.program, "dilate");
     Kernel erodeKernel = Kernel(ocl.program, "erode");
     Kernel initGrowKernel = Kernel(ocl.program, "initGrowing");
@@ -26,116 +56,103 @@ Image3D runInverseGradientSegmentation(OpenCL &ocl, Image3D &centerline, Image3D
     region[2] = size.z;
 
 
-	Image3D volume = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SIGNED_INT8), size.x, size.y, size.z);
-	ocl.queue.enqueueCopyImage(centerline, volume, offset, offset, region);
-
-    int stopGrowing = 0;
-    Buffer stop = Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(int));
-    ocl.queue.enqueueWriteBuffer(stop, CL_FALSE, 0, sizeof(int), &stopGrowing);
-
-    growKernel.setArg(1, vectorField);
-    growKernel.setArg(3, stop);
-
-    int i = 0;
-    int minimumIterations = 0;
-    if(no3Dwrite) {
-        Buffer volume2 = Buffer(
-                ocl.context,
-                CL_MEM_READ_WRITE,
-                sizeof(char)*totalSize
-        );
-        ocl.queue.enqueueCopyImageToBuffer(
-                volume,
-                volume2,
-                offset,
-                region,
-                0
-        );
-        initGrowKernel.setArg(0, volume);
-        initGrowKernel.setArg(1, volume2);
-        initGrowKernel.setArg(2, radius);
+    // The segmentation is grown from the voxels around the centerline. Each
+    // round only processes the voxels of the frontier, which are the voxels
+    // that were added in the previous round.
+    Buffer segmentation = createBuffer(
+            ocl,
+            CL_MEM_READ_WRITE,
+            sizeof(int)*((totalSize+3)/4) // grow accesses the voxels through 32 bit words
+    );
+    ocl.queue.enqueueCopyImageToBuffer(centerline, segmentation, offset, region, 0);
+    Buffer counter = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(int));
+    int capacities[2] = {65536, 65536};
+    Buffer frontiers[2];
+    frontiers[0] = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(int)*capacities[0]);
+    frontiers[1] = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(int)*capacities[1]);
+
+    // Use the first frontier for the centerline voxels
+    const int nofCenterpoints = createGrowingFrontier(ocl, segmentation, 1, frontiers[0], capacities[0], counter, totalSize);
+    int zero = 0;
+    ocl.queue.enqueueWriteBuffer(counter, CL_FALSE, 0, sizeof(int), &zero);
+    initGrowKernel.setArg(0, radius);
+    initGrowKernel.setArg(1, segmentation);
+    initGrowKernel.setArg(2, frontiers[0]);
+    initGrowKernel.setArg(3, nofCenterpoints);
+    initGrowKernel.setArg(4, frontiers[1]);
+    initGrowKernel.setArg(5, counter);
+    initGrowKernel.setArg(6, capacities[1]);
+    initGrowKernel.setArg(7, size.x);
+    initGrowKernel.setArg(8, size.y);
+    initGrowKernel.setArg(9, size.z);
+    if(nofCenterpoints > 0) {
         ocl.queue.enqueueNDRangeKernel(
             initGrowKernel,
             NullRange,
-            NDRange(size.x, size.y, size.z),
-            NullRange
+            NDRange(getFrontierGlobalSize(nofCenterpoints)),
+            NDRange(64)
         );
-        ocl.queue.enqueueCopyBufferToImage(
-                volume2,
-                volume,
-                0,
-                offset,
-                region
-        );
-        growKernel.setArg(0, volume);
-        growKernel.setArg(2, volume2);
-        while(stopGrowing == 0) {
-            if(i > minimumIterations) {
-                stopGrowing = 1;
-                ocl.queue.enqueueWriteBuffer(stop, CL_TRUE, 0, sizeof(int), &stopGrowing);
-            }
-
-            ocl.queue.enqueueNDRangeKernel(
-                    growKernel,
-                    NullRange,
-                        NDRange(size.x, size.y, size.z),
-                        NullRange
-                    );
-            if(i > minimumIterations)
-                ocl.queue.enqueueReadBuffer(stop, CL_TRUE, 0, sizeof(int), &stopGrowing);
-            i++;
-            ocl.queue.enqueueCopyBufferToImage(
-                    volume2,
-                    volume,
-                    0,
-                    offset,
-                    region
-            );
-        }
+    }
+    int frontierSize;
+    ocl.queue.enqueueReadBuffer(counter, CL_TRUE, 0, sizeof(int), &frontierSize);
+    if(frontierSize > capacities[1])
+        frontierSize = createGrowingFrontier(ocl, segmentation, 2, frontiers[1], capacities[1], counter, totalSize);
 
-    } else {
-        Image3D volume2 = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SIGNED_INT8), size.x, size.y, size.z);
-        ocl.queue.enqueueCopyImage(volume, volume2, offset, offset, region);
-        initGrowKernel.setArg(0, volume);
-        initGrowKernel.setArg(1, volume2);
-        initGrowKernel.setArg(2, radius);
+    Kernel updateGrowingKernel = Kernel(ocl.program, "updateGrowing");
+    int i = 0;
+    while(frontierSize > 0) {
+        // Voxels in the frontier have the value 2 or 3, alternating between rounds
+        const int current = i % 2 == 0 ? 2 : 3;
+        const int next = i % 2 == 0 ? 3 : 2;
+        Buffer &frontier = frontiers[(i+1) % 2];
+        Buffer &nextFrontier = frontiers[i % 2];
+        int &nextCapacity = capacities[i % 2];
+
+        ocl.queue.enqueueWriteBuffer(counter, CL_FALSE, 0, sizeof(int), &zero);
+        growKernel.setArg(0, vectorField);
+        growKernel.setArg(1, segmentation);
+        growKernel.setArg(2, frontier);
+        growKernel.setArg(3, frontierSize);
+        growKernel.setArg(4, nextFrontier);
+        growKernel.setArg(5, counter);
+        growKernel.setArg(6, nextCapacity);
+        growKernel.setArg(7, current);
+        growKernel.setArg(8, size.x);
+        growKernel.setArg(9, size.y);
+        growKernel.setArg(10, size.z);
         ocl.queue.enqueueNDRangeKernel(
-            initGrowKernel,
-            NullRange,
-            NDRange(size.x, size.y, size.z),
-            NDRange(4,4,4)
+                growKernel,
+                NullRange,
+                NDRange(getFrontierGlobalSize(frontierSize)),
+                NDRange(64)
+        );
+        updateGrowingKernel.setArg(0, segmentation);
+        updateGrowingKernel.setArg(1, frontier);
+        updateGrowingKernel.setArg(2, frontierSize);
+        updateGrowingKernel.setArg(3, next);
+        ocl.queue.enqueueNDRangeKernel(
+                updateGrowingKernel,
+                NullRange,
+                NDRange(getFrontierGlobalSize(frontierSize)),
+                NDRange(64)
         );
-        while(stopGrowing == 0) {
-            if(i > minimumIterations) {
-                stopGrowing = 1;
-                ocl.queue.enqueueWriteBuffer(stop, CL_FALSE, 0, sizeof(int), &stopGrowing);
-            }
-            if(i % 2 == 0) {
-                growKernel.setArg(0, volume);
-                growKernel.setArg(2, volume2);
-            } else {
-                growKernel.setArg(0, volume2);
-                growKernel.setArg(2, volume);
-            }
-
-            ocl.queue.enqueueNDRangeKernel(
-                    growKernel,
-                    NullRange,
-                    NDRange(size.x, size.y, size.z),
-                    NDRange(4,4,4)
-                    );
-            if(i > minimumIterations)
-                ocl.queue.enqueueReadBuffer(stop, CL_TRUE, 0, sizeof(int), &stopGrowing);
-            i++;
-        }
 
+        ocl.queue.enqueueReadBuffer(counter, CL_TRUE, 0, sizeof(int), &frontierSize);
+        if(frontierSize > nextCapacity) {
+            // The next frontier didn't fit, find its voxels in the whole volume instead
+            frontierSize = createGrowingFrontier(ocl, segmentation, next, nextFrontier, nextCapacity, counter, totalSize);
+        }
+        i++;
     }
 
+	Image3D volume = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SIGNED_INT8), size.x, size.y, size.z);
+    ocl.queue.enqueueCopyBufferToImage(segmentation, volume, 0, offset, region);
+
     std::cout << "segmentation result grown in " << i << " iterations" << std::endl;
 
     if(no3Dwrite) {
-        Buffer volumeBuffer = Buffer(
-                ocl.context,
+        Buffer volumeBuffer = createBuffer(
+                ocl,
                 CL_MEM_WRITE_ONLY,
                 sizeof(char)*totalSize
         );
@@ -173,8 +190,8 @@ Image3D runInverseGradientSegmentation(OpenCL &ocl, Image3D &centerline, Image3D
             region
         );
     } else {
-        Image3D volume2 = Image3D(
-                ocl.context,
+        Image3D volume2 = createImage3D(
+                ocl,
                 CL_MEM_READ_WRITE,
                 ImageFormat(CL_R, CL_SIGNED_INT8),
                 size.x, size.y, size.z
@@ -209,18 +226,10 @@ Image3D runInverseGradientSegmentation(OpenCL &ocl, Image3D &centerline, Image3D
             NullRange
         );
     }
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME of segmentation: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
-
     return volume;
 }
 
-Image3D runSphereSegmentation(OpenCL ocl, Image3D &centerline, Image3D &radius, SIPL::int3 size, paramList parameters) {
+Image3D runSphereSegmentation(OpenCL ocl, Image3D &centerline, Image3D &radius, SIPL::int3 size, const paramList &parameters) {
 	const bool no3Dwrite = !getParamBool(parameters, "3d_write");
 	if(no3Dwrite) {
 		cl::size_t<3> offset;
@@ -233,8 +242,8 @@ Image3D runSphereSegmentation(OpenCL ocl, Image3D &centerline, Image3D &radius,
 		region[2] = size.z;
 
 		const int totalSize = size.x*size.y*size.z;
-		Buffer segmentation = Buffer(
-				ocl.context,
+		Buffer segmentation = createBuffer(
+				ocl,
 				CL_MEM_WRITE_ONLY,
 				sizeof(char)*totalSize
 		);
@@ -258,8 +267,8 @@ Image3D runSphereSegmentation(OpenCL ocl, Image3D &centerline, Image3D &radius,
 			NDRange(4,4,4)
 		);
 
-		Image3D segmentationImage = Image3D(
-				ocl.context,
+		Image3D segmentationImage = createImage3D(
+				ocl,
 				CL_MEM_WRITE_ONLY,
 				ImageFormat(CL_R, CL_UNSIGNED_INT8),
 				size.x, size.y, size.z
@@ -275,8 +284,8 @@ Image3D runSphereSegmentation(OpenCL ocl, Image3D &centerline, Image3D &radius,
 
 		return segmentationImage;
 	} else {
-		Image3D segmentation = Image3D(
-				ocl.context,
+		Image3D segmentation = createImage3D(
+				ocl,
 				CL_MEM_WRITE_ONLY,
 				ImageFormat(CL_R, CL_UNSIGNED_INT8),
 				size.x, size.y, size.z
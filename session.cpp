@@ -0,0 +1,316 @@
+#include "session.hpp"
+#include "memoryPool.hpp"
+#include "SIPL/Exceptions.hpp"
+#include "tsf-config.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <vector>
+
+std::map<std::string, TSFSession *> TSFSession::instances;
+Mutex TSFSession::instancesMutex;
+
+// 64 bit FNV-1a hash. Used instead of std::hash because the value has to be
+// stable between builds and processes as it is used as a file name.
+static unsigned long long hashString(const std::string &str, unsigned long long hash = 14695981039346656037ULL) {
+	for(unsigned int i = 0; i < str.size(); i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+TSFSession::TSFSession(oul::DeviceCriteria criteria, std::string binaryCacheDir) {
+    oul::OpenCLManager * manager = oul::OpenCLManager::getInstance();
+    std::vector<oul::PlatformDevices> platformDevices = manager->getDevices(criteria);
+    std::vector<cl::Device> validDevices = manager->getDevicesForBestPlatform(
+                            criteria, platformDevices);
+
+    // Profiling is enabled on the queue so that the device time of each stage can be measured
+    this->context = new oul::Context(validDevices,false,true);
+    this->binaryCacheDir = binaryCacheDir;
+    this->subDeviceContext = NULL;
+    this->subDevicesCreated = false;
+    this->users = 0;
+    this->discarded = false;
+    this->memoryPool = new DeviceMemoryPool(context->getContext());
+}
+
+TSFSession::~TSFSession() {
+	programs.clear();
+	subDevicePrograms.clear();
+	delete memoryPool;
+	if(subDeviceContext != NULL)
+		delete subDeviceContext;
+	delete context;
+}
+
+TSFSession * TSFSession::getInstanceUnlocked(std::string deviceType) {
+	if(instances.count(deviceType) == 0) {
+		oul::DeviceCriteria criteria;
+		criteria.setDeviceCountCriteria(1);
+		if(deviceType == "gpu") {
+			criteria.setTypeCriteria(oul::DEVICE_TYPE_GPU);
+		} else {
+			criteria.setTypeCriteria(oul::DEVICE_TYPE_CPU);
+		}
+		instances[deviceType] = new TSFSession(criteria, std::string(KERNEL_CACHE_DIR));
+	}
+	return instances[deviceType];
+}
+
+TSFSession * TSFSession::getInstance(std::string deviceType) {
+	MutexLock lock(instancesMutex);
+	return getInstanceUnlocked(deviceType);
+}
+
+TSFSession * TSFSession::acquireInstance(std::string deviceType) {
+	MutexLock lock(instancesMutex);
+	TSFSession * session = getInstanceUnlocked(deviceType);
+	session->users++;
+	return session;
+}
+
+void TSFSession::release() {
+	bool unused;
+	{
+		MutexLock lock(instancesMutex);
+		users--;
+		unused = discarded && users == 0;
+	}
+	if(unused)
+		delete this;
+}
+
+// Returns whether the session can be deleted
+bool TSFSession::discardUnlocked(std::string deviceType, TSFSession * session) {
+	if(session->discarded)
+		return false;
+	// Another run may already have replaced the session
+	if(instances.count(deviceType) > 0 && instances[deviceType] == session)
+		instances.erase(deviceType);
+	session->discarded = true;
+	return session->users == 0;
+}
+
+void TSFSession::discardInstance(std::string deviceType, TSFSession * session) {
+	bool unused;
+	{
+		MutexLock lock(instancesMutex);
+		unused = discardUnlocked(deviceType, session);
+	}
+	if(unused)
+		delete session;
+}
+
+void TSFSession::releaseInstance(std::string deviceType) {
+	TSFSession * session = NULL;
+	{
+		MutexLock lock(instancesMutex);
+		if(instances.count(deviceType) > 0) {
+			session = instances[deviceType];
+			if(!discardUnlocked(deviceType, session))
+				session = NULL;
+		}
+	}
+	delete session;
+}
+
+oul::Context * TSFSession::getContext() {
+	return context;
+}
+
+DeviceMemoryPool * TSFSession::getMemoryPool() {
+	return memoryPool;
+}
+
+std::string TSFSession::getBinaryCacheDir() const {
+	return binaryCacheDir;
+}
+
+void TSFSession::setBinaryCacheDir(std::string binaryCacheDir) {
+	this->binaryCacheDir = binaryCacheDir;
+}
+
+cl::Program TSFSession::getProgram(std::string filename, std::string buildOptions, bool useBinaryCache) {
+	// Runs that need the same program wait for it to be compiled once
+	MutexLock lock(mutex);
+	// Already compiled in this process?
+	std::string key = filename + " " + buildOptions;
+	if(programs.count(key) > 0)
+		return programs[key];
+
+	std::string source = readSource(filename);
+
+	cl::Program program;
+	bool built = false;
+	std::string binaryFilename = "";
+	if(useBinaryCache && binaryCacheDir.size() > 0) {
+		binaryFilename = getBinaryFilename(source, buildOptions);
+		built = buildProgramFromBinary(binaryFilename, buildOptions, program);
+		if(built)
+			std::cout << "NOTE: Using cached program binary " << binaryFilename << std::endl;
+	}
+	if(!built) {
+		program = buildProgramFromSource(source, buildOptions);
+		if(binaryFilename.size() > 0)
+			storeProgramBinary(binaryFilename, program);
+	}
+
+	programs[key] = program;
+	return program;
+}
+
+oul::Context * TSFSession::getSubDeviceContext() {
+	MutexLock lock(mutex);
+	if(subDevicesCreated)
+		return subDeviceContext;
+	subDevicesCreated = true;
+
+	const cl_device_partition_property properties[] = {
+		CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+		CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE,
+		0
+	};
+	std::vector<cl::Device> devices;
+	try {
+		context->getDevice(0).createSubDevices(properties, &devices);
+	} catch(cl::Error &e) {
+		std::cout << "NOTE: The device can not be partitioned into sub-devices." << std::endl;
+		return NULL;
+	}
+	if(devices.size() < 2) {
+		std::cout << "NOTE: The device has only one affinity domain." << std::endl;
+		return NULL;
+	}
+
+	subDevices = devices;
+	subDeviceContext = new oul::Context(subDevices,false,true);
+	return subDeviceContext;
+}
+
+std::vector<cl::Device> TSFSession::getSubDevices() {
+	MutexLock lock(mutex);
+	return subDevices;
+}
+
+cl::Program TSFSession::getSubDeviceProgram(std::string filename, std::string buildOptions) {
+	MutexLock lock(mutex);
+	std::string key = filename + " " + buildOptions;
+	if(subDevicePrograms.count(key) > 0)
+		return subDevicePrograms[key];
+
+	std::string source = readSource(filename);
+	cl::Program::Sources sources(1, std::make_pair(source.c_str(), source.length()));
+	cl::Program program(subDeviceContext->getContext(), sources);
+	try {
+		program.build(subDevices, buildOptions.c_str());
+	} catch(cl::Error &e) {
+		if(e.err() == CL_BUILD_PROGRAM_FAILURE) {
+			std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(subDevices[0]) << std::endl;
+		}
+		throw SIPL::SIPLException("Failed to build OpenCL program for sub-devices", __LINE__, __FILE__);
+	}
+	subDevicePrograms[key] = program;
+	return program;
+}
+
+std::string TSFSession::readSource(std::string filename) {
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if(!file.is_open())
+		throw SIPL::IOException(filename.c_str(), __LINE__, __FILE__);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	file.close();
+	return buffer.str();
+}
+
+std::string TSFSession::getBinaryFilename(std::string &source, std::string buildOptions) {
+	// The binary depends on the device, the driver, the build options and the kernel code
+	cl::Device device = context->getDevice(0);
+	unsigned long long hash = hashString(source);
+	hash = hashString(buildOptions, hash);
+	hash = hashString(device.getInfo<CL_DEVICE_NAME>(), hash);
+	hash = hashString(device.getInfo<CL_DEVICE_VERSION>(), hash);
+	hash = hashString(device.getInfo<CL_DRIVER_VERSION>(), hash);
+	hash = hashString(context->getPlatform().getInfo<CL_PLATFORM_NAME>(), hash);
+
+	char str[17];
+	sprintf(str, "%016llx", hash);
+	return binaryCacheDir + "/" + std::string(str) + ".bin";
+}
+
+cl::Program TSFSession::buildProgramFromSource(std::string &source, std::string buildOptions) {
+	cl::Program::Sources sources(1, std::make_pair(source.c_str(), source.length()));
+	cl::Program program(context->getContext(), sources);
+	std::vector<cl::Device> devices(1, context->getDevice(0));
+	try {
+		program.build(devices, buildOptions.c_str());
+	} catch(cl::Error &e) {
+		if(e.err() == CL_BUILD_PROGRAM_FAILURE) {
+			std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << std::endl;
+		}
+		throw SIPL::SIPLException("Failed to build OpenCL program", __LINE__, __FILE__);
+	}
+	return program;
+}
+
+bool TSFSession::buildProgramFromBinary(std::string binaryFilename, std::string buildOptions, cl::Program &program) {
+	std::ifstream file(binaryFilename.c_str(), std::ios::in | std::ios::binary);
+	if(!file.is_open())
+		return false;
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	file.close();
+	std::string binary = buffer.str();
+	if(binary.size() == 0)
+		return false;
+
+	std::vector<cl::Device> devices(1, context->getDevice(0));
+	cl::Program::Binaries binaries(1, std::make_pair((const void *)binary.data(), binary.size()));
+	try {
+		program = cl::Program(context->getContext(), devices, binaries);
+		program.build(devices, buildOptions.c_str());
+	} catch(cl::Error &e) {
+		// Binary is stale or invalid, fall back to compiling the source
+		std::cout << "NOTE: Ignoring invalid program binary " << binaryFilename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void TSFSession::storeProgramBinary(std::string binaryFilename, cl::Program &program) {
+	// Find the binary that belongs to the device of this session
+	std::vector<cl::Device> devices = program.getInfo<CL_PROGRAM_DEVICES>();
+	std::vector< ::size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+	std::vector<unsigned char *> binaries(devices.size());
+	for(unsigned int i = 0; i < devices.size(); i++)
+		binaries[i] = new unsigned char[sizes[i]];
+	clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(unsigned char *)*binaries.size(), &binaries[0], NULL);
+
+	int index = 0;
+	for(unsigned int i = 0; i < devices.size(); i++) {
+		if(devices[i]() == context->getDevice(0)())
+			index = i;
+	}
+
+	// Write to a temporary file first so that concurrent processes never see a partial binary
+	if(sizes[index] > 0) {
+		std::string tempFilename = binaryFilename + ".tmp";
+		FILE * file = fopen(tempFilename.c_str(), "wb");
+		if(file != NULL) {
+			size_t written = fwrite(binaries[index], sizeof(unsigned char), sizes[index], file);
+			fclose(file);
+			if(written != sizes[index] || rename(tempFilename.c_str(), binaryFilename.c_str()) != 0) {
+				remove(tempFilename.c_str());
+				std::cout << "NOTE: Could not store program binary in " << binaryCacheDir << std::endl;
+			}
+		} else {
+			std::cout << "NOTE: Could not store program binary in " << binaryCacheDir << std::endl;
+		}
+	}
+
+	for(unsigned int i = 0; i < binaries.size(); i++)
+		delete[] binaries[i];
+}
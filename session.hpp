@@ -0,0 +1,72 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "commons.hpp"
+#include <string>
+#include <map>
+#include <vector>
+
+class DeviceMemoryPool;
+
+/*
+ * A session keeps the OpenCL context and compiled programs alive between
+ * calls to run(). Compiled program binaries are in addition stored on disk,
+ * keyed by device, build options and kernel source, so that a new process can
+ * skip compilation as well. A session can be used by several threads at the
+ * same time. Each run creates its own command queues.
+ */
+class TSFSession {
+public:
+	TSFSession(oul::DeviceCriteria criteria, std::string binaryCacheDir = "");
+	~TSFSession();
+	// Get the shared session for a device type ("gpu" or "cpu")
+	static TSFSession * getInstance(std::string deviceType);
+	// Get the shared session for a device type, and mark it as in use until
+	// release is called
+	static TSFSession * acquireInstance(std::string deviceType);
+	void release();
+	// Remove a shared session, e.g. when its context was lost in a reset of
+	// the device. The next call to getInstance creates a new session. The
+	// removed session is deleted when it is no longer in use.
+	static void discardInstance(std::string deviceType, TSFSession * session);
+	static void releaseInstance(std::string deviceType);
+	oul::Context * getContext();
+	// Images and buffers of the context that are reused between runs
+	DeviceMemoryPool * getMemoryPool();
+	cl::Program getProgram(std::string filename, std::string buildOptions, bool useBinaryCache = true);
+	// Context of sub-devices of the device, one for each affinity domain (e.g.
+	// NUMA node). Created on the first call. Returns NULL if the device can
+	// not be partitioned into more than one sub-device.
+	oul::Context * getSubDeviceContext();
+	std::vector<cl::Device> getSubDevices();
+	// Program built for all sub-devices. It is not stored on disk, as the
+	// binary cache holds programs for a single device.
+	cl::Program getSubDeviceProgram(std::string filename, std::string buildOptions);
+	std::string getBinaryCacheDir() const;
+	void setBinaryCacheDir(std::string binaryCacheDir);
+private:
+	cl::Program buildProgramFromSource(std::string &source, std::string buildOptions);
+	bool buildProgramFromBinary(std::string binaryFilename, std::string buildOptions, cl::Program &program);
+	void storeProgramBinary(std::string binaryFilename, cl::Program &program);
+	std::string getBinaryFilename(std::string &source, std::string buildOptions);
+	std::string readSource(std::string filename);
+	oul::Context * context;
+	oul::Context * subDeviceContext;
+	DeviceMemoryPool * memoryPool;
+	std::vector<cl::Device> subDevices;
+	bool subDevicesCreated;
+	std::map<std::string, cl::Program> subDevicePrograms;
+	std::string binaryCacheDir;
+	std::map<std::string, cl::Program> programs;
+	// Guards the programs and the sub-devices
+	Mutex mutex;
+	static TSFSession * getInstanceUnlocked(std::string deviceType);
+	static bool discardUnlocked(std::string deviceType, TSFSession * session);
+	// Runs that use the session, and whether it has been removed. Guarded by instancesMutex.
+	int users;
+	bool discarded;
+	static std::map<std::string, TSFSession *> instances;
+	static Mutex instancesMutex;
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include "tests.hpp"
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
 
 TEST(TSFOutputTest, Initialization) {
 	TSFOutput output(oul::DeviceCriteria(), new SIPL::int3);
@@ -70,3 +73,62 @@ TEST(TSFOutputTest, ShiftVector) {
 	EXPECT_EQ(2, output.getShiftVector().z);
 }
 
+
+TEST(TSFOutputTest, BitPackedMaskRoundTrip) {
+	const unsigned int voxels = 21;
+	char mask[voxels] = {0,1,1,0,0,0,1,1,1,1,0,1,0,0,0,0,0,0,0,0,1};
+	std::vector<unsigned char> bits = packBits(mask, voxels);
+	EXPECT_EQ(3u, bits.size());
+	EXPECT_EQ(0x06 | 0x40 | 0x80, bits[0]);
+	char unpacked[voxels];
+	unpackBits(bits, unpacked, voxels);
+	for(unsigned int i = 0; i < voxels; i++)
+		EXPECT_EQ(mask[i], unpacked[i]);
+}
+
+TEST(TSFOutputTest, RunLengthMaskRoundTrip) {
+	const unsigned int voxels = 12;
+	char mask[voxels] = {1,1,0,0,0,1,0,0,0,0,0,1};
+	std::vector<unsigned int> runs = encodeRunLengths(mask, voxels);
+	// Starts with an empty run of zeros
+	ASSERT_EQ(6u, runs.size());
+	EXPECT_EQ(0u, runs[0]);
+	EXPECT_EQ(2u, runs[1]);
+	EXPECT_EQ(3u, runs[2]);
+	char decoded[voxels];
+	decodeRunLengths(runs, decoded, voxels);
+	for(unsigned int i = 0; i < voxels; i++)
+		EXPECT_EQ(mask[i], decoded[i]);
+}
+
+#ifdef USE_ZLIB
+TEST(TSFOutputTest, ZlibRoundTrip) {
+	// More than two chunks of 4 MB, so that the last chunk is partial
+	const unsigned long long bytes = 2*4*1024*1024 + 1000;
+	std::vector<char> data(bytes);
+	unsigned int state = 1;
+	for(unsigned long long i = 0; i < bytes; i++) {
+		// Runs of zeros and pseudo random bytes, like a sparse segmentation
+		state = state*1103515245 + 12345;
+		data[i] = (i / 4096) % 3 == 0 ? 0 : (char)(state >> 16);
+	}
+	std::string compressed = compressZlib(&data[0], bytes);
+	std::vector<char> decompressed(bytes);
+	uLongf decompressedSize = bytes;
+	ASSERT_EQ(Z_OK, uncompress((Bytef *)&decompressed[0], &decompressedSize, (const Bytef *)compressed.data(), compressed.size()));
+	ASSERT_EQ(bytes, decompressedSize);
+	EXPECT_TRUE(data == decompressed);
+}
+#endif
+
+TEST(TSFOutputTest, ReadMhdHeader) {
+	MhdHeader header;
+	ASSERT_TRUE(readMhdHeader(std::string(TESTDATA_DIR) + "/synthetic/dataset_1/noisy.mhd", header));
+	EXPECT_TRUE(header.typeFound && header.sizeFound && header.rawFilenameFound);
+	EXPECT_EQ("MET_UCHAR", header.elementType);
+	EXPECT_EQ(std::string(TESTDATA_DIR) + "/synthetic/dataset_1/noisy0.raw", header.rawFilename);
+	EXPECT_EQ(100, header.size.x);
+	EXPECT_EQ(100, header.size.z);
+	EXPECT_EQ(1.0f, header.spacing.x);
+	EXPECT_FALSE(readMhdHeader("somefilethatdoesntexist.mhd", header));
+}
@@ -0,0 +1,45 @@
+#include "tests.hpp"
+
+TEST(CenterlineLinkingTest, NeighbourVerticesMatchBruteForce) {
+	srand(0);
+	const int nofVertices = 1000;
+	const float maxDistance = 7.5f;
+	std::vector<int> positions(nofVertices*3);
+	for(int i = 0; i < nofVertices*3; i++)
+		positions[i] = rand() % 64;
+
+	std::vector<int> offsets, neighbours;
+	std::vector<float> distances;
+	findNeighbourVertices(&positions[0], nofVertices, maxDistance, offsets, neighbours, distances);
+	ASSERT_EQ(nofVertices+1, (int)offsets.size());
+
+	for(int i = 0; i < nofVertices; i++) {
+		std::vector<int> expected;
+		for(int j = 0; j < nofVertices; j++) {
+			const float dx = positions[i*3]-positions[j*3];
+			const float dy = positions[i*3+1]-positions[j*3+1];
+			const float dz = positions[i*3+2]-positions[j*3+2];
+			const float distance = sqrt(dx*dx+dy*dy+dz*dz);
+			if(distance < maxDistance && distance > 0.0f)
+				expected.push_back(j);
+		}
+		std::vector<int> found(neighbours.begin()+offsets[i], neighbours.begin()+offsets[i+1]);
+		EXPECT_EQ(expected, found);
+	}
+}
+
+TEST(CenterlineLinkingTest, GraphComponentLabels) {
+	// Two chains 0-2-4-6 and 1-3-5, linked out of order, and a single vertex 7
+	std::vector<SIPL::int2> edges;
+	edges.push_back(SIPL::int2(4,6));
+	edges.push_back(SIPL::int2(5,3));
+	edges.push_back(SIPL::int2(2,4));
+	edges.push_back(SIPL::int2(1,3));
+	edges.push_back(SIPL::int2(0,2));
+	int labels[8];
+	labelGraphComponents(edges, 8, labels);
+
+	const int expected[8] = {0, 1, 0, 1, 0, 1, 0, 7};
+	for(int i = 0; i < 8; i++)
+		EXPECT_EQ(expected[i], labels[i]);
+}
@@ -0,0 +1,106 @@
+#include "tests.hpp"
+
+static MemoryLimits getTestLimits(unsigned long long deviceBytes) {
+	MemoryLimits limits;
+	limits.deviceBytes = deviceBytes;
+	limits.maxAllocBytes = deviceBytes;
+	limits.hostBytes = 0;
+	limits.budget = false;
+	limits.canChangeVectorType = false;
+	return limits;
+}
+
+static unsigned long long getPlannedPeak(SIPL::int3 size, paramList &parameters) {
+	return planMemory(size, parameters, getTestLimits(1ULL << 40)).deviceBytes;
+}
+
+TEST(MemoryPlannerTest, WholeVolumeWhenItFits) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	MemoryPlan plan = planMemory(SIPL::int3(64,64,64), parameters, getTestLimits(1ULL << 40));
+	EXPECT_TRUE(plan.fits);
+	EXPECT_FALSE(plan.tiled);
+	EXPECT_FALSE(plan.lowMemoryGVF);
+}
+
+TEST(MemoryPlannerTest, SparseTDFIsCounted) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	SIPL::int3 size(64,64,64);
+	std::vector<StageMemory> dense = estimateStageMemory(size, parameters);
+	setParameter(parameters, "sparse-tdf", "true");
+	std::vector<StageMemory> sparse = estimateStageMemory(size, parameters);
+	ASSERT_EQ(dense.size(), sparse.size());
+	for(unsigned int i = 0; i < dense.size(); i++) {
+		if(dense[i].name == "TDF") {
+			// The char candidates and the histogram pyramid levels, and no
+			// buffer with more than a byte per voxel
+			EXPECT_GE(sparse[i].deviceBytes, dense[i].deviceBytes + 64*64*64);
+			EXPECT_LT(sparse[i].deviceBytes, dense[i].deviceBytes + 2*64*64*64);
+		}
+	}
+}
+
+TEST(MemoryPlannerTest, SwitchesTo16BitVectors) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	SIPL::int3 size(128,128,128);
+	const unsigned long long peak16bit = getPlannedPeak(size, parameters);
+	setParameter(parameters, "16bit-vectors", "false");
+	EXPECT_LT(peak16bit, getPlannedPeak(size, parameters));
+
+	MemoryLimits limits = getTestLimits(peak16bit);
+	limits.canChangeVectorType = true;
+	MemoryPlan plan = planMemory(size, parameters, limits);
+	EXPECT_TRUE(plan.fits);
+	EXPECT_TRUE(plan.use16bitVectors);
+	EXPECT_FALSE(plan.tiled);
+}
+
+TEST(MemoryPlannerTest, LowMemoryGVFBeforeTiles) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	SIPL::int3 size(128,128,128);
+	paramList lowMemoryParameters = parameters;
+	setParameter(lowMemoryParameters, "gvf-low-memory", "true");
+	const unsigned long long lowMemoryPeak = getPlannedPeak(size, lowMemoryParameters);
+	EXPECT_LT(lowMemoryPeak, getPlannedPeak(size, parameters));
+
+	MemoryPlan plan = planMemory(size, parameters, getTestLimits(lowMemoryPeak));
+	EXPECT_TRUE(plan.fits);
+	EXPECT_TRUE(plan.lowMemoryGVF);
+	EXPECT_FALSE(plan.tiled);
+}
+
+TEST(MemoryPlannerTest, TilesWhenVolumeDoesNotFit) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	SIPL::int3 size(256,256,256);
+	setParameter(parameters, "gvf-low-memory", "true");
+	const unsigned long long lowMemoryPeak = getPlannedPeak(size, parameters);
+	setParameter(parameters, "gvf-low-memory", "false");
+
+	MemoryPlan plan = planMemory(size, parameters, getTestLimits(lowMemoryPeak - 1));
+	EXPECT_TRUE(plan.tiled);
+	EXPECT_LT(plan.tileSize, 256);
+	EXPECT_LE(plan.deviceBytes, lowMemoryPeak - 1);
+}
+
+TEST(MemoryPlannerTest, TiledPlanCountsWholeVolumeStages) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	// With 32 bit vectors the segmentation of the volume needs more than the
+	// stitched results and a small brick
+	SIPL::int3 size(512,512,512);
+	setParameter(parameters, "16bit-vectors", "false");
+	setParameter(parameters, "tiled-execution", "true");
+	setParameter(parameters, "tile-size", "40");
+	// The centerline and the segmentation run on the stitched volume
+	unsigned long long segmentation = 0;
+	std::vector<StageMemory> stages = estimateStageMemory(size, parameters);
+	for(unsigned int i = 0; i < stages.size(); i++) {
+		if(stages[i].name == "segmentation")
+			segmentation = stages[i].deviceBytes;
+	}
+	ASSERT_GT(segmentation, 0u);
+	EXPECT_GE(getPlannedPeak(size, parameters), segmentation);
+
+	// Small tiles do not help if the segmentation of the volume does not fit
+	MemoryPlan plan = planMemory(size, parameters, getTestLimits(segmentation));
+	EXPECT_TRUE(plan.tiled);
+	EXPECT_FALSE(plan.fits);
+}
@@ -0,0 +1,160 @@
+#include "tests.hpp"
+#include "../nativeBackend.hpp"
+
+TEST(NativeBackendTest, BlurMatchesDirectConvolution) {
+	SIPL::int3 size(12,12,12);
+	const int totalSize = size.x*size.y*size.z;
+	float * volume = new float[totalSize];
+	for(int i = 0; i < totalSize; i++)
+		volume[i] = (float)((i*7919) % 101) / 100.0f;
+
+	float * blurred = blurVolumeWithGaussianNative(volume, size, 1.0f);
+
+	// Compare with a direct convolution with the 3D Gaussian
+	int maskSize;
+	float * mask = createBlurMask(1.0f, &maskSize);
+	for(int z = 0; z < size.z; z++) {
+	for(int y = 0; y < size.y; y++) {
+	for(int x = 0; x < size.x; x++) {
+		float sum = 0.0f;
+		for(int c = -maskSize; c <= maskSize; c++) {
+		for(int b = -maskSize; b <= maskSize; b++) {
+		for(int a = -maskSize; a <= maskSize; a++) {
+			int3 pos(
+					std::min(std::max(x+a, 0), size.x-1),
+					std::min(std::max(y+b, 0), size.y-1),
+					std::min(std::max(z+c, 0), size.z-1)
+			);
+			sum += mask[a+maskSize]*mask[b+maskSize]*mask[c+maskSize]*volume[pos.x+pos.y*size.x+pos.z*size.x*size.y];
+		}}}
+		EXPECT_NEAR(sum, blurred[x+y*size.x+z*size.x*size.y], 1e-5);
+	}}}
+
+	delete[] mask;
+	delete[] volume;
+	delete[] blurred;
+}
+
+TEST(NativeBackendTest, ConstantVolumeGivesNoResponse) {
+	SIPL::int3 size(8,8,8);
+	const int totalSize = size.x*size.y*size.z;
+	float * volume = new float[totalSize];
+	for(int i = 0; i < totalSize; i++)
+		volume[i] = 0.5f;
+	float * Fx = new float[totalSize];
+	float * Fy = new float[totalSize];
+	float * Fz = new float[totalSize];
+	float * TDF = new float[totalSize];
+	float * radius = new float[totalSize];
+
+	createVectorFieldNative(volume, size, 0.2f, 1, Fx, Fy, Fz);
+	runGVFNative(size, 0.05f, 10, Fx, Fy, Fz);
+	runCircleFittingTDFNative(size, Fx, Fy, Fz, TDF, radius, 2.5f, 5.0f, 1.0f);
+	for(int i = 0; i < totalSize; i++) {
+		EXPECT_FLOAT_EQ(0.0f, Fx[i]);
+		EXPECT_FLOAT_EQ(0.0f, TDF[i]);
+	}
+
+	delete[] volume;
+	delete[] Fx;
+	delete[] Fy;
+	delete[] Fz;
+	delete[] TDF;
+	delete[] radius;
+}
+
+TEST(NativeBackendTest, SystemTestWithSyntheticData) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	setParameter(parameters, "parameters", "Synthetic-Vascusynth");
+	loadParameterPreset(parameters, PARAMETERS_DIR);
+	setParameter(parameters, "device", "native");
+	setParameter(parameters, "centerline-method", "ridge");
+	TSFOutput * output = run(std::string(TESTDATA_DIR) + "/synthetic/dataset_1/noisy.mhd", parameters, KERNELS_DIR);
+
+	EXPECT_TRUE(output->hasTDF());
+	EXPECT_TRUE(output->hasCenterlineVoxels());
+	EXPECT_FALSE(output->hasSegmentation());
+
+	// Compare extracted centerlines with the real centerlines
+	SIPL::Volume<char> * realCenterlines = new SIPL::Volume<char>((std::string(TESTDATA_DIR) + "/synthetic/dataset_1/real_centerline.mhd").c_str());
+	SIPL::int3 * size = output->getSize();
+	char * centerlines = output->getCenterlineVoxels();
+	int extracted = 0, close = 0;
+	for(int z = 1; z < size->z-1; z++) {
+	for(int y = 1; y < size->y-1; y++) {
+	for(int x = 1; x < size->x-1; x++) {
+		if(centerlines[x+y*size->x+z*size->x*size->y] == 0)
+			continue;
+		extracted++;
+		bool found = false;
+		for(int c = -1; c <= 1; c++) {
+		for(int b = -1; b <= 1; b++) {
+		for(int a = -1; a <= 1; a++) {
+			if(realCenterlines->get(x+a,y+b,z+c) > 0)
+				found = true;
+		}}}
+		if(found)
+			close++;
+	}}}
+	EXPECT_LT(0, extracted);
+	EXPECT_LT(0.7, (float)close / extracted);
+
+	delete realCenterlines;
+	delete output;
+}
+
+TEST(NativeBackendTest, MatchesOpenCLBackend) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	setParameter(parameters, "parameters", "Synthetic-Vascusynth");
+	setParameter(parameters, "centerline-method", "ridge");
+	loadParameterPreset(parameters, PARAMETERS_DIR);
+	// Float vector fields and a dense TDF, as computed by the native backend
+	setParameter(parameters, "32bit-vectors", "true");
+	setParameter(parameters, "sparse-tdf", "false");
+	const std::string filename = std::string(TESTDATA_DIR) + "/synthetic/dataset_1/noisy.mhd";
+	TSFOutput * openCLOutput = run(filename, parameters, KERNELS_DIR);
+	setParameter(parameters, "device", "native");
+	TSFOutput * nativeOutput = run(filename, parameters, KERNELS_DIR);
+
+	SIPL::int3 * size = nativeOutput->getSize();
+	ASSERT_EQ(openCLOutput->getSize()->x, size->x);
+	ASSERT_EQ(openCLOutput->getSize()->y, size->y);
+	ASSERT_EQ(openCLOutput->getSize()->z, size->z);
+	const int totalSize = size->x*size->y*size->z;
+
+	// The TDF may only differ by rounding and by the order of the summations
+	float * openCLTDF = openCLOutput->getTDF();
+	float * nativeTDF = nativeOutput->getTDF();
+	int different = 0;
+	for(int i = 0; i < totalSize; i++) {
+		if(fabs(openCLTDF[i] - nativeTDF[i]) > 0.01f)
+			different++;
+	}
+	EXPECT_GT(0.001, (double)different / totalSize);
+
+	// Ridge traversal from almost the same TDF has to find almost the same centerlines
+	char * openCLCenterlines = openCLOutput->getCenterlineVoxels();
+	char * nativeCenterlines = nativeOutput->getCenterlineVoxels();
+	int extracted = 0, close = 0;
+	for(int z = 1; z < size->z-1; z++) {
+	for(int y = 1; y < size->y-1; y++) {
+	for(int x = 1; x < size->x-1; x++) {
+		if(nativeCenterlines[x+y*size->x+z*size->x*size->y] == 0)
+			continue;
+		extracted++;
+		bool found = false;
+		for(int c = -1; c <= 1; c++) {
+		for(int b = -1; b <= 1; b++) {
+		for(int a = -1; a <= 1; a++) {
+			if(openCLCenterlines[x+a+(y+b)*size->x+(z+c)*size->x*size->y] > 0)
+				found = true;
+		}}}
+		if(found)
+			close++;
+	}}}
+	EXPECT_LT(0, extracted);
+	EXPECT_LT(0.95, (float)close / extracted);
+
+	delete openCLOutput;
+	delete nativeOutput;
+}
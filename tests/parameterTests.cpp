@@ -79,3 +79,20 @@ TEST(ParameterTest, Group) {
 	EXPECT_EQ("general", parameters.strings["mode"].getGroup());
 	EXPECT_EQ("tube-detection-filter", parameters.numerics["radius-min"].getGroup());
 }
+
+TEST(ParameterTest, InitParametersReturnsCopy) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	setParameter(parameters, "display", "true");
+
+	paramList parameters2 = initParameters(PARAMETERS_DIR);
+	EXPECT_FALSE(getParamBool(parameters2, "display"));
+}
+
+TEST(ParameterTest, ValidateParameters) {
+	paramList parameters = initParameters(PARAMETERS_DIR);
+	EXPECT_NO_THROW(validateParameters(parameters));
+
+	setParameter(parameters, "radius-min", "10");
+	setParameter(parameters, "radius-max", "5");
+	EXPECT_THROW(validateParameters(parameters), SIPL::SIPLException);
+}
@@ -0,0 +1,75 @@
+#include "tests.hpp"
+#include <sstream>
+
+TEST(TSFProfilerTest, DisabledProfilerRecordsNothing) {
+	TSFProfiler profiler;
+	profiler.start("read");
+	profiler.addBytesTransferred("read", 100);
+	profiler.stop("read");
+	EXPECT_EQ(0, profiler.getStages().size());
+}
+
+TEST(TSFProfilerTest, StagesAreAccumulated) {
+	TSFProfiler profiler(true);
+	for(int i = 0; i < 2; i++) {
+		profiler.start("TDF");
+		profiler.addBytesTransferred("TDF", 100);
+		profiler.stop("TDF");
+	}
+	profiler.start("centerline");
+	profiler.stop("centerline");
+
+	std::vector<StageTiming> stages = profiler.getStages();
+	ASSERT_EQ(2, stages.size());
+	EXPECT_EQ("TDF", stages[0].name);
+	EXPECT_EQ(2, stages[0].count);
+	EXPECT_EQ(200, stages[0].bytesTransferred);
+	EXPECT_LE(0.0, stages[0].hostTime);
+	EXPECT_EQ("centerline", stages[1].name);
+}
+
+TEST(TSFProfilerTest, AddStagesWithPrefix) {
+	TSFProfiler slab(true);
+	slab.start("GVF");
+	slab.addIterations("GVF", 250);
+	slab.stop("GVF");
+
+	TSFProfiler profiler(true);
+	profiler.addStages(slab, "slab 0 ");
+	profiler.addStages(slab, "slab 0 ");
+	std::vector<StageTiming> stages = profiler.getStages();
+	ASSERT_EQ(1, stages.size());
+	EXPECT_EQ("slab 0 GVF", stages[0].name);
+	EXPECT_EQ(2, stages[0].count);
+	EXPECT_EQ(500, stages[0].iterations);
+}
+
+TEST(TSFProfilerTest, WriteCSV) {
+	TSFProfiler profiler(true);
+	profiler.start("GVF");
+	profiler.stop("GVF");
+	std::stringstream out;
+	profiler.writeCSV(out);
+	std::string header, row;
+	std::getline(out, header);
+	std::getline(out, row);
+	EXPECT_EQ("stage,host_ms,device_ms,bytes,count", header);
+	EXPECT_EQ("GVF,", row.substr(0, 4));
+}
+
+TEST(TSFProfilerTest, WriteIterationsAndResiduals) {
+	TSFProfiler profiler(true);
+	profiler.start("GVF");
+	profiler.addResidual("GVF", 10, 0.5);
+	profiler.addResidual("GVF", 20, 0.25);
+	profiler.addIterations("GVF", 20);
+	profiler.stop("GVF");
+	std::vector<StageTiming> stages = profiler.getStages();
+	ASSERT_EQ(1, stages.size());
+	EXPECT_EQ(20, stages[0].iterations);
+	ASSERT_EQ(2, stages[0].residuals.size());
+	EXPECT_EQ(20, stages[0].residuals[1].first);
+	std::stringstream out;
+	profiler.writeJSON(out);
+	EXPECT_NE(std::string::npos, out.str().find("\"iterations\": 20, \"residuals\": [[10, 0.5], [20, 0.25]]"));
+}
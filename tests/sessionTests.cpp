@@ -0,0 +1,93 @@
+#include "tests.hpp"
+
+TEST(TSFSessionTest, SharedInstance) {
+	TSFSession * session = TSFSession::getInstance("gpu");
+	EXPECT_EQ(session, TSFSession::getInstance("gpu"));
+}
+
+TEST(TSFSessionTest, DiscardedInstanceIsReplaced) {
+	TSFSession * session = TSFSession::acquireInstance("gpu");
+	TSFSession::discardInstance("gpu", session);
+	EXPECT_NE(session, TSFSession::getInstance("gpu"));
+	// The discarded session is deleted when it is released
+	EXPECT_TRUE(session->getContext() != NULL);
+	session->release();
+}
+
+TEST(TSFSessionTest, ProgramIsReused) {
+	TSFSession * session = TSFSession::getInstance("gpu");
+	cl::Program program = session->getProgram(std::string(KERNELS_DIR) + "/kernels_no_3d_write.cl", "", false);
+	cl::Program program2 = session->getProgram(std::string(KERNELS_DIR) + "/kernels_no_3d_write.cl", "", false);
+	EXPECT_EQ(program(), program2());
+}
+
+TEST(TSFSessionTest, WrongKernelFilenameException) {
+	TSFSession * session = TSFSession::getInstance("gpu");
+	ASSERT_THROW(session->getProgram("somefilethatdoesntexist.cl", ""), SIPL::IOException);
+}
+
+TEST(DeviceMemoryPoolTest, ReleasedBufferIsReused) {
+	TSFSession * session = TSFSession::getInstance("gpu");
+	cl::Context context = session->getContext()->getContext();
+	cl::CommandQueue queue = session->getContext()->getQueue(0);
+	DeviceMemoryPool pool(context);
+	cl::Buffer first = pool.getBuffer(queue, 1024);
+	EXPECT_EQ(1024, pool.getPeakBytesInUse());
+	pool.release(first);
+	cl::Buffer buffer = pool.getBuffer(queue, 1024);
+	EXPECT_EQ(first(), buffer());
+	EXPECT_EQ(1024, pool.getAllocatedBytes());
+}
+
+TEST(DeviceMemoryPoolTest, BufferInUseIsNotReused) {
+	TSFSession * session = TSFSession::getInstance("gpu");
+	cl::Context context = session->getContext()->getContext();
+	cl::CommandQueue queue = session->getContext()->getQueue(0);
+	DeviceMemoryPool pool(context);
+	cl::Buffer buffer = pool.getBuffer(queue, 1024);
+	cl::Buffer buffer2 = pool.getBuffer(queue, 1024);
+	EXPECT_NE(buffer(), buffer2());
+	EXPECT_EQ(2048, pool.getPeakBytesInUse());
+
+	// Only objects that are not in use are freed
+	pool.clear();
+	EXPECT_EQ(2048, pool.getAllocatedBytes());
+}
+
+TEST(DeviceMemoryPoolTest, DetachedBufferIsNotPooled) {
+	TSFSession * session = TSFSession::getInstance("gpu");
+	cl::Context context = session->getContext()->getContext();
+	cl::CommandQueue queue = session->getContext()->getQueue(0);
+	DeviceMemoryPool pool(context);
+	cl::Buffer buffer = pool.getBuffer(queue, 1024);
+	pool.detach(buffer);
+	EXPECT_EQ(0, pool.getAllocatedBytes());
+
+	// Releasing a detached object has no effect
+	pool.release(buffer);
+	cl::Buffer buffer2 = pool.getBuffer(queue, 1024);
+	EXPECT_NE(buffer(), buffer2());
+}
+
+TEST(DeviceMemoryPoolTest, ScopeReleasesObjects) {
+	TSFSession * session = TSFSession::getInstance("gpu");
+	cl::Context context = session->getContext()->getContext();
+	DeviceMemoryPool pool(context);
+	OpenCL ocl;
+	ocl.queue = session->getContext()->getQueue(0);
+	ocl.pool = &pool;
+	cl::Buffer before = createBuffer(ocl, CL_MEM_READ_WRITE, 1024);
+	cl::Buffer released, kept;
+	{
+		DeviceMemoryScope scope(ocl);
+		released = createBuffer(ocl, CL_MEM_READ_WRITE, 1024);
+		kept = createBuffer(ocl, CL_MEM_READ_WRITE, 1024);
+		scope.keep(kept);
+	}
+	// Only the object that was requested in the scope and not kept is reused
+	cl::Buffer buffer = createBuffer(ocl, CL_MEM_READ_WRITE, 1024);
+	EXPECT_EQ(released(), buffer());
+	cl::Buffer buffer2 = createBuffer(ocl, CL_MEM_READ_WRITE, 1024);
+	EXPECT_NE(before(), buffer2());
+	EXPECT_NE(kept(), buffer2());
+}
@@ -5,6 +5,12 @@
 #include "parameterTests.cpp"
 #include "tubeSegmentationTests.cpp"
 #include "clinicalTests.cpp"
+#include "sessionTests.cpp"
+#include "nativeBackendTests.cpp"
+#include "profilerTests.cpp"
+#include "vectorFieldViewTests.cpp"
+#include "memoryPlannerTests.cpp"
+#include "centerlineLinkingTests.cpp"
 
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
@@ -3,7 +3,13 @@
 
 #include "../tube-segmentation.hpp"
 #include <gtest/gtest.h>
+#ifdef USE_ZLIB
+// Before the sources that use namespace cl, as its size_t conflicts with zlib
+#include <zlib.h>
+#endif
 #include "../tube-segmentation.cpp"
+#include "../memoryPool.hpp"
+#include "../memoryPlanner.hpp"
 #include "../parameters.hpp"
 #include "../SIPL/Exceptions.hpp"
 #include "tubeValidation.cpp"
@@ -142,3 +142,65 @@ TEST_F(TubeSegmentationRidge, SystemTestWithSyntheticData16bitBuffers) {
 	EXPECT_LT(0.6, result.recall);
 }
 
+
+// Reads the TDF of a run with a bool parameter off and on, and counts the
+// voxels that differ among those with a TDF of at least minTDF in either run
+static int countTDFDifferences(paramList parameters, std::string parameter, int * totalSize, float minTDF = 0.0f) {
+	const std::string filename = std::string(TESTDATA_DIR) + "/synthetic/dataset_1/noisy.mhd";
+	setParameter(parameters, "32bit-vectors", "true");
+	setParameter(parameters, "tdf-only", "true");
+	setParameter(parameters, parameter, "false");
+	TSFOutput * off = run(filename, parameters, KERNELS_DIR);
+	setParameter(parameters, parameter, "true");
+	TSFOutput * on = run(filename, parameters, KERNELS_DIR);
+	SIPL::int3 * size = off->getSize();
+	*totalSize = size->x*size->y*size->z;
+	float * offTDF = off->getTDF();
+	float * onTDF = on->getTDF();
+	int different = 0;
+	for(int i = 0; i < *totalSize; i++) {
+		if((offTDF[i] >= minTDF || onTDF[i] >= minTDF) && fabs(offTDF[i] - onTDF[i]) > 0.001f)
+			different++;
+	}
+	delete off;
+	delete on;
+	return different;
+}
+
+TEST_F(TubeSegmentationPCE, SparseTDFMatchesDenseTDF) {
+	// The candidate test only removes voxels with a small response, so the
+	// voxels with a strong response are the same as with the dense TDF
+	setParameter(parameters, "buffers-only", "false");
+	int totalSize;
+	const int different = countTDFDifferences(parameters, "sparse-tdf", &totalSize, 0.5f);
+	EXPECT_GT(0.001, (double)different / totalSize);
+}
+
+TEST_F(TubeSegmentationPCE, SparseTDFMatchesDenseTDFBuffers) {
+	setParameter(parameters, "buffers-only", "true");
+	int totalSize;
+	const int different = countTDFDifferences(parameters, "sparse-tdf", &totalSize, 0.5f);
+	EXPECT_GT(0.001, (double)different / totalSize);
+}
+
+// The slabs exchange the GVF during the iterations, so the seams between them
+// are exact. Without a device that can be partitioned, both runs use the
+// whole device.
+TEST_F(TubeSegmentationPCE, SubDevicesMatchWholeDevice) {
+	setParameter(parameters, "buffers-only", "false");
+	int totalSize;
+	EXPECT_EQ(0, countTDFDifferences(parameters, "sub-devices", &totalSize));
+}
+
+TEST_F(TubeSegmentationPCE, SubDevicesMatchWholeDeviceBuffers) {
+	setParameter(parameters, "buffers-only", "true");
+	int totalSize;
+	EXPECT_EQ(0, countTDFDifferences(parameters, "sub-devices", &totalSize));
+}
+
+// The specialized radius loop searches the same radii as the general one
+TEST_F(TubeSegmentationPCE, SpecializedKernelsMatchGeneralKernels) {
+	setParameter(parameters, "buffers-only", "false");
+	int totalSize;
+	EXPECT_EQ(0, countTDFDifferences(parameters, "specialize-kernels", &totalSize));
+}
@@ -0,0 +1,32 @@
+#include "tests.hpp"
+
+TEST(VectorFieldViewTest, LayoutsGiveSameVectors) {
+	const int totalSize = 8;
+	float Fx[totalSize], Fy[totalSize], Fz[totalSize];
+	float float4[totalSize*4];
+	short short4[totalSize*4];
+	for(int i = 0; i < totalSize; i++) {
+		Fx[i] = (i-4) / 4.0f;
+		Fy[i] = 0.5f;
+		Fz[i] = -1.0f;
+		float4[i*4] = Fx[i];
+		float4[i*4+1] = Fy[i];
+		float4[i*4+2] = Fz[i];
+		float4[i*4+3] = 0.0f;
+		short4[i*4] = (short)(Fx[i]*32767);
+		short4[i*4+1] = (short)(Fy[i]*32767);
+		short4[i*4+2] = -32768; // Has to be clamped to -1
+		short4[i*4+3] = 0;
+	}
+
+	VectorFieldView separate(Fx, Fy, Fz);
+	VectorFieldView interleaved(float4);
+	VectorFieldView interleaved16bit(short4);
+	for(int i = 0; i < totalSize; i++) {
+		for(int component = 0; component < 3; component++) {
+			EXPECT_FLOAT_EQ(separate.get(i, component), interleaved.get(i, component));
+			EXPECT_NEAR(separate.get(i, component), interleaved16bit.get(i, component), 1e-4);
+		}
+		EXPECT_FLOAT_EQ(sqrt(Fx[i]*Fx[i]+Fy[i]*Fy[i]+Fz[i]*Fz[i]), interleaved.magnitude(i));
+	}
+}
@@ -0,0 +1,54 @@
+#include "transfer.hpp"
+#include <cstring>
+#include <vector>
+
+AsyncImageRead::AsyncImageRead(OpenCL &ocl, cl::Image3D &image, SIPL::int3 size) : image(image) {
+    // Without a transfer queue, the read is done in order on the main queue
+    const bool hasTransferQueue = ocl.transferQueue() != NULL;
+    queue = hasTransferQueue ? ocl.transferQueue : ocl.queue;
+    bytes = (unsigned long long)size.x*size.y*size.z*image.getImageInfo<CL_IMAGE_ELEMENT_SIZE>();
+    staging = cl::Buffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes);
+
+    std::vector<cl::Event> waitFor;
+    if(hasTransferQueue) {
+        // The image is written by commands on the main queue
+        cl::Event marker;
+        ocl.queue.enqueueMarker(&marker);
+        ocl.queue.flush();
+        waitFor.push_back(marker);
+    }
+
+    cl::size_t<3> origin;
+    origin[0] = 0;
+    origin[1] = 0;
+    origin[2] = 0;
+    cl::size_t<3> region;
+    region[0] = size.x;
+    region[1] = size.y;
+    region[2] = size.z;
+    queue.enqueueCopyImageToBuffer(image, staging, origin, region, 0, waitFor.size() > 0 ? &waitFor : NULL);
+    data = queue.enqueueMapBuffer(staging, CL_FALSE, CL_MAP_READ, 0, bytes, NULL, &mapEvent);
+    queue.flush();
+    finished = false;
+}
+
+AsyncImageRead::~AsyncImageRead() {
+    queue.enqueueUnmapMemObject(staging, data);
+    queue.flush();
+}
+
+void * AsyncImageRead::getData() {
+    if(!finished) {
+        mapEvent.wait();
+        finished = true;
+    }
+    return data;
+}
+
+void AsyncImageRead::copyTo(void * destination) {
+    memcpy(destination, getData(), bytes);
+}
+
+unsigned long long AsyncImageRead::getBytes() const {
+    return bytes;
+}
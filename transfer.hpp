@@ -0,0 +1,35 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "commons.hpp"
+
+/*
+ * Reads an image back to the host in the background. The read is enqueued on
+ * the transfer queue, so it can overlap with kernels on the main queue, and
+ * waits only for the commands that were enqueued on the main queue before it
+ * was started. The image is copied to a pinned staging buffer
+ * (CL_MEM_ALLOC_HOST_PTR), which is mapped when the copy has finished, so no
+ * copy through pageable memory is made by the driver.
+ */
+class AsyncImageRead {
+public:
+    AsyncImageRead(OpenCL &ocl, cl::Image3D &image, SIPL::int3 size);
+    ~AsyncImageRead();
+    // Waits for the read and returns the data. It is valid for the lifetime of the object.
+    void * getData();
+    // Waits for the read and copies the data to destination
+    void copyTo(void * destination);
+    unsigned long long getBytes() const;
+private:
+    AsyncImageRead(const AsyncImageRead &other);
+    AsyncImageRead & operator=(const AsyncImageRead &other);
+    cl::CommandQueue queue;
+    cl::Image3D image; // Held so that a memory pool does not reuse it while it is copied
+    cl::Buffer staging;
+    cl::Event mapEvent;
+    void * data;
+    bool finished;
+    unsigned long long bytes;
+};
+
+#endif
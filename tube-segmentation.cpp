@@ -11,15 +11,19 @@
 #include "parallelCenterlineExtraction.hpp"
 #include "inputOutput.hpp"
 #include "segmentation.hpp"
+#include "nativeBackend.hpp"
+#include "memoryPool.hpp"
+#include "memoryPlanner.hpp"
 #include "SIPL/Types.hpp"
-#include <boost/iostreams/device/mapped_file.hpp>
 #include <queue>
 #include <stack>
 #include <list>
+#include <vector>
 #include <cstdio>
 #include <limits>
 #include <fstream>
-#include "timing.hpp"
+#include <sstream>
+#include <locale>
 #include <cmath>
 #include "HelperFunctions.hpp"
 #define MAX(a,b) a > b ? a : b
@@ -32,10 +36,10 @@
 #endif
 
 
-void print(paramList parameters){
-	unordered_map<std::string, BoolParameter>::iterator bIt;
-	unordered_map<std::string, NumericParameter>::iterator nIt;
-	unordered_map<std::string, StringParameter>::iterator sIt;
+void print(const paramList &parameters){
+	unordered_map<std::string, BoolParameter>::const_iterator bIt;
+	unordered_map<std::string, NumericParameter>::const_iterator nIt;
+	unordered_map<std::string, StringParameter>::const_iterator sIt;
 
 	for(bIt = parameters.bools.begin(); bIt != parameters.bools.end(); ++bIt){
 		std::cout << bIt->first << " = " << bIt->second.get() << " " << bIt->second.getDescription() << " "  << bIt->second.getGroup() << std::endl;
@@ -49,88 +53,153 @@ void print(paramList parameters){
 	}
 }
 
-int runCounter = 0;
-TSFOutput * run(std::string filename, paramList &parameters, std::string kernel_dir) {
+TSFOutput * run(std::string filename, const paramList &parameters, std::string kernel_dir) {
+    if(getParamStr(parameters, "device") == "native") {
+        paramList nativeParameters = parameters;
+        return runNative(filename, nativeParameters);
+    }
 
-    INIT_TIMER
-    oul::DeviceCriteria criteria;
-    criteria.setDeviceCountCriteria(1);
-    if(parameters.strings["device"].get() == "gpu") {
-    	criteria.setTypeCriteria(oul::DEVICE_TYPE_GPU);
-    } else {
-        setParameter(parameters, "16bit-vectors", "false");
-        criteria.setTypeCriteria(oul::DEVICE_TYPE_CPU);
+    // Reuse the context and compiled programs of previous runs on the same device type
+    const std::string deviceType = getParamStr(parameters, "device");
+    for(int attempt = 0; ; attempt++) {
+        TSFSession * session = TSFSession::acquireInstance(deviceType);
+        try {
+            TSFOutput * output = run(filename, parameters, kernel_dir, session);
+            session->release();
+            return output;
+        } catch(cl::Error &e) {
+            if(e.err() != CL_INVALID_COMMAND_QUEUE || attempt >= 2) {
+                session->release();
+                throw;
+            }
+            // The context may have been lost with the queue, e.g. in a reset
+            // of the device, so the run is retried with a new session
+            std::cout << "OpenCL error: Invalid Command Queue. Retrying..." << std::endl;
+            TSFSession::discardInstance(deviceType, session);
+            session->release();
+        } catch(...) {
+            session->release();
+            throw;
+        }
     }
-    
+}
+
+TSFOutput * run(std::string filename, const paramList &inputParameters, std::string kernel_dir, TSFSession * session) {
+
+    // The run changes some parameters depending on the device, so it works on a copy
+    paramList parameters = inputParameters;
+    validateParameters(parameters);
+    if(parameters.strings["device"].get() != "gpu")
+        setParameter(parameters, "16bit-vectors", "false");
 
     SIPL::int3 * size = new SIPL::int3();
-    TSFOutput * output = new TSFOutput(criteria, size, getParamBool(parameters, "16bit-vectors"));
-    oul::Context * c = output->getContext();
+    oul::Context * c = session->getContext();
+    const bool isApple = c->getPlatform().getInfo<CL_PLATFORM_VENDOR>().substr(0,5) == "Apple";
+    if(isApple)
+        setParameter(parameters, "16bit-vectors", "false");
+    BoolParameter write3D = parameters.bools["3d_write"];
+    write3D.set(!getParamBool(parameters, "buffers-only") && (int)c->getDevice(0).getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_3d_image_writes") > -1);
+    parameters.bools["3d_write"] = write3D;
+
+    // The vector type is compiled into the kernels, so it is chosen from the
+    // size in the header. The rest of the memory plan is made when the volume
+    // has been read and cropped.
+    MhdHeader header;
+    if(readMhdHeader(filename, header) && header.sizeFound) {
+        MemoryLimits limits = getMemoryLimits(c->getDevice(0), parameters);
+        limits.canChangeVectorType = getParamStr(parameters, "device") == "gpu" && !isApple;
+        MemoryPlan plan = planMemory(header.size, parameters, limits);
+        if(plan.use16bitVectors && !getParamBool(parameters, "16bit-vectors")) {
+            std::cout << "NOTE: Using 16 bit vectors, as the volume does not fit in memory with 32 bit vectors." << std::endl;
+            setParameter(parameters, "16bit-vectors", "true");
+        }
+    }
+    TSFOutput * output = new TSFOutput(c, size, getParamBool(parameters, "16bit-vectors"));
 
+    // Each run has its own queues and garbage collector, so that several runs
+    // can share the context of the session from different threads
     OpenCL * ocl = new OpenCL;
     ocl->context = c->getContext();
 	ocl->platform = c->getPlatform();
-	ocl->queue = c->getQueue(0);
 	ocl->device = c->getDevice(0);
-	ocl->GC = c->getGarbageCollector();
+	ocl->queue = cl::CommandQueue(ocl->context, ocl->device, CL_QUEUE_PROFILING_ENABLE);
+	ocl->transferQueue = cl::CommandQueue(ocl->context, ocl->device, CL_QUEUE_PROFILING_ENABLE);
+	ocl->GC = new oul::GarbageCollector;
+	ocl->profiler = output->getProfiler();
+    ocl->pool = getParamBool(parameters, "memory-pool") ? session->getMemoryPool() : NULL;
+    ocl->haloExchange = NULL;
+    if(ocl->pool != NULL)
+        ocl->pool->resetPeak();
+	output->setQueue(ocl->queue);
+	ocl->profiler->setEnabled(getParamBool(parameters, "timing") || getParamBool(parameters, "timer-total") || getParamStr(parameters, "timing-file") != "off");
+    // Results that are displayed or stored are read to the host while the later stages run
+    if(getParamBool(parameters, "display") || getParamStr(parameters, "storage-dir") != "off")
+        output->enableBackgroundTransfers(ocl->transferQueue);
 
     // Select first device
     std::cout << "Using device: " << ocl->device.getInfo<CL_DEVICE_NAME>() << std::endl;
     std::cout << "Using platform: " << ocl->platform.getInfo<CL_PLATFORM_NAME>() << std::endl;
 
     // Query the size of available memory
-    unsigned int memorySize = ocl->device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    cl_ulong memorySize = ocl->device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
     std::cout << "Available memory on selected device " << (double)memorySize/(1024*1024) << " MB "<< std::endl;
     std::cout << "Max alloc size: " << (float)ocl->device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()/(1024*1024) << " MB " << std::endl;
 
-    if(ocl->platform.getInfo<CL_PLATFORM_VENDOR>().substr(0,5) == "Apple")
-        setParameter(parameters, "16bit-vectors", "false");
-
-    // Compile and create program
-    if(!getParamBool(parameters, "buffers-only") && (int)ocl->device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_3d_image_writes") > -1) {
-    	std::string filename = kernel_dir+"/kernels.cl";
-        std::string buildOptions = "";
-        if(getParamBool(parameters, "16bit-vectors")) {
-        	buildOptions = "-D VECTORS_16BIT";
-        }
-        c->createProgramFromSource(filename, buildOptions);
-        BoolParameter v = parameters.bools["3d_write"];
-        v.set(true);
-        parameters.bools["3d_write"] = v;
+    // Compile and create program, or fetch it from the session if compiled before
+    std::string buildOptions = getGVFBuildOptions(ocl->device, parameters);
+    if(getParamBool(parameters, "16bit-vectors")) {
+        buildOptions += " -D VECTORS_16BIT";
+    }
+    buildOptions += getSpecializationBuildOptions(parameters);
+    std::string programFilename;
+    if(getParamBool(parameters, "3d_write")) {
+    	programFilename = kernel_dir+"/kernels.cl";
     } else {
         std::cout << "NOTE: Writing to 3D textures is not supported on the selected device." << std::endl;
-        BoolParameter v = parameters.bools["3d_write"];
-        v.set(false);
-        parameters.bools["3d_write"] = v;
-        std::string filename = kernel_dir+"/kernels_no_3d_write.cl";
-        std::string buildOptions = "";
+        programFilename = kernel_dir+"/kernels_no_3d_write.cl";
         if(getParamBool(parameters, "16bit-vectors")) {
-        	buildOptions = "-D VECTORS_16BIT";
         	std::cout << "NOTE: Forcing the use of 16 bit buffers. This is slow, but uses half the memory." << std::endl;
         }
-        c->createProgramFromSource(filename, buildOptions);
     }
+    ocl->program = session->getProgram(programFilename, buildOptions, getParamBool(parameters, "kernel-cache"));
     std::cout << "program compiled" << std::endl;
-    ocl->program = c->getProgram(0);
 
-    if(getParamBool(parameters, "timer-total")) {
-		START_TIMER
-    }
+    if(getParamBool(parameters, "sub-devices")) {
+        // The filtering stages are run on z-slabs, one on each sub-device
+        oul::Context * subDeviceContext = session->getSubDeviceContext();
+        if(subDeviceContext == NULL) {
+            setParameter(parameters, "sub-devices", "false");
+        } else {
+            cl::Program subDeviceProgram = session->getSubDeviceProgram(programFilename, buildOptions);
+            std::vector<cl::Device> subDevices = session->getSubDevices();
+            for(unsigned int i = 0; i < subDevices.size(); i++) {
+                SlabDevice slabDevice;
+                slabDevice.context = subDeviceContext->getContext();
+                slabDevice.device = subDevices[i];
+                slabDevice.queue = cl::CommandQueue(slabDevice.context, slabDevice.device, CL_QUEUE_PROFILING_ENABLE);
+                slabDevice.program = subDeviceProgram;
+                ocl->slabDevices.push_back(slabDevice);
+            }
+            std::cout << "Using " << subDevices.size() << " sub-devices" << std::endl;
+        }
+    }
+
+    ocl->profiler->start("total", ocl->queue);
     try {
+        // Pooled objects of the run are returned at the end of the scope, the outputs are detached
+        DeviceMemoryScope scope(*ocl);
+
         // Read dataset and transfer to device
         cl::Image3D * dataset = new cl::Image3D;
         ocl->GC->addMemoryObject(dataset);
         *dataset = readDatasetAndTransfer(*ocl, filename, parameters, size, output);
 
-        // Calculate maximum memory usage
-        double totalSize = size->x*size->y*size->z;
-        double vectorTypeSize = getParamBool(parameters, "16bit-vectors") ? sizeof(short):sizeof(float);
-        double peakSize = totalSize*10.0*vectorTypeSize;
-        std::cout << "NOTE: Peak memory usage with current dataset size is: " << (double)peakSize/(1024*1024) << " MB " << std::endl;
-        if(peakSize > memorySize) {
-            std::cout << "WARNING: There may not be enough space available on the GPU to process this volume." << std::endl;
-            std::cout << "WARNING: Shrink volume with " << (double)(peakSize-memorySize)*100.0/peakSize << "% (" << (double)(peakSize-memorySize)/(1024*1024) << " MB) " << std::endl;
-        }
+        // Choose the GVF and whether to use tiles from the size of the cropped volume
+        MemoryLimits limits = getMemoryLimits(ocl->device, parameters);
+        MemoryPlan plan = planMemory(*size, parameters, limits);
+        applyMemoryPlan(parameters, plan, limits);
+        if(!plan.fits && limits.budget)
+            throw SIPL::SIPLException("The volume does not fit in the memory budget, even in tiles", __LINE__, __FILE__);
 
         // Run specified method on dataset
         if(getParamStr(parameters, "centerline-method") == "ridge") {
@@ -140,25 +209,29 @@ TSFOutput * run(std::string filename, paramList &parameters, std::string kernel_
         } else if(getParamStr(parameters, "centerline-method") == "test") {
             runCircleFittingAndTest(ocl, dataset, size, parameters, output);
         }
-    } catch(cl::Error e) {
-    	//std::string str = "OpenCL error: " + oul::getCLErrorString(e.err());
+    } catch(...) {
+        // OpenCL errors are passed on with their code, a lost queue is retried by the caller
         ocl->GC->deleteAllMemoryObjects();
+        delete ocl->GC;
+        delete ocl;
         delete output;
-
-        if(e.err() == CL_INVALID_COMMAND_QUEUE && runCounter < 2) {
-            std::cout << "OpenCL error: Invalid Command Queue. Retrying..." << std::endl;
-            runCounter++;
-            return run(filename,parameters,kernel_dir);
-        }
-
-        //throw SIPL::SIPLException(str.c_str());
-        throw SIPL::SIPLException();
+        throw;
     }
     ocl->queue.finish();
-    if(getParamBool(parameters, "timer-total")) {
-		STOP_TIMER("total")
-    }
+    ocl->profiler->stop("total", ocl->queue);
+    if(getParamStr(parameters, "timing-file") != "off")
+        ocl->profiler->writeToFile(getParamStr(parameters, "timing-file"));
     ocl->GC->deleteAllMemoryObjects();
+    delete ocl->GC;
+    if(ocl->pool != NULL) {
+        if(getParamBool(parameters, "timing")) {
+            std::cout << "Memory pool: " << (double)ocl->pool->getPeakBytesInUse()/(1024*1024) << " MB peak in use, " <<
+                (double)ocl->pool->getAllocatedBytes()/(1024*1024) << " MB allocated" << std::endl;
+        }
+        // Objects that were not needed by this run are released
+        ocl->pool->trim();
+    }
+    delete ocl;
     return output;
 }
 
@@ -186,30 +259,122 @@ void __stdcall notify(cl_mem memobj, void * user_data) {
 
 
 float * createBlurMask(float sigma, int * maskSizePointer) {
+    // Same radius as the 3D mask the separable blur replaced, so that the
+    // results are unchanged
     int maskSize = (int)ceil(sigma/0.5f);
-    if(maskSize < 1) // cap min mask size at 3x3x3
+    if(maskSize < 1) // cap min mask size at 3
     	maskSize = 1;
-    if(maskSize > 5) // cap mask size at 11x11x11
+    if(maskSize > 5) // cap mask size at 11
     	maskSize = 5;
-    float * mask = new float[(maskSize*2+1)*(maskSize*2+1)*(maskSize*2+1)];
+    float * mask = new float[maskSize*2+1];
     float sum = 0.0f;
     for(int a = -maskSize; a < maskSize+1; a++) {
-        for(int b = -maskSize; b < maskSize+1; b++) {
-            for(int c = -maskSize; c < maskSize+1; c++) {
-                sum += exp(-((float)(a*a+b*b+c*c) / (2*sigma*sigma)));
-                mask[a+maskSize+(b+maskSize)*(maskSize*2+1)+(c+maskSize)*(maskSize*2+1)*(maskSize*2+1)] = exp(-((float)(a*a+b*b+c*c) / (2*sigma*sigma)));
-
-            }
-        }
+        mask[a+maskSize] = exp(-((float)(a*a) / (2*sigma*sigma)));
+        sum += mask[a+maskSize];
     }
-    for(int i = 0; i < (maskSize*2+1)*(maskSize*2+1)*(maskSize*2+1); i++)
+    for(int i = 0; i < maskSize*2+1; i++)
         mask[i] = mask[i] / sum;
 
     *maskSizePointer = maskSize;
 
     return mask;
 }
+
+/*
+ * Runs one pass of the separable blur. The arguments volume and blurredVolume
+ * must already be set. Each work-group is made of up to four lines along the
+ * blur direction, placed next to each other in x for the y and z passes so that
+ * the reads stay coalesced. The lines along the blur direction are whole, the
+ * other dimensions are padded to whole work-groups.
+ */
+void enqueueBlurPass(OpenCL &ocl, Kernel &blurKernel, Buffer &blurMask, int maskSize, SIPL::int3 size, int direction) {
+    const int maxWorkGroupSize = blurKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(ocl.device);
+    const int lengths[3] = {size.x, size.y, size.z};
+    const int lines = maxWorkGroupSize >= 16 ? 4 : 1;
+    int length = 32;
+    while(length > 1 && (lengths[direction] % length != 0 || length*lines > maxWorkGroupSize))
+        length /= 2;
+
+    int local[3] = {lines, 1, 1};
+    if(direction == 0)
+        local[1] = lines;
+    local[direction] = length;
+    int global[3];
+    for(int i = 0; i < 3; i++)
+        global[i] = ((lengths[i] + local[i] - 1) / local[i]) * local[i];
+
+    blurKernel.setArg(2, maskSize);
+    blurKernel.setArg(3, blurMask);
+    blurKernel.setArg(4, direction);
+    blurKernel.setArg(5, cl::__local(sizeof(float)*lines*(length+2*maskSize)));
+    blurKernel.setArg(6, size.x);
+    blurKernel.setArg(7, size.y);
+    blurKernel.setArg(8, size.z);
+    ocl.queue.enqueueNDRangeKernel(
+            blurKernel,
+            NullRange,
+            NDRange(global[0],global[1],global[2]),
+            NDRange(local[0],local[1],local[2])
+    );
+}
+
+/*
+ * Blurs the dataset with a Gaussian in three passes (x, y and z) and stores the
+ * result in blurredVolume. The cost per voxel grows linearly with sigma.
+ */
+void blurVolumeWithGaussian(OpenCL &ocl, Image3D * dataset, Image3D * blurredVolume, SIPL::int3 size, float sigma, bool no3Dwrite) {
+    int maskSize = 1;
+    float * mask = createBlurMask(sigma, &maskSize);
+    Buffer blurMask = Buffer(ocl.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float)*(maskSize*2+1), mask);
+    blurMask.setDestructorCallback((void (__stdcall *)(cl_mem,void *))(freeData<float>), (void *)mask);
+
+    Kernel blurKernel(ocl.program, "blurVolumeWithGaussianPass");
+    cl::size_t<3> offset = oul::createOrigoRegion();
+    cl::size_t<3> region = oul::createRegion(size.x, size.y, size.z);
+    const int totalSize = size.x*size.y*size.z;
+
+    if(no3Dwrite) {
+        // Create auxillary buffers, the passes go A -> B -> A -> B
+        Buffer buffers[2] = {
+            createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(float)*totalSize),
+            createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(float)*totalSize)
+        };
+        ocl.queue.enqueueCopyImageToBuffer(*dataset, buffers[0], offset, region, 0);
+        for(int direction = 0; direction < 3; direction++) {
+            blurKernel.setArg(0, buffers[direction % 2]);
+            blurKernel.setArg(1, buffers[(direction+1) % 2]);
+            enqueueBlurPass(ocl, blurKernel, blurMask, maskSize, size, direction);
+        }
+        ocl.queue.enqueueCopyBufferToImage(buffers[1], *blurredVolume, 0, offset, region);
+        releaseToPool(ocl, buffers[0]);
+        releaseToPool(ocl, buffers[1]);
+    } else {
+        // The passes go dataset -> blurredVolume -> temp -> blurredVolume
+        Image3D temp = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z);
+        Image3D * inputs[3] = {dataset, blurredVolume, &temp};
+        Image3D * outputs[3] = {blurredVolume, &temp, blurredVolume};
+        for(int direction = 0; direction < 3; direction++) {
+            blurKernel.setArg(0, *inputs[direction]);
+            blurKernel.setArg(1, *outputs[direction]);
+            enqueueBlurPass(ocl, blurKernel, blurMask, maskSize, size, direction);
+        }
+        releaseToPool(ocl, temp);
+    }
+}
+
+void runTiledCircleFittingMethod(OpenCL &ocl, Image3D * dataset, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radiusImage);
+void runSlabCircleFittingMethod(OpenCL &ocl, Image3D * dataset, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radiusImage);
+
 void runCircleFittingMethod(OpenCL &ocl, Image3D * dataset, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radiusImage) {
+    if(getParamBool(parameters, "sub-devices") && ocl.slabDevices.size() > 1) {
+        runSlabCircleFittingMethod(ocl, dataset, size, parameters, vectorField, TDF, radiusImage);
+        return;
+    }
+    if(getParamBool(parameters, "tiled-execution")) {
+        runTiledCircleFittingMethod(ocl, dataset, size, parameters, vectorField, TDF, radiusImage);
+        return;
+    }
+
     // Set up parameters
     const float radiusMin = getParam(parameters, "radius-min");
     const float radiusMax = getParam(parameters, "radius-max");
@@ -232,71 +397,23 @@ void runCircleFittingMethod(OpenCL &ocl, Image3D * dataset, SIPL::int3 size, par
     region[2] = size.z;
 
     // Create kernels
-    Kernel blurVolumeWithGaussianKernel(ocl.program, "blurVolumeWithGaussian");
     Kernel createVectorFieldKernel(ocl.program, "createVectorField");
     Kernel combineKernel = Kernel(ocl.program, "combine");
 
-    cl::Event startEvent, endEvent;
-    cl_ulong start, end;
-    INIT_TIMER
     void * TDFsmall;
     float * radiusSmall;
     if(radiusMin < 2.5f) {
-        Image3D * blurredVolume = new Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z);
+        Image3D * blurredVolume = new Image3D(createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z));
         ocl.GC->addMemoryObject(blurredVolume);
+    ocl.profiler->start("blur", ocl.queue);
     if(smallBlurSigma > 0) {
-    	int maskSize = 1;
-		float * mask = createBlurMask(smallBlurSigma, &maskSize);
-		Buffer blurMask = Buffer(ocl.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float)*(maskSize*2+1)*(maskSize*2+1)*(maskSize*2+1), mask);
-        blurMask.setDestructorCallback((void (__stdcall *)(cl_mem,void *))(freeData<float>), (void *)mask);
-    	if(no3Dwrite) {
-			// Create auxillary buffer
-			Buffer blurredVolumeBuffer = Buffer(
-					ocl.context,
-					CL_MEM_WRITE_ONLY,
-					sizeof(float)*totalSize
-			);
-
-			// Run blurVolumeWithGaussian on dataset
-			blurVolumeWithGaussianKernel.setArg(0, *dataset);
-			blurVolumeWithGaussianKernel.setArg(1, blurredVolumeBuffer);
-			blurVolumeWithGaussianKernel.setArg(2, maskSize);
-			blurVolumeWithGaussianKernel.setArg(3, blurMask);
-
-			ocl.queue.enqueueNDRangeKernel(
-					blurVolumeWithGaussianKernel,
-					NullRange,
-					NDRange(size.x,size.y,size.z),
-					NullRange
-			);
-
-			ocl.queue.enqueueCopyBufferToImage(
-					blurredVolumeBuffer,
-					*blurredVolume,
-					0,
-					offset,
-					region
-			);
-    	} else {
-			// Run blurVolumeWithGaussian on processedVolume
-			blurVolumeWithGaussianKernel.setArg(0, *dataset);
-			blurVolumeWithGaussianKernel.setArg(1, *blurredVolume);
-			blurVolumeWithGaussianKernel.setArg(2, maskSize);
-			blurVolumeWithGaussianKernel.setArg(3, blurMask);
-			ocl.queue.enqueueNDRangeKernel(
-					blurVolumeWithGaussianKernel,
-					NullRange,
-					NDRange(size.x,size.y,size.z),
-					NullRange
-			);
-    	}
+        blurVolumeWithGaussian(ocl, dataset, blurredVolume, size, smallBlurSigma, no3Dwrite);
     } else {
         blurredVolume = dataset;
     }
+    ocl.profiler->stop("blur", ocl.queue);
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
+    ocl.profiler->start("vector field", ocl.queue);
     Image3D * vectorFieldSmall;
     if(no3Dwrite) {
     	bool usingTwoBuffers = false;
@@ -306,28 +423,28 @@ if(getParamBool(parameters, "timing")) {
         unsigned int maxBufferSize = ocl.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
         if(getParamBool(parameters, "16bit-vectors")) {
 			if(4*sizeof(short)*totalSize < maxBufferSize) {
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize);
 			} else {
 				std::cout << "NOTE: Could not fit entire vector field into one buffer. Splitting buffer in two." << std::endl;
 				// create two buffers
 				unsigned int limit = (float)maxBufferSize / (4*sizeof(short));
 				maxZ = floor((float)limit/(size.x*size.y));
 				unsigned int splitSize = maxZ*size.x*size.y*4*sizeof(short);
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, splitSize);
-				vectorFieldBuffer2 = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize-splitSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, splitSize);
+				vectorFieldBuffer2 = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize-splitSize);
 				usingTwoBuffers = true;
 			}
         } else {
 			if(4*sizeof(float)*totalSize < maxBufferSize) {
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize);
 			} else {
 				std::cout << "NOTE: Could not fit entire vector field into one buffer. Splitting buffer in two." << std::endl;
 				// create two buffers
 				unsigned int limit = (float)maxBufferSize / (4*sizeof(float));
 				maxZ = floor((float)limit/(size.x*size.y));
 				unsigned int splitSize = maxZ*size.x*size.y*4*sizeof(float);
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, splitSize);
-				vectorFieldBuffer2 = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize-splitSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, splitSize);
+				vectorFieldBuffer2 = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize-splitSize);
 				usingTwoBuffers = true;
     		}
         }
@@ -350,23 +467,23 @@ if(getParamBool(parameters, "timing")) {
 
         if(smallBlurSigma > 0) {
             ocl.queue.finish();
-            ocl.GC->deleteMemoryObject(blurredVolume);
+            deleteMemoryObject(ocl, blurredVolume);
         }
 
         if(getParamBool(parameters, "16bit-vectors")) {
-            vectorFieldSmall = new Image3D(
-                ocl.context, 
+            vectorFieldSmall = new Image3D(createImage3D(
+                ocl, 
                 CL_MEM_READ_ONLY,
                 ImageFormat(CL_RGBA, CL_SNORM_INT16),
                 size.x,size.y,size.z
-            );
+            ));
         } else {
-            vectorFieldSmall = new Image3D(
-                    ocl.context, 
+            vectorFieldSmall = new Image3D(createImage3D(
+                    ocl, 
                     CL_MEM_READ_ONLY,
                     ImageFormat(CL_RGBA, CL_FLOAT),
                 size.x,size.y,size.z
-            );
+            ));
         }
         ocl.GC->addMemoryObject(vectorFieldSmall);
         if(usingTwoBuffers) {
@@ -412,14 +529,16 @@ if(getParamBool(parameters, "timing")) {
 					region
 			);
         }
+        releaseToPool(ocl, vectorFieldBuffer);
+        releaseToPool(ocl, vectorFieldBuffer2);
 
     } else {
         if(getParamBool(parameters, "32bit-vectors")) {
             std::cout << "NOTE: Using 32 bit vectors" << std::endl;
-            vectorFieldSmall = new Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+            vectorFieldSmall = new Image3D(createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z));
         } else {
             std::cout << "NOTE: Using 16 bit vectors" << std::endl;
-            vectorFieldSmall = new Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+            vectorFieldSmall = new Image3D(createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z));
         }
         ocl.GC->addMemoryObject(vectorFieldSmall);
 
@@ -438,42 +557,34 @@ if(getParamBool(parameters, "timing")) {
 
     if(smallBlurSigma > 0) {
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(blurredVolume);
+        deleteMemoryObject(ocl, blurredVolume);
     }
     }
 
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME of Create vector field: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
+    ocl.profiler->stop("vector field", ocl.queue);
+    ocl.profiler->start("TDF", ocl.queue);
     // Run circle fitting TDF kernel
     Buffer * TDFsmallBuffer;
     if(getParamBool(parameters, "16bit-vectors")) {
-        TDFsmallBuffer = new Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(short)*totalSize);
+        TDFsmallBuffer = new Buffer(createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(short)*totalSize));
     } else {
-        TDFsmallBuffer = new Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize);
+        TDFsmallBuffer = new Buffer(createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize));
     }
     ocl.GC->addMemoryObject(TDFsmallBuffer);
-    Buffer * radiusSmallBuffer = new Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize);
+    Buffer * radiusSmallBuffer = new Buffer(createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize));
     ocl.GC->addMemoryObject(radiusSmallBuffer);
-    runCircleFittingTDF(ocl,size,vectorFieldSmall,TDFsmallBuffer,radiusSmallBuffer,radiusMin,3.0f,0.5f);
+    runCircleFittingTDF(ocl,size,vectorFieldSmall,TDFsmallBuffer,radiusSmallBuffer,radiusMin,3.0f,0.5f,parameters);
 
 
     if(radiusMax < 2.5) {
     	// Stop here
     	// Copy TDFsmall to TDF and radiusSmall to radiusImage
         if(getParamBool(parameters, "16bit-vectors")) {
-            TDF = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_UNORM_INT16),
+            TDF = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_UNORM_INT16),
 				size.x, size.y, size.z);
         } else {
-            TDF = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT),
+            TDF = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT),
 				size.x, size.y, size.z);
         }
 		ocl.queue.enqueueCopyBufferToImage(
@@ -483,7 +594,7 @@ if(getParamBool(parameters, "timing")) {
 			offset,
 			region
 		);
-		radiusImage = Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT),
+		radiusImage = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT),
 				size.x, size.y, size.z);
 		ocl.queue.enqueueCopyBufferToImage(
 			*radiusSmallBuffer,
@@ -494,11 +605,11 @@ if(getParamBool(parameters, "timing")) {
 		);
         vectorField = *vectorFieldSmall;
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(dataset);
+        deleteMemoryObject(ocl, dataset);
 		return;
     } else {
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(vectorFieldSmall);
+        deleteMemoryObject(ocl, vectorFieldSmall);
     }
 
     // TODO: cleanup the two arrays below!!!!!!!!
@@ -514,92 +625,32 @@ if(getParamBool(parameters, "timing")) {
     ocl.queue.enqueueReadBuffer(*radiusSmallBuffer, CL_FALSE, 0, sizeof(float)*totalSize, radiusSmall);
 
     ocl.queue.finish(); // This finish statement is necessary. Incorrect combine result if not present.
-    ocl.GC->deleteMemoryObject(TDFsmallBuffer);
-    ocl.GC->deleteMemoryObject(radiusSmallBuffer);
-
-    if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME of TDF small: " << (end-start)*1.0e-6 << " ms" << std::endl;
-    }
+    deleteMemoryObject(ocl, TDFsmallBuffer);
+    deleteMemoryObject(ocl, radiusSmallBuffer);
+
+    ocl.profiler->stop("TDF", ocl.queue);
 
     } // end if radiusMin < 2.5
 
 
     /* Large Airways */
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
-    Image3D * blurredVolume = new Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z);
+    ocl.profiler->start("blur", ocl.queue);
+    Image3D * blurredVolume = new Image3D(createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_FLOAT), size.x, size.y, size.z));
     ocl.GC->addMemoryObject(blurredVolume);
     if(largeBlurSigma > 0) {
-    	int maskSize = 1;
-		float * mask = createBlurMask(largeBlurSigma, &maskSize);
-	    Buffer blurMask = Buffer(ocl.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float)*(maskSize*2+1)*(maskSize*2+1)*(maskSize*2+1), mask);
-        blurMask.setDestructorCallback((void (__stdcall *)(cl_mem,void *))(freeData<float>), (void *)mask);
-    	if(no3Dwrite) {
-			// Create auxillary buffer
-			Buffer blurredVolumeBuffer = Buffer(
-					ocl.context,
-					CL_MEM_WRITE_ONLY,
-					sizeof(float)*totalSize
-			);
-
-			// Run blurVolumeWithGaussian on dataset
-			blurVolumeWithGaussianKernel.setArg(0, *dataset);
-			blurVolumeWithGaussianKernel.setArg(1, blurredVolumeBuffer);
-			blurVolumeWithGaussianKernel.setArg(2, maskSize);
-			blurVolumeWithGaussianKernel.setArg(3, blurMask);
-
-			ocl.queue.enqueueNDRangeKernel(
-					blurVolumeWithGaussianKernel,
-					NullRange,
-					NDRange(size.x,size.y,size.z),
-					NullRange
-			);
-
-			ocl.queue.enqueueCopyBufferToImage(
-					blurredVolumeBuffer,
-					*blurredVolume,
-					0,
-					offset,
-					region
-			);
-    	} else {
-			// Run blurVolumeWithGaussian on processedVolume
-			blurVolumeWithGaussianKernel.setArg(0, *dataset);
-			blurVolumeWithGaussianKernel.setArg(1, *blurredVolume);
-			blurVolumeWithGaussianKernel.setArg(2, maskSize);
-			blurVolumeWithGaussianKernel.setArg(3, blurMask);
-			ocl.queue.enqueueNDRangeKernel(
-					blurVolumeWithGaussianKernel,
-					NullRange,
-					NDRange(size.x,size.y,size.z),
-					NullRange
-			);
-    	}
+        blurVolumeWithGaussian(ocl, dataset, blurredVolume, size, largeBlurSigma, no3Dwrite);
     } else {
         blurredVolume = dataset;
     }
     if(largeBlurSigma > 0) {
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(dataset);
+        deleteMemoryObject(ocl, dataset);
     }
 
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME blurring: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
+    ocl.profiler->stop("blur", ocl.queue);
+    ocl.profiler->start("vector field", ocl.queue);
 	Image3D * initVectorField;
    if(no3Dwrite) {
 		bool usingTwoBuffers = false;
@@ -608,33 +659,33 @@ if(getParamBool(parameters, "timing")) {
         Buffer vectorFieldBuffer, vectorFieldBuffer2;
         unsigned int maxBufferSize = ocl.device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
         if(getParamBool(parameters, "16bit-vectors")) {
-			initVectorField = new Image3D(ocl.context, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+			initVectorField = new Image3D(createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z));
 			ocl.GC->addMemoryObject(initVectorField);
 			if(4*sizeof(short)*totalSize < maxBufferSize) {
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize);
 			} else {
 				std::cout << "NOTE: Could not fit entire vector field into one buffer. Splitting buffer in two." << std::endl;
 				// create two buffers
 				unsigned int limit = (float)maxBufferSize / (4*sizeof(short));
 				maxZ = floor((float)limit/(size.x*size.y));
 				unsigned int splitSize = maxZ*size.x*size.y*4*sizeof(short);
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, splitSize);
-				vectorFieldBuffer2 = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize-splitSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, splitSize);
+				vectorFieldBuffer2 = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(short)*totalSize-splitSize);
 				usingTwoBuffers = true;
 			}
         } else {
-			initVectorField = new Image3D(ocl.context, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+			initVectorField = new Image3D(createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z));
 			ocl.GC->addMemoryObject(initVectorField);
 			if(4*sizeof(float)*totalSize < maxBufferSize) {
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize);
 			} else {
 				std::cout << "NOTE: Could not fit entire vector field into one buffer. Splitting buffer in two." << std::endl;
 				// create two buffers
 				unsigned int limit = (float)maxBufferSize / (4*sizeof(float));
 				maxZ = floor((float)limit/(size.x*size.y));
 				unsigned int splitSize = maxZ*size.x*size.y*4*sizeof(float);
-				vectorFieldBuffer = Buffer(ocl.context, CL_MEM_WRITE_ONLY, splitSize);
-				vectorFieldBuffer2 = Buffer(ocl.context, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize-splitSize);
+				vectorFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, splitSize);
+				vectorFieldBuffer2 = createBuffer(ocl, CL_MEM_WRITE_ONLY, 4*sizeof(float)*totalSize-splitSize);
 				usingTwoBuffers = true;
     		}
         }
@@ -656,7 +707,7 @@ if(getParamBool(parameters, "timing")) {
         );
 
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(blurredVolume);
+        deleteMemoryObject(ocl, blurredVolume);
 
         if(usingTwoBuffers) {
         	cl::size_t<3> region2;
@@ -701,13 +752,15 @@ if(getParamBool(parameters, "timing")) {
 					region
 			);
         }
+        releaseToPool(ocl, vectorFieldBuffer);
+        releaseToPool(ocl, vectorFieldBuffer2);
 
 
     } else {
         if(getParamBool(parameters, "32bit-vectors")) {
-            initVectorField = new Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z);
+            initVectorField = new Image3D(createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_FLOAT), size.x, size.y, size.z));
         } else {
-            initVectorField = new Image3D(ocl.context, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z);
+            initVectorField = new Image3D(createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_RGBA, CL_SNORM_INT16), size.x, size.y, size.z));
         }
         ocl.GC->addMemoryObject(initVectorField);
 
@@ -726,19 +779,11 @@ if(getParamBool(parameters, "timing")) {
         );
 
         ocl.queue.finish();
-        ocl.GC->deleteMemoryObject(blurredVolume);
+        deleteMemoryObject(ocl, blurredVolume);
     }
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME Create vector field: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
+    ocl.profiler->stop("vector field", ocl.queue);
+    ocl.profiler->start("GVF", ocl.queue);
 	// Determine whether to use the slow GVF that use less memory or not
 	bool useSlowGVF = false;
 	if(no3Dwrite) {
@@ -753,7 +798,9 @@ if(getParamBool(parameters, "timing")) {
 			}
 		}
 	}
-    if(getParamBool(parameters, "use-fmg-gvf")) {
+    if(getParamBool(parameters, "gvf-low-memory"))
+        useSlowGVF = true;
+    if(getParamBool(parameters, "use-fmg-gvf") && !useSlowGVF) {
         vectorField = runFMGGVF(ocl,initVectorField,parameters,size);
     } else if(useSlowGVF) {
 		vectorField = runGVF(ocl, initVectorField, parameters, size, true);
@@ -762,53 +809,38 @@ if(getParamBool(parameters, "timing")) {
 	}
 std::cout << "GVF finished" << std::endl;
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME of GVF: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
+    ocl.profiler->stop("GVF", ocl.queue);
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
+    ocl.profiler->start("TDF", ocl.queue);
     // Run circle fitting TDF kernel on GVF result
     Buffer TDFlarge;
     if(getParamBool(parameters, "16bit-vectors")) {
-        TDFlarge = Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(short)*totalSize);
+        TDFlarge = createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(short)*totalSize);
     } else {
-        TDFlarge = Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize);
+        TDFlarge = createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize);
     }
-    Buffer radiusLarge = Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize);
+    Buffer radiusLarge = createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(float)*totalSize);
 
-    if(getParamBool(parameters,"use-spline-tdf")) {
-        runSplineTDF(ocl,size,&vectorField,&TDFlarge,&radiusLarge,std::max(1.5f, radiusMin),radiusMax,radiusStep);
+    const float TDFRadiusMin = getParamBool(parameters,"use-spline-tdf") ? std::max(1.5f, radiusMin) : std::max(2.5f, radiusMin);
+    if(getParam(parameters, "tdf-band-radius") > 0 && radiusMax > std::max(4.0f, getParam(parameters, "tdf-band-radius"))) {
+        runScaleSpaceTDF(ocl,size,&vectorField,&TDFlarge,&radiusLarge,TDFRadiusMin,radiusMax,radiusStep,parameters);
+    } else if(getParamBool(parameters,"use-spline-tdf")) {
+        runSplineTDF(ocl,size,&vectorField,&TDFlarge,&radiusLarge,TDFRadiusMin,radiusMax,radiusStep);
     } else {
-        runCircleFittingTDF(ocl,size,&vectorField,&TDFlarge,&radiusLarge,std::max(2.5f, radiusMin),radiusMax,radiusStep);
+        runCircleFittingTDF(ocl,size,&vectorField,&TDFlarge,&radiusLarge,std::max(2.5f, radiusMin),radiusMax,radiusStep,parameters);
     }
 std::cout << "TDF finished" << std::endl;
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME of TDF large: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&startEvent);
-}
 	if(radiusMin < 2.5f) {
         Buffer TDFsmall2;
         if(getParamBool(parameters, "16bit-vectors")) {
-            TDFsmall2 = Buffer(ocl.context, CL_MEM_READ_ONLY, sizeof(short)*totalSize);
+            TDFsmall2 = createBuffer(ocl, CL_MEM_READ_ONLY, sizeof(short)*totalSize);
             ocl.queue.enqueueWriteBuffer(TDFsmall2, CL_FALSE, 0, sizeof(short)*totalSize, (unsigned short*)TDFsmall);
         } else {
-            TDFsmall2 = Buffer(ocl.context, CL_MEM_READ_ONLY, sizeof(float)*totalSize);
+            TDFsmall2 = createBuffer(ocl, CL_MEM_READ_ONLY, sizeof(float)*totalSize);
             ocl.queue.enqueueWriteBuffer(TDFsmall2, CL_FALSE, 0, sizeof(float)*totalSize, (float*)TDFsmall);
         }
-        Buffer radiusSmall2 = Buffer(ocl.context, CL_MEM_READ_ONLY, sizeof(float)*totalSize);
+        Buffer radiusSmall2 = createBuffer(ocl, CL_MEM_READ_ONLY, sizeof(float)*totalSize);
         ocl.queue.enqueueWriteBuffer(radiusSmall2, CL_FALSE, 0, sizeof(float)*totalSize, radiusSmall);
 		combineKernel.setArg(0, TDFsmall2);
 		combineKernel.setArg(1, radiusSmall2);
@@ -821,12 +853,14 @@ if(getParamBool(parameters, "timing")) {
 				NDRange(totalSize),
 				NDRange(64)
 		);
+        releaseToPool(ocl, TDFsmall2);
+        releaseToPool(ocl, radiusSmall2);
 	}
     if(getParamBool(parameters, "16bit-vectors")) {
-        TDF = Image3D(ocl.context, CL_MEM_READ_ONLY, ImageFormat(CL_R, CL_UNORM_INT16),
+        TDF = createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_R, CL_UNORM_INT16),
                 size.x, size.y, size.z);
     } else {
-        TDF = Image3D(ocl.context, CL_MEM_READ_ONLY, ImageFormat(CL_R, CL_FLOAT),
+        TDF = createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_R, CL_FLOAT),
                 size.x, size.y, size.z);
     }
     ocl.queue.enqueueCopyBufferToImage(
@@ -836,7 +870,7 @@ if(getParamBool(parameters, "timing")) {
         offset,
         region
     );
-    radiusImage = Image3D(ocl.context, CL_MEM_READ_ONLY, ImageFormat(CL_R, CL_FLOAT),
+    radiusImage = createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_R, CL_FLOAT),
             size.x, size.y, size.z);
     ocl.queue.enqueueCopyBufferToImage(
         radiusLarge,
@@ -845,14 +879,10 @@ if(getParamBool(parameters, "timing")) {
         offset,
         region
     );
+    releaseToPool(ocl, TDFlarge);
+    releaseToPool(ocl, radiusLarge);
 
-if(getParamBool(parameters, "timing")) {
-    ocl.queue.enqueueMarker(&endEvent);
-    ocl.queue.finish();
-    startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-    endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-    std::cout << "RUNTIME of combine: " << (end-start)*1.0e-6 << " ms" << std::endl;
-}
+    ocl.profiler->stop("TDF", ocl.queue);
 #ifdef USE_SIPL_VISUALIZATION
 //if(getParamBool(parameters, "show-vector-field")) {
 // get vector field
@@ -905,6 +935,7 @@ if(getParamBool(parameters, "timing")) {
         delete[] Fs;
         delete[] tempTDF;
     }
+    T.vectorField = VectorFieldView(T.Fx, T.Fy, T.Fz);
     //vis->show();
     magnitude->show(0.5, 1.0);
 
@@ -938,10 +969,430 @@ radius->show(40, 80);
 #endif
 }
 
+int getBlurMaskRadius(float sigma) {
+    if(sigma <= 0)
+        return 0;
+    int maskSize = 1;
+    float * mask = createBlurMask(sigma, &maskSize);
+    delete[] mask;
+    return maskSize;
+}
+
+static std::string getFloatDefine(std::string name, float value) {
+    // Enough digits to give the same float, with a decimal point so that the f suffix is valid
+    std::ostringstream ostr;
+    ostr.imbue(std::locale("C"));
+    ostr.precision(9);
+    ostr << std::showpoint << " -D " << name << "=" << value << "f";
+    return ostr.str();
+}
+
+std::string getSpecializationBuildOptions(paramList &parameters) {
+    if(!getParamBool(parameters, "specialize-kernels"))
+        return "";
+
+    // Radius range of the TDF of large tubes, as passed to runCircleFittingTDF
+    const float radiusMin = std::max(2.5f, getParam(parameters, "radius-min"));
+    float radiusMax = getParam(parameters, "radius-max");
+    const float bandRadius = std::max(4.0f, getParam(parameters, "tdf-band-radius"));
+    if(getParam(parameters, "tdf-band-radius") > 0 && radiusMax > bandRadius)
+        radiusMax = bandRadius;
+
+    const float radiusStep = getParam(parameters, "radius-step");
+
+    std::ostringstream options;
+    options << getFloatDefine("TDF_RADIUS_MIN", radiusMin);
+    options << getFloatDefine("TDF_RADIUS_MAX", radiusMax);
+    options << getFloatDefine("TDF_RADIUS_STEP", radiusStep);
+    // The number of radii, as counted by getRadiusCount in the kernels
+    int radiusCount = 0;
+    if(radiusMin <= radiusMax)
+        radiusCount = radiusStep > 0 ? (int)floor((radiusMax - radiusMin)/radiusStep + 0.001f) + 1 : 1;
+    options << " -D TDF_RADIUS_COUNT=" << radiusCount;
+    options << " -D BLUR_MASK_SIZE_SMALL=" << std::max(1, getBlurMaskRadius(getParam(parameters, "small-blur")));
+    options << " -D BLUR_MASK_SIZE_LARGE=" << std::max(1, getBlurMaskRadius(getParam(parameters, "large-blur")));
+    options << " -D CUBE_SIZE=" << (int)getParam(parameters, "cube-size");
+    return options.str();
+}
+
+int roundUpToMultipleOf4(int value) {
+    return value % 4 == 0 ? value : value + 4 - value % 4;
+}
+
+/*
+ * Overlap between the tiles of tiled execution. The halo covers the blur mask,
+ * the largest circle of the TDF and the central differences of the gradients.
+ * Each GVF iteration reads one voxel further, and a halo that covers all
+ * iterations would usually be larger than the tiles. The halo only covers
+ * two std. devs of the diffusion of the GVF, which is sqrt(2*mu*iterations),
+ * so the vector field near the seams of the tiles is close to, but not the
+ * same as, that of the whole volume.
+ */
+int getBrickHalo(const paramList &parameters) {
+    const float radiusMax = getParam(parameters, "radius-max");
+    const float MU = getParam(parameters, "gvf-mu");
+    const int GVFIterations = getParam(parameters, "gvf-iterations");
+    const int blurRadius = std::max(
+            getBlurMaskRadius(getParam(parameters, "small-blur")),
+            getBlurMaskRadius(getParam(parameters, "large-blur"))
+    );
+    const int GVFSupport = (int)ceil(2.0f*sqrt(2.0f*MU*GVFIterations));
+    return roundUpToMultipleOf4(blurRadius + GVFSupport + (int)ceil(radiusMax) + 2);
+}
+
+/*
+ * Runs the circle fitting method on overlapping bricks of the volume, so that
+ * the memory used by blurring, GVF and TDF is bounded by the brick size instead
+ * of the volume size. Only the interior of each brick is copied to the result.
+ */
+void runTiledCircleFittingMethod(OpenCL &ocl, Image3D * dataset, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radiusImage) {
+    const int halo = getBrickHalo(parameters);
+
+    int tileSize = getParam(parameters, "tile-size");
+    if(tileSize <= 0) {
+        // The dataset and the stitched results stay on the device, the rest is available for one brick
+        tileSize = getTileSizeForLimits(size, parameters, getMemoryLimits(ocl.device, parameters));
+        if(tileSize == 0) {
+            std::cout << "WARNING: There may not be enough space available on the device to process this volume, even in tiles." << std::endl;
+            tileSize = std::max(16, halo);
+        }
+    }
+    tileSize = roundUpToMultipleOf4(tileSize);
+
+    // A brick of a tile that is smaller than the halo is mostly halo, and
+    // processing all of them is many times the work of the whole volume
+    if(halo > tileSize && (size.x > tileSize || size.y > tileSize || size.z > tileSize)) {
+        std::ostringstream message;
+        message << "The tile size " << tileSize << " is smaller than the halo " << halo <<
+            " needed by radius-max, the blur and the GVF. Increase tile-size or reduce radius-max.";
+        throw SIPL::SIPLException(message.str().c_str(), __LINE__, __FILE__);
+    }
+
+    const int tilesX = (size.x + tileSize - 1) / tileSize;
+    const int tilesY = (size.y + tileSize - 1) / tileSize;
+    const int tilesZ = (size.z + tileSize - 1) / tileSize;
+    std::cout << "NOTE: Running tiled execution with " << tilesX*tilesY*tilesZ << " tiles of size " << tileSize << " and halo " << halo << std::endl;
+
+    // Each brick is processed as a separate volume
+    paramList brickParameters = parameters;
+    setParameter(brickParameters, "tiled-execution", "false");
+    const ImageFormat datasetFormat = dataset->getImageInfo<CL_IMAGE_FORMAT>();
+
+    int counter = 0;
+    for(int z = 0; z < size.z; z += tileSize) {
+    for(int y = 0; y < size.y; y += tileSize) {
+    for(int x = 0; x < size.x; x += tileSize) {
+        counter++;
+        std::cout << "Processing tile " << counter << " of " << tilesX*tilesY*tilesZ << std::endl;
+        SIPL::int3 tileStart(x,y,z);
+        SIPL::int3 tileEnd(
+                std::min(x+tileSize, size.x),
+                std::min(y+tileSize, size.y),
+                std::min(z+tileSize, size.z)
+        );
+        SIPL::int3 brickStart(
+                std::max(x-halo, 0),
+                std::max(y-halo, 0),
+                std::max(z-halo, 0)
+        );
+        SIPL::int3 brickEnd(
+                std::min(tileEnd.x+halo, size.x),
+                std::min(tileEnd.y+halo, size.y),
+                std::min(tileEnd.z+halo, size.z)
+        );
+        SIPL::int3 brickSize(
+                brickEnd.x-brickStart.x,
+                brickEnd.y-brickStart.y,
+                brickEnd.z-brickStart.z
+        );
+
+        // The objects of this brick are returned to the pool at the end of the tile
+        DeviceMemoryScope brickScope(ocl);
+
+        // Copy brick from the dataset. It is deleted by runCircleFittingMethod
+        Image3D * brick = new Image3D(createImage3D(ocl, CL_MEM_READ_ONLY, datasetFormat, brickSize.x, brickSize.y, brickSize.z));
+        ocl.GC->addMemoryObject(brick);
+        cl::size_t<3> origin = oul::createRegion(brickStart.x, brickStart.y, brickStart.z);
+        ocl.queue.enqueueCopyImage(*dataset, *brick, origin, oul::createOrigoRegion(), oul::createRegion(brickSize.x, brickSize.y, brickSize.z));
+
+        Image3D brickVectorField, brickTDF, brickRadius;
+        runCircleFittingMethod(ocl, brick, brickSize, brickParameters, brickVectorField, brickTDF, brickRadius);
+
+        if(counter == 1) {
+            // Result formats depend on the selected method and device
+            vectorField = createImage3D(ocl, CL_MEM_READ_WRITE, brickVectorField.getImageInfo<CL_IMAGE_FORMAT>(), size.x, size.y, size.z);
+            TDF = createImage3D(ocl, CL_MEM_READ_WRITE, brickTDF.getImageInfo<CL_IMAGE_FORMAT>(), size.x, size.y, size.z);
+            radiusImage = createImage3D(ocl, CL_MEM_READ_WRITE, brickRadius.getImageInfo<CL_IMAGE_FORMAT>(), size.x, size.y, size.z);
+            brickScope.keep(vectorField);
+            brickScope.keep(TDF);
+            brickScope.keep(radiusImage);
+        }
+
+        // Stitch interior of brick into the result
+        cl::size_t<3> interiorOrigin = oul::createRegion(x-brickStart.x, y-brickStart.y, z-brickStart.z);
+        cl::size_t<3> resultOrigin = oul::createRegion(x, y, z);
+        cl::size_t<3> interiorRegion = oul::createRegion(tileEnd.x-x, tileEnd.y-y, tileEnd.z-z);
+        ocl.queue.enqueueCopyImage(brickVectorField, vectorField, interiorOrigin, resultOrigin, interiorRegion);
+        ocl.queue.enqueueCopyImage(brickTDF, TDF, interiorOrigin, resultOrigin, interiorRegion);
+        ocl.queue.enqueueCopyImage(brickRadius, radiusImage, interiorOrigin, resultOrigin, interiorRegion);
+
+        // Release the memory of this brick before starting on the next
+        ocl.queue.finish();
+    }}}
+
+    deleteMemoryObject(ocl, dataset);
+}
+
+
+typedef struct SlabJob {
+    SlabDevice device;
+    cl::Platform platform;
+    paramList parameters;
+    GVFHaloExchange * exchange;
+    int slab;
+    ImageFormat datasetFormat;
+    SIPL::int3 brickSize;
+    void * brickData;
+    // Position and thickness in z of the interior of the slab in the brick
+    int interiorStart;
+    int interiorSize;
+    // Interior of the vector field, TDF and radius
+    void * results[3];
+    ImageFormat resultFormats[3];
+    TSFProfiler profiler;
+    bool failed;
+    bool stoppedOthers; // Whether this slab was the first to fail
+    std::string error;
+} SlabJob;
+
+static void deleteSlabJob(SlabJob * job) {
+    for(int i = 0; i < 3; i++)
+        delete[] (char *)job->results[i];
+    delete[] (char *)job->brickData;
+    delete job;
+}
+
+static void * readSlabInterior(OpenCL &ocl, Image3D &image, SlabJob * job) {
+    const ::size_t bytes = (::size_t)job->brickSize.x*job->brickSize.y*job->interiorSize*image.getImageInfo<CL_IMAGE_ELEMENT_SIZE>();
+    char * data = new char[bytes];
+    ocl.queue.enqueueReadImage(
+            image,
+            CL_TRUE,
+            oul::createRegion(0, 0, job->interiorStart),
+            oul::createRegion(job->brickSize.x, job->brickSize.y, job->interiorSize),
+            0, 0,
+            data
+    );
+    return data;
+}
+
+static void runSlab(SlabJob * job) {
+    OpenCL ocl;
+    ocl.context = job->device.context;
+    ocl.queue = job->device.queue;
+    ocl.program = job->device.program;
+    ocl.device = job->device.device;
+    ocl.platform = job->platform;
+    oul::GarbageCollector GC;
+    ocl.GC = &GC;
+    ocl.pool = NULL;
+    ocl.profiler = &job->profiler;
+    ocl.haloExchange = job->exchange;
+    ocl.slab = job->slab;
+    try {
+        // The brick is deleted by runCircleFittingMethod
+        Image3D * brick = new Image3D(
+                ocl.context,
+                CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                job->datasetFormat,
+                job->brickSize.x, job->brickSize.y, job->brickSize.z,
+                0, 0,
+                job->brickData
+        );
+        GC.addMemoryObject(brick);
+        Image3D vectorField, TDF, radius;
+        runCircleFittingMethod(ocl, brick, job->brickSize, job->parameters, vectorField, TDF, radius);
+        Image3D * results[3] = {&vectorField, &TDF, &radius};
+        for(int i = 0; i < 3; i++) {
+            job->resultFormats[i] = results[i]->getImageInfo<CL_IMAGE_FORMAT>();
+            job->results[i] = readSlabInterior(ocl, *results[i], job);
+        }
+    } catch(SIPL::SIPLException &e) {
+        job->failed = true;
+        job->error = e.what();
+    } catch(cl::Error &e) {
+        job->failed = true;
+        job->error = std::string("OpenCL error in ") + e.what();
+    } catch(std::exception &e) {
+        job->failed = true;
+        job->error = e.what();
+    }
+    // The other slabs would otherwise wait for this slab in the GVF
+    if(job->failed)
+        job->stoppedOthers = job->exchange->abort();
+    GC.deleteAllMemoryObjects();
+}
+
+/*
+ * Runs the circle fitting method on z-slabs of the volume concurrently, one
+ * slab on each sub-device. Each slab is processed in a brick that extends a
+ * halo into the neighbouring slabs. The blur, the vector field and the TDF only
+ * read a few voxels around each voxel, and the halo covers these exactly. The
+ * GVF reads one voxel further per iteration, so the bricks exchange the layers
+ * outside their slabs every few iterations (see GVFHaloExchange). The result
+ * is therefore the same as that of processing the whole volume on one device.
+ * The sub-devices share a context of their own, so the slabs are moved through
+ * host memory, which is the memory of the sub-devices on a CPU.
+ */
+void runSlabCircleFittingMethod(OpenCL &ocl, Image3D * dataset, SIPL::int3 size, paramList &parameters, Image3D &vectorField, Image3D &TDF, Image3D &radiusImage) {
+    const int devices = ocl.slabDevices.size();
+    const int slabSize = roundUpToMultipleOf4((size.z + devices - 1) / devices);
+    const float radiusMax = getParam(parameters, "radius-max");
+    const int sweeps = getParam(parameters, "gvf-sweeps");
+    // Layers at the cut faces of a brick where the vector field before GVF
+    // is not exact, because of the blur and the central differences
+    const int vectorFieldHalo = std::max(
+            getBlurMaskRadius(getParam(parameters, "small-blur")),
+            getBlurMaskRadius(getParam(parameters, "large-blur"))
+    ) + 1;
+    // Layers around a slab that are read by the TDF: the largest circle, and
+    // the derivatives of the vector field and the interpolation around it
+    const int TDFHalo = (int)ceil(std::max(3.0f, radiusMax)) + 2;
+    // GVF iterations between the exchanges, each kernel launch runs gvf-sweeps iterations
+    const int interval = sweeps*std::max(1, 8/sweeps);
+    const int halo = roundUpToMultipleOf4(vectorFieldHalo + interval + TDFHalo);
+
+    paramList singleDeviceParameters = parameters;
+    setParameter(singleDeviceParameters, "sub-devices", "false");
+    std::string reason = "";
+    if(getParamBool(parameters, "use-fmg-gvf")) {
+        reason = "the FMG GVF does not exchange halos between slabs";
+    } else if(getParamBool(parameters, "gvf-low-memory")) {
+        reason = "the low memory GVF does not exchange halos between slabs";
+    } else if(getParam(parameters, "gvf-tolerance") > 0) {
+        reason = "the GVF of the slabs would converge after different numbers of iterations";
+    } else if(getParam(parameters, "tdf-band-radius") > 0 && radiusMax > std::max(4.0f, getParam(parameters, "tdf-band-radius"))) {
+        reason = "the downsampled bands of the TDF are not aligned between slabs";
+    } else if(2*halo >= slabSize) {
+        std::ostringstream message;
+        message << "the halo " << halo << " of the slabs is not small compared to the slab size " << slabSize;
+        reason = message.str();
+    }
+    if(reason.size() > 0) {
+        std::cout << "WARNING: Not using sub-devices, because " << reason << "." << std::endl;
+        runCircleFittingMethod(ocl, dataset, size, singleDeviceParameters, vectorField, TDF, radiusImage);
+        return;
+    }
+
+    const ImageFormat datasetFormat = dataset->getImageInfo<CL_IMAGE_FORMAT>();
+    const int datasetElementSize = dataset->getImageInfo<CL_IMAGE_ELEMENT_SIZE>();
+
+    paramList slabParameters = singleDeviceParameters;
+    setParameter(slabParameters, "tiled-execution", "false");
+
+    GVFHaloExchange exchange((size.z + slabSize - 1) / slabSize, interval);
+    std::vector<SlabJob *> jobs;
+    std::vector<Thread *> threads;
+    try {
+        for(int z = 0; z < size.z; z += slabSize) {
+            const int end = std::min(z+slabSize, size.z);
+            const int brickStart = std::max(z-halo, 0);
+            const int brickEnd = std::min(end+halo, size.z);
+
+            SlabJob * job = new SlabJob;
+            job->brickData = NULL;
+            for(int i = 0; i < 3; i++)
+                job->results[i] = NULL;
+            jobs.push_back(job);
+            job->device = ocl.slabDevices[jobs.size()-1];
+            job->platform = ocl.platform;
+            job->parameters = slabParameters;
+            job->exchange = &exchange;
+            job->slab = jobs.size()-1;
+            job->datasetFormat = datasetFormat;
+            job->brickSize = SIPL::int3(size.x, size.y, brickEnd-brickStart);
+            job->interiorStart = z-brickStart;
+            job->interiorSize = end-z;
+            job->profiler.setEnabled(ocl.profiler->isEnabled());
+            job->failed = false;
+            job->stoppedOthers = false;
+            exchange.setSlab(job->slab, z, end, brickStart, job->brickSize.z);
+            job->brickData = new char[(::size_t)size.x*size.y*job->brickSize.z*datasetElementSize];
+            ocl.queue.enqueueReadImage(
+                    *dataset,
+                    CL_TRUE,
+                    oul::createRegion(0, 0, brickStart),
+                    oul::createRegion(size.x, size.y, job->brickSize.z),
+                    0, 0,
+                    job->brickData
+            );
+        }
+        deleteMemoryObject(ocl, dataset);
+        std::cout << "NOTE: Processing " << jobs.size() << " slabs of size " << slabSize << " with halo " << halo <<
+            " on sub-devices, exchanging the GVF every " << interval << " iterations" << std::endl;
+
+        for(unsigned int i = 0; i < jobs.size(); i++)
+            threads.push_back(new Thread(runSlab, jobs[i]));
+    } catch(...) {
+        // Threads that have started stop waiting for the slabs that did not
+        exchange.abort();
+        for(unsigned int i = 0; i < threads.size(); i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+        for(unsigned int i = 0; i < jobs.size(); i++)
+            deleteSlabJob(jobs[i]);
+        throw;
+    }
+    for(unsigned int i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    // Report the error of the slab that failed first, the others were stopped by it
+    std::string error = "";
+    for(unsigned int i = 0; i < jobs.size(); i++) {
+        if(jobs[i]->failed && (error.size() == 0 || jobs[i]->stoppedOthers))
+            error = jobs[i]->error;
+    }
+
+    // Stitch the interior of each slab into the result
+    try {
+        Image3D * results[3] = {&vectorField, &TDF, &radiusImage};
+        int z = 0;
+        for(unsigned int i = 0; i < jobs.size() && error.size() == 0; i++) {
+            for(int j = 0; j < 3; j++) {
+                if(i == 0)
+                    *results[j] = createImage3D(ocl, CL_MEM_READ_WRITE, jobs[i]->resultFormats[j], size.x, size.y, size.z);
+                ocl.queue.enqueueWriteImage(
+                        *results[j],
+                        CL_TRUE,
+                        oul::createRegion(0, 0, z),
+                        oul::createRegion(size.x, size.y, jobs[i]->interiorSize),
+                        0, 0,
+                        jobs[i]->results[j]
+                );
+            }
+            z += jobs[i]->interiorSize;
+        }
+    } catch(...) {
+        for(unsigned int i = 0; i < jobs.size(); i++)
+            deleteSlabJob(jobs[i]);
+        throw;
+    }
+    for(unsigned int i = 0; i < jobs.size(); i++) {
+        std::ostringstream prefix;
+        prefix << "slab " << i << " ";
+        ocl.profiler->addStages(jobs[i]->profiler, prefix.str());
+        deleteSlabJob(jobs[i]);
+    }
+    if(error.size() > 0)
+        throw SIPL::SIPLException(("Processing of slab failed: " + error).c_str(), __LINE__, __FILE__);
+}
+
 
 
 void runCircleFittingAndNewCenterlineAlg(OpenCL * ocl, cl::Image3D * dataset, SIPL::int3 * size, paramList &parameters, TSFOutput * output) {
-    INIT_TIMER
     Image3D vectorField, radius;
     Image3D * TDF = new Image3D;
     const int totalSize = size->x*size->y*size->z;
@@ -957,26 +1408,38 @@ void runCircleFittingAndNewCenterlineAlg(OpenCL * ocl, cl::Image3D * dataset, SI
     region[2] = size->z;
 
     runCircleFittingMethod(*ocl, dataset, *size, parameters, vectorField, *TDF, radius);
+    detachFromPool(*ocl, *TDF);
     output->setTDF(TDF);
+    // The radius is only kept on the device if it is stored
+    if(getParamStr(parameters, "storage-tdf-radius") != "off") {
+        detachFromPool(*ocl, radius);
+        output->setRadius(new Image3D(radius));
+    }
     if(getParamBool(parameters, "tdf-only"))
     	return;
 
+    ocl->profiler->start("centerline", ocl->queue);
     Image3D * centerline = new Image3D;
     *centerline = runNewCenterlineAlg(*ocl, *size, parameters, vectorField, *TDF, radius);
+    detachFromPool(*ocl, *centerline);
     output->setCenterlineVoxels(centerline);
+    ocl->profiler->stop("centerline", ocl->queue);
 
     Image3D * segmentation = new Image3D;
     if(!getParamBool(parameters, "no-segmentation")) {
+        ocl->profiler->start("segmentation", ocl->queue);
     	if(!getParamBool(parameters, "sphere-segmentation")) {
 			*segmentation = runInverseGradientSegmentation(*ocl, *centerline, vectorField, radius, *size, parameters);
     	} else {
 			*segmentation = runSphereSegmentation(*ocl, *centerline, radius, *size, parameters);
     	}
+        ocl->profiler->stop("segmentation", ocl->queue);
+        detachFromPool(*ocl, *segmentation);
     	output->setSegmentation(segmentation);
     }
 
 	if(getParamStr(parameters, "storage-dir") != "off") {
-		writeDataToDisk(output, getParamStr(parameters, "storage-dir"), getParamStr(parameters, "storage-name"));
+		writeDataToDisk(output, getParamStr(parameters, "storage-dir"), getParamStr(parameters, "storage-name"), parameters);
     }
 
 }
@@ -1021,7 +1484,6 @@ SIPL::Volume<float3> * visualizeSegments(std::vector<Segment *> segments, int3 s
 #endif
 
 void runCircleFittingAndTest(OpenCL * ocl, cl::Image3D * dataset, SIPL::int3 * size, paramList &parameters, TSFOutput * output) {
-    INIT_TIMER
     Image3D vectorField, radius, vectorFieldSmall;
     Image3D * TDF = new Image3D;
     const int totalSize = size->x*size->y*size->z;
@@ -1110,10 +1572,13 @@ void runCircleFittingAndTest(OpenCL * ocl, cl::Image3D * dataset, SIPL::int3 * s
         delete[] tempTDF;
 
     }
+    TS.vectorField = VectorFieldView(TS.Fx, TS.Fy, TS.Fz);
     TS.radius = new float[totalSize];
     //TS.intensity = new float[totalSize];
     output->setTDF(TS.TDF);
     ocl->queue.enqueueReadImage(radius, CL_TRUE, offset, region, 0, 0, TS.radius);
+    if(getParamStr(parameters, "storage-tdf-radius") != "off")
+        output->setRadius(TS.radius);
     //ocl->queue.enqueueReadImage(dataset, CL_TRUE, offset, region, 0, 0, TS.intensity);
 
     // Create pairs of voxels with high TDF
@@ -1239,19 +1704,22 @@ void runCircleFittingAndTest(OpenCL * ocl, cl::Image3D * dataset, SIPL::int3 * s
 
     Image3D * volume = new Image3D;
     if(!getParamBool(parameters, "no-segmentation")) {
+        ocl->profiler->start("segmentation", ocl->queue);
         *volume = Image3D(ocl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, ImageFormat(CL_R, CL_SIGNED_INT8), size->x, size->y, size->z, 0, 0, centerline);
 		if(!getParamBool(parameters, "sphere-segmentation")) {
 			*volume = runInverseGradientSegmentation(*ocl, *volume, vectorField, radius, *size, parameters);
     	} else {
 			*volume = runSphereSegmentation(*ocl,*volume, radius, *size, parameters);
     	}
+        ocl->profiler->stop("segmentation", ocl->queue);
+        detachFromPool(*ocl, *volume);
 		output->setSegmentation(volume);
     }
 
 
 
 	if(getParamStr(parameters, "storage-dir") != "off") {
-        writeDataToDisk(output, getParamStr(parameters, "storage-dir"), getParamStr(parameters, "storage-name"));
+        writeDataToDisk(output, getParamStr(parameters, "storage-dir"), getParamStr(parameters, "storage-name"), parameters);
     }
 
 }
@@ -1259,246 +1727,199 @@ void runCircleFittingAndTest(OpenCL * ocl, cl::Image3D * dataset, SIPL::int3 * s
 
 void runCircleFittingAndRidgeTraversal(OpenCL * ocl, Image3D * dataset, SIPL::int3 * size, paramList &parameters, TSFOutput * output) {
     
-    INIT_TIMER
-    cl::Event startEvent, endEvent;
-    cl_ulong start, end;
-    Image3D vectorField, radius,vectorFieldSmall;
-    Image3D * TDF = new Image3D;
+    Image3D vectorField, radius, TDF;
     TubeSegmentation TS;
-    runCircleFittingMethod(*ocl, dataset, *size, parameters, vectorField, *TDF, radius);
-    output->setTDF(TDF);
+    runCircleFittingMethod(*ocl, dataset, *size, parameters, vectorField, TDF, radius);
+    const bool storeRadius = getParamStr(parameters, "storage-tdf-radius") != "off";
     const int totalSize = size->x*size->y*size->z;
-	const bool no3Dwrite = !getParamBool(parameters, "3d_write");
-
-    cl::size_t<3> offset;
-    offset[0] = 0;
-    offset[1] = 0;
-    offset[2] = 0;
-    cl::size_t<3> region;
-    region[0] = size->x;
-    region[1] = size->y;
-    region[2] = size->z;
 
-    START_TIMER
-    // Transfer buffer back to host
-    TS.Fx = new float[totalSize];
-    TS.Fy = new float[totalSize];
-    TS.Fz = new float[totalSize];
-    TS.TDF = new float[totalSize];
-    if(!getParamBool(parameters, "16bit-vectors")) {
-    	// 32 bit vector fields
-        float * Fs = new float[totalSize*4];
-        ocl->queue.enqueueReadImage(vectorField, CL_TRUE, offset, region, 0, 0, Fs);
-#pragma omp parallel for
-        for(int i = 0; i < totalSize; i++) {
-            TS.Fx[i] = Fs[i*4];
-            TS.Fy[i] = Fs[i*4+1];
-            TS.Fz[i] = Fs[i*4+2];
-        }
-        delete[] Fs;
-        ocl->queue.enqueueReadImage(*TDF, CL_TRUE, offset, region, 0, 0, TS.TDF);
-    } else {
-    	// 16 bit vector fields
-        short * Fs = new short[totalSize*4];
-        ocl->queue.enqueueReadImage(vectorField, CL_TRUE, offset, region, 0, 0, Fs);
+    ocl->profiler->start("centerline", ocl->queue);
+    // Transfer TDF and radius back to host on the transfer queue, while the
+    // vector field is mapped
+    AsyncImageRead TDFRead(*ocl, TDF, *size);
+    AsyncImageRead radiusRead(*ocl, radius, *size);
+    {
+        // The vector field is read directly from the mapped image. It is
+        // unmapped at the end of this block, before segmentation uses it.
+        HostVectorField hostVectorField(*ocl, vectorField, *size);
+        TS.vectorField = hostVectorField.getView();
+        TS.TDF = new float[totalSize];
+        if(!getParamBool(parameters, "16bit-vectors")) {
+            TDFRead.copyTo(TS.TDF);
+        } else {
+            // Convert 16 bit TDF to 32 bit
+            unsigned short * tempTDF = (unsigned short *)TDFRead.getData();
 #pragma omp parallel for
-        for(int i = 0; i < totalSize; i++) {
-            TS.Fx[i] = MAX(-1.0f, Fs[i*4] / 32767.0f);
-            TS.Fy[i] = MAX(-1.0f, Fs[i*4+1] / 32767.0f);;
-            TS.Fz[i] = MAX(-1.0f, Fs[i*4+2] / 32767.0f);
+            for(int i = 0; i < totalSize; i++) {
+                TS.TDF[i] = (float)tempTDF[i] / 65535.0f;
+            }
         }
-        delete[] Fs;
-
-        // Convert 16 bit TDF to 32 bit
-        unsigned short * tempTDF = new unsigned short[totalSize];
-        ocl->queue.enqueueReadImage(*TDF, CL_TRUE, offset, region, 0, 0, tempTDF);
-#pragma omp parallel for
-        for(int i = 0; i < totalSize; i++) {
-            TS.TDF[i] = (float)tempTDF[i] / 65535.0f;
+        output->setTDF(TS.TDF);
+        if(storeRadius) {
+            // The host copy of the radius is kept as the output
+            TS.radius = new float[totalSize];
+            radiusRead.copyTo(TS.radius);
+            output->setRadius(TS.radius);
+        } else {
+            // The radius is only read, so the staging memory is used directly
+            TS.radius = (float *)radiusRead.getData();
         }
-        delete[] tempTDF;
+        ocl->profiler->addBytesTransferred("centerline", hostVectorField.getBytes() + TDFRead.getBytes() + radiusRead.getBytes());
+        std::stack<CenterlinePoint> centerlineStack;
+        TS.centerline = runRidgeTraversal(TS, *size, parameters, centerlineStack, *ocl->profiler);
     }
-    TS.radius = new float[totalSize];
-    output->setTDF(TS.TDF);
-    ocl->queue.enqueueReadImage(radius, CL_TRUE, offset, region, 0, 0, TS.radius);
-    std::stack<CenterlinePoint> centerlineStack;
-    TS.centerline = runRidgeTraversal(TS, *size, parameters, centerlineStack);
     output->setCenterlineVoxels(TS.centerline);
-
-    if(getParamBool(parameters, "timing")) {
-        ocl->queue.finish();
-        STOP_TIMER("Centerline extraction + transfer of data back and forth")
-        ocl->queue.enqueueMarker(&startEvent);
-    }
+    ocl->profiler->stop("centerline", ocl->queue);
 
     Image3D * volume = new Image3D;
     if(!getParamBool(parameters, "no-segmentation")) {
+        ocl->profiler->start("segmentation", ocl->queue);
         *volume = Image3D(ocl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, ImageFormat(CL_R, CL_SIGNED_INT8), size->x, size->y, size->z, 0, 0, TS.centerline);
 		if(!getParamBool(parameters, "sphere-segmentation")) {
 			*volume = runInverseGradientSegmentation(*ocl, *volume, vectorField, radius, *size, parameters);
     	} else {
 			*volume = runSphereSegmentation(*ocl,*volume, radius, *size, parameters);
     	}
+        ocl->profiler->stop("segmentation", ocl->queue);
+        detachFromPool(*ocl, *volume);
 		output->setSegmentation(volume);
     }
 
 
     if(getParamStr(parameters, "storage-dir") != "off") {
-        writeDataToDisk(output, getParamStr(parameters, "storage-dir"), getParamStr(parameters, "storage-name"));
+        writeDataToDisk(output, getParamStr(parameters, "storage-dir"), getParamStr(parameters, "storage-name"), parameters);
     }
 
 }
 
 
-void __stdcall unmapRawfile(cl_mem memobj, void * user_data) {
-    boost::iostreams::mapped_file_source * file = (boost::iostreams::mapped_file_source *)user_data;
-    file->close();
-    delete[] file;
-}
+// Size of the slabs in which raw files are read and uploaded to the device
+#define RAW_SLAB_BYTES (32*1024*1024)
 
-template <class T> 
-float getMaximum(void * data, const int totalSize) {
-    T * newDataPointer = (T *)data;
-    T maximum = std::numeric_limits<T>::min();
-    for(int i = 0; i < totalSize; i++) 
-        maximum = std::max(maximum, newDataPointer[i]);
+void getLimits(paramList &parameters, bool limitsFound, float foundMinimum, float foundMaximum, float * minimum, float * maximum) {
+    if(getParamStr(parameters, "minimum") != "off") {
+        *minimum = atof(getParamStr(parameters, "minimum").c_str());
+    } else if(limitsFound) {
+        *minimum = foundMinimum;
+        std::cout << "NOTE: minimum parameter not set, minimum found to be " << *minimum << std::endl;
+    }
 
-    return (float)maximum;
+    if(getParamStr(parameters, "maximum") != "off") {
+        *maximum = atof(getParamStr(parameters, "maximum").c_str());
+    } else if(limitsFound) {
+        *maximum = foundMaximum;
+        std::cout << "NOTE: maximum parameter not set, maximum found to be " << *maximum << std::endl;
+    }
 }
 
-template <class T> 
-float getMinimum(void * data, const int totalSize) {
-    T * newDataPointer = (T *)data;
-    T minimum = std::numeric_limits<T>::max();
-    for(int i = 0; i < totalSize; i++) 
-        minimum = std::min(minimum, newDataPointer[i]);
-
-    return (float)minimum;
+// The uploads read from host memory that is only valid until they are done
+static void waitForUploads(cl::Event uploaded[2]) {
+    for(int i = 0; i < 2; i++) {
+        if(uploaded[i]() != NULL)
+            uploaded[i].wait();
+    }
 }
 
+/*
+ * Reads a raw file in slabs of slices and uploads each slab to its part of the
+ * image, so that only two slabs are kept on the host at any time. The next
+ * slab is read from file while the previous one is uploaded, and the minimum
+ * and maximum are found in the same pass, if they are not set as parameters.
+ */
 template <typename T>
-void getLimits(paramList parameters, void * data, const int totalSize, float * minimum, float * maximum) {
-    if(getParamStr(parameters, "minimum") != "off") {
-        *minimum = atof(getParamStr(parameters, "minimum").c_str());
-    } else {
-        std::cout << "NOTE: minimum parameter not set, finding minimum automatically." << std::endl;
-        *minimum = getMinimum<T>(data, totalSize);
-        std::cout << "NOTE: minimum found to be " << *minimum << std::endl;
+Image3D readRawFile(OpenCL &ocl, std::string rawFilename, ImageFormat imageFormat, SIPL::int3 size, paramList &parameters, float * minimum, float * maximum) {
+    std::ifstream rawFile(rawFilename.c_str(), std::ios::in | std::ios::binary);
+    if(!rawFile) {
+    	throw SIPL::IOException(rawFilename.c_str(), __LINE__, __FILE__);
     }
-            
-    if(getParamStr(parameters, "maximum") != "off") {
-        *maximum = atof(getParamStr(parameters, "maximum").c_str());
-    } else {
-        std::cout << "NOTE: maximum parameter not set, finding maximum automatically." << std::endl;
-        *maximum = getMaximum<T>(data, totalSize);
-        std::cout << "NOTE: maximum found to be " << *maximum << std::endl;
+    Image3D image = createImage3D(ocl, CL_MEM_READ_ONLY, imageFormat, size.x, size.y, size.z);
+
+    const bool findLimits = getParamStr(parameters, "minimum") == "off" || getParamStr(parameters, "maximum") == "off";
+    T foundMinimum = std::numeric_limits<T>::max();
+    T foundMaximum = std::numeric_limits<T>::is_integer ? std::numeric_limits<T>::min() : -std::numeric_limits<T>::max();
+
+    const ::size_t sliceSize = (::size_t)size.x*size.y;
+    const int slabSlices = std::max(1, std::min(size.z, (int)(RAW_SLAB_BYTES / (sliceSize*sizeof(T)))));
+    std::vector<T> slabs[2];
+    cl::Event uploaded[2];
+    int slab = 0;
+    try {
+        for(int z = 0; z < size.z; z += slabSlices) {
+            const int slices = std::min(slabSlices, size.z - z);
+            std::vector<T> &data = slabs[slab];
+            // Wait until the previous upload from this slab is finished
+            if(uploaded[slab]() != NULL)
+                uploaded[slab].wait();
+            data.resize(sliceSize*slices);
+            rawFile.read((char *)&data[0], data.size()*sizeof(T));
+            if((::size_t)rawFile.gcount() != data.size()*sizeof(T)) {
+                std::string str = "raw file " + rawFilename + " is smaller than the size given in the mhd file";
+                throw SIPL::SIPLException(str.c_str(), __LINE__, __FILE__);
+            }
+
+            cl::size_t<3> origin;
+            origin[0] = 0;
+            origin[1] = 0;
+            origin[2] = z;
+            cl::size_t<3> region;
+            region[0] = size.x;
+            region[1] = size.y;
+            region[2] = slices;
+            ocl.queue.enqueueWriteImage(image, CL_FALSE, origin, region, 0, 0, &data[0], NULL, &uploaded[slab]);
+            ocl.queue.flush();
+
+            if(findLimits) {
+                for(::size_t i = 0; i < data.size(); i++) {
+                    foundMinimum = std::min(foundMinimum, data[i]);
+                    foundMaximum = std::max(foundMaximum, data[i]);
+                }
+            }
+            slab = 1 - slab;
+        }
+    } catch(...) {
+        // The other slab may still be uploading when the slabs are freed
+        try {
+            waitForUploads(uploaded);
+        } catch(...) {}
+        throw;
     }
+    // The slabs are freed on return
+    waitForUploads(uploaded);
+
+    getLimits(parameters, findLimits, (float)foundMinimum, (float)foundMaximum, minimum, maximum);
+    return image;
 }
 
-boost::iostreams::mapped_file_source * file;
 Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &parameters, SIPL::int3 * size, TSFOutput * output) {
-    cl_ulong start, end;
-    Event startEvent, endEvent;
-    if(getParamBool(parameters, "timing")) {
-        ocl.queue.enqueueMarker(&startEvent);
-    }
-    INIT_TIMER
-    START_TIMER
+    ocl.profiler->start("read", ocl.queue);
     // Read mhd file, determine file type
-    std::fstream mhdFile;
-    mhdFile.open(filename.c_str(), std::fstream::in);
-    if(!mhdFile) {
+    MhdHeader header;
+    if(!readMhdHeader(filename, header)) {
     	throw SIPL::IOException(filename.c_str(), __LINE__, __FILE__);
     }
-    std::string typeName = "";
-    std::string rawFilename = "";
-    bool typeFound = false, sizeFound = false, rawFilenameFound = false;
-    SIPL::float3 spacing(1,1,1);
-    do {
-        std::string line;
-        std::getline(mhdFile, line);
-        if(line.substr(0, 11) == "ElementType") {
-            typeName = line.substr(11+3);
-            typeFound = true;
-        } else if(line.substr(0, 15) == "ElementDataFile") {
-            rawFilename = line.substr(15+3);
-            rawFilenameFound = true;
-
-            // Remove any trailing spaces
-            int pos = rawFilename.find(" ");
-            if(pos > 0)
-            rawFilename = rawFilename.substr(0,pos);
-            
-            // Get path name
-            pos = filename.rfind('/');
-            if(pos > 0)
-                rawFilename = filename.substr(0,pos+1) + rawFilename;
-        } else if(line.substr(0, 7) == "DimSize") {
-            std::string sizeString = line.substr(7+3);
-            std::string sizeX = sizeString.substr(0,sizeString.find(" "));
-            sizeString = sizeString.substr(sizeString.find(" ")+1);
-            std::string sizeY = sizeString.substr(0,sizeString.find(" "));
-            sizeString = sizeString.substr(sizeString.find(" ")+1);
-            std::string sizeZ = sizeString.substr(0,sizeString.find(" "));
-
-            size->x = atoi(sizeX.c_str());
-            size->y = atoi(sizeY.c_str());
-            size->z = atoi(sizeZ.c_str());
-
-            sizeFound = true;
-		} else if(line.substr(0, 14) == "ElementSpacing") {
-            std::string sizeString = line.substr(14+3);
-            std::string sizeX = sizeString.substr(0,sizeString.find(" "));
-            sizeString = sizeString.substr(sizeString.find(" ")+1);
-            std::string sizeY = sizeString.substr(0,sizeString.find(" "));
-            sizeString = sizeString.substr(sizeString.find(" ")+1);
-            std::string sizeZ = sizeString.substr(0,sizeString.find(" "));
-
-            spacing.x = atof(sizeX.c_str());
-            spacing.y = atof(sizeY.c_str());
-            spacing.z = atof(sizeZ.c_str());
-        }
-
-    } while(!mhdFile.eof());
-
-    // Remove any trailing spaces
-    int pos = typeName.find(" ");
-    if(pos > 0)
-        typeName = typeName.substr(0,pos);
-
-    if(!typeFound || !sizeFound || !rawFilenameFound) {
+    if(!header.typeFound || !header.sizeFound || !header.rawFilenameFound) {
         throw SIPL::SIPLException("Error reading mhd file. Type, filename or size not found", __LINE__, __FILE__);
     }
+    const std::string typeName = header.elementType;
+    const std::string rawFilename = header.rawFilename;
+    const SIPL::float3 spacing = header.spacing;
+    *size = header.size;
 
-    // Read dataset by memory mapping the file and transfer to device
+    // Read dataset in slabs and transfer to device
     Image3D dataset;
     int type = 0;
-    file = new boost::iostreams::mapped_file_source[1];
-    void * data;
-    cl::size_t<3> offset;
-    offset[0] = 0;
-    offset[1] = 0;
-    offset[2] = 0;
-    cl::size_t<3> region2;
-    region2[0] = size->x;
-    region2[1] = size->y;
-    region2[2] = size->z;
     float minimum = 0.0f, maximum = 1.0f;
     const int totalSize = size->x*size->y*size->z;
     ImageFormat imageFormat;
 
     if(typeName == "MET_SHORT") {
         type = 1;
-        file->open(rawFilename, size->x*size->y*size->z*sizeof(short));
-        data = (void *)file->data();
         imageFormat = ImageFormat(CL_R, CL_SIGNED_INT16);
-        getLimits<short>(parameters, data, totalSize, &minimum, &maximum);
+        dataset = readRawFile<short>(ocl, rawFilename, imageFormat, *size, parameters, &minimum, &maximum);
     } else if(typeName == "MET_USHORT") {
         type = 2;
-        file->open(rawFilename, size->x*size->y*size->z*sizeof(short));
-        data = (void *)file->data();
         imageFormat = ImageFormat(CL_R, CL_UNSIGNED_INT16);
-        getLimits<unsigned short>(parameters, data, totalSize, &minimum, &maximum);
+        dataset = readRawFile<unsigned short>(ocl, rawFilename, imageFormat, *size, parameters, &minimum, &maximum);
 
         if(getParamStr(parameters, "parameters") == "Lung-Airways-CT" || getParamStr(parameters, "parameters") == "AAA-Vessels-CT") {
         	// If parameter preset is airway and the volume loaded is unsigned;
@@ -1514,45 +1935,25 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
 
     } else if(typeName == "MET_CHAR") {
         type = 1;
-        file->open(rawFilename, size->x*size->y*size->z*sizeof(char));
-        data = (void *)file->data();
         imageFormat = ImageFormat(CL_R, CL_SIGNED_INT8);
-        getLimits<char>(parameters, data, totalSize, &minimum, &maximum);
+        dataset = readRawFile<char>(ocl, rawFilename, imageFormat, *size, parameters, &minimum, &maximum);
     } else if(typeName == "MET_UCHAR") {
         type = 2;
-        file->open(rawFilename, size->x*size->y*size->z*sizeof(char));
-        data = (void *)file->data();
         imageFormat = ImageFormat(CL_R, CL_UNSIGNED_INT8);
-        getLimits<unsigned char>(parameters, data, totalSize, &minimum, &maximum);
+        dataset = readRawFile<unsigned char>(ocl, rawFilename, imageFormat, *size, parameters, &minimum, &maximum);
     } else if(typeName == "MET_FLOAT") {
         type = 3;
-        file->open(rawFilename, size->x*size->y*size->z*sizeof(float));
-        data = (void *)file->data();
         imageFormat = ImageFormat(CL_R, CL_FLOAT);
-        getLimits<float>(parameters, data, totalSize, &minimum, &maximum);
+        dataset = readRawFile<float>(ocl, rawFilename, imageFormat, *size, parameters, &minimum, &maximum);
     } else {
     	std::string str = "unsupported data type " + typeName;
     	throw SIPL::SIPLException(str.c_str(), __LINE__, __FILE__);
     }
-    dataset = Image3D(
-            ocl.context,
-            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-            imageFormat,
-            size->x, size->y, size->z,
-            0,0,
-            data
-    );
-
 
     std::cout << "Dataset of size " << size->x << " " << size->y << " " << size->z << " loaded" << std::endl;
-    if(getParamBool(parameters, "timing")) {
-        ocl.queue.enqueueMarker(&endEvent);
-        ocl.queue.finish();
-        startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-        endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-        std::cout << "RUNTIME of data transfer to device: " << (end-start)*1.0e-6 << " ms" << std::endl;
-        ocl.queue.enqueueMarker(&startEvent);
-    }
+    ocl.profiler->addBytesTransferred("read", (unsigned long long)totalSize*dataset.getImageInfo<CL_IMAGE_ELEMENT_SIZE>());
+    ocl.profiler->stop("read", ocl.queue);
+    ocl.profiler->start("crop", ocl.queue);
     // Perform cropping if required
     std::string cropping = getParamStr(parameters, "cropping");
     SIPL::int3 shiftVector;
@@ -1574,9 +1975,9 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
 			cropping_start_z = getParamStr(parameters, "cropping-start-z");
         }
 
-        Buffer scanLinesInsideX = Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(short)*size->x);
-        Buffer scanLinesInsideY = Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(short)*size->y);
-        Buffer scanLinesInsideZ = Buffer(ocl.context, CL_MEM_WRITE_ONLY, sizeof(short)*size->z);
+        Buffer scanLinesInsideX = createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(short)*size->x);
+        Buffer scanLinesInsideY = createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(short)*size->y);
+        Buffer scanLinesInsideZ = createBuffer(ocl, CL_MEM_WRITE_ONLY, sizeof(short)*size->z);
         cropDatasetKernel.setArg(0, dataset);
         cropDatasetKernel.setArg(1, scanLinesInsideX);
         cropDatasetKernel.setArg(2, 0);
@@ -1744,7 +2145,7 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
  
 
         std::cout << "Dataset cropped to " << SIZE_X << ", " << SIZE_Y << ", " << SIZE_Z << std::endl;
-        Image3D imageHUvolume = Image3D(ocl.context, CL_MEM_READ_ONLY, imageFormat, SIZE_X, SIZE_Y, SIZE_Z);
+        Image3D imageHUvolume = createImage3D(ocl, CL_MEM_READ_ONLY, imageFormat, SIZE_X, SIZE_Y, SIZE_Z);
 
         cl::size_t<3> offset;
         offset[0] = 0;
@@ -1763,14 +2164,6 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
         shiftVector.z = z1;
         ocl.queue.enqueueCopyImage(dataset, imageHUvolume, srcOffset, offset, region);
         dataset = imageHUvolume;
-        if(getParamBool(parameters, "timing")) {
-            ocl.queue.enqueueMarker(&endEvent);
-            ocl.queue.finish();
-            startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-            endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-            std::cout << "Cropping time: " << (end-start)*1.0e-6 << " ms" << std::endl;
-            ocl.queue.enqueueMarker(&startEvent);
-        }
     } else if(getParamStr(parameters, "parameters") == "AAA-Vessels-CT") {
         float percentToRemove = 0.15f; // Remove 10% from each side in the xy plane
 
@@ -1791,7 +2184,7 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
             size->z--;
 
         cl::size_t<3> region = oul::createRegion(size->x, size->y, size->z);
-        Image3D imageHUvolume = Image3D(ocl.context, CL_MEM_READ_ONLY, imageFormat, size->x, size->y, size->z);
+        Image3D imageHUvolume = createImage3D(ocl, CL_MEM_READ_ONLY, imageFormat, size->x, size->y, size->z);
 
         ocl.queue.enqueueCopyImage(dataset, imageHUvolume, offset, oul::createOrigoRegion(), region);
         dataset = imageHUvolume;
@@ -1819,7 +2212,7 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
 			region[0] = size->x;
 			region[1] = size->y;
 			region[2] = size->z;
-			Image3D imageHUvolume = Image3D(ocl.context, CL_MEM_READ_ONLY, imageFormat, size->x, size->y, size->z);
+			Image3D imageHUvolume = createImage3D(ocl, CL_MEM_READ_ONLY, imageFormat, size->x, size->y, size->z);
 
 			ocl.queue.enqueueCopyImage(dataset, imageHUvolume, offset, offset, region);
 			dataset = imageHUvolume;
@@ -1829,12 +2222,14 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
     }
     output->setShiftVector(shiftVector);
     output->setSpacing(spacing);
+    ocl.profiler->stop("crop", ocl.queue);
 
     // Run toFloat kernel
+    ocl.profiler->start("to float", ocl.queue);
 
     Kernel toFloatKernel = Kernel(ocl.program, "toFloat");
-    Image3D convertedDataset = Image3D(
-        ocl.context,
+    Image3D convertedDataset = createImage3D(
+        ocl,
         CL_MEM_READ_ONLY,
         ImageFormat(CL_R, CL_FLOAT),
         size->x, size->y, size->z
@@ -1842,8 +2237,8 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
 
 	const bool no3Dwrite = !getParamBool(parameters, "3d_write");
     if(no3Dwrite) {
-        Buffer convertedDatasetBuffer = Buffer(
-                ocl.context, 
+        Buffer convertedDatasetBuffer = createBuffer(
+                ocl, 
                 CL_MEM_WRITE_ONLY,
                 sizeof(float)*size->x*size->y*size->z
         );
@@ -1890,16 +2285,8 @@ Image3D readDatasetAndTransfer(OpenCL &ocl, std::string filename, paramList &par
             NullRange
         );
     }
-    if(getParamBool(parameters, "timing")) {
-        ocl.queue.enqueueMarker(&endEvent);
-        ocl.queue.finish();
-        startEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &start);
-        endEvent.getProfilingInfo<cl_ulong>(CL_PROFILING_COMMAND_START, &end);
-        std::cout << "RUNTIME of to float conversion: " << (end-start)*1.0e-6 << " ms" << std::endl;
-        ocl.queue.enqueueMarker(&startEvent);
-    }
+    ocl.profiler->stop("to float", ocl.queue);
 
-    dataset.setDestructorCallback((void (__stdcall *)(cl_mem,void *))unmapRawfile, (void *)(file));
     // Return dataset
     return convertedDataset;
 }
@@ -18,9 +18,12 @@ using boost::unordered_map;
 #include "parameters.hpp"
 #include "SIPL/Exceptions.hpp"
 #include "inputOutput.hpp"
+#include "session.hpp"
+#include "vectorFieldView.hpp"
 
 typedef struct TubeSegmentation {
     float *Fx, *Fy, *Fz; // The GVF vector field
+    VectorFieldView vectorField; // Used by the host centerline methods, either of Fx, Fy and Fz or of the mapped image
     float *FxSmall, *FySmall, *FzSmall; // The GVF vector field
     float *TDF; // The TDF response
     float *radius;
@@ -33,7 +36,28 @@ typedef struct TubeSegmentation {
 /*
  * For debugging.
  */
-void print(paramList parameters);
+void print(const paramList &parameters);
+
+/*
+ * Creates a normalized 1D Gaussian mask with maskSize*2+1 elements. The 3D blur
+ * applies it along x, y and z in turn.
+ */
+float * createBlurMask(float sigma, int * maskSizePointer);
+
+/*
+ * Build options that compile the radius range of the TDF, the blur mask sizes
+ * and the cube size into the kernels when specialize-kernels is set. The
+ * kernels use the constants when their arguments are equal to them. The
+ * compiled programs are cached by build options, so there is one program for
+ * each combination of values.
+ */
+std::string getSpecializationBuildOptions(paramList &parameters);
+
+/*
+ * Overlap needed between parts of the volume that are processed separately,
+ * in tiles or on sub-devices.
+ */
+int getBrickHalo(const paramList &parameters);
 
 cl::Image3D readDatasetAndTransfer(OpenCL &ocl, std::string, paramList &parameters, SIPL::int3 *, TSFOutput *);
 
@@ -44,6 +68,18 @@ void runCircleFittingAndNewCenterlineAlg(OpenCL *, cl::Image3D *dataset, SIPL::i
 void runCircleFittingAndTest(OpenCL *, cl::Image3D *dataset, SIPL::int3 * size, paramList &parameters, TSFOutput *);
 
 
-TSFOutput * run(std::string filename, paramList &parameters, std::string kernel_dir);
+/*
+ * Runs the pipeline on a volume. The parameters are not changed, and each call
+ * has its own command queues, so volumes can be processed from several threads
+ * at the same time.
+ */
+TSFOutput * run(std::string filename, const paramList &parameters, std::string kernel_dir);
+
+/*
+ * Same as above, but uses the context and compiled programs of the given session.
+ * The session has to outlive the returned TSFOutput. A cl::Error with
+ * CL_INVALID_COMMAND_QUEUE is passed on, so that the caller can retry.
+ */
+TSFOutput * run(std::string filename, const paramList &parameters, std::string kernel_dir, TSFSession * session);
 
 #endif
@@ -1,4 +1,8 @@
 #include "tubeDetectionFilters.hpp"
+#include "memoryPool.hpp"
+#include "OpenCLUtilityLibrary/HistogramPyramids.hpp"
+#include <iostream>
+#include <algorithm>
 using namespace cl;
 
 void runSplineTDF(
@@ -54,7 +58,11 @@ void runSplineTDF(
     );
 }
 
-void runCircleFittingTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep) {
+void runCircleFittingTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep, paramList &parameters) {
+    if(getParamBool(parameters, "sparse-tdf")) {
+        runSparseCircleFittingTDF(ocl, size, vectorField, TDF, radius, radiusMin, radiusMax, radiusStep, parameters);
+        return;
+    }
     Kernel circleFittingTDFKernel(ocl.program, "circleFittingTDF");
     circleFittingTDFKernel.setArg(0, *vectorField);
     circleFittingTDFKernel.setArg(1, *TDF);
@@ -72,3 +80,210 @@ void runCircleFittingTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, B
 
 }
 
+void runSparseCircleFittingTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep, paramList &parameters) {
+    const int totalSize = size.x*size.y*size.z;
+
+    // Find the voxels that may be inside a tube with a test of the vector
+    // field only. All other voxels get TDF 0.
+    Kernel candidatesKernel(ocl.program, "circleFittingTDFCandidates");
+    candidatesKernel.setArg(0, *vectorField);
+    candidatesKernel.setArg(1, *TDF);
+    candidatesKernel.setArg(2, *radius);
+    candidatesKernel.setArg(4, radiusMin);
+    candidatesKernel.setArg(5, radiusMax);
+    candidatesKernel.setArg(6, getParam(parameters, "sparse-tdf-prefilter"));
+
+    // Compact the candidates to a list of positions with a histogram pyramid
+    int sum;
+    Buffer positions;
+    if(!getParamBool(parameters, "3d_write")) {
+        Buffer candidates = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(char)*totalSize);
+        candidatesKernel.setArg(3, candidates);
+        ocl.queue.enqueueNDRangeKernel(
+                candidatesKernel,
+                NullRange,
+                NDRange(size.x,size.y,size.z),
+                NDRange(4,4,4)
+        );
+        oul::HistogramPyramid3DBuffer hp(ocl);
+        hp.create(candidates, size.x, size.y, size.z);
+        sum = hp.getSum();
+        if(sum > 0)
+            positions = hp.createPositionBuffer();
+        hp.deleteHPlevels();
+    } else {
+        Image3D candidates = createImage3D(ocl, CL_MEM_READ_WRITE, ImageFormat(CL_R, CL_SIGNED_INT8), size.x, size.y, size.z);
+        candidatesKernel.setArg(3, candidates);
+        ocl.queue.enqueueNDRangeKernel(
+                candidatesKernel,
+                NullRange,
+                NDRange(size.x,size.y,size.z),
+                NDRange(4,4,4)
+        );
+        oul::HistogramPyramid3D hp(ocl);
+        hp.create(candidates, size.x, size.y, size.z);
+        sum = hp.getSum();
+        if(sum > 0)
+            positions = hp.createPositionBuffer();
+        hp.deleteHPlevels();
+    }
+    std::cout << "TDF candidates: " << sum << " of " << totalSize << " voxels" << std::endl;
+    if(sum == 0)
+        return;
+
+    // Run the Hessian, the eigen decomposition and the circle fitting on the
+    // candidates only
+    Kernel sparseKernel(ocl.program, "circleFittingTDFSparse");
+    sparseKernel.setArg(0, *vectorField);
+    sparseKernel.setArg(1, *TDF);
+    sparseKernel.setArg(2, *radius);
+    sparseKernel.setArg(3, positions);
+    sparseKernel.setArg(4, sum);
+    sparseKernel.setArg(5, size.x);
+    sparseKernel.setArg(6, size.y);
+    sparseKernel.setArg(7, radiusMin);
+    sparseKernel.setArg(8, radiusMax);
+    sparseKernel.setArg(9, radiusStep);
+    ocl.queue.enqueueNDRangeKernel(
+            sparseKernel,
+            NullRange,
+            NDRange(((sum+63)/64)*64),
+            NDRange(64)
+    );
+}
+
+static void copyToImage(OpenCL &ocl, Buffer &buffer, Image3D &image, SIPL::int3 size) {
+    cl::size_t<3> offset;
+    offset[0] = 0;
+    offset[1] = 0;
+    offset[2] = 0;
+    cl::size_t<3> region;
+    region[0] = size.x;
+    region[1] = size.y;
+    region[2] = size.z;
+    ocl.queue.enqueueCopyBufferToImage(buffer, image, 0, offset, region);
+}
+
+// The spline TDF or the circle fitting TDF, as selected by use-spline-tdf
+static void runTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep, paramList &parameters) {
+    if(getParamBool(parameters, "use-spline-tdf")) {
+        runSplineTDF(ocl, size, vectorField, TDF, radius, radiusMin, radiusMax, radiusStep);
+    } else {
+        runCircleFittingTDF(ocl, size, vectorField, TDF, radius, radiusMin, radiusMax, radiusStep, parameters);
+    }
+}
+
+void runScaleSpaceTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep, paramList &parameters) {
+    const float bandRadius = std::max(4.0f, getParam(parameters, "tdf-band-radius"));
+    const bool no3Dwrite = !getParamBool(parameters, "3d_write");
+    const bool is16bit = getParamBool(parameters, "16bit-vectors");
+    // The spline TDF only responds if the border is found on every arm, so
+    // its bands overlap the previous band by half, to not lose tubes at the
+    // band limits
+    const float overlap = getParamBool(parameters, "use-spline-tdf") ? 0.5f : 1.0f;
+    const int totalSize = size.x*size.y*size.z;
+
+    // Radii up to the band radius are detected at full resolution
+    runTDF(ocl, size, vectorField, TDF, radius, radiusMin, std::min(bandRadius, radiusMax), radiusStep, parameters);
+
+    const ImageFormat vectorFormat = vectorField->getImageInfo<CL_IMAGE_FORMAT>();
+    const ImageFormat TDFFormat = is16bit ? ImageFormat(CL_R, CL_UNORM_INT16) : ImageFormat(CL_R, CL_FLOAT);
+    const int TDFElementSize = is16bit ? sizeof(short) : sizeof(float);
+    const int vectorElementSize = is16bit ? 4*sizeof(short) : 4*sizeof(float);
+    Kernel downsampleKernel(ocl.program, "downsampleVectorField");
+    Kernel combineKernel(ocl.program, "combineUpsampled");
+
+    // Each band doubles the radius range and the voxel size. The vector field
+    // of a band is downsampled from that of the previous band. The kernels run
+    // on work-groups of 4x4x4, so a downsampled field is padded to a multiple
+    // of 4. The padding has zero vectors, and only the voxels inside the
+    // previous field (fineSize) are averaged.
+    Image3D fineField = *vectorField;
+    SIPL::int3 fineSize = size;
+    float bandMin = bandRadius;
+    for(int scale = 2; bandMin < radiusMax; scale *= 2) {
+        const float bandMax = std::min(bandMin*2.0f, radiusMax);
+        const SIPL::int3 coarseDataSize(
+                (fineSize.x+1)/2,
+                (fineSize.y+1)/2,
+                (fineSize.z+1)/2
+        );
+        SIPL::int3 coarseSize(
+                ((coarseDataSize.x+3)/4)*4,
+                ((coarseDataSize.y+3)/4)*4,
+                ((coarseDataSize.z+3)/4)*4
+        );
+        if(coarseDataSize.x < 8 || coarseDataSize.y < 8 || coarseDataSize.z < 8) {
+            std::cout << "NOTE: Volume is too small to detect radii above " << bandMin << " on a downsampled vector field. Using full resolution." << std::endl;
+            Buffer TDFband = createBuffer(ocl, CL_MEM_READ_WRITE, TDFElementSize*totalSize);
+            Buffer radiusBand = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(float)*totalSize);
+            runTDF(ocl, size, vectorField, &TDFband, &radiusBand, bandMin*overlap, radiusMax, radiusStep, parameters);
+            Kernel fullResolutionCombineKernel(ocl.program, "combine");
+            fullResolutionCombineKernel.setArg(0, TDFband);
+            fullResolutionCombineKernel.setArg(1, radiusBand);
+            fullResolutionCombineKernel.setArg(2, *TDF);
+            fullResolutionCombineKernel.setArg(3, *radius);
+            ocl.queue.enqueueNDRangeKernel(
+                    fullResolutionCombineKernel,
+                    NullRange,
+                    NDRange(totalSize),
+                    NDRange(64)
+            );
+            break;
+        }
+        const int coarseTotalSize = coarseSize.x*coarseSize.y*coarseSize.z;
+
+        Image3D coarseField = createImage3D(ocl, CL_MEM_READ_WRITE, vectorFormat, coarseSize.x, coarseSize.y, coarseSize.z);
+        downsampleKernel.setArg(0, fineField);
+        downsampleKernel.setArg(2, fineSize.x);
+        downsampleKernel.setArg(3, fineSize.y);
+        downsampleKernel.setArg(4, fineSize.z);
+        if(no3Dwrite) {
+            Buffer coarseFieldBuffer = createBuffer(ocl, CL_MEM_WRITE_ONLY, vectorElementSize*coarseTotalSize);
+            downsampleKernel.setArg(1, coarseFieldBuffer);
+            ocl.queue.enqueueNDRangeKernel(
+                    downsampleKernel,
+                    NullRange,
+                    NDRange(coarseSize.x,coarseSize.y,coarseSize.z),
+                    NDRange(4,4,4)
+            );
+            copyToImage(ocl, coarseFieldBuffer, coarseField, coarseSize);
+        } else {
+            downsampleKernel.setArg(1, coarseField);
+            ocl.queue.enqueueNDRangeKernel(
+                    downsampleKernel,
+                    NullRange,
+                    NDRange(coarseSize.x,coarseSize.y,coarseSize.z),
+                    NDRange(4,4,4)
+            );
+        }
+
+        std::cout << "TDF band: radius " << bandMin << " to " << bandMax << " at 1/" << scale << " resolution" << std::endl;
+        Buffer TDFband = createBuffer(ocl, CL_MEM_READ_WRITE, TDFElementSize*coarseTotalSize);
+        Buffer radiusBand = createBuffer(ocl, CL_MEM_READ_WRITE, sizeof(float)*coarseTotalSize);
+        runTDF(ocl, coarseSize, &coarseField, &TDFband, &radiusBand, bandMin*overlap/scale, bandMax/scale, radiusStep, parameters);
+
+        // Merge the band with the result, upsampling it with linear interpolation
+        Image3D TDFImage = createImage3D(ocl, CL_MEM_READ_ONLY, TDFFormat, coarseSize.x, coarseSize.y, coarseSize.z);
+        Image3D radiusImage = createImage3D(ocl, CL_MEM_READ_ONLY, ImageFormat(CL_R, CL_FLOAT), coarseSize.x, coarseSize.y, coarseSize.z);
+        copyToImage(ocl, TDFband, TDFImage, coarseSize);
+        copyToImage(ocl, radiusBand, radiusImage, coarseSize);
+        combineKernel.setArg(0, TDFImage);
+        combineKernel.setArg(1, radiusImage);
+        combineKernel.setArg(2, *TDF);
+        combineKernel.setArg(3, *radius);
+        combineKernel.setArg(4, scale);
+        combineKernel.setArg(5, size.x);
+        combineKernel.setArg(6, size.y);
+        ocl.queue.enqueueNDRangeKernel(
+                combineKernel,
+                NullRange,
+                NDRange(totalSize),
+                NDRange(64)
+        );
+
+        fineField = coarseField;
+        fineSize = coarseDataSize;
+        bandMin = bandMax;
+    }
+}
@@ -1,5 +1,6 @@
 #include "commons.hpp"
 #include "SIPL/Types.hpp"
+#include "parameters.hpp"
 using namespace cl;
 
 void runSplineTDF(
@@ -12,4 +13,15 @@ void runSplineTDF(
         float radiusMax,
         float radiusStep
         );
-void runCircleFittingTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep);
+void runCircleFittingTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep, paramList &parameters);
+// Circle fitting TDF where only a test of the vector field magnitude and
+// divergence is done for every voxel. The candidates are compacted with a
+// histogram pyramid, and the Hessian, the eigen decomposition and the radius
+// search are done for the candidates only. Voxels that fail the test, or do
+// not have negative eigenvalues across the tube, get TDF 0.
+void runSparseCircleFittingTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep, paramList &parameters);
+// Circle fitting or spline TDF (use-spline-tdf) where radii above
+// tdf-band-radius are detected on downsampled vector fields. Each band doubles
+// the radius range and the voxel size, and is merged with the result by linear
+// interpolation.
+void runScaleSpaceTDF(OpenCL &ocl, SIPL::int3 &size, Image3D * vectorField, Buffer * TDF, Buffer * radius, float radiusMin, float radiusMax, float radiusStep, paramList &parameters);
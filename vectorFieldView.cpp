@@ -0,0 +1,53 @@
+#include "vectorFieldView.hpp"
+
+HostVectorField::HostVectorField(OpenCL &ocl, cl::Image3D &image, SIPL::int3 size) : ocl(ocl), image(image), size(size) {
+    is16bit = image.getImageInfo<CL_IMAGE_FORMAT>().image_channel_data_type != CL_FLOAT;
+    const int elementSize = is16bit ? 4*sizeof(short) : 4*sizeof(float);
+
+    cl::size_t<3> offset;
+    offset[0] = 0;
+    offset[1] = 0;
+    offset[2] = 0;
+    cl::size_t<3> region;
+    region[0] = size.x;
+    region[1] = size.y;
+    region[2] = size.z;
+
+    ::size_t rowPitch, slicePitch;
+    data = ocl.queue.enqueueMapImage(image, CL_TRUE, CL_MAP_READ, offset, region, &rowPitch, &slicePitch);
+    mapped = true;
+    if(rowPitch != (::size_t)size.x*elementSize || slicePitch != rowPitch*size.y) {
+        // The views use linear positions, so padded rows have to be removed
+        ocl.queue.enqueueUnmapMemObject(image, data);
+        const int totalSize = size.x*size.y*size.z;
+        if(is16bit) {
+            data = new short[(::size_t)totalSize*4];
+        } else {
+            data = new float[(::size_t)totalSize*4];
+        }
+        mapped = false;
+        ocl.queue.enqueueReadImage(image, CL_TRUE, offset, region, 0, 0, data);
+    }
+}
+
+HostVectorField::~HostVectorField() {
+    if(mapped) {
+        ocl.queue.enqueueUnmapMemObject(image, data);
+    } else if(is16bit) {
+        delete[] (short *)data;
+    } else {
+        delete[] (float *)data;
+    }
+}
+
+VectorFieldView HostVectorField::getView() const {
+    if(is16bit) {
+        return VectorFieldView((const short *)data);
+    } else {
+        return VectorFieldView((const float *)data);
+    }
+}
+
+unsigned long long HostVectorField::getBytes() const {
+    return (unsigned long long)size.x*size.y*size.z*4*(is16bit ? sizeof(short) : sizeof(float));
+}
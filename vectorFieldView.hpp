@@ -0,0 +1,79 @@
+#ifndef VECTOR_FIELD_VIEW_H
+#define VECTOR_FIELD_VIEW_H
+
+#include "commons.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+/*
+ * Read-only access to a vector field on the host. The field is either stored
+ * as three separate float arrays, or interleaved with four components per
+ * voxel as floats or as 16 bit normalized shorts, which is the layout of the
+ * vector field image on the device. The interleaved layouts can therefore be
+ * read directly from a mapped image.
+ */
+class VectorFieldView {
+public:
+    enum Layout { EMPTY, SEPARATE, FLOAT4, SHORT4 };
+    VectorFieldView() : layout(EMPTY), data(NULL), Fx(NULL), Fy(NULL), Fz(NULL) {}
+    VectorFieldView(const float * Fx, const float * Fy, const float * Fz) :
+        layout(SEPARATE), data(NULL), Fx(Fx), Fy(Fy), Fz(Fz) {}
+    VectorFieldView(const float * data) : layout(FLOAT4), data(data), Fx(NULL), Fy(NULL), Fz(NULL) {}
+    VectorFieldView(const short * data) : layout(SHORT4), data(data), Fx(NULL), Fy(NULL), Fz(NULL) {}
+    Layout getLayout() const { return layout; }
+    // Component 0 (x), 1 (y) or 2 (z) of the vector at linear position i
+    inline float get(int i, int component) const {
+        switch(layout) {
+            case SEPARATE:
+                return component == 0 ? Fx[i] : (component == 1 ? Fy[i] : Fz[i]);
+            case FLOAT4:
+                return ((const float *)data)[(::size_t)i*4+component];
+            case SHORT4:
+                return std::max(-1.0f, ((const short *)data)[(::size_t)i*4+component] / 32767.0f);
+            default:
+                return 0.0f;
+        }
+    }
+    inline float x(int i) const { return get(i, 0); }
+    inline float y(int i) const { return get(i, 1); }
+    inline float z(int i) const { return get(i, 2); }
+    inline SIPL::float3 get(int i) const { return SIPL::float3(x(i), y(i), z(i)); }
+    inline float magnitude(int i) const {
+        const float vx = x(i), vy = y(i), vz = z(i);
+        return sqrt(vx*vx + vy*vy + vz*vz);
+    }
+private:
+    Layout layout;
+    const void * data;
+    const float * Fx;
+    const float * Fy;
+    const float * Fz;
+};
+
+/*
+ * Makes a vector field image readable on the host for the lifetime of the
+ * object. The image is mapped, so no copy is made on devices that share
+ * memory with the host. If the mapping is not tightly packed, the image is
+ * read into an array instead. Both the float4 and the short4 (16 bit vectors)
+ * formats are supported.
+ */
+class HostVectorField {
+public:
+    HostVectorField(OpenCL &ocl, cl::Image3D &image, SIPL::int3 size);
+    ~HostVectorField();
+    VectorFieldView getView() const;
+    // Size in bytes of the field, as transferred from the device
+    unsigned long long getBytes() const;
+private:
+    HostVectorField(const HostVectorField &other);
+    HostVectorField & operator=(const HostVectorField &other);
+    OpenCL &ocl;
+    cl::Image3D image;
+    void * data;
+    bool mapped;
+    bool is16bit;
+    SIPL::int3 size;
+};
+
+#endif